@@ -3,230 +3,247 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <string.h>
 
 #include "avro.h"
 #include "nobench_schema.h"
+#include "../bench.h"
 #include "../json.h"
 
-char dbname[] = "avro_test.db";
-const char codec[] = "null";
+/* The input and its serialized form, both in memory */
+typedef struct {
+    char **lines;
+    size_t *line_lens;
+    char **binaries;
+    size_t *binary_lens;
+    avro_value_t value;         /* Scratch record of the full schema */
+    avro_writer_t writer;
+    avro_reader_t reader;
+} records;
+
+/* Reads a record of the full schema through a narrower reader schema */
+typedef struct {
+    records *recs;
+    const char *const *keys;
+    int num_keys;
+    avro_schema_t reader_schema;
+    avro_value_iface_t *reader_iface;
+    avro_value_iface_t *writer_iface;
+    avro_value_t reader_value;
+    avro_value_t writer_value;
+} projection;
+
+/* Keeps the projections from being optimized away */
+size_t projected_bytes = 0;
 
 char *to_avro_keyname(char *key, json_typeid type, char *value);
 int avro_record_value_fill(avro_value_t *avro_value, char *json);
-int test_serialize(FILE* infile);
-int test_deserialize(FILE *outfile);
-int test_project(FILE *outfile);
-int test_multiple_project(FILE *outfile);
+int projection_init(projection *proj, records *recs, avro_schema_t writer_schema,
+                    const char *reader_schema_json, const char *const *keys, int num_keys);
+void projection_free(projection *proj);
+long bench_serialize(void *arg, size_t i);
+long bench_deserialize(void *arg, size_t i);
+long bench_project(void *arg, size_t i);
 
 int main(int argc, char** argv) {
-    char *infilename, *outfilename, *extract_outfilename, *multiple_extract_outfilename;
-    FILE *infile, *outfile, *extract_outfile, *multiple_extract_outfile;
-    int rval; // Function status codes
-    clock_t start, diff;
-    int msec;
+    bench_options opts;
+    bench_result results[4];
+    records recs;
+    projection proj, mproj;
+    size_t nrecords;
+    avro_schema_t schema;
     avro_schema_error_t error;
+    avro_value_iface_t *iface;
+    const char *projected_key = PROJECTED_KEY;
+    int rval; // Function status codes
 
-    // TODO: DRY
-    infilename = argv[1];
-    infile = fopen(infilename, "r");
-    start = clock();
-    if (!test_serialize(infile)) {
+    if (!bench_parse_args(argc, argv, &opts)) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Serialize: %d ms\n", msec);
-    fflush(stdout);
-    fclose(infile);
-
-    outfilename = argv[2];
-    outfile = fopen(outfilename, "w");
-    start = clock();
-    if (!test_deserialize(outfile)) {
+    recs.lines = bench_read_lines(&opts, &nrecords);
+    if (!recs.lines) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Deserialize: %d ms\n", msec);
-    fflush(stdout);
-    fclose(outfile);
-
-    extract_outfilename = argv[3];
-    extract_outfile = fopen(extract_outfilename, "w");
-    start = clock();
-    if (!test_project(extract_outfile)) {
-        exit(EXIT_FAILURE);
+    recs.line_lens = malloc(nrecords * sizeof(size_t));
+    recs.binaries = calloc(nrecords, sizeof(char*));
+    recs.binary_lens = calloc(nrecords, sizeof(size_t));
+    for (size_t i = 0; i < nrecords; ++i) {
+        recs.line_lens[i] = strlen(recs.lines[i]);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Extract: %d ms\n", msec);
-    fflush(stdout);
-    fclose(extract_outfile);
-
-    multiple_extract_outfilename = argv[4];
-    multiple_extract_outfile = fopen(multiple_extract_outfilename, "w");
-    start = clock();
-    if (!test_multiple_project(multiple_extract_outfile)) {
+
+    // Parse schema into a schema data structure
+    if ((rval = avro_schema_from_json(NOBENCH_SCHEMA, 0, &schema, &error))) {
+        fprintf(stderr, "Unable to parse nobench schema\n");
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Multiple Extract: %d ms\n", msec);
-    fflush(stdout);
-    fclose(multiple_extract_outfile);
-}
+    iface = avro_generic_class_from_schema(schema);
+    avro_generic_value_new(iface, &recs.value);
+    recs.writer = avro_writer_memory(NULL, 0);
+    recs.reader = avro_reader_memory(NULL, 0);
 
-/* Read all the records and print them */
-int test_deserialize(FILE *outfile) {
-    avro_file_reader_t reader;
-    avro_schema_t schema;
-    avro_value_iface_t *iface;
-    avro_value_t avro_value;
-    char *json;
-    int rval;
+    // The later phases read what the last serialize pass left behind
+    if (!bench_run(&opts, "serialize", nrecords, bench_serialize, &recs, &results[0]) ||
+        !bench_run(&opts, "deserialize", nrecords, bench_deserialize, &recs, &results[1])) {
+        exit(EXIT_FAILURE);
+    }
 
-    rval = avro_file_reader(dbname, &reader);
-    if (rval) {
-        fprintf(stderr, "Error opening file: %s\n", avro_strerror());
-        return rval;
+    if (projection_init(&proj, &recs, schema, PROJECTED_SCHEMA, &projected_key, 1) ||
+        projection_init(&mproj, &recs, schema, MULTIPLE_PROJECTED_SCHEMA,
+                        MULTIPLE_PROJECTED_KEY, num_projected_keys)) {
+        exit(EXIT_FAILURE);
     }
-    schema = avro_file_reader_get_writer_schema(reader);
-    iface = avro_generic_class_from_schema(schema);
-    avro_generic_value_new(iface, &avro_value);
+    if (!bench_run(&opts, "project", nrecords, bench_project, &proj, &results[2]) ||
+        !bench_run(&opts, "multiple_project", nrecords, bench_project, &mproj, &results[3])) {
+        exit(EXIT_FAILURE);
+    }
+    projection_free(&proj);
+    projection_free(&mproj);
 
-    while (avro_file_reader_read_value(reader, &avro_value) == 0) {
-        rval = avro_value_to_json(&avro_value, 1, &json);
-        if (rval) {
-            fprintf(stderr, "Error converting to json: %s\n", avro_strerror());
-            return rval;
-        }
-        fprintf(outfile, "%s\n", json);
-        free(json);
+    if (!bench_report(&opts, "avro", nrecords, results, 4)) {
+        exit(EXIT_FAILURE);
     }
 
     // Cleanup
-    avro_file_reader_close(reader);
-    avro_value_decref(&avro_value);
+    avro_reader_free(recs.reader);
+    avro_writer_free(recs.writer);
+    avro_value_decref(&recs.value);
     avro_value_iface_decref(iface);
     avro_schema_decref(schema);
+    for (size_t i = 0; i < nrecords; ++i) {
+        free(recs.binaries[i]);
+    }
+    free(recs.binaries);
+    free(recs.binary_lens);
+    free(recs.line_lens);
+    bench_free_lines(recs.lines, nrecords);
 
-    return 1;
+    return 0;
 }
 
 /* See: http://dcreager.github.io/avro-examples/resolved-writer.html */
-int test_multiple_project(FILE *outfile) {
-    avro_file_reader_t dbreader;
+int projection_init(projection *proj, records *recs, avro_schema_t writer_schema,
+                    const char *reader_schema_json, const char *const *keys, int num_keys) {
     avro_schema_error_t error;
-    avro_schema_t  reader_schema;
-    avro_schema_t  writer_schema;
-    avro_value_iface_t  *writer_iface;
-    avro_value_iface_t  *reader_iface;
-    avro_value_t  writer_value;
-    avro_value_t  reader_value;
     int rval;
+
+    proj->recs = recs;
+    proj->keys = keys;
+    proj->num_keys = num_keys;
+
     // Parse schema into a schema data structure
-    if ((rval = avro_schema_from_json(MULTIPLE_PROJECTED_SCHEMA, 0, &reader_schema, &error))) {
-        fprintf(stderr, "Unable to parse nobench schema\n");
+    if ((rval = avro_schema_from_json(reader_schema_json, 0, &proj->reader_schema, &error))) {
+        fprintf(stderr, "Unable to parse projected schema\n");
         return rval;
     }
 
-    rval = avro_file_reader(dbname, &dbreader);
-    if (rval) {
-        fprintf(stderr, "Error opening file: %s\n", avro_strerror());
-        return rval;
+    proj->reader_iface = avro_generic_class_from_schema(proj->reader_schema);
+    avro_generic_value_new(proj->reader_iface, &proj->reader_value);
+    proj->writer_iface = avro_resolved_writer_new(writer_schema, proj->reader_schema);
+    if (!proj->writer_iface) {
+        fprintf(stderr, "Unable to resolve schemas: %s\n", avro_strerror());
+        return 1;
     }
+    avro_resolved_writer_new_value(proj->writer_iface, &proj->writer_value);
+    avro_resolved_writer_set_dest(&proj->writer_value, &proj->reader_value);
 
-    writer_schema = avro_file_reader_get_writer_schema(dbreader);
-    reader_iface = avro_generic_class_from_schema(reader_schema);
-    avro_generic_value_new(reader_iface, &reader_value);
-    writer_iface = avro_resolved_writer_new(writer_schema, reader_schema);
-    avro_resolved_writer_new_value(writer_iface, &writer_value);
-    avro_resolved_writer_set_dest(&writer_value, &reader_value);
+    return 0;
+}
 
-    while (avro_file_reader_read_value(dbreader, &writer_value) == 0) {
-        avro_value_t field, subfield;
-        int branch;
-        const char *value;
-        size_t size;
+void projection_free(projection *proj) {
+    avro_value_decref(&proj->writer_value);
+    avro_value_iface_decref(proj->writer_iface);
+    avro_value_decref(&proj->reader_value);
+    avro_value_iface_decref(proj->reader_iface);
+    avro_schema_decref(proj->reader_schema);
+}
 
-        char buffer[1000];
-        sprintf(buffer, "");
+long bench_serialize(void *arg, size_t i) {
+    records *recs = arg;
+    avro_value_t field, subfield;
+    size_t size;
+    int rval;
 
-        for (int i = 0; i < num_projected_keys; ++i) {
-            avro_value_get_by_name(&reader_value, MULTIPLE_PROJECTED_KEY[i], &field, NULL);
-            if (rval) {
-                fprintf(stderr, "Error reading: %s\n", avro_strerror());
-                return rval;
-            }
+    // Initialize the values that can be null (hardcoded)
+    char *dynamic_keys[] = { "dyn1_int", "dyn1_str", "dyn2_int", "dyn2_str", "dyn2_bool" };
+    for (int k = 0; k < 5; ++k) {
+        avro_value_get_by_name(&recs->value, dynamic_keys[k], &field, NULL);
+        avro_value_set_branch(&field, 1, &subfield);
+        avro_value_set_null(&subfield);
+    }
+    for (int k = 0; k < 1000; ++k) {
+        char keyname[100];
+        sprintf(keyname, "sparse_%03d_str", k);
+        avro_value_get_by_name(&recs->value, keyname, &field, NULL);
+        avro_value_set_branch(&field, 1, &subfield);
+        avro_value_set_null(&subfield);
+    }
 
-            avro_value_get_discriminant(&field, &branch);
-            if (branch == 0) {
-                avro_value_get_current_branch(&field, &subfield);
-                rval = avro_value_get_string(&subfield, &value, &size);
-                if (rval) {
-                    fprintf(stderr, "Error converting to string: %s\n", avro_strerror());
-                    return rval;
-                }
-                sprintf(buffer, "%s%s, ", buffer, value);
-            } else if (branch == 1) {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-        }
-        fprintf(outfile, "%s\n", buffer);
+    // Create a new record
+    avro_record_value_fill(&recs->value, recs->lines[i]);
+
+    // Write the record
+    avro_value_sizeof(&recs->value, &size);
+    free(recs->binaries[i]);
+    recs->binaries[i] = malloc(size);
+    recs->binary_lens[i] = size;
+    avro_writer_memory_set_dest(recs->writer, recs->binaries[i], size);
+    rval = avro_value_write(recs->writer, &recs->value);
+    if (rval) {
+        fprintf(stderr, "Unable to write datum: %d: %s\n", rval, avro_strerror());
+        return -1;
     }
 
-    avro_file_reader_close(dbreader);
-    avro_value_decref(&writer_value);
-    avro_value_iface_decref(writer_iface);
-    avro_schema_decref(writer_schema);
-    avro_value_decref(&reader_value);
-    avro_value_iface_decref(reader_iface);
-    avro_schema_decref(reader_schema);
+    // Cleanup
+    avro_value_reset(&recs->value);
 
-    return 1;
+    return recs->line_lens[i];
 }
-/* See: http://dcreager.github.io/avro-examples/resolved-writer.html */
-int test_project(FILE *outfile) {
-    avro_file_reader_t dbreader;
-    avro_schema_error_t error;
-    avro_schema_t  reader_schema;
-    avro_schema_t  writer_schema;
-    avro_value_iface_t  *writer_iface;
-    avro_value_iface_t  *reader_iface;
-    avro_value_t  writer_value;
-    avro_value_t  reader_value;
+
+long bench_deserialize(void *arg, size_t i) {
+    records *recs = arg;
+    char *json;
     int rval;
-    // Parse schema into a schema data structure
-    if ((rval = avro_schema_from_json(PROJECTED_SCHEMA, 0, &reader_schema, &error))) {
-        fprintf(stderr, "Unable to parse nobench schema\n");
-        return rval;
+
+    avro_value_reset(&recs->value);
+    avro_reader_memory_set_source(recs->reader, recs->binaries[i], recs->binary_lens[i]);
+    rval = avro_value_read(recs->reader, &recs->value);
+    if (rval) {
+        fprintf(stderr, "Error reading: %s\n", avro_strerror());
+        return -1;
     }
 
-    rval = avro_file_reader(dbname, &dbreader);
+    rval = avro_value_to_json(&recs->value, 1, &json);
     if (rval) {
-        fprintf(stderr, "Error opening file: %s\n", avro_strerror());
-        return rval;
+        fprintf(stderr, "Error converting to json: %s\n", avro_strerror());
+        return -1;
     }
+    free(json);
 
-    writer_schema = avro_file_reader_get_writer_schema(dbreader);
-    reader_iface = avro_generic_class_from_schema(reader_schema);
-    avro_generic_value_new(reader_iface, &reader_value);
-    writer_iface = avro_resolved_writer_new(writer_schema, reader_schema);
-    avro_resolved_writer_new_value(writer_iface, &writer_value);
-    avro_resolved_writer_set_dest(&writer_value, &reader_value);
+    return recs->binary_lens[i];
+}
 
-    while (avro_file_reader_read_value(dbreader, &writer_value) == 0) {
+long bench_project(void *arg, size_t i) {
+    projection *proj = arg;
+    records *recs = proj->recs;
+    int rval;
+
+    avro_reader_memory_set_source(recs->reader, recs->binaries[i], recs->binary_lens[i]);
+    rval = avro_value_read(recs->reader, &proj->writer_value);
+    if (rval) {
+        fprintf(stderr, "Error reading: %s\n", avro_strerror());
+        return -1;
+    }
+
+    for (int k = 0; k < proj->num_keys; ++k) {
         avro_value_t field, subfield;
         int branch;
         const char *value;
         size_t size;
 
-        avro_value_get_by_name(&reader_value, PROJECTED_KEY, &field, NULL);
+        rval = avro_value_get_by_name(&proj->reader_value, proj->keys[k], &field, NULL);
         if (rval) {
             fprintf(stderr, "Error reading: %s\n", avro_strerror());
-            return rval;
+            return -1;
         }
 
         avro_value_get_discriminant(&field, &branch);
@@ -235,103 +252,13 @@ int test_project(FILE *outfile) {
             rval = avro_value_get_string(&subfield, &value, &size);
             if (rval) {
                 fprintf(stderr, "Error converting to string: %s\n", avro_strerror());
-                return rval;
+                return -1;
             }
-            fprintf(outfile, "%s\n", value);
-        } else if (branch == 1) {
+            projected_bytes += size;
         }
     }
 
-    avro_file_reader_close(dbreader);
-    avro_value_decref(&writer_value);
-    avro_value_iface_decref(writer_iface);
-    avro_schema_decref(writer_schema);
-    avro_value_decref(&reader_value);
-    avro_value_iface_decref(reader_iface);
-    avro_schema_decref(reader_schema);
-
-    return 1;
-}
-
-// NOTE: File must be \n terminated
-int test_serialize(FILE* infile) {
-    avro_schema_t schema;
-    avro_schema_error_t error;
-    avro_file_writer_t db;
-    avro_value_iface_t *iface;
-    avro_value_t avro_value;
-
-    char *buffer;
-    size_t len, read;
-    int rval;
-
-    // Parse schema into a schema data structure
-    if ((rval = avro_schema_from_json(NOBENCH_SCHEMA, 0, &schema, &error))) {
-        fprintf(stderr, "Unable to parse nobench schema\n");
-        return rval;
-    }
-
-    iface = avro_generic_class_from_schema(schema);
-    rval = avro_generic_value_new(iface, &avro_value);
-
-    if ((rval = avro_file_writer_create_with_codec(dbname, schema, &db, codec, 13000 * 1024))) {
-        fprintf(stderr, "Error creating %s: %s\n", dbname, avro_strerror());
-        return rval;
-    }
-    avro_file_writer_flush(db);
-
-    buffer = NULL;
-    len = 0;
-    while ((read = getline(&buffer, &len, infile)) != -1) {
-        avro_value_t field, subfield;
-        size_t index;
-        const char *dummy;
-
-        // Initialize the values that can be null (hardcoded)
-        char *dynamic_keys[] = { "dyn1_int", "dyn1_str", "dyn2_int", "dyn2_str", "dyn2_bool" };
-        for (int i = 0; i < 5; ++i) {
-            avro_value_get_by_name(&avro_value, dynamic_keys[i], &field, NULL);
-            avro_value_set_branch(&field, 1, &subfield);
-            avro_value_set_null(&subfield);
-        }
-        for (int i = 0; i < 1000; ++i) {
-            char keyname[100];
-            sprintf(keyname, "sparse_%03d_str", i);
-            avro_value_get_by_name(&avro_value, keyname, &field, NULL);
-            avro_value_set_branch(&field, 1, &subfield);
-            avro_value_set_null(&subfield);
-        }
-
-        // Create a new record
-        avro_record_value_fill(&avro_value, buffer);
-        // fprintf(stderr, "Filled record\n");
-        // avro_value_get_size(&avro_value, &index);
-        // fprintf(stderr, "record has %zu attr\n", index);
-        // avro_value_get_by_name(&avro_value, "str1_str", &field, NULL);
-        // avro_value_set_branch(&field, 0, &subfield);
-        // avro_value_get_string(&subfield, &dummy, &index);
-        // fprintf(stderr, "got string %s, len %zu\n", dummy, index);
-
-        // Write the record
-        rval = avro_file_writer_append_value(db, &avro_value);
-        if (rval) {
-            fprintf(stderr, "Unable to write datum: %d: %s\n", rval, avro_strerror());
-        }
-
-        // Cleanup
-        avro_value_reset(&avro_value);
-        free(buffer);
-        buffer = NULL;
-        len = 0;
-    }
-    // fprintf(stderr, "Finished serialization\n");
-
-    avro_file_writer_flush(db);
-    avro_file_writer_close(db);
-    avro_value_decref(&avro_value);
-    avro_value_iface_decref(iface);
-
-    return 1;
+    return recs->binary_lens[i];
 }
 
 // Returns - how many tokens to advance
@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*******************************************************************************
+ * Allocation counting
+ ******************************************************************************/
+
+/*
+ * On glibc the allocator is replaced by thin wrappers that count calls and
+ * forward to the real implementation, which catches allocations made by the
+ * format libraries as well as our own. Elsewhere allocations are not counted
+ * and the report says so with -1.
+ */
+#if defined(__GLIBC__) && !defined(BENCH_NO_ALLOC_COUNT)
+#define BENCH_COUNT_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t num_allocs = 0;
+
+void *
+malloc(size_t size)
+{
+    ++num_allocs;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    ++num_allocs;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    ++num_allocs;
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+/*******************************************************************************
+ * Helpers
+ ******************************************************************************/
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* splitmix64, so a seed gives the same order on every platform */
+static uint64_t
+next_random(uint64_t *state)
+{
+    uint64_t z;
+
+    z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static size_t *
+record_order(size_t n, uint64_t seed)
+{
+    size_t *order;
+    uint64_t state;
+    size_t i;
+
+    order = malloc(n * sizeof(size_t));
+    for (i = 0; i < n; ++i)
+    {
+        order[i] = i;
+    }
+    if (seed != 0)
+    {
+        state = seed;
+        for (i = n; i > 1; --i)
+        {
+            size_t j, tmp;
+
+            j = next_random(&state) % i;
+            tmp = order[i - 1];
+            order[i - 1] = order[j];
+            order[j] = tmp;
+        }
+    }
+
+    return order;
+}
+
+static int
+uint64_comparator(const void *v1, const void *v2)
+{
+    uint64_t a = *(const uint64_t *) v1;
+    uint64_t b = *(const uint64_t *) v2;
+
+    return a < b ? -1 : a > b;
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t
+percentile(const uint64_t *samples, size_t n, int pct)
+{
+    size_t rank;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+    rank = (n * pct + 99) / 100;
+    return samples[rank > 0 ? rank - 1 : 0];
+}
+
+/* Fills in result from the timed passes' samples, which it sorts */
+static void
+summarize(bench_result *result, uint64_t *samples, size_t nsamples,
+          uint64_t allocs)
+{
+    result->records = nsamples;
+#ifdef BENCH_COUNT_ALLOCS
+    result->allocs = nsamples ? (double) allocs / nsamples : 0;
+#else
+    result->allocs = -1;
+#endif
+
+    qsort(samples, nsamples, sizeof(uint64_t), uint64_comparator);
+    result->p50_ns = percentile(samples, nsamples, 50);
+    result->p99_ns = percentile(samples, nsamples, 99);
+    result->max_ns = nsamples ? samples[nsamples - 1] : 0;
+}
+
+static void
+print_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; ++str)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            fputc('\\', out);
+        }
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+/*******************************************************************************
+ * Driver
+ ******************************************************************************/
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-w warmup] [-r repetitions] [-s seed] [-n records] "
+            "[-p prefetch] [-b batch] [-o report.json] input.json\n", prog);
+}
+
+int
+bench_parse_args(int argc, char **argv, bench_options *opts)
+{
+    int c;
+
+    opts->input = NULL;
+    opts->output = NULL;
+    opts->warmup = 1;
+    opts->repetitions = 3;
+    opts->seed = 42;
+    opts->limit = 0;
+    opts->prefetch = 0;
+    opts->batch = 256;
+
+    while ((c = getopt(argc, argv, "w:r:s:n:p:b:o:")) != -1)
+    {
+        switch (c)
+        {
+        case 'w':
+            opts->warmup = atoi(optarg);
+            break;
+        case 'r':
+            opts->repetitions = atoi(optarg);
+            break;
+        case 's':
+            opts->seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            opts->limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            opts->prefetch = atoi(optarg);
+            break;
+        case 'b':
+            opts->batch = atoi(optarg);
+            break;
+        case 'o':
+            opts->output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 0;
+        }
+    }
+    if (optind != argc - 1 || opts->warmup < 0 || opts->repetitions < 1 ||
+        opts->prefetch < 0 || opts->batch < 1)
+    {
+        usage(argv[0]);
+        return 0;
+    }
+    opts->input = argv[optind];
+
+    return 1;
+}
+
+/* Blank lines are skipped; the rest keep their newline, as read */
+char **
+bench_read_lines(const bench_options *opts, size_t *nlines)
+{
+    FILE *infile;
+    char **lines;
+    size_t n, capacity;
+    char *buffer;
+    size_t len;
+    ssize_t read;
+
+    infile = fopen(opts->input, "r");
+    if (!infile)
+    {
+        fprintf(stderr, "Unable to open %s\n", opts->input);
+        return NULL;
+    }
+
+    n = 0;
+    capacity = 1024;
+    lines = malloc(capacity * sizeof(char*));
+
+    buffer = NULL;
+    len = 0;
+    while ((opts->limit == 0 || n < opts->limit) &&
+           (read = getline(&buffer, &len, infile)) != -1)
+    {
+        if (strspn(buffer, " \t\r\n") == (size_t) read)
+        {
+            continue;
+        }
+        if (n == capacity)
+        {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(char*));
+        }
+        lines[n++] = strdup(buffer);
+    }
+    free(buffer);
+    fclose(infile);
+
+    *nlines = n;
+    return lines;
+}
+
+void
+bench_free_lines(char **lines, size_t nlines)
+{
+    size_t i;
+
+    for (i = 0; i < nlines; ++i)
+    {
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+int
+bench_run(const bench_options *opts, const char *name, size_t nrecords,
+          bench_fn fn, void *arg, bench_result *result)
+{
+    return bench_run_prefetch(opts, name, nrecords, fn, NULL, arg, result);
+}
+
+int
+bench_run_prefetch(const bench_options *opts, const char *name,
+                   size_t nrecords, bench_fn fn, bench_prefetch_fn prefetch,
+                   void *arg, bench_result *result)
+{
+    size_t *order;
+    uint64_t *samples;
+    uint64_t start, pass_start;
+    size_t nsamples;
+    long bytes;
+    int pass;
+    size_t i;
+    size_t distance;
+#ifdef BENCH_COUNT_ALLOCS
+    uint64_t allocs_start;
+#endif
+
+    memset(result, 0, sizeof(bench_result));
+    result->name = name;
+
+    order = record_order(nrecords, opts->seed);
+    samples = malloc((nrecords ? nrecords * opts->repetitions : 1) * sizeof(uint64_t));
+    nsamples = 0;
+    distance = prefetch ? opts->prefetch : 0;
+
+    for (pass = 0; pass < opts->warmup; ++pass)
+    {
+        for (i = 0; i < nrecords; ++i)
+        {
+            if (distance && i + distance < nrecords)
+            {
+                prefetch(arg, order[i + distance]);
+            }
+            if (fn(arg, order[i]) < 0)
+            {
+                goto fail;
+            }
+        }
+    }
+
+#ifdef BENCH_COUNT_ALLOCS
+    allocs_start = num_allocs;
+#endif
+    for (pass = 0; pass < opts->repetitions; ++pass)
+    {
+        pass_start = now_ns();
+        for (i = 0; i < nrecords; ++i)
+        {
+            start = now_ns();
+            if (distance && i + distance < nrecords)
+            {
+                prefetch(arg, order[i + distance]);
+            }
+            bytes = fn(arg, order[i]);
+            samples[nsamples++] = now_ns() - start;
+            if (bytes < 0)
+            {
+                goto fail;
+            }
+            result->bytes += bytes;
+        }
+        result->elapsed_ns += now_ns() - pass_start;
+    }
+#ifdef BENCH_COUNT_ALLOCS
+    summarize(result, samples, nsamples, num_allocs - allocs_start);
+#else
+    summarize(result, samples, nsamples, 0);
+#endif
+
+    free(samples);
+    free(order);
+    return 1;
+
+fail:
+    fprintf(stderr, "%s failed on record %zu\n", name, order[i]);
+    free(samples);
+    free(order);
+    return 0;
+}
+
+int
+bench_run_batch(const bench_options *opts, const char *name,
+                size_t nrecords, bench_batch_fn fn, void *arg,
+                bench_result *result)
+{
+    size_t *order;
+    uint64_t *samples;
+    uint64_t start, pass_start, share;
+    size_t nsamples;
+    long bytes;
+    int pass;
+    size_t i, j, n;
+#ifdef BENCH_COUNT_ALLOCS
+    uint64_t allocs_start;
+#endif
+
+    memset(result, 0, sizeof(bench_result));
+    result->name = name;
+
+    order = record_order(nrecords, opts->seed);
+    samples = malloc((nrecords ? nrecords * opts->repetitions : 1) * sizeof(uint64_t));
+    nsamples = 0;
+
+    for (pass = 0; pass < opts->warmup; ++pass)
+    {
+        for (i = 0; i < nrecords; i += n)
+        {
+            n = nrecords - i;
+            if (n > (size_t) opts->batch)
+            {
+                n = opts->batch;
+            }
+            if (fn(arg, order + i, n) < 0)
+            {
+                goto fail;
+            }
+        }
+    }
+
+#ifdef BENCH_COUNT_ALLOCS
+    allocs_start = num_allocs;
+#endif
+    for (pass = 0; pass < opts->repetitions; ++pass)
+    {
+        pass_start = now_ns();
+        for (i = 0; i < nrecords; i += n)
+        {
+            n = nrecords - i;
+            if (n > (size_t) opts->batch)
+            {
+                n = opts->batch;
+            }
+            start = now_ns();
+            bytes = fn(arg, order + i, n);
+            share = (now_ns() - start) / n;
+            for (j = 0; j < n; ++j)
+            {
+                samples[nsamples++] = share;
+            }
+            if (bytes < 0)
+            {
+                goto fail;
+            }
+            result->bytes += bytes;
+        }
+        result->elapsed_ns += now_ns() - pass_start;
+    }
+#ifdef BENCH_COUNT_ALLOCS
+    summarize(result, samples, nsamples, num_allocs - allocs_start);
+#else
+    summarize(result, samples, nsamples, 0);
+#endif
+
+    free(samples);
+    free(order);
+    return 1;
+
+fail:
+    fprintf(stderr, "%s failed on the batch at record %zu\n", name, order[i]);
+    free(samples);
+    free(order);
+    return 0;
+}
+
+int
+bench_report(const bench_options *opts, const char *format,
+             size_t nrecords, const bench_result *results, int nresults)
+{
+    FILE *out;
+    int i;
+
+    out = opts->output ? fopen(opts->output, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "Unable to open %s\n", opts->output);
+        return 0;
+    }
+
+    fprintf(out, "{\n  \"format\": ");
+    print_json_string(out, format);
+    fprintf(out, ",\n  \"context\": {\n    \"input\": ");
+    print_json_string(out, opts->input);
+    fprintf(out, ",\n    \"records\": %zu,\n    \"warmup\": %d,\n"
+            "    \"repetitions\": %d,\n    \"seed\": %llu,\n"
+            "    \"prefetch\": %d,\n    \"batch\": %d\n  },\n"
+            "  \"benchmarks\": [",
+            nrecords, opts->warmup, opts->repetitions,
+            (unsigned long long) opts->seed, opts->prefetch, opts->batch);
+    for (i = 0; i < nresults; ++i)
+    {
+        const bench_result *r = results + i;
+        double seconds = r->elapsed_ns / 1e9;
+
+        fprintf(out, "%s\n    {\n      \"name\": ", i ? "," : "");
+        print_json_string(out, r->name);
+        fprintf(out, ",\n      \"records\": %zu,\n      \"bytes\": %llu,\n"
+                "      \"seconds\": %.6f,\n"
+                "      \"records_per_second\": %.1f,\n"
+                "      \"bytes_per_second\": %.1f,\n"
+                "      \"p50_ns\": %llu,\n      \"p99_ns\": %llu,\n"
+                "      \"max_ns\": %llu,\n"
+                "      \"allocs_per_record\": %.2f\n    }",
+                r->records, (unsigned long long) r->bytes, seconds,
+                seconds > 0 ? r->records / seconds : 0,
+                seconds > 0 ? r->bytes / seconds : 0,
+                (unsigned long long) r->p50_ns, (unsigned long long) r->p99_ns,
+                (unsigned long long) r->max_ns, r->allocs);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 1;
+}
@@ -0,0 +1,80 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared driver for the per-format microbenchmarks.
+ *
+ * Each format loads its input into memory and hands the driver one callback
+ * per phase. The callback processes a single record, so the driver can time
+ * every record, and returns the number of bytes it consumed (or -1 on
+ * error): the JSON text when serializing, the encoded record otherwise.
+ *
+ * A phase is run `warmup' times untimed and then `repetitions' times timed,
+ * visiting the records in an order fixed by `seed', and the timed passes are
+ * summarized as throughput, latency percentiles and allocations per record.
+ * File I/O never happens inside a timed pass.
+ *
+ * Phases that work on many records at once instead hand the driver a batch
+ * callback, which gets `batch' records per call in visiting order. A batch is
+ * timed as a whole and each of its records is charged an equal share, so
+ * percentiles are of per-record averages within a batch.
+ */
+
+typedef struct
+{
+    const char *input;         /* NDJSON file, one document per line */
+    const char *output;        /* JSON report, NULL for stdout */
+    int         warmup;        /* untimed passes per phase */
+    int         repetitions;   /* timed passes per phase */
+    uint64_t    seed;          /* record order; 0 keeps the file order */
+    size_t      limit;         /* records to read, 0 for all */
+    int         prefetch;      /* records ahead to prefetch, 0 for none */
+    int         batch;         /* records per call of a batch callback */
+} bench_options;
+
+typedef long (*bench_fn)(void *arg, size_t record);
+typedef long (*bench_batch_fn)(void *arg, const size_t *records, size_t n);
+typedef void (*bench_prefetch_fn)(void *arg, size_t record);
+
+typedef struct
+{
+    const char *name;
+    size_t      records;       /* records processed by the timed passes */
+    uint64_t    bytes;
+    uint64_t    elapsed_ns;    /* wall-clock time of the timed passes */
+    uint64_t    p50_ns;
+    uint64_t    p99_ns;
+    uint64_t    max_ns;
+    double      allocs;        /* per record, -1 when not counted */
+} bench_result;
+
+int bench_parse_args(int argc, char **argv, bench_options *opts);
+char **bench_read_lines(const bench_options *opts, size_t *nlines);
+void bench_free_lines(char **lines, size_t nlines);
+
+int bench_run(const bench_options *opts, const char *name, size_t nrecords,
+              bench_fn fn, void *arg, bench_result *result);
+/* As bench_run, but with opts->prefetch > 0 calls prefetch for the record
+ * that many places ahead in the visiting order before each call to fn */
+int bench_run_prefetch(const bench_options *opts, const char *name,
+                       size_t nrecords, bench_fn fn, bench_prefetch_fn prefetch,
+                       void *arg, bench_result *result);
+int bench_run_batch(const bench_options *opts, const char *name,
+                    size_t nrecords, bench_batch_fn fn, void *arg,
+                    bench_result *result);
+int bench_report(const bench_options *opts, const char *format,
+                 size_t nrecords, const bench_result *results, int nresults);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
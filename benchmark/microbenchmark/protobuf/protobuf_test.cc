@@ -1,282 +1,172 @@
 #define _GNU_SOURCE
 
 #include <iostream>
-#include <fstream>
+#include <string>
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "nobench.pb.h"
+#include "../bench.h"
 #include "json.h"
 
-char dbname[] = "protobuf_test.db";
-
-int num_dbfiles = 0;
-const int MAX_DB_SIZE = 100000;
-
-int test_serialize(FILE* infile);
-int test_deserialize(FILE *outfile);
-int test_project(FILE *outfile);
-int test_multiple_project(FILE *outfile);
+/* The input and its serialized form, both in memory */
+typedef struct {
+    char **lines;
+    size_t *line_lens;
+    std::string *binaries;
+    Database::NoBench nb;       /* Scratch record */
+} records;
+
+/* Keeps the projections from being optimized away */
+size_t projected_bytes = 0;
+
+long bench_serialize(void *arg, size_t i);
+long bench_deserialize(void *arg, size_t i);
+long bench_project(void *arg, size_t i);
+long bench_multiple_project(void *arg, size_t i);
 int protobuf_fill(Database::NoBench *protobuf, char *json);
 
 using namespace std;
 
 int main(int argc, char** argv) {
-    char *infilename, *outfilename, *extract_outfilename, *multiple_extract_outfilename;
-    FILE *infile, *outfile, *extract_outfile, *multiple_extract_outfile;
-    int rval; // Function status codes
-    clock_t start, diff;
-    int msec;
+    bench_options opts;
+    bench_result results[4];
+    records recs;
+    size_t nrecords;
 
     // Verify that the version of the library that we linked against is
     //   // compatible with the version of the headers we compiled against.
     GOOGLE_PROTOBUF_VERIFY_VERSION;
 
-    infilename = argv[1];
-    infile = fopen(infilename, "r");
-    // Measures CPU Time
-    // TODO: DRY
-    start = clock();
-    if (!test_serialize(infile)) {
+    if (!bench_parse_args(argc, argv, &opts)) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Serialize: %d ms\n", msec);
-    fflush(stdout);
-    fclose(infile);
-
-    outfilename = argv[2];
-    outfile = fopen(outfilename, "w");
-    start = clock();
-    if (!test_deserialize(outfile)) {
+    recs.lines = bench_read_lines(&opts, &nrecords);
+    if (!recs.lines) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Deserialize: %d ms\n", msec);
-    fflush(stdout);
-    fclose(outfile);
-
-    extract_outfilename = argv[3];
-    extract_outfile = fopen(extract_outfilename, "w");
-    start = clock();
-    if (!test_project(extract_outfile)) {
+    recs.line_lens = new size_t[nrecords];
+    recs.binaries = new string[nrecords];
+    for (size_t i = 0; i < nrecords; ++i) {
+        recs.line_lens[i] = strlen(recs.lines[i]);
+    }
+
+    // The later phases read what the last serialize pass left behind
+    if (!bench_run(&opts, "serialize", nrecords, bench_serialize, &recs, &results[0]) ||
+        !bench_run(&opts, "deserialize", nrecords, bench_deserialize, &recs, &results[1]) ||
+        !bench_run(&opts, "project", nrecords, bench_project, &recs, &results[2]) ||
+        !bench_run(&opts, "multiple_project", nrecords, bench_multiple_project, &recs,
+                   &results[3])) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Extract: %d ms\n", msec);
-    fflush(stdout);
-    fclose(extract_outfile);
-
-    multiple_extract_outfilename = argv[4];
-    multiple_extract_outfile = fopen(multiple_extract_outfilename, "w");
-    start = clock();
-    if (!test_multiple_project(multiple_extract_outfile)) {
+    if (!bench_report(&opts, "protobuf", nrecords, results, 4)) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Multiple Extract: %d ms\n", msec);
-    fflush(stdout);
-    fclose(multiple_extract_outfile);
-}
 
-/* Read all the records and print them */
-int test_deserialize(FILE *outfile) {
-    Database db;
-    Database::NoBench *nb;
-    char *json;
+    delete[] recs.binaries;
+    delete[] recs.line_lens;
+    bench_free_lines(recs.lines, nrecords);
 
-    fprintf(stderr, "In test deser\n");
-
-    for (int j = 0; j < num_dbfiles; ++j) {
-        char dbname_full[200];
-        sprintf(dbname_full, "%s_%d", dbname, j);
-        fstream input(dbname_full, ios::in | ios::binary);
-
-        db.ParseFromIstream(&input);
-        // fprintf(stderr, "Parsing file %d of %d: name = %s db size = %d\n", j, num_dbfiles, dbname_full, db.nb_size());
-        for (int i = 0; i < db.nb_size(); ++i) {
-            nb = db.mutable_nb(i);
-
-            json = (char*)calloc(10000, 1);
-            sprintf(json, "{ \"ID\" : %d", i);
-            for (int j = 0; j < 5; ++j) {
-                // /Junk just for the sake of I/O
-                sprintf(json, "%s, \"%s\":\"%s\"", json, "str1", nb->str1_str().c_str());
-                sprintf(json, "%s, \"%s\":\"%s\"", json, "str2", nb->str2_str().c_str());
-                sprintf(json, "%s, \"%s\":%ld", json, "num", nb->num_int());
-                sprintf(json, "%s, \"%s\":%d", json, "bool", nb->bool_bool());
-                sprintf(json, "%s, \"%s\":\"%s\"", json, "dyn1", nb->dyn1_str().c_str());
-                sprintf(json, "%s, \"%s\":\"%s\"", json, "dyn2", nb->dyn2_str().c_str());
-            }
-            for (int j = 0; j < 1000; ++j) {
-                // Junk for the sake of memory dereferences
-                if (nb->has_dyn1_str()) {};
-            }
-
-            fprintf(outfile, "%s\n", json);
-            free(json);
-        }
+    return 0;
+}
+
+long bench_serialize(void *arg, size_t i) {
+    records *recs = (records *) arg;
 
-        fflush(outfile);
-        input.close();
-        db.Clear();
+    recs->nb.Clear();
+    protobuf_fill(&recs->nb, recs->lines[i]);
+    if (!recs->nb.SerializeToString(&recs->binaries[i])) {
+        cerr << "Failed to write datum." << endl;
+        return -1;
     }
 
-    return 1;
+    return recs->line_lens[i];
 }
 
-int test_project(FILE *outfile) {
-    Database db;
-    Database::NoBench *nb;
-
-    // TODO: DRY with deser
-    for (int j = 0; j < num_dbfiles; ++j) {
-        char dbname_full[200];
-        sprintf(dbname_full, "%s_%d", dbname, j);
-        fstream input(dbname_full, ios::in | ios::binary);
-
-        db.ParseFromIstream(&input);
-        for (int i = 0; i < db.nb_size(); ++i) {
-            nb = db.mutable_nb(i);
-            if (nb->has_sparse_987_str()) {
-                fprintf(outfile, "%s\n", nb->sparse_987_str().c_str());
-            }
-        }
+long bench_deserialize(void *arg, size_t i) {
+    records *recs = (records *) arg;
+    Database::NoBench *nb = &recs->nb;
+    char *json;
 
-        fflush(outfile);
-        input.close();
-        db.Clear();
+    if (!nb->ParseFromString(recs->binaries[i])) {
+        cerr << "Failed to parse datum." << endl;
+        return -1;
+    }
+
+    json = (char*)calloc(10000, 1);
+    sprintf(json, "{ \"ID\" : %zu", i);
+    for (int j = 0; j < 5; ++j) {
+        // /Junk just for the sake of I/O
+        sprintf(json, "%s, \"%s\":\"%s\"", json, "str1", nb->str1_str().c_str());
+        sprintf(json, "%s, \"%s\":\"%s\"", json, "str2", nb->str2_str().c_str());
+        sprintf(json, "%s, \"%s\":%ld", json, "num", nb->num_int());
+        sprintf(json, "%s, \"%s\":%d", json, "bool", nb->bool_bool());
+        sprintf(json, "%s, \"%s\":\"%s\"", json, "dyn1", nb->dyn1_str().c_str());
+        sprintf(json, "%s, \"%s\":\"%s\"", json, "dyn2", nb->dyn2_str().c_str());
+    }
+    for (int j = 0; j < 1000; ++j) {
+        // Junk for the sake of memory dereferences
+        if (nb->has_dyn1_str()) {};
     }
+    free(json);
 
-    return 1;
+    return recs->binaries[i].size();
 }
 
-int test_multiple_project(FILE *outfile) {
-    Database db;
-    Database::NoBench *nb;
-
-    // TODO: DRY with deser
-    for (int j = 0; j < num_dbfiles; ++j) {
-        char dbname_full[200];
-        sprintf(dbname_full, "%s_%d", dbname, j);
-        fstream input(dbname_full, ios::in | ios::binary);
-
-        db.ParseFromIstream(&input);
-        for (int i = 0; i < db.nb_size(); ++i) {
-            char buffer[1000];
-            sprintf(buffer, "");
-
-            nb = db.mutable_nb(i);
-            if (nb->has_sparse_987_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_987_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_sparse_123_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_123_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_sparse_234_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_234_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_sparse_345_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_345_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_sparse_456_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_456_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_sparse_567_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_567_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_sparse_789_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->sparse_789_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            if (nb->has_dyn1_str()) {
-                sprintf(buffer, "%s%s, ", buffer, nb->dyn1_str().c_str());
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-            sprintf(buffer, "%s%s, ", buffer, nb->str1_str().c_str());
-            sprintf(buffer, "%s%s, ", buffer, nb->str2_str().c_str());
-
-            fprintf(outfile, "%s\n", buffer);
-        }
+long bench_project(void *arg, size_t i) {
+    records *recs = (records *) arg;
+    Database::NoBench *nb = &recs->nb;
 
-        fflush(outfile);
-        input.close();
-        db.Clear();
+    if (!nb->ParseFromString(recs->binaries[i])) {
+        cerr << "Failed to parse datum." << endl;
+        return -1;
+    }
+    if (nb->has_sparse_987_str()) {
+        projected_bytes += nb->sparse_987_str().size();
     }
 
-    return 1;
+    return recs->binaries[i].size();
 }
 
-// NOTE: File must be \n terminated
-int test_serialize(FILE* infile) {
-    char *buffer;
-    size_t len, read;
-    Database db;
-
-    buffer = NULL;
-    len = 0;
-    while ((read = getline(&buffer, &len, infile)) != -1) {
-        Database::NoBench *nb;
-
-        nb = db.add_nb();
-        protobuf_fill(nb, buffer);
-
-        free(buffer);
-        buffer = NULL;
-        len = 0;
-
-        if (db.nb_size() >= MAX_DB_SIZE) {
-            char dbname_full[200];
-            sprintf(dbname_full, "%s_%d", dbname, num_dbfiles++);
-            fstream output(dbname_full, ios::out | ios::trunc | ios::binary);
-            // fprintf(stderr, "Outputting file %d : db size = %d\n", num_dbfiles, db.nb_size());
-            if (!db.SerializeToOstream(&output)) {
-                cerr << "Failed to write datum." << endl;
-                return -1;
-            }
-            output.close();
-            db.Clear();
-        }
-    }
+long bench_multiple_project(void *arg, size_t i) {
+    records *recs = (records *) arg;
+    Database::NoBench *nb = &recs->nb;
 
-    if (db.nb_size() != 0) {
-        char dbname_full[200];
-        sprintf(dbname_full, "%s_%d", dbname, num_dbfiles++);
-        fstream output(dbname_full, ios::out | ios::trunc | ios::binary);
-        // fprintf(stderr, "Outputting file %d : db size = %d\n", num_dbfiles, db.nb_size());
-        if (!db.SerializeToOstream(&output)) {
-            cerr << "Failed to write datum." << endl;
-            return -1;
-        }
-        output.close();
-        db.Clear();
+    if (!nb->ParseFromString(recs->binaries[i])) {
+        cerr << "Failed to parse datum." << endl;
+        return -1;
     }
+    if (nb->has_sparse_987_str()) {
+        projected_bytes += nb->sparse_987_str().size();
+    }
+    if (nb->has_sparse_123_str()) {
+        projected_bytes += nb->sparse_123_str().size();
+    }
+    if (nb->has_sparse_234_str()) {
+        projected_bytes += nb->sparse_234_str().size();
+    }
+    if (nb->has_sparse_345_str()) {
+        projected_bytes += nb->sparse_345_str().size();
+    }
+    if (nb->has_sparse_456_str()) {
+        projected_bytes += nb->sparse_456_str().size();
+    }
+    if (nb->has_sparse_567_str()) {
+        projected_bytes += nb->sparse_567_str().size();
+    }
+    if (nb->has_sparse_789_str()) {
+        projected_bytes += nb->sparse_789_str().size();
+    }
+    if (nb->has_dyn1_str()) {
+        projected_bytes += nb->dyn1_str().size();
+    }
+    projected_bytes += nb->str1_str().size();
+    projected_bytes += nb->str2_str().size();
 
-    fprintf(stderr, "Finished serialize\n");
-
-    return 1;
+    return recs->binaries[i].size();
 }
 
 // Returns - how many tokens to advance
@@ -1,259 +1,244 @@
 #define _GNU_SOURCE
 
+/* The extension's own encoder and decoder, built standalone (see
+ * src/postgres/document/core.h) */
+#include "core.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <string.h>
+#include <sys/mman.h>
 
+#include "binary.h"
 #include "document.h"
+#include "project.h"
 #include "schema.h"
-#include "../json.h"
+#include "../bench.h"
+#include "../store.h"
 
-char dbname[] = "sinew_test.db";
-char schemafname[] = "sinew_test.schema";
 const char projected_keyname[] = "sparse_987";
 const char projected_typename[] = STRING_TYPE;
 const char *multiple_projected_keyname[] = { "sparse_987", "str1", "dyn1", "sparse_567", "str2",
                                               "sparse_123", "sparse_234", "sparse_345", "sparse_456", "sparse_789" };
-const char *multiple_projected_typename[] = { "str", "str", "str", "str", "str",
-                                              "str", "str", "str", "str", "str" };
+const char *multiple_projected_typename[] = { STRING_TYPE, STRING_TYPE, STRING_TYPE, STRING_TYPE,
+                                              STRING_TYPE, STRING_TYPE, STRING_TYPE, STRING_TYPE,
+                                              STRING_TYPE, STRING_TYPE };
 const int num_projected_keys = 10;
 
-int test_serialize(FILE* infile);
-int test_deserialize(FILE *outfile);
-int test_projection(FILE *outfile);
-int test_multiple_projection(FILE *outfile);
-char *extract_key(char *binary, const char* key, const char *type);
+char dbname[] = "sinew_test.db";
+
+/* The input, its serialized form in memory while serializing, and then the
+ * same records mapped from dbname for reading, with the projected keys
+ * resolved once and what batch projection needs */
+typedef struct {
+    char **lines;
+    size_t *line_lens;
+    char **binaries;
+    size_t *binary_lens;
+    store db;
+    doc_projection *single;
+    doc_projection *proj;
+    doc_column *columns;
+    const char **batch;
+} records;
+
+/* Keeps the projections from being optimized away */
+size_t projected_bytes = 0;
+
+long bench_serialize(void *arg, size_t i);
+long bench_deserialize(void *arg, size_t i);
+long bench_projection(void *arg, size_t i);
+long bench_multiple_projection(void *arg, size_t i);
+long bench_batch_projection(void *arg, const size_t *batch, size_t n);
+void bench_prefetch(void *arg, size_t i);
+int write_db(records *recs, size_t nrecords);
+const char *extract_key(const char *binary, const doc_projection *proj, int k, int *len);
 
 int main(int argc, char** argv) {
-    char *infilename, *outfilename, *extract_outfilename, *multiple_extract_outfilename;
-    FILE *infile, *outfile, *extract_outfile, *multiple_extract_outfile;
-    clock_t start, diff;
-    int msec;
-
-    infilename = argv[1];
-    infile = fopen(infilename, "r");
-    outfilename = argv[2];
-    outfile = fopen(outfilename, "w");
-    extract_outfilename = argv[3];
-    extract_outfile = fopen(extract_outfilename, "w");
-    multiple_extract_outfilename = argv[4];
-    multiple_extract_outfile = fopen(multiple_extract_outfilename, "w");
-
-    // Measures CPU Time
-    // TODO: DRY
-    start = clock();
-    if (!test_serialize(infile)) {
+    const char *single_keyname = projected_keyname;
+    const char *single_typename = projected_typename;
+    bench_options opts;
+    bench_result results[5];
+    records recs;
+    size_t nrecords;
+
+    if (!bench_parse_args(argc, argv, &opts)) {
         exit(EXIT_FAILURE);
     }
-    fprintf(stderr, "%s\n", "made it here");
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Serialize: %d ms\n", msec);
-    fflush(stdout);
-
-    start = clock();
-    if (!test_deserialize(outfile)) {
+    document_standalone_init(NULL, NULL);
+    recs.lines = bench_read_lines(&opts, &nrecords);
+    if (!recs.lines) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Deserialize: %d ms\n", msec);
-    fflush(stdout);
+    recs.line_lens = malloc(nrecords * sizeof(size_t));
+    recs.binaries = calloc(nrecords, sizeof(char*));
+    recs.binary_lens = calloc(nrecords, sizeof(size_t));
+    for (size_t i = 0; i < nrecords; ++i) {
+        recs.line_lens[i] = strlen(recs.lines[i]);
+    }
 
-    start = clock();
-    if (!test_projection(extract_outfile)) {
+    if (!bench_run(&opts, "serialize", nrecords, bench_serialize, &recs, &results[0])) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Extract: %d ms\n", msec);
-    fflush(stdout);
 
-    start = clock();
-    if (!test_multiple_projection(multiple_extract_outfile)) {
+    // The later phases read what the last serialize pass left behind, in
+    // place from the mapping
+    if (!write_db(&recs, nrecords) ||
+        !store_open(&recs.db, dbname, opts.seed ? MADV_RANDOM : MADV_SEQUENTIAL)) {
+        exit(EXIT_FAILURE);
+    }
+    recs.single = doc_projection_compile(1, &single_keyname, &single_typename);
+    recs.proj = doc_projection_compile(num_projected_keys, multiple_projected_keyname,
+                                       multiple_projected_typename);
+    recs.columns = doc_columns_create(recs.proj, opts.batch);
+    recs.batch = malloc(opts.batch * sizeof(char*));
+    if (!bench_run_prefetch(&opts, "deserialize", nrecords, bench_deserialize,
+                            bench_prefetch, &recs, &results[1]) ||
+        !bench_run_prefetch(&opts, "project", nrecords, bench_projection,
+                            bench_prefetch, &recs, &results[2]) ||
+        !bench_run_prefetch(&opts, "multiple_project", nrecords, bench_multiple_projection,
+                            bench_prefetch, &recs, &results[3]) ||
+        !bench_run_batch(&opts, "batch_project", nrecords, bench_batch_projection, &recs,
+                         &results[4])) {
+        exit(EXIT_FAILURE);
+    }
+    if (!bench_report(&opts, "sinew", nrecords, results, 5)) {
         exit(EXIT_FAILURE);
     }
-    diff = clock() - start;
-    msec = diff * 1000 / CLOCKS_PER_SEC;
-    printf("Multiple Extract: %d ms\n", msec);
-    fflush(stdout);
-
-    fclose(infile);
-    fclose(outfile);
-    fclose(extract_outfile);
-}
-
-/* Read all the records and print them */
-int test_deserialize(FILE *outfile) {
-    FILE *dbfile, *schemafile;
-    size_t binsize;
-    char *binary, *json;
-
-    dbfile = fopen(dbname, "r");
-    schemafile = fopen(schemafname, "r");
 
-    read_schema(schemafile);
-    fprintf(stderr, "read schema\n");
+    free(recs.batch);
+    doc_columns_free(recs.proj, recs.columns);
+    doc_projection_free(recs.proj);
+    doc_projection_free(recs.single);
+    store_close(&recs.db);
+    free(recs.line_lens);
+    bench_free_lines(recs.lines, nrecords);
 
-    fread(&binsize, sizeof(binsize), 1, dbfile);
-    while (!feof(dbfile)) {
-        binary = malloc(binsize);
-        fread(binary, binsize, 1, dbfile);
+    return 0;
+}
 
-        // fprintf(stderr, "read object\n");
-        json = binary_document_to_string(binary);
-        // fprintf(stderr, "converted to json\n");
-        fprintf(outfile, "%s\n", json);
-        fflush(outfile);
+long bench_serialize(void *arg, size_t i) {
+    records *recs = arg;
 
-        free(json);
-        free(binary);
-        fread(&binsize, sizeof(binsize), 1, dbfile);
+    if (recs->binaries[i]) {
+        pfree(recs->binaries[i]);
     }
+    recs->binary_lens[i] = document_to_binary(recs->lines[i], &recs->binaries[i]);
 
-    fclose(schemafile);
-
-    return 1;
+    return recs->line_lens[i];
 }
 
-int test_multiple_projection(FILE *outfile) {
-    FILE *dbfile, *schemafile;
-    size_t binsize;
-    char *binary, *value;
-
-    dbfile = fopen(dbname, "r");
-    schemafile = fopen(schemafname, "r");
-
-    read_schema(schemafile);
-    fprintf(stderr, "read schema\n");
-
-    fread(&binsize, sizeof(binsize), 1, dbfile);
-    while (!feof(dbfile)) {
-        char buffer[1000];
-        sprintf(buffer, "");
-
-        binary = malloc(binsize);
-        fread(binary, binsize, 1, dbfile);
-        for (int i = 0; i < num_projected_keys; ++i) {
-            value = extract_key(binary, multiple_projected_keyname[i], multiple_projected_typename[i]);
-            if (value) {
-                sprintf(buffer, "%s%s,", buffer, value);
-                free(value);
-            } else {
-                sprintf(buffer, "%s%s, ", buffer, "");
-            }
-        }
-        fprintf(outfile, "%s\n", buffer);
-        free(binary);
+/* Writes the records to dbname, with an index for visiting them in any
+ * order, and frees them */
+int write_db(records *recs, size_t nrecords) {
+    store_writer writer;
 
-        fread(&binsize, sizeof(binsize), 1, dbfile);
+    if (!store_writer_open(&writer, dbname)) {
+        return 0;
     }
+    for (size_t i = 0; i < nrecords; ++i) {
+        if (!store_append(&writer, recs->binaries[i], recs->binary_lens[i])) {
+            return 0;
+        }
+        pfree(recs->binaries[i]);
+    }
+    free(recs->binaries);
+    free(recs->binary_lens);
+    recs->binaries = NULL;
+    recs->binary_lens = NULL;
 
-    fclose(schemafile);
-
-    return 1;
+    return store_writer_close(&writer, 1);
 }
 
-int test_projection(FILE *outfile) {
-    FILE *dbfile, *schemafile;
-    size_t binsize;
-    char *binary, *value;
+void bench_prefetch(void *arg, size_t i) {
+    records *recs = arg;
 
-    dbfile = fopen(dbname, "r");
-    schemafile = fopen(schemafname, "r");
+    store_prefetch(&recs->db, i);
+}
 
-    read_schema(schemafile);
-    fprintf(stderr, "read schema\n");
+long bench_deserialize(void *arg, size_t i) {
+    records *recs = arg;
+    const char *binary;
+    uint32_t len;
+    char *json;
 
-    fread(&binsize, sizeof(binsize), 1, dbfile);
-    while (!feof(dbfile)) {
-        binary = malloc(binsize);
-        fread(binary, binsize, 1, dbfile);
+    binary = store_record(&recs->db, i, &len);
+    json = binary_document_to_string((char *) binary);
+    if (!json) {
+        return -1;
+    }
+    pfree(json);
 
-        value = extract_key(binary, projected_keyname, projected_typename);
-        if (value) {
-            fprintf(outfile, "%s\n", value);
-            free(value);
-        }
+    return len;
+}
 
-        free(binary);
+long bench_projection(void *arg, size_t i) {
+    records *recs = arg;
+    const char *binary;
+    uint32_t len;
+    int value_len;
 
-        fread(&binsize, sizeof(binsize), 1, dbfile);
+    binary = store_record(&recs->db, i, &len);
+    if (extract_key(binary, recs->single, 0, &value_len)) {
+        projected_bytes += value_len;
     }
 
-    fclose(schemafile);
-
-    return 1;
+    return len;
 }
 
-// NOTE: File must be \n terminated
-int test_serialize(FILE* infile) {
-    char *buffer, *binary;
-    size_t len, read;
-    size_t binsize; // NOTE: Must read in size_t bytes
-    FILE *dbfile, *schemafile;
-
-    dbfile = fopen(dbname, "w");
-    schemafile = fopen(schemafname, "w");
-
-    buffer = NULL;
-    len = 0;
-    while ((read = getline(&buffer, &len, infile)) != -1) {
-        binsize = document_to_binary(buffer, &binary);
-        fwrite(&binsize, sizeof(binsize), 1, dbfile);
-        fwrite(binary, binsize, 1, dbfile);
-
-        // Cleanup
-        free(buffer);
-        free(binary);
-        buffer = NULL;
-        len = 0;
+long bench_multiple_projection(void *arg, size_t i) {
+    records *recs = arg;
+    const char *binary;
+    uint32_t len;
+    int value_len;
+
+    binary = store_record(&recs->db, i, &len);
+    for (int k = 0; k < num_projected_keys; ++k) {
+        if (extract_key(binary, recs->proj, k, &value_len)) {
+            projected_bytes += value_len;
+        }
     }
 
-    dump_schema(schemafile);
+    return len;
+}
 
-    fclose(dbfile);
+/* The same keys as bench_multiple_projection, a batch of records at a time */
+long bench_batch_projection(void *arg, const size_t *batch, size_t n) {
+    records *recs = arg;
+    uint32_t len;
+    long bytes = 0;
 
-    return 1;
+    for (size_t i = 0; i < n; ++i) {
+        recs->batch[i] = store_record(&recs->db, batch[i], &len);
+        bytes += len;
+    }
+    doc_project_batch(recs->proj, recs->batch, n, recs->columns);
+    for (int k = 0; k < num_projected_keys; ++k) {
+        for (size_t i = 0; i < n; ++i) {
+            projected_bytes += recs->columns[k].lengths[i];
+        }
+    }
+
+    return bytes;
 }
 
-char *extract_key(char *binary, const char* key, const char *type) {
-    char *value;
-    char *attr_listing;
-    size_t attr_id;
-    int natts, buffpos, pos, len;
-    int offstart, offend;
-
-    attr_id = get_attribute_id(key, type);
-    // fprintf(stderr, "Got attr id: %ld for: %s %s\n", attr_id, projected_keyname,
-    //     projected_typename);
-
-    memcpy(&natts, binary, sizeof(int));
-    buffpos = sizeof(int);
-    attr_listing = NULL;
-    attr_listing = bsearch(&attr_id,
-                           binary + buffpos,
-                           natts,
-                           sizeof(int),
-                           int_comparator);
-    if (attr_listing) {
-        pos = (attr_listing - buffpos - binary) / sizeof(int);
-        // fprintf(stderr, "attr_listing: %p\n", attr_listing);
-        // fprintf(stderr, "binary: %p\n", binary);
-        // fprintf(stderr, "Position: %d\n", pos);
-        buffpos += natts * sizeof(int);
-        memcpy(&offstart, binary + buffpos + pos * sizeof(int), sizeof(int));
-        memcpy(&offend, binary + buffpos + (pos + 1) * sizeof(int), sizeof(int));
-        len = offend - offstart;
-        // fprintf(stderr, "Len: %d\n", len);
-
-        value = malloc(len + 1);
-        memcpy(value, binary + offstart, len);
-        value[len] = '\0';
-        return value;
-    } else {
+/* The value of proj's kth key in binary, in place, or NULL. The ids are
+ * resolved before the timed loops, so this is only the format's cost */
+const char *extract_key(const char *binary, const doc_projection *proj, int k, int *len) {
+    int pos;
+
+    // As document_get does, less the dictionary lookup
+    if (proj->attr_ids[k] < 0 ||
+        (doc_has_bloom(binary) &&
+         !doc_bloom_has_bits(binary + sizeof(int), proj->bloom_bit1[k], proj->bloom_bit2[k]))) {
+        return NULL;
+    }
+    pos = doc_find_attr(binary, proj->attr_ids[k]);
+    if (pos < 0) {
         return NULL;
     }
+    *len = doc_offset(binary, pos + 1) - doc_offset(binary, pos);
+
+    return binary + doc_offset(binary, pos);
 }
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store.h"
+
+static const char magic[8] = { 'D', 'O', 'C', 'S', 'T', 'O', 'R', 'E' };
+
+#define HEADER_SIZE (sizeof(magic) + 2 * sizeof(uint64_t))
+
+/*******************************************************************************
+ * Writing
+ ******************************************************************************/
+
+int
+store_writer_open(store_writer *writer, const char *path)
+{
+    char header[HEADER_SIZE];
+
+    writer->file = fopen(path, "w");
+    if (!writer->file)
+    {
+        fprintf(stderr, "Unable to create %s\n", path);
+        return 0;
+    }
+    writer->nrecords = 0;
+    writer->offset = HEADER_SIZE;
+    writer->capacity = 1024;
+    writer->offsets = malloc(writer->capacity * sizeof(uint64_t));
+
+    /* Filled in on close */
+    memset(header, 0, sizeof(header));
+    fwrite(header, sizeof(header), 1, writer->file);
+
+    return 1;
+}
+
+int
+store_append(store_writer *writer, const char *data, uint32_t len)
+{
+    if (writer->nrecords == writer->capacity)
+    {
+        writer->capacity *= 2;
+        writer->offsets = realloc(writer->offsets,
+                                  writer->capacity * sizeof(uint64_t));
+    }
+    writer->offsets[writer->nrecords++] = writer->offset;
+
+    if (fwrite(&len, sizeof(len), 1, writer->file) != 1 ||
+        fwrite(data, 1, len, writer->file) != len)
+    {
+        fprintf(stderr, "Unable to write record %llu\n",
+                (unsigned long long) writer->nrecords - 1);
+        return 0;
+    }
+    writer->offset += sizeof(len) + len;
+
+    return 1;
+}
+
+int
+store_writer_close(store_writer *writer, int with_index)
+{
+    uint64_t index_offset;
+    int ok;
+
+    index_offset = 0;
+    if (with_index)
+    {
+        static const char padding[sizeof(uint64_t)] = { 0 };
+        size_t pad;
+
+        pad = (sizeof(uint64_t) - writer->offset % sizeof(uint64_t)) %
+            sizeof(uint64_t);
+        fwrite(padding, 1, pad, writer->file);
+        index_offset = writer->offset + pad;
+        fwrite(writer->offsets, sizeof(uint64_t), writer->nrecords, writer->file);
+    }
+
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(magic, sizeof(magic), 1, writer->file);
+    fwrite(&writer->nrecords, sizeof(uint64_t), 1, writer->file);
+    fwrite(&index_offset, sizeof(uint64_t), 1, writer->file);
+
+    ok = !ferror(writer->file);
+    ok = fclose(writer->file) == 0 && ok;
+    free(writer->offsets);
+    if (!ok)
+    {
+        fprintf(stderr, "Unable to write record store\n");
+    }
+
+    return ok;
+}
+
+/*******************************************************************************
+ * Reading
+ ******************************************************************************/
+
+int
+store_open(store *s, const char *path, int advice)
+{
+    struct stat st;
+    uint64_t index_offset;
+    void *base;
+
+    memset(s, 0, sizeof(store));
+    s->fd = open(path, O_RDONLY);
+    if (s->fd < 0 || fstat(s->fd, &st) != 0)
+    {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return 0;
+    }
+    s->size = st.st_size;
+    if (s->size < HEADER_SIZE)
+    {
+        fprintf(stderr, "%s is not a record store\n", path);
+        close(s->fd);
+        return 0;
+    }
+
+    base = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, s->fd, 0);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map %s\n", path);
+        close(s->fd);
+        return 0;
+    }
+    s->base = base;
+    madvise(base, s->size, advice);
+
+    memcpy(&s->nrecords, s->base + sizeof(magic), sizeof(uint64_t));
+    memcpy(&index_offset, s->base + sizeof(magic) + sizeof(uint64_t),
+           sizeof(uint64_t));
+    if (memcmp(s->base, magic, sizeof(magic)) != 0 ||
+        (index_offset != 0 &&
+         index_offset + s->nrecords * sizeof(uint64_t) > s->size))
+    {
+        fprintf(stderr, "%s is not a record store\n", path);
+        store_close(s);
+        return 0;
+    }
+
+    if (index_offset != 0)
+    {
+        uint32_t len;
+
+        s->index = (const uint64_t *) (s->base + index_offset);
+        s->end = HEADER_SIZE;
+        if (s->nrecords > 0)
+        {
+            store_record(s, s->nrecords - 1, &len);
+            s->end = s->index[s->nrecords - 1] + sizeof(uint32_t) + len;
+        }
+    }
+    else
+    {
+        uint64_t offset = 0;
+        const char *data;
+        uint32_t len;
+        uint64_t i;
+
+        s->end = s->size;
+        s->built_index = malloc((s->nrecords ? s->nrecords : 1) * sizeof(uint64_t));
+        for (i = 0; i < s->nrecords; ++i)
+        {
+            if (!store_next(s, &offset, &data, &len))
+            {
+                fprintf(stderr, "%s is truncated\n", path);
+                store_close(s);
+                return 0;
+            }
+            s->built_index[i] = data - sizeof(uint32_t) - s->base;
+        }
+        s->index = s->built_index;
+    }
+
+    return 1;
+}
+
+void
+store_close(store *s)
+{
+    if (s->base)
+    {
+        munmap((void *) s->base, s->size);
+    }
+    if (s->fd >= 0)
+    {
+        close(s->fd);
+    }
+    free(s->built_index);
+    memset(s, 0, sizeof(store));
+    s->fd = -1;
+}
+
+int
+store_next(const store *s, uint64_t *offset, const char **data, uint32_t *len)
+{
+    if (*offset == 0)
+    {
+        *offset = HEADER_SIZE;
+    }
+    if (*offset + sizeof(uint32_t) > s->end)
+    {
+        return 0;
+    }
+    memcpy(len, s->base + *offset, sizeof(uint32_t));
+    if (*offset + sizeof(uint32_t) + *len > s->end)
+    {
+        return 0;
+    }
+    *data = s->base + *offset + sizeof(uint32_t);
+    *offset += sizeof(uint32_t) + *len;
+
+    return 1;
+}
@@ -0,0 +1,88 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A file of length-prefixed binary records, read through mmap so that
+ * records are used in place, with no read() or copy per record:
+ *
+ *   char     magic[8]          "DOCSTORE"
+ *   uint64_t nrecords
+ *   uint64_t index_offset      0 if there is no index
+ *   { uint32_t len; char data[len]; } records[nrecords]
+ *   uint64_t offsets[nrecords] optional index, 8-byte aligned; the offset of
+ *                              each record's len from the start of the file
+ *
+ * Records are not aligned; readers of the data are expected to memcpy, as
+ * the document format's are (see binary.h).
+ */
+
+typedef struct
+{
+    FILE       *file;
+    uint64_t    nrecords;
+    uint64_t    offset;        /* where the next record goes */
+    uint64_t   *offsets;
+    size_t      capacity;
+} store_writer;
+
+typedef struct
+{
+    int             fd;
+    const char     *base;
+    size_t          size;
+    uint64_t        end;       /* of the records */
+    uint64_t        nrecords;
+    const uint64_t *index;     /* into the mapping, or built on open */
+    uint64_t       *built_index;
+} store;
+
+int store_writer_open(store_writer *writer, const char *path);
+int store_append(store_writer *writer, const char *data, uint32_t len);
+int store_writer_close(store_writer *writer, int with_index);
+
+/*
+ * Maps the file, with advice for the kernel's read-ahead (one of the
+ * MADV_* constants, e.g. MADV_SEQUENTIAL or MADV_RANDOM). Files without an
+ * index are scanned once to build one in memory.
+ */
+int store_open(store *s, const char *path, int advice);
+void store_close(store *s);
+
+/* Walks the records in file order: start with *offset at 0. Returns 0 at
+ * the end */
+int store_next(const store *s, uint64_t *offset, const char **data,
+               uint32_t *len);
+
+/* Record i, in place */
+static inline const char *
+store_record(const store *s, size_t i, uint32_t *len)
+{
+    const char *record;
+
+    record = s->base + s->index[i];
+    memcpy(len, record, sizeof(uint32_t));
+    return record + sizeof(uint32_t);
+}
+
+/* Starts loading the cache line holding record i's length and the head of
+ * its data, e.g. a document's natts and attr_ids */
+static inline void
+store_prefetch(const store *s, size_t i)
+{
+    __builtin_prefetch(s->base + s->index[i], 0, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
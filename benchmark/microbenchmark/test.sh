@@ -1,19 +1,18 @@
 #!/bin/bash
 
+# Runs every format over the same input with the same seed and keeps one
+# JSON report per format, so runs can be compared across formats and commits.
+
 HOME=`pwd`
 OUT='/tmp/dtahara/out'
+INPUT=${1:-/tmp/dtahara/nb.out}
 
 mkdir -p $OUT
 
 for ser in sinew protobuf avro; do
   cd $ser
-  mkdir -p /tmp/dtahara/$ser
   make clean
   make
-  for i in 1 2 3 4; do
-    make test >> $OUT/$ser.out
-    rm -f /tmp/dtahara/$ser/*
-  done
+  ./${ser}_test -w 1 -r 4 -s 42 -o $OUT/$ser.json $INPUT
   cd $HOME
 done
-
@@ -8,511 +8,2395 @@
 #include <postmaster/bgworker.h>
 #include <storage/ipc.h>
 #include <storage/latch.h>
+#include <storage/lmgr.h>
 #include <storage/lwlock.h>
 #include <storage/proc.h>
+#include <storage/itemptr.h>
 #include <storage/shmem.h>
 
+#include <access/htup_details.h>
+#include <access/xact.h>
+#include <catalog/pg_type.h>
 #include <executor/spi.h>
+#if PG_VERSION_NUM >= 130000
+#include <executor/instrument.h>
+#endif
 #include <fmgr.h>
+#include <funcapi.h>
 #include <lib/stringinfo.h>
-#include <utils/snapmgr.h>
-// FIXME: Do i use these?
-#include <access/xact.h>
 #include <pgstat.h>
+#include <utils/array.h>
 #include <utils/builtins.h>
-#include <tcop/utility.h>
+#include <utils/guc.h>
+#include <utils/inval.h>
+#include <utils/memutils.h>
+#include <utils/snapmgr.h>
+#include <utils/timestamp.h>
+
+#include "bw_colupgrader.h"
+#include "../document/upgrade.h"
 
 PG_MODULE_MAGIC;
 
 void _PG_init(void);
-static bool upgrade_columns(char *tname);
-static bool downgrade_columns(char *tname);
+PGDLLEXPORT void bw_colupgrader_main(Datum main_arg);
+PGDLLEXPORT void bw_colupgrader_helper_main(Datum main_arg);
+PGDLLEXPORT void bw_colupgrader_request_table(const char *tname);
+Datum bw_colupgrader_worker_stats(PG_FUNCTION_ARGS);
+Datum bw_colupgrader_table_stats(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(bw_colupgrader_worker_stats);
+PG_FUNCTION_INFO_V1(bw_colupgrader_table_stats);
+
+/*
+ * A key of a table whose physical column is out of date: either it should be
+ * materialized (upgraded) or folded back into the document (downgraded).
+ * Columns are rewritten in ranges of batch_size heap blocks, each in its own
+ * transaction, and next_block (document_schema.<table>.upgrade_block) records
+ * where the next batch starts, so a restarted worker picks up where the last
+ * one stopped.
+ *
+ * document_schema.<table>.upgrade_state tells readers where the key is (see
+ * upgrade.h in document_type). analyze_schema sets an upgraded key pending,
+ * and we set it copying once its column exists; from then on the document_type
+ * trigger route_keys puts the key of new rows in the column. After the first
+ * pass it is stripping: a second pass, once every writer that may not have
+ * seen the change yet is gone, strips the documents written meanwhile. Then it
+ * is done, and readers use the column alone. A downgraded key is copying until
+ * its column is dropped.
+ */
+typedef struct pending_attr {
+    int64 attr_id;
+    char *key_name; /* Or a path into nested documents, e.g. user.lang */
+    char *key_type;
+    char *column; /* doc_column_name(key_name) */
+    bool upgraded;
+    char *state; /* upgrade_state */
+    int64 next_block; /* -1 if the rewrite hasn't started */
+} pending_attr;
+
+/*
+ * Work distribution. Each of the total_workers static workers coordinates one
+ * table at a time, and a session advisory lock on the table keeps the others
+ * off it. The coordinator splits the blocks left to rewrite into units in its
+ * job slot in shared memory, and starts up to parallel_workers dynamic workers
+ * that claim units alongside it. After each batch, the cursor saved in
+ * document_schema.<table> is the lowest block no unit has committed past, so a
+ * crash resumes from there.
+ */
+#define MAX_JOB_ATTRS (64)
+#define MAX_JOB_UNITS (64)
+#define MAX_PENDING_TABLES (64)
+#define UPGRADER_LOCK_CLASS (0x636f6c75) /* Advisory lock key space, "colu" */
+
+typedef enum unit_state {
+    UNIT_QUEUED,
+    UNIT_RUNNING,
+    UNIT_DONE
+} unit_state;
+
+typedef struct upgrade_unit {
+    int64 start;
+    int64 end;
+    int64 next_block; /* First block not yet committed */
+    unit_state state;
+} upgrade_unit;
+
+typedef struct upgrade_job {
+    Latch *latch; /* The coordinator's */
+    char current[NAMEDATALEN]; /* Table the coordinator is on, or "" */
+    uint32 generation; /* Bumped for every round, so stale helpers back off */
+    bool active;
+    bool aborted; /* A key flipped; stop claiming units */
+    char tname[NAMEDATALEN];
+    int nattrs;
+    int64 attr_ids[MAX_JOB_ATTRS];
+    bool upgraded[MAX_JOB_ATTRS];
+    int nunits;
+    upgrade_unit units[MAX_JOB_UNITS];
+} upgrade_job;
+
+/*
+ * Instrumentation, read through document_schema.upgrade_progress and
+ * document_schema.upgrade_table_progress (see initialize_bw_colupgrader).
+ * Every job has WORKERS_PER_JOB progress slots: the first is its
+ * coordinator's, the rest are claimed by helpers as they start. Counters of a
+ * slot cover the table its worker is on; those of the table survive it.
+ * Batch latencies go into a histogram whose bucket i counts batches of less
+ * than 2^i ms (the last one, of any length).
+ */
+#define WORKERS_PER_JOB (MAX_JOB_UNITS) /* A helper per unit, at most */
+#define MAX_TABLE_STATS (64)
+#define LATENCY_BUCKETS (16)
+#define ERROR_LEN (256)
+
+typedef struct worker_progress {
+    int pid; /* 0 if the slot is free */
+    char tname[NAMEDATALEN]; /* "" between tables */
+    char attribute[NAMEDATALEN]; /* First key of the job, and how many more */
+    char state[NAMEDATALEN];
+    TimestampTz state_since;
+    int64 rows; /* Updated by the rewrite */
+    int64 bytes; /* Of WAL written by it */
+    int64 batches;
+    int64 latency[LATENCY_BUCKETS];
+    char last_error[ERROR_LEN]; /* Kept across restarts of the coordinator */
+    TimestampTz last_error_time;
+} worker_progress;
+
+typedef struct table_progress {
+    char tname[NAMEDATALEN]; /* "" if the entry is free */
+    int64 passes; /* process_table calls that got the table's lock */
+    int64 batches;
+    int64 rows;
+    int64 bytes;
+    int64 batch_time; /* In microseconds */
+    int64 errors;
+    TimestampTz last_activity;
+} table_progress;
+
+/*
+ * Tables are queued by analyze_schema, through bw_colupgrader_request_table,
+ * when a transaction that flipped one of their keys commits; coordinators
+ * sleep on their latches until then. A full scan of document_schema only
+ * happens at startup, when the queue overflows, and every naptime seconds if
+ * that is set.
+ */
+typedef struct upgrader_shared {
+    LWLock *lock; /* Protects everything below */
+    bool rescan; /* The queue overflowed; scan every table */
+    int npending;
+    char pending[MAX_PENDING_TABLES][NAMEDATALEN];
+    table_progress tables[MAX_TABLE_STATS];
+    worker_progress *workers; /* WORKERS_PER_JOB per job, after the jobs */
+    int njobs;
+    upgrade_job jobs[FLEXIBLE_ARRAY_MEMBER]; /* One per static worker */
+} upgrader_shared;
+
+static upgrader_shared *shared = NULL;
+static worker_progress *my_progress = NULL; /* NULL if there was no slot */
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static void begin_transaction(const char *activity);
+static void end_transaction(void);
+static void throttle(void);
+static void progress_set_state(const char *state);
+static char **get_table_names(int *num_tables);
+static pending_attr *get_pending_attrs(char *tname, int *nattrs);
+static bool process_table(int slot, char *tname, pending_attr *attrs, int nattrs);
+static void upgrader_shmem_request(void);
+static void upgrader_shmem_startup(void);
 
 /* flags set by signal handlers */
 static volatile sig_atomic_t got_sighup = false;
 static volatile sig_atomic_t got_sigterm = false;
 
 /* GUC variables */
-static int	bw_colupgrader_naptime = 10;
+static int	bw_colupgrader_naptime = 0;
 static int	bw_colupgrader_total_workers = 1;
+static int	bw_colupgrader_batch_size = 1024;
+static int	bw_colupgrader_cost_delay = 10;
+static int	bw_colupgrader_parallel_workers = 2;
+
+/* Holds table names and pending attributes across the batch transactions */
+static MemoryContext upgrader_context = NULL;
 
 #define SCHEMA_NAME "document_schema"
 #define BGW_MAXLEN (64)
+#define BGW_RESTART_SECONDS (10)
+
+/*
+ * Signal handler for SIGTERM
+ * Set a flag to let the main loop to terminate, and set our latch to wake
+ * it up.
+ */
+static void
+bw_colupgrader_sigterm(SIGNAL_ARGS)
+{
+    int save_errno = errno;
+
+    got_sigterm = true;
+    SetLatch(MyLatch);
+
+    errno = save_errno;
+}
+
+/*
+ * Signal handler for SIGHUP
+ * Set a flag to let the main loop to reread the config file, and set
+ * our latch to wake it up.
+ */
+static void
+bw_colupgrader_sighup(SIGNAL_ARGS)
+{
+    int save_errno = errno;
+
+    got_sighup = true;
+    SetLatch(MyLatch);
+
+    errno = save_errno;
+}
+
+static void
+begin_transaction(const char *activity)
+{
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    SPI_connect();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, activity);
+}
+
+static void
+end_transaction(void)
+{
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+    pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * Sleep for cost_delay milliseconds between batches, so that the rewrite
+ * leaves I/O and WAL bandwidth to the foreground workload (like
+ * vacuum_cost_delay).
+ */
+static void
+throttle(void)
+{
+    if (got_sighup)
+    {
+        got_sighup = false;
+        ProcessConfigFile(PGC_SIGHUP);
+    }
+
+    if (bw_colupgrader_cost_delay > 0 && !got_sigterm)
+    {
+        progress_set_state("throttled");
+        (void)WaitLatch(MyLatch,
+                        WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                        bw_colupgrader_cost_delay,
+                        PG_WAIT_EXTENSION);
+        ResetLatch(MyLatch);
+    }
+}
+
+/*
+ * Progress reporting, into our slot of shared->workers and the entry of our
+ * table in shared->tables. NOTE: None of these throw, so they may be called
+ * from error handlers.
+ */
+static void
+progress_detach(int code, Datum arg)
+{
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    my_progress->pid = 0;
+    my_progress->tname[0] = '\0';
+    strlcpy(my_progress->state, "stopped", NAMEDATALEN);
+    my_progress->state_since = GetCurrentTimestamp();
+    LWLockRelease(shared->lock);
+    my_progress = NULL;
+}
+
+/*
+ * Claim a progress slot of job slot: the first for its coordinator, any free
+ * one for a helper. A helper finding none goes unreported.
+ */
+static void
+progress_attach(int slot, bool helper)
+{
+    worker_progress *workers = &shared->workers[slot * WORKERS_PER_JOB];
+    int i;
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    if (!helper)
+    {
+        my_progress = &workers[0];
+    }
+    else
+    {
+        for (i = 1; i < WORKERS_PER_JOB; i++)
+        {
+            if (workers[i].pid == 0)
+            {
+                my_progress = &workers[i];
+                break;
+            }
+        }
+    }
+    if (my_progress)
+    {
+        char last_error[ERROR_LEN];
+        TimestampTz last_error_time;
+
+        /* What killed the previous coordinator is worth keeping */
+        memcpy(last_error, my_progress->last_error, ERROR_LEN);
+        last_error_time = my_progress->last_error_time;
+        memset(my_progress, 0, sizeof(worker_progress));
+        if (!helper)
+        {
+            memcpy(my_progress->last_error, last_error, ERROR_LEN);
+            my_progress->last_error_time = last_error_time;
+        }
+        my_progress->pid = MyProcPid;
+        strlcpy(my_progress->state, "starting", NAMEDATALEN);
+        my_progress->state_since = GetCurrentTimestamp();
+    }
+    LWLockRelease(shared->lock);
+
+    if (my_progress)
+    {
+        on_shmem_exit(progress_detach, (Datum)0);
+    }
+}
+
+static void
+progress_set_state(const char *state)
+{
+    if (!my_progress)
+    {
+        return;
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    strlcpy(my_progress->state, state, NAMEDATALEN);
+    my_progress->state_since = GetCurrentTimestamp();
+    LWLockRelease(shared->lock);
+}
+
+/*
+ * The entry of tname in shared->tables, replacing the least recently active
+ * one if it has none. NOTE: Caller must hold shared->lock exclusively
+ */
+static table_progress *
+table_stats(const char *tname)
+{
+    table_progress *entry;
+    int i;
+
+    entry = &shared->tables[0];
+    for (i = 0; i < MAX_TABLE_STATS; i++)
+    {
+        if (!strcmp(shared->tables[i].tname, tname))
+        {
+            return &shared->tables[i];
+        }
+        /* Free entries never had any activity, so go first */
+        if (shared->tables[i].last_activity < entry->last_activity)
+        {
+            entry = &shared->tables[i];
+        }
+    }
+
+    memset(entry, 0, sizeof(table_progress));
+    strlcpy(entry->tname, tname, NAMEDATALEN);
+    return entry;
+}
+
+/* Start reporting on the attributes of tname. A coordinator counts a pass */
+static void
+progress_start_table(const char *tname, pending_attr *attrs, int nattrs,
+                     bool pass)
+{
+    if (!my_progress)
+    {
+        return;
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    strlcpy(my_progress->tname, tname, NAMEDATALEN);
+    if (nattrs > 1)
+    {
+        snprintf(my_progress->attribute, NAMEDATALEN, "%s (+%d)",
+                 attrs[0].key_name, nattrs - 1);
+    }
+    else
+    {
+        strlcpy(my_progress->attribute, nattrs > 0 ? attrs[0].key_name : "",
+                NAMEDATALEN);
+    }
+    my_progress->rows = 0;
+    my_progress->bytes = 0;
+    my_progress->batches = 0;
+    memset(my_progress->latency, 0, sizeof(my_progress->latency));
+    if (pass)
+    {
+        table_progress *table = table_stats(tname);
+
+        table->passes++;
+        table->last_activity = GetCurrentTimestamp();
+    }
+    LWLockRelease(shared->lock);
+}
+
+static void
+progress_end_table(void)
+{
+    if (!my_progress)
+    {
+        return;
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    my_progress->tname[0] = '\0';
+    my_progress->attribute[0] = '\0';
+    strlcpy(my_progress->state, "idle", NAMEDATALEN);
+    my_progress->state_since = GetCurrentTimestamp();
+    LWLockRelease(shared->lock);
+}
+
+/* WAL written by this process so far; 0 before 13, which doesn't count it */
+static int64
+wal_bytes(void)
+{
+#if PG_VERSION_NUM >= 130000
+    return pgWalUsage.wal_bytes;
+#else
+    return 0;
+#endif
+}
+
+/* Count a committed batch of tname, which took elapsed microseconds */
+static void
+progress_report_batch(const char *tname, uint64 rows, int64 bytes,
+                      int64 elapsed)
+{
+    table_progress *table;
+    int bucket;
+
+    bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && elapsed / 1000 >= ((int64)1 << bucket))
+    {
+        bucket++;
+    }
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    if (my_progress)
+    {
+        my_progress->rows += rows;
+        my_progress->bytes += bytes;
+        my_progress->batches++;
+        my_progress->latency[bucket]++;
+    }
+    table = table_stats(tname);
+    table->batches++;
+    table->rows += rows;
+    table->bytes += bytes;
+    table->batch_time += elapsed;
+    table->last_activity = GetCurrentTimestamp();
+    LWLockRelease(shared->lock);
+}
+
+/*
+ * Record the error being handled against tname, before it takes the worker
+ * down. NOTE: Must be called in a PG_CATCH block
+ */
+static void
+progress_report_error(const char *tname)
+{
+    ErrorData *edata;
+    MemoryContext oldcontext;
+    table_progress *table;
+
+    /* CopyErrorData won't copy into ErrorContext itself */
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    edata = CopyErrorData();
+    MemoryContextSwitchTo(oldcontext);
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    if (my_progress)
+    {
+        strlcpy(my_progress->last_error,
+                edata->message ? edata->message : "unknown error",
+                ERROR_LEN);
+        my_progress->last_error_time = GetCurrentTimestamp();
+    }
+    table = table_stats(tname);
+    table->errors++;
+    table->last_activity = GetCurrentTimestamp();
+    LWLockRelease(shared->lock);
+
+    FreeErrorData(edata);
+}
+
+/*
+ * Declare the functions reading the progress counters, and the views over
+ * them. upgrade_progress adds what the worker's backend is waiting on, so that
+ * a rewrite stuck behind a lock shows.
+ */
+static void
+create_progress_views(void)
+{
+    int ret;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "CREATE OR REPLACE FUNCTION %s.upgrade_worker_stats("
+                     "OUT pid integer, OUT role text, OUT job integer, "
+                     "OUT table_name text, OUT attribute text, OUT state text, "
+                     "OUT state_since timestamptz, OUT rows_processed bigint, "
+                     "OUT bytes_rewritten bigint, OUT batches bigint, "
+                     "OUT batch_latency_ms bigint[], OUT last_error text, "
+                     "OUT last_error_time timestamptz) RETURNS SETOF record "
+                     "AS '$libdir/bw_colupgrader', 'bw_colupgrader_worker_stats' "
+                     "LANGUAGE C VOLATILE",
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(FATAL, "bw_colupgrader: cannot create %s.upgrade_worker_stats", SCHEMA_NAME);
+    }
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "CREATE OR REPLACE FUNCTION %s.upgrade_table_stats("
+                     "OUT table_name text, OUT passes bigint, OUT batches bigint, "
+                     "OUT rows_processed bigint, OUT bytes_rewritten bigint, "
+                     "OUT batch_time_ms double precision, OUT errors bigint, "
+                     "OUT last_activity timestamptz) RETURNS SETOF record "
+                     "AS '$libdir/bw_colupgrader', 'bw_colupgrader_table_stats' "
+                     "LANGUAGE C VOLATILE",
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(FATAL, "bw_colupgrader: cannot create %s.upgrade_table_stats", SCHEMA_NAME);
+    }
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "CREATE OR REPLACE VIEW %s.upgrade_progress AS "
+                     "SELECT w.*, a.wait_event_type, a.wait_event "
+                     "FROM %s.upgrade_worker_stats() w "
+                     "LEFT JOIN pg_stat_activity a ON a.pid = w.pid",
+                     SCHEMA_NAME,
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(FATAL, "bw_colupgrader: cannot create %s.upgrade_progress", SCHEMA_NAME);
+    }
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "CREATE OR REPLACE VIEW %s.upgrade_table_progress AS "
+                     "SELECT * FROM %s.upgrade_table_stats()",
+                     SCHEMA_NAME,
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(FATAL, "bw_colupgrader: cannot create %s.upgrade_table_progress", SCHEMA_NAME);
+    }
+
+    pfree(buf.data);
+}
+
+/*
+ * Initialize workspace for a worker process: create the schema if it doesn't
+ * already exist, and add the progress cursor and upgrade state to schema
+ * tables created before they existed. Keys of such tables that are upgraded,
+ * or still have a column, start over as copying: a pass is cheap on rows that
+ * are already right. Also (re)creates the progress views. Coordinators take
+ * turns at this, since concurrent DDL on the same objects fails.
+ */
+static void
+initialize_bw_colupgrader(void)
+{
+    int ret;
+    int ntables;
+    char **tnames;
+    int i;
+    StringInfoData buf;
+
+    begin_transaction("bw_colupgrader: initializing document schema");
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf, "SELECT pg_advisory_xact_lock(%d, 0)", UPGRADER_LOCK_CLASS);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(FATAL, "bw_colupgrader: cannot lock the document schema");
+    }
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf, "CREATE SCHEMA IF NOT EXISTS %s", SCHEMA_NAME);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(FATAL, "bw_colupgrader: failed to create my schema");
+    }
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "CREATE TABLE IF NOT EXISTS %s._attributes(_id serial, "
+                     "key_name text NOT NULL, key_type text NOT NULL)",
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(FATAL, "bw_colupgrader: failed to create %s._attributes", SCHEMA_NAME);
+    }
+
+    create_progress_views();
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT c.relname FROM pg_class c "
+                     "JOIN pg_namespace n ON n.oid = c.relnamespace "
+                     "WHERE n.nspname = '%s' AND c.relkind = 'r' "
+                     "AND c.relname <> '_attributes' AND NOT EXISTS ("
+                     "SELECT 1 FROM pg_attribute a WHERE a.attrelid = c.oid "
+                     "AND a.attname = 'upgrade_state' AND NOT a.attisdropped)",
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(FATAL, "bw_colupgrader: cannot list tables in schema '%s'", SCHEMA_NAME);
+    }
+
+    /* Need to do this separately so as not to overwrite the global SPI_tuptable */
+    ntables = SPI_processed;
+    tnames = palloc0(Max(ntables, 1) * sizeof(char*));
+    for (i = 0; i < ntables; i++)
+    {
+        tnames[i] = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+    }
+    for (i = 0; i < ntables; i++)
+    {
+        resetStringInfo(&buf);
+        appendStringInfo(&buf,
+                         "ALTER TABLE %s.%s ADD COLUMN IF NOT EXISTS upgrade_block bigint, "
+                         "ADD COLUMN upgrade_state text",
+                         SCHEMA_NAME,
+                         quote_identifier(tnames[i]));
+        ret = SPI_execute(buf.data, false, 0);
+        if (ret != SPI_OK_UTILITY)
+        {
+            elog(FATAL, "bw_colupgrader: cannot add progress cursor to '%s'", tnames[i]);
+        }
+
+        /* Keys are materialized as doc_column_name(key_name): nested paths
+         * have their dots turned into "__" */
+        resetStringInfo(&buf);
+        appendStringInfo(&buf,
+                         "UPDATE %s.%s s SET upgrade_state = 'copying', dirty = true "
+                         "FROM %s._attributes a WHERE a._id = s.key_id AND "
+                         "(s.upgraded OR EXISTS (SELECT 1 FROM pg_attribute "
+                         "WHERE attrelid = to_regclass(%s) "
+                         "AND attname = replace(a.key_name, '.', '__') "
+                         "AND NOT attisdropped))",
+                         SCHEMA_NAME,
+                         quote_identifier(tnames[i]),
+                         SCHEMA_NAME,
+                         quote_literal_cstr(quote_identifier(tnames[i])));
+        ret = SPI_execute(buf.data, false, 0);
+        if (ret != SPI_OK_UPDATE)
+        {
+            elog(FATAL, "bw_colupgrader: cannot set upgrade states of '%s'", tnames[i]);
+        }
+    }
+
+    end_transaction();
+}
+
+/* NOTE: Result is allocated in upgrader_context */
+static char **
+get_table_names(int *num_tables)
+{
+    int ret;
+    int i;
+    char **tnames;
+    StringInfoData buf;
+
+    begin_transaction("bw_colupgrader: listing tables");
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT tablename FROM pg_tables WHERE schemaname = '%s' "
+                     "AND tablename <> '_attributes'",
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(ERROR, "bw_colupgrader: cannot get table names in schema '%s'", SCHEMA_NAME);
+    }
+
+    *num_tables = SPI_processed;
+    tnames = MemoryContextAllocZero(upgrader_context,
+                                    Max(*num_tables, 1) * sizeof(char*));
+    for (i = 0; i < *num_tables; i++)
+    {
+        tnames[i] = MemoryContextStrdup(upgrader_context,
+                                        SPI_getvalue(SPI_tuptable->vals[i],
+                                                     SPI_tuptable->tupdesc,
+                                                     1));
+    }
+
+    end_transaction();
+    return tnames;
+}
+
+/* NOTE: Result is allocated in upgrader_context */
+static pending_attr *
+get_pending_attrs(char *tname, int *nattrs)
+{
+    int ret;
+    int i;
+    pending_attr *attrs;
+    StringInfoData buf;
+
+    begin_transaction("bw_colupgrader: reading document schema");
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT s.key_id, a.key_name, a.key_type, s.upgraded, "
+                     "s.upgrade_block, s.upgrade_state FROM %s.%s s "
+                     "JOIN %s._attributes a ON a._id = s.key_id "
+                     "WHERE s.dirty = true AND s.upgrade_state IN "
+                     "('pending', 'copying', 'stripping') ORDER BY s.key_id",
+                     SCHEMA_NAME,
+                     quote_identifier(tname),
+                     SCHEMA_NAME);
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(ERROR, "bw_colupgrader: cannot get document schema for table '%s'", tname);
+    }
+
+    *nattrs = SPI_processed;
+    attrs = MemoryContextAllocZero(upgrader_context,
+                                   Max(*nattrs, 1) * sizeof(pending_attr));
+    for (i = 0; i < *nattrs; i++)
+    {
+        HeapTuple tuple = SPI_tuptable->vals[i];
+        TupleDesc tupdesc = SPI_tuptable->tupdesc;
+        bool isnull;
+        Datum value;
+
+        attrs[i].attr_id = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+        attrs[i].key_name = MemoryContextStrdup(upgrader_context,
+                                                SPI_getvalue(tuple, tupdesc, 2));
+        attrs[i].key_type = MemoryContextStrdup(upgrader_context,
+                                                SPI_getvalue(tuple, tupdesc, 3));
+        attrs[i].column = MemoryContextStrdup(upgrader_context,
+                                              doc_column_name(attrs[i].key_name));
+        attrs[i].upgraded = DatumGetBool(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+        value = SPI_getbinval(tuple, tupdesc, 5, &isnull);
+        attrs[i].next_block = isnull ? -1 : DatumGetInt64(value);
+        attrs[i].state = MemoryContextStrdup(upgrader_context,
+                                             SPI_getvalue(tuple, tupdesc, 6));
+    }
+
+    end_transaction();
+    return attrs;
+}
+
+static bool
+column_exists(char *tname, char *column)
+{
+    int ret;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT 1 FROM pg_attribute WHERE attrelid = %s::regclass "
+                     "AND attname = %s AND NOT attisdropped",
+                     quote_literal_cstr(quote_identifier(tname)),
+                     quote_literal_cstr(column));
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(ERROR, "bw_colupgrader: checking column existence failed");
+    }
+    pfree(buf.data);
+
+    return SPI_processed > 0;
+}
+
+static int64
+relation_nblocks(char *tname)
+{
+    int ret;
+    bool isnull;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT pg_relation_size(%s::regclass) / "
+                     "current_setting('block_size')::bigint",
+                     quote_literal_cstr(quote_identifier(tname)));
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT || SPI_processed != 1)
+    {
+        elog(ERROR, "bw_colupgrader: cannot get size of '%s'", tname);
+    }
+    pfree(buf.data);
+
+    return DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+                                       SPI_tuptable->tupdesc,
+                                       1,
+                                       &isnull));
+}
+
+static Oid
+relation_oid(char *tname)
+{
+    int ret;
+    bool isnull;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT %s::regclass::oid",
+                     quote_literal_cstr(quote_identifier(tname)));
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT || SPI_processed != 1)
+    {
+        elog(ERROR, "bw_colupgrader: cannot find '%s'", tname);
+    }
+    pfree(buf.data);
+
+    return DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+                                          SPI_tuptable->tupdesc,
+                                          1,
+                                          &isnull));
+}
+
+/* Whether tname has the trigger that keeps upgraded keys out of new documents */
+static bool
+routes_keys(char *tname)
+{
+    int ret;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT 1 FROM pg_trigger t JOIN pg_proc p ON p.oid = t.tgfoid "
+                     "WHERE t.tgrelid = %s::regclass AND t.tgenabled <> 'D' "
+                     "AND p.proname = 'document_route_keys'",
+                     quote_literal_cstr(quote_identifier(tname)));
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(ERROR, "bw_colupgrader: cannot list triggers of '%s'", tname);
+    }
+    pfree(buf.data);
+
+    return SPI_processed > 0;
+}
+
+/*
+ * Move attr to state (NULL for none), and have readers of tname pick it up
+ * when we commit
+ */
+static void
+set_state(char *tname, pending_attr *attr, const char *state, bool dirty)
+{
+    int ret;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "UPDATE %s.%s SET upgrade_state = %s, dirty = %s",
+                     SCHEMA_NAME,
+                     quote_identifier(tname),
+                     state ? quote_literal_cstr(state) : "NULL",
+                     dirty ? "true" : "false");
+    if (state && !strcmp(state, "stripping"))
+    {
+        appendStringInfoString(&buf, ", upgrade_block = 0");
+    }
+    appendStringInfo(&buf,
+                     " WHERE key_id = " INT64_FORMAT " AND upgraded = %s",
+                     attr->attr_id,
+                     attr->upgraded ? "true" : "false");
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UPDATE)
+    {
+        elog(ERROR, "bw_colupgrader: could not update schema properly");
+    }
+    pfree(buf.data);
+
+    attr->state = state ? MemoryContextStrdup(upgrader_context, state) : NULL;
+    CacheInvalidateRelcacheByRelid(relation_oid(tname));
+}
+
+/*
+ * Wait for every transaction that has written to tname so far. Those may have
+ * looked up the upgrade states before the last change, and so put upgraded
+ * keys in their documents
+ */
+static void
+wait_for_writers(char *tname, const char *activity)
+{
+    LOCKTAG tag;
+
+    progress_set_state("waiting for writers");
+    begin_transaction(activity);
+    SET_LOCKTAG_RELATION(tag, MyDatabaseId, relation_oid(tname));
+    WaitForLockers(tag, ShareLock, false);
+    end_transaction();
+}
+
+/*
+ * key_type without its array brackets: bigint for bigint[][]. Sets *is_array
+ * if it had any.
+ */
+static char *
+element_type(const char *key_type, bool *is_array)
+{
+    char *base_type;
+    int len;
+
+    base_type = pstrdup(key_type);
+    len = strlen(base_type);
+    while (len > 2 && !strcmp(base_type + len - 2, "[]"))
+    {
+        len -= 2;
+        base_type[len] = '\0';
+    }
+    *is_array = len < (int)strlen(key_type);
+    return base_type;
+}
+
+/*
+ * The column type of key_type. Nested arrays become extra dimensions of one
+ * array column, since postgres arrays don't have a declared depth.
+ */
+static char *
+column_type(const char *key_type)
+{
+    char *base_type;
+    bool is_array;
+
+    base_type = element_type(key_type, &is_array);
+    return is_array ? psprintf("%s[]", base_type) : base_type;
+}
+
+/*
+ * The accessor that extracts key_type straight to its column type: a typed
+ * one for scalars, a native array one for arrays. Either takes key_name as a
+ * path, so nested keys need nothing special.
+ */
+static void
+append_getter(StringInfo buf, const char *key_name, const char *key_type)
+{
+    const char *accessor;
+    char *base_type;
+    bool is_array;
+
+    base_type = element_type(key_type, &is_array);
+    if (!strcmp(base_type, "bigint"))
+    {
+        accessor = "document_get_int";
+    }
+    else if (!strcmp(base_type, "double precision"))
+    {
+        accessor = "document_get_float";
+    }
+    else if (!strcmp(base_type, "boolean"))
+    {
+        accessor = "document_get_bool";
+    }
+    else if (!strcmp(base_type, "text"))
+    {
+        accessor = "document_get_text";
+    }
+    else if (!strcmp(base_type, "document"))
+    {
+        accessor = "document_get_doc";
+    }
+    else
+    {
+        elog(ERROR, "bw_colupgrader: cannot materialize keys of type '%s'", key_type);
+    }
+
+    if (is_array)
+    {
+        appendStringInfo(buf,
+                         "%s_array(data, %s, %s)",
+                         accessor,
+                         quote_literal_cstr(key_name),
+                         quote_literal_cstr(key_type));
+    }
+    else
+    {
+        appendStringInfo(buf, "%s(data, %s)", accessor, quote_literal_cstr(key_name));
+    }
+    pfree(base_type);
+}
+
+/*
+ * A column of key_type as the JSON text document_put parses. Arrays of
+ * documents are joined by hand, since array_to_json would quote the elements;
+ * they only come back flat.
+ */
+static void
+append_json_value(StringInfo buf, const char *column, const char *key_type)
+{
+    char *base_type;
+    bool is_array;
+
+    base_type = element_type(key_type, &is_array);
+    if (is_array && !strcmp(base_type, "document"))
+    {
+        appendStringInfo(buf,
+                         "('[' || array_to_string(%s, ', ') || ']')::cstring",
+                         column);
+    }
+    else if (is_array)
+    {
+        appendStringInfo(buf, "array_to_json(%s)::text::cstring", column);
+    }
+    else
+    {
+        appendStringInfo(buf, "%s::text::cstring", column);
+    }
+    pfree(base_type);
+}
+
+/*
+ * The rewrite of a block range of tname, as UPDATEs with the range bounds as
+ * tid parameters $1 and $2. All upgraded keys go in one statement, which fills
+ * their columns and strips them from the document with one
+ * document_delete_many (which takes nested paths too), so N keys cost one
+ * rewrite of each row rather than 2N. Downgraded keys get one statement each (document_put is strict, so
+ * folding several nullable columns back in one expression would need the
+ * document once per column).
+ */
+static char **
+build_rewrite_queries(char *tname, pending_attr *attrs, int nattrs, int *nqueries)
+{
+    char **queries;
+    char *table;
+    int i;
+    bool first;
+    StringInfoData buf;
+    StringInfoData cond;
+    StringInfoData names;
+    StringInfoData types;
+    const char *range = " WHERE ctid >= $1 AND ctid < $2 AND ";
+
+    table = quote_identifier(tname);
+    queries = palloc0((nattrs + 1) * sizeof(char*));
+    *nqueries = 0;
+
+    initStringInfo(&buf);
+    initStringInfo(&cond);
+    initStringInfo(&names);
+    initStringInfo(&types);
+    appendStringInfo(&buf, "UPDATE %s SET ", table);
+    first = true;
+    for (i = 0; i < nattrs; i++)
+    {
+        char *column;
+
+        if (!attrs[i].upgraded)
+        {
+            continue;
+        }
+        column = quote_identifier(attrs[i].column);
+
+        /* Keep what the column has for rows without the key */
+        appendStringInfo(&buf, "%s = COALESCE(", column);
+        append_getter(&buf, attrs[i].key_name, attrs[i].key_type);
+        appendStringInfo(&buf, ", %s), ", column);
+
+        if (!first)
+        {
+            appendStringInfoString(&cond, " OR ");
+            appendStringInfoString(&names, ", ");
+            appendStringInfoString(&types, ", ");
+        }
+        append_getter(&cond, attrs[i].key_name, attrs[i].key_type);
+        appendStringInfoString(&cond, " IS NOT NULL");
+        appendStringInfoString(&names, quote_literal_cstr(attrs[i].key_name));
+        appendStringInfoString(&types, quote_literal_cstr(attrs[i].key_type));
+        first = false;
+    }
+    if (!first)
+    {
+        appendStringInfo(&buf,
+                         "data = document_delete_many(data, ARRAY[%s]::text[], "
+                         "ARRAY[%s]::text[])%s(%s)",
+                         names.data,
+                         types.data,
+                         range,
+                         cond.data);
+        queries[(*nqueries)++] = pstrdup(buf.data);
+    }
+
+    for (i = 0; i < nattrs; i++)
+    {
+        char *column;
+
+        if (attrs[i].upgraded)
+        {
+            continue;
+        }
+        column = quote_identifier(attrs[i].column);
+
+        resetStringInfo(&buf);
+        appendStringInfo(&buf,
+                         "UPDATE %s SET data = document_put(data, %s, %s, ",
+                         table,
+                         quote_literal_cstr(attrs[i].key_name),
+                         quote_literal_cstr(attrs[i].key_type));
+        append_json_value(&buf, column, attrs[i].key_type);
+        appendStringInfo(&buf,
+                         "), %s = NULL%s%s IS NOT NULL",
+                         column,
+                         range,
+                         column);
+        queries[(*nqueries)++] = pstrdup(buf.data);
+    }
+
+    pfree(cond.data);
+    pfree(names.data);
+    pfree(types.data);
+    return queries;
+}
+
+/*
+ * Rewrite the blocks [start, end) of tname. Only rows that still need it are
+ * updated, so rows moved past end by earlier batches (or inserted since) are
+ * skipped when the scan gets to them. Returns how many were.
+ */
+static uint64
+rewrite_batch(char *tname, char **queries, int nqueries, int64 start, int64 end)
+{
+    Oid argtypes[2] = { TIDOID, TIDOID };
+    Datum values[2];
+    ItemPointerData bounds[2];
+    uint64 rows;
+    int i;
+
+    ItemPointerSet(&bounds[0], (BlockNumber)start, 0);
+    ItemPointerSet(&bounds[1], (BlockNumber)end, 0);
+    values[0] = ItemPointerGetDatum(&bounds[0]);
+    values[1] = ItemPointerGetDatum(&bounds[1]);
+
+    rows = 0;
+    for (i = 0; i < nqueries; i++)
+    {
+        int ret;
+
+        ret = SPI_execute_with_args(queries[i], 2, argtypes, values, NULL, false, 0);
+        if (ret != SPI_OK_UPDATE)
+        {
+            elog(ERROR, "bw_colupgrader: rewrite of '%s' failed (%s)", tname, queries[i]);
+        }
+        rows += SPI_processed;
+    }
+
+    return rows;
+}
+
+/*
+ * Record the progress of attr, unless analyze_schema has flipped its
+ * direction in the meantime. Returns false in that case, after resetting the
+ * cursor so the opposite rewrite starts from the first block.
+ */
+static bool
+save_progress(char *tname, pending_attr *attr, bool done)
+{
+    int ret;
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    if (done)
+    {
+        appendStringInfo(&buf,
+                         "UPDATE %s.%s SET dirty = false, upgrade_block = NULL",
+                         SCHEMA_NAME,
+                         quote_identifier(tname));
+    }
+    else
+    {
+        appendStringInfo(&buf,
+                         "UPDATE %s.%s SET upgrade_block = " INT64_FORMAT,
+                         SCHEMA_NAME,
+                         quote_identifier(tname),
+                         attr->next_block);
+    }
+    appendStringInfo(&buf,
+                     " WHERE key_id = " INT64_FORMAT " AND upgraded = %s",
+                     attr->attr_id,
+                     attr->upgraded ? "true" : "false");
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UPDATE)
+    {
+        elog(ERROR, "bw_colupgrader: could not update schema properly");
+    }
+    if (SPI_processed > 0)
+    {
+        pfree(buf.data);
+        return true;
+    }
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "UPDATE %s.%s SET upgrade_block = NULL WHERE key_id = " INT64_FORMAT,
+                     SCHEMA_NAME,
+                     quote_identifier(tname),
+                     attr->attr_id);
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UPDATE)
+    {
+        elog(ERROR, "bw_colupgrader: could not update schema properly");
+    }
+    pfree(buf.data);
+    return false;
+}
+
+/* Add the columns of newly upgraded keys, and start their cursors */
+static void
+prepare_columns(char *tname, pending_attr *attrs, int nattrs)
+{
+    int i;
+
+    for (i = 0; i < nattrs; i++)
+    {
+        if (attrs[i].next_block >= 0)
+        {
+            continue;
+        }
+
+        if (attrs[i].upgraded && !column_exists(tname, attrs[i].column))
+        {
+            StringInfoData buf;
+
+            /* No default, so this only touches the catalog */
+            initStringInfo(&buf);
+            appendStringInfo(&buf,
+                             "ALTER TABLE %s ADD COLUMN %s %s",
+                             quote_identifier(tname),
+                             quote_identifier(attrs[i].column),
+                             column_type(attrs[i].key_type));
+            if (SPI_execute(buf.data, false, 0) != SPI_OK_UTILITY)
+            {
+                elog(ERROR,
+                     "bw_colupgrader: column creation for '%s.%s' failed",
+                     tname,
+                     attrs[i].key_name);
+            }
+            pfree(buf.data);
+        }
+        /*
+         * NOTE: a downgraded key is only pending work while it is copying,
+         * which it only is if it has a column
+         */
+        if (attrs[i].upgraded)
+        {
+            set_state(tname, &attrs[i], "copying", true);
+        }
+        attrs[i].next_block = 0;
+        (void)save_progress(tname, &attrs[i], false);
+    }
+}
+
+static void
+drop_columns(char *tname, pending_attr *attrs, int nattrs)
+{
+    int i;
+
+    for (i = 0; i < nattrs; i++)
+    {
+        StringInfoData buf;
+
+        if (attrs[i].upgraded)
+        {
+            continue;
+        }
+
+        initStringInfo(&buf);
+        appendStringInfo(&buf,
+                         "ALTER TABLE %s DROP COLUMN %s",
+                         quote_identifier(tname),
+                         quote_identifier(attrs[i].column));
+        if (SPI_execute(buf.data, false, 0) != SPI_OK_UTILITY)
+        {
+            elog(ERROR,
+                 "bw_colupgrader: column deletion for '%s.%s' failed",
+                 tname,
+                 attrs[i].key_name);
+        }
+        pfree(buf.data);
+    }
+}
+
+/*
+ * Roll back the current batch, e.g. because analyze_schema flipped a key while
+ * we were rewriting it.
+ */
+static void
+abort_transaction(void)
+{
+    SPI_finish();
+    PopActiveSnapshot();
+    AbortCurrentTransaction();
+    pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/* Reset the cursors of flipped keys, after the batch has been rolled back */
+static void
+reset_flipped(char *tname, pending_attr *attrs, int nattrs, bool *flipped,
+              const char *activity)
+{
+    int i;
+
+    begin_transaction(activity);
+    for (i = 0; i < nattrs; i++)
+    {
+        if (flipped[i])
+        {
+            (void)save_progress(tname, &attrs[i], false);
+        }
+    }
+    end_transaction();
+}
+
+/*
+ * Save next_block as the cursor of every attribute. Returns false, having
+ * rolled back the current transaction, if a key flipped.
+ */
+static bool
+save_all_progress(char *tname, pending_attr *attrs, int nattrs,
+                  int64 next_block, bool done, const char *activity)
+{
+    bool flipped[MAX_JOB_ATTRS];
+    bool any_flipped;
+    int i;
+
+    any_flipped = false;
+    for (i = 0; i < nattrs; i++)
+    {
+        attrs[i].next_block = next_block;
+        flipped[i] = !save_progress(tname, &attrs[i], done);
+        any_flipped |= flipped[i];
+    }
+
+    if (any_flipped)
+    {
+        abort_transaction();
+        reset_flipped(tname, attrs, nattrs, flipped, activity);
+        return false;
+    }
+    return true;
+}
+
+/* Take or release the advisory lock that makes us tname's coordinator */
+static bool
+lock_table(char *tname, bool lock)
+{
+    int ret;
+    bool isnull;
+    bool result;
+    StringInfoData buf;
+
+    begin_transaction("bw_colupgrader: locking table");
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT %s(%d, %s::regclass::oid::integer)",
+                     lock ? "pg_try_advisory_lock" : "pg_advisory_unlock",
+                     UPGRADER_LOCK_CLASS,
+                     quote_literal_cstr(quote_identifier(tname)));
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_SELECT || SPI_processed != 1)
+    {
+        elog(ERROR, "bw_colupgrader: cannot lock '%s'", tname);
+    }
+    result = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+                                        SPI_tuptable->tupdesc,
+                                        1,
+                                        &isnull));
+
+    end_transaction();
+    return result;
+}
+
+/*
+ * Split [start, end) into at most MAX_JOB_UNITS units of at least batch_size
+ * blocks. NOTE: Caller must hold shared->lock exclusively
+ */
+static void
+queue_units(upgrade_job *job, int64 start, int64 end)
+{
+    int64 unit_blocks;
+
+    unit_blocks = Max(bw_colupgrader_batch_size,
+                      (end - start + MAX_JOB_UNITS - 1) / MAX_JOB_UNITS);
+    job->nunits = 0;
+    while (start < end && job->nunits < MAX_JOB_UNITS)
+    {
+        upgrade_unit *unit = &job->units[job->nunits++];
+
+        unit->start = start;
+        unit->end = Min(start + unit_blocks, end);
+        unit->next_block = start;
+        unit->state = UNIT_QUEUED;
+        start = unit->end;
+    }
+}
+
+/*
+ * The lowest block of the job not yet committed, with own_next as the progress
+ * of unit own (about to be committed). Every block below it has been
+ * rewritten, so it is what gets saved as the cursor.
+ * NOTE: Caller must hold shared->lock
+ */
+static int64
+job_low_water(upgrade_job *job, int own, int64 own_next)
+{
+    int64 low;
+    int i;
+
+    low = job->units[job->nunits - 1].end;
+    for (i = 0; i < job->nunits; i++)
+    {
+        upgrade_unit *unit = &job->units[i];
+        int64 next;
+
+        if (i == own)
+        {
+            next = own_next;
+        }
+        else
+        {
+            next = unit->state == UNIT_DONE ? unit->end : unit->next_block;
+        }
+        if (next < unit->end)
+        {
+            low = Min(low, next);
+        }
+    }
+
+    return low;
+}
+
+/*
+ * Claim queued units of job and rewrite them batch by batch, until none is
+ * left. Run by the coordinator and its helpers alike. A unit whose worker
+ * stops half way stays RUNNING, so the coordinator knows the pass is
+ * incomplete.
+ */
+static void
+run_units(upgrade_job *job, uint32 generation, char *tname,
+          pending_attr *attrs, int nattrs, char **queries, int nqueries,
+          const char *activity)
+{
+    while (!got_sigterm)
+    {
+        int unit;
+        int64 next_block = 0;
+        int64 end = 0;
+        int i;
+
+        unit = -1;
+        LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+        if (job->generation == generation && !job->aborted)
+        {
+            for (i = 0; i < job->nunits; i++)
+            {
+                if (job->units[i].state == UNIT_QUEUED)
+                {
+                    job->units[i].state = UNIT_RUNNING;
+                    next_block = job->units[i].next_block;
+                    end = job->units[i].end;
+                    unit = i;
+                    break;
+                }
+            }
+        }
+        LWLockRelease(shared->lock);
+
+        if (unit < 0)
+        {
+            return;
+        }
+
+        while (next_block < end && !got_sigterm)
+        {
+            int64 batch_end;
+            int64 low;
+            bool stop;
+            TimestampTz batch_start;
+            int64 batch_wal;
+            uint64 rows;
+
+            batch_end = Min(next_block + bw_colupgrader_batch_size, end);
+
+            /* Since the start of the batch, so a long wait stands out */
+            progress_set_state("rewriting");
+            batch_start = GetCurrentTimestamp();
+            batch_wal = wal_bytes();
+            begin_transaction(activity);
+            rows = rewrite_batch(tname, queries, nqueries, next_block, batch_end);
+
+            LWLockAcquire(shared->lock, LW_SHARED);
+            low = job_low_water(job, unit, batch_end);
+            LWLockRelease(shared->lock);
+
+            if (!save_all_progress(tname, attrs, nattrs, low, false, activity))
+            {
+                LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+                if (job->generation == generation)
+                {
+                    job->aborted = true;
+                }
+                LWLockRelease(shared->lock);
+                return;
+            }
+            end_transaction();
+            progress_report_batch(tname, rows, wal_bytes() - batch_wal,
+                                  GetCurrentTimestamp() - batch_start);
+
+            /* Only published once committed, since others save it */
+            next_block = batch_end;
+            LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+            stop = job->generation != generation || job->aborted;
+            if (job->generation == generation)
+            {
+                job->units[unit].next_block = next_block;
+                if (next_block >= end)
+                {
+                    job->units[unit].state = UNIT_DONE;
+                }
+            }
+            LWLockRelease(shared->lock);
+
+            if (stop)
+            {
+                return;
+            }
+            throttle();
+        }
+    }
+}
+
+/* Start up to nhelpers dynamic workers on job slot; returns how many started */
+static int
+launch_helpers(int slot, uint32 generation, int nhelpers,
+               BackgroundWorkerHandle **handles)
+{
+    BackgroundWorker worker;
+    int n;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+        BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    /* The coordinator notices an unfinished unit; no need to restart */
+    worker.bgw_restart_time = BGW_NEVER_RESTART;
+    sprintf(worker.bgw_library_name, "bw_colupgrader");
+    sprintf(worker.bgw_function_name, "bw_colupgrader_helper_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "bw_colupgrader helper %d", slot + 1);
+    snprintf(worker.bgw_type, BGW_MAXLEN, "bw_colupgrader");
+    worker.bgw_main_arg = Int32GetDatum(slot);
+    memcpy(worker.bgw_extra, &generation, sizeof(generation));
+    worker.bgw_notify_pid = MyProcPid;
+
+    for (n = 0; n < nhelpers; n++)
+    {
+        /* Fails once max_worker_processes are in use; go on with fewer */
+        if (!RegisterDynamicBackgroundWorker(&worker, &handles[n]))
+        {
+            break;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Once the whole table has been rewritten: drop the columns of downgraded
+ * keys, and move upgraded ones on from copying to stripping, or from stripping
+ * to done. Sets *again if some key needs the stripping pass.
+ */
+static bool
+finish_table(char *tname, pending_attr *attrs, int nattrs, const char *activity,
+             bool *again)
+{
+    bool routed;
+    int i;
+
+    progress_set_state("finishing");
+    begin_transaction(activity);
+    drop_columns(tname, attrs, nattrs);
+    if (!save_all_progress(tname, attrs, nattrs, 0, true, activity))
+    {
+        return false;
+    }
+
+    *again = false;
+    routed = routes_keys(tname);
+    for (i = 0; i < nattrs; i++)
+    {
+        if (!attrs[i].upgraded)
+        {
+            set_state(tname, &attrs[i], NULL, false);
+        }
+        else if (attrs[i].state && !strcmp(attrs[i].state, "stripping"))
+        {
+            /* Without the trigger, new rows may still bring the key along */
+            if (routed)
+            {
+                set_state(tname, &attrs[i], "done", false);
+            }
+        }
+        else
+        {
+            set_state(tname, &attrs[i], "stripping", true);
+            *again = true;
+        }
+    }
+    end_transaction();
+
+    if (*again)
+    {
+        wait_for_writers(tname, activity);
+    }
+    return true;
+}
+
+/*
+ * Bring every pending attribute of tname up to date in one pass over the
+ * table, with up to parallel_workers helpers working on block ranges. Only the
+ * worker holding the table's advisory lock coordinates it. The pass starts at
+ * the saved cursor; rewriting a range twice is harmless since only rows that
+ * still need it are touched. Returns false if it was skipped or interrupted,
+ * by a shutdown or by analyze_schema changing its mind about a key; the rest
+ * is picked up on a later pass.
+ */
+static bool
+process_table(int slot, char *tname, pending_attr *attrs, int nattrs)
+{
+    StringInfoData activity;
+    char **queries;
+    int nqueries;
+    int64 next_block;
+    upgrade_job *job;
+    BackgroundWorkerHandle **handles;
+    bool result;
+    bool again;
+    int i;
+    MemoryContext oldcontext;
+
+    if (nattrs == 0 || !lock_table(tname, true))
+    {
+        return false;
+    }
+    /* The rest wait for the next pass */
+    nattrs = Min(nattrs, MAX_JOB_ATTRS);
+
+    /* Needed across the batch transactions */
+    oldcontext = MemoryContextSwitchTo(upgrader_context);
+    initStringInfo(&activity);
+    appendStringInfo(&activity, "bw_colupgrader: rewriting %s", tname);
+    MemoryContextSwitchTo(oldcontext);
+
+    progress_start_table(tname, attrs, nattrs, true);
+    progress_set_state("preparing columns");
+    begin_transaction(activity.data);
+    prepare_columns(tname, attrs, nattrs);
+    end_transaction();
+
+    oldcontext = MemoryContextSwitchTo(upgrader_context);
+    next_block = attrs[0].next_block;
+    for (i = 1; i < nattrs; i++)
+    {
+        next_block = Min(next_block, attrs[i].next_block);
+    }
+    queries = build_rewrite_queries(tname, attrs, nattrs, &nqueries);
+    handles = palloc0(Max(bw_colupgrader_parallel_workers, 1) *
+                      sizeof(BackgroundWorkerHandle*));
+    MemoryContextSwitchTo(oldcontext);
+
+    job = &shared->jobs[slot];
+    result = false;
+    while (!got_sigterm)
+    {
+        int64 nblocks;
+        uint32 generation;
+        int nhelpers;
+        bool complete;
+
+        /* Re-read every round: the table grows while we work */
+        begin_transaction(activity.data);
+        nblocks = relation_nblocks(tname);
+        end_transaction();
+
+        if (next_block >= nblocks)
+        {
+            result = finish_table(tname, attrs, nattrs, activity.data, &again);
+            if (result && again)
+            {
+                /* Picked up again once we let go of the table */
+                bw_colupgrader_request_table(tname);
+            }
+            break;
+        }
 
-/*
- * Signal handler for SIGTERM
- * Set a flag to let the main loop to terminate, and set our latch to wake
- * it up.
- */
-static void
-bw_colupgrader_sigterm(SIGNAL_ARGS)
-{
-	int	save_errno = errno;
+        LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+        generation = ++job->generation;
+        job->active = true;
+        job->aborted = false;
+        strlcpy(job->tname, tname, NAMEDATALEN);
+        job->nattrs = nattrs;
+        for (i = 0; i < nattrs; i++)
+        {
+            job->attr_ids[i] = attrs[i].attr_id;
+            job->upgraded[i] = attrs[i].upgraded;
+        }
+        queue_units(job, next_block, nblocks);
+        nhelpers = Min(bw_colupgrader_parallel_workers, job->nunits - 1);
+        LWLockRelease(shared->lock);
+
+        nhelpers = launch_helpers(slot, generation, nhelpers, handles);
+        run_units(job, generation, tname, attrs, nattrs, queries, nqueries,
+                  activity.data);
+        for (i = 0; i < nhelpers; i++)
+        {
+            (void)WaitForBackgroundWorkerShutdown(handles[i]);
+            pfree(handles[i]);
+        }
 
-	got_sigterm = true;
-	if (MyProc)
-	{
-		SetLatch(&MyProc->procLatch);
+        LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+        complete = !job->aborted;
+        for (i = 0; i < job->nunits; i++)
+        {
+            complete &= job->units[i].state == UNIT_DONE;
+        }
+        next_block = job->units[job->nunits - 1].end;
+        job->active = false;
+        LWLockRelease(shared->lock);
+
+        if (!complete)
+        {
+            break;
+        }
     }
 
-	errno = save_errno;
+    progress_end_table();
+    (void)lock_table(tname, false);
+    return result;
 }
 
-/*
- * Signal handler for SIGHUP
- * Set a flag to let the main loop to reread the config file, and set
- * our latch to wake it up.
- */
-static void
-bw_colupgrader_sighup(SIGNAL_ARGS)
+/* Load the attributes of job, as its coordinator saw them */
+static pending_attr *
+get_job_attrs(upgrade_job *job, char *tname, int *nattrs)
 {
-	got_sighup = true;
-	if (MyProc)
-	{
-		SetLatch(&MyProc->procLatch);
+    pending_attr *attrs;
+    int64 attr_ids[MAX_JOB_ATTRS];
+    bool upgraded[MAX_JOB_ATTRS];
+    int njob_attrs;
+    int n;
+    int i, j;
+
+    LWLockAcquire(shared->lock, LW_SHARED);
+    njob_attrs = job->nattrs;
+    memcpy(attr_ids, job->attr_ids, sizeof(attr_ids));
+    memcpy(upgraded, job->upgraded, sizeof(upgraded));
+    LWLockRelease(shared->lock);
+
+    attrs = get_pending_attrs(tname, &n);
+    *nattrs = 0;
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < njob_attrs; j++)
+        {
+            if (attrs[i].attr_id == attr_ids[j] && attrs[i].upgraded == upgraded[j])
+            {
+                attrs[(*nattrs)++] = attrs[i];
+                break;
+            }
+        }
     }
+
+    return attrs;
 }
 
 /*
- * Initialize workspace for a worker process: create the schema if it doesn't
- * already exist.
+ * Entrypoint of the dynamic workers that help a coordinator with its job:
+ * claim units until there are none left, then exit.
  */
-static void
-initialize_bw_colupgrader()
+void
+bw_colupgrader_helper_main(Datum main_arg)
 {
-    int	  ret;
-    int	  ntup;
-    bool  isnull;
-    StringInfoData buf;
-
-    SetCurrentStatementStartTimestamp();
-    StartTransactionCommand();
-    SPI_connect();
-    PushActiveSnapshot(GetTransactionSnapshot());
-    pgstat_report_activity(STATE_RUNNING, "bw_colupgrader: initializing document schema");
-
-    /* XXX could we use CREATE SCHEMA IF NOT EXISTS? */
-    initStringInfo(&buf);
-    appendStringInfo(&buf, "select count(*) from pg_namespace where nspname = 'document_schema'");
-
-    ret = SPI_execute(buf.data, true, 0);
-    if (ret != SPI_OK_SELECT)
+    int slot = DatumGetInt32(main_arg);
+    uint32 generation;
+    upgrade_job *job;
+    char tname[NAMEDATALEN];
+    bool active;
+    pending_attr *attrs;
+    int nattrs;
+    char **queries;
+    int nqueries;
+    StringInfoData activity;
+
+    pqsignal(SIGHUP, bw_colupgrader_sighup);
+    pqsignal(SIGTERM, bw_colupgrader_sigterm);
+    BackgroundWorkerUnblockSignals();
+    BackgroundWorkerInitializeConnection("test", "postgres", 0);
+    /* We read keys from the document, not from the columns being filled */
+    SetConfigOption("document_type.rewrite_accessors", "off",
+                    PGC_SUSET, PGC_S_OVERRIDE);
+
+    upgrader_context = AllocSetContextCreate(TopMemoryContext,
+                                             "bw_colupgrader",
+                                             ALLOCSET_DEFAULT_SIZES);
+    memcpy(&generation, MyBgworkerEntry->bgw_extra, sizeof(generation));
+    job = &shared->jobs[slot];
+
+    LWLockAcquire(shared->lock, LW_SHARED);
+    active = job->active && job->generation == generation;
+    strlcpy(tname, job->tname, NAMEDATALEN);
+    LWLockRelease(shared->lock);
+    if (!active)
     {
-        elog(ERROR, "bw_colupgrader: SPI_execute failed: error code %d", ret);
+        proc_exit(0);
     }
+    progress_attach(slot, true);
 
-    if (SPI_processed != 1)
+    attrs = get_job_attrs(job, tname, &nattrs);
+    if (nattrs == 0)
     {
-        elog(ERROR, "bw_colupgrader: not a singleton result");
+        proc_exit(0);
     }
+    progress_start_table(tname, attrs, nattrs, false);
+
+    MemoryContextSwitchTo(upgrader_context);
+    initStringInfo(&activity);
+    appendStringInfo(&activity, "bw_colupgrader: rewriting %s", tname);
+    queries = build_rewrite_queries(tname, attrs, nattrs, &nqueries);
 
-    ntup = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0],
-                       SPI_tuptable->tupdesc,
-                       1, &isnull));
-    if (isnull)
+    PG_TRY();
     {
-        elog(ERROR, "bw_colupgrader: null result");
+        run_units(job, generation, tname, attrs, nattrs, queries, nqueries,
+                  activity.data);
     }
-
-    if (ntup == 0)
+    PG_CATCH();
     {
-        resetStringInfo(&buf);
-        appendStringInfo(&buf, "CREATE SCHEMA document_schema");
+        progress_report_error(tname);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
 
-        /* set statement start time */
-        SetCurrentStatementStartTimestamp();
+    proc_exit(0);
+}
 
-        ret = SPI_execute(buf.data, false, 0);
+/* Wake every coordinator. NOTE: Caller must hold shared->lock */
+static void
+wake_coordinators(void)
+{
+    int i;
 
-        if (ret != SPI_OK_UTILITY)
+    for (i = 0; i < shared->njobs; i++)
+    {
+        if (shared->jobs[i].latch)
         {
-            elog(FATAL, "bw_colupgrader: failed to create my schema");
+            SetLatch(shared->jobs[i].latch);
         }
+    }
+}
 
-        resetStringInfo(&buf);
-        appendStringInfo(&buf, "CREATE TABLE document_schema._attributes(_id SERIAL, key_name TEXT, key_type TEXT");
+/*
+ * Queue tname for the coordinators and wake them. analyze_schema calls this
+ * (through the BW_COLUPGRADER_RENDEZVOUS variable) when a transaction that
+ * flipped a key of tname commits, so must not throw.
+ */
+void
+bw_colupgrader_request_table(const char *tname)
+{
+    int i;
 
-        ret = SPI_execute(buf.data, false, 0);
+    if (!shared)
+    {
+        return;
+    }
 
-        if (ret != SPI_OK_UTILITY)
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    for (i = 0; i < shared->npending; i++)
+    {
+        if (!strcmp(shared->pending[i], tname))
         {
-            elog(FATAL, "bw_colupgrader: failed to create document_schema._attributes");
+            break;
         }
     }
-
-    SPI_finish();
-    PopActiveSnapshot();
-    CommitTransactionCommand();
-    pgstat_report_activity(STATE_IDLE, NULL);
+    if (i == shared->npending)
+    {
+        if (shared->npending < MAX_PENDING_TABLES)
+        {
+            strlcpy(shared->pending[shared->npending++], tname, NAMEDATALEN);
+        }
+        else
+        {
+            shared->rescan = true;
+        }
+    }
+    wake_coordinators();
+    LWLockRelease(shared->lock);
 }
 
 static bool
-upgrade_columns(char *tname)
+take_rescan_request(void)
 {
-    StringInfoData buf;
+    bool rescan;
 
-    initStringInfo(&buf);
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    rescan = shared->rescan;
+    shared->rescan = false;
+    LWLockRelease(shared->lock);
 
-    /* Retrieve document schema for table */
-    appendStringInfo(&buf,
-                     "SELECT key_id FROM %s.%s WHERE "
-                     "upgraded = true AND dirty = true",
-                     SCHEMA_NAME,
-                     tname);
-    ret = SPI_execute(buf.data, true, 0);
-    if (ret != SPI_OK_SELECT)
+    return rescan;
+}
+
+/* NOTE: Caller must hold shared->lock */
+static bool
+table_is_busy(int slot, const char *tname)
+{
+    int i;
+
+    for (i = 0; i < shared->njobs; i++)
     {
-        elog(ERROR, "bw_colupgrade: cannot get document schema for table '%s'", tname);
+        if (i != slot && !strcmp(shared->jobs[i].current, tname))
+        {
+            return true;
+        }
     }
-    else /* Materialize a column */
+    return false;
+}
+
+/*
+ * Dequeue the first table no other coordinator is on, and claim it. Tables
+ * that are busy stay queued: their coordinator may have read the schema
+ * before the flip, so they need another pass once it is done.
+ * NOTE: Result is allocated in upgrader_context
+ */
+static char *
+next_pending_table(int slot)
+{
+    char *tname = NULL;
+    int i;
+
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    for (i = 0; i < shared->npending; i++)
     {
-        char *key_name;
-        char *key_type;
-        char *udf_suffix;
-        int attr_id;
-        bool isnull;
-        int ntups;
-        int *attr_ids;
-        int j;
-        bool exists;
-
-        ntups = SPI_processed;
-        if (ntups == 0) /* Go until we find a table with a column to upgrade, or we run out of tables */
-        {
-            elog(DEBUG5, "bw_colupgrade: table '%s' has no upgradeable columns", tname);
-            return false;
-        }
-
-        attr_ids = palloc0(ntups * sizeof(int));
-        for (j = 0; j < ntups; j++)
-        {
-              attr_id[j] = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[j],
-                                                       SPI_tuptable->tupdesc,
-                                                       1,
-                                                       &isnull));
-              if (isnull)
-              {
-                  elog(WARNING, "bw_colupgrade: null result for attribute id");
-                  return false;
-              }
-        }
-
-        for (j = 0; j < ntups; j++)
-        {
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "SELECT key_name, key_type FROM document_schema._attributes WHERE"
-                               " _id = %d",
-                               attr_id);
-              ret = SPI_execute(buf.data, true, 0);
-              if (ret != SPI_OK_SELECT)
-              {
-                  elog(ERROR, "bw_colupgrade: cannot find attribute name for id %d", attr_id);
-              }
-              if (SPI_processed == 0) /* Go until we find a table with a column to upgrade, or we run out of tables */
-              {
-                  elog(ERROR, "bw_colupgrade: cannot find attribute name for id %d", attr_id);
-                  return false;
-              }
-
-              key_name = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
-              key_type = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2);
-
-              /* See if column exists */
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "SELECT 1 FROM pg_attribute WHERE attrelid = '%s'::regclass "
-                               "AND attrname = %s AND NOT attisdropped",
-                               tname,
-                               key_name);
-              ret = SPI_execute(buf.data, true, 0);
-              if (ret != SPI_OK_SELECT)
-              {
-                  elog(ERROR, "bw_colupgrade: checking column existence failed")
-              }
-              /* Need to create column */
-              if (SPI_processed == 0)
-              {
-                  resetStringInfo(&buf);
-                  appendStringInfo(&buf,
-                                   "ALTER TABLE %s ADD COLUMN %s %s",
-                                   tname,
-                                   key_name,
-                                   key_type);
-                  ret = SPI_execute(buf.data, false, 0);
-                  if (ret != SPI_OK_UTILITY)
-                  {
-                      elog(ERROR, "bw_colupgrade: column creation for '%s.%s' failed", tname, key_name);
-                  }
-              }
-
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "UPDATE %s SET %s = document_get(json_data, '%s', '%s')",
-                               tname,
-                               key_name,
-                               key_name,
-                               key_type);
-              ret = SPI_execute(buf.data, false, 0);
-              if (ret != SPI_OK_UPDATE)
-              {
-                  elog(ERROR, "bw_colupgrade: column upgrade for '%s.%s' failed", tname, key_name);
-              }
-              /* Delete from doc column */
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "UPDATE %s SET json_data = document_delete(json_data, '%s', '%s')",
-                               tname,
-                               key_name,
-                               key_type);
-              ret = SPI_execute(buf.data, false, 0);
-              if (ret != SPI_OK_UPDATE)
-              {
-                  elog(ERROR, "bw_colupgrade: column upgrade for '%s.%s' failed", tname, key_name);
-              }
-
-              /* Set dirty = false */
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "UPDATE %s.%s SET dirty = false" 
-                               " WHERE _id = %d",
-                               SCHEMA_NAME,
-                               tname,
-                               attr_id);
-              ret = SPI_execute(buf.data, false, 0);
-              if (ret != SPI_OK_UPDATE || SPI_processed != 1)
-              {
-                  elog(ERROR, "bw_colupgrade: could not update schema properly");
-              }
-        }
-        pfree(attr_ids);
-        return true;
+        if (!table_is_busy(slot, shared->pending[i]))
+        {
+            tname = MemoryContextStrdup(upgrader_context, shared->pending[i]);
+            strlcpy(shared->jobs[slot].current, tname, NAMEDATALEN);
+            memmove(shared->pending[i],
+                    shared->pending[i + 1],
+                    (shared->npending - i - 1) * NAMEDATALEN);
+            --shared->npending;
+            break;
+        }
     }
+    LWLockRelease(shared->lock);
+
+    return tname;
 }
 
 static bool
-downgrade_columns(char *tname)
+claim_table(int slot, const char *tname)
 {
-    StringInfoData buf;
-
-    initStringInfo(&buf);
+    bool claimed;
 
-    /* Retrieve document schema for table */
-    appendStringInfo(&buf,
-                     "SELECT key_id FROM %s.%s WHERE "
-                     "upgraded = true AND dirty = true",
-                     SCHEMA_NAME,
-                     tname);
-    ret = SPI_execute(buf.data, true, 0);
-    if (ret != SPI_OK_SELECT)
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    claimed = !table_is_busy(slot, tname);
+    if (claimed)
     {
-        elog(ERROR, "bw_colupgrade: cannot get document schema for table '%s'", tname);
+        strlcpy(shared->jobs[slot].current, tname, NAMEDATALEN);
     }
-    else /* Materialize a column */
+    LWLockRelease(shared->lock);
+
+    return claimed;
+}
+
+/* Let whoever is waiting on our table have it */
+static void
+release_table(int slot)
+{
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    shared->jobs[slot].current[0] = '\0';
+    if (shared->npending > 0)
     {
-        char *key_name;
-        char *key_type;
-        char *udf_suffix;
-        int attr_id;
-        bool isnull;
-        int ntups;
-        int *attr_ids;
-        int j;
-        bool exists;
-
-        ntups = SPI_processed;
-        if (ntups == 0) /* Go until we find a table with a column to upgrade, or we run out of tables */
-        {
-            elog(DEBUG5, "bw_colupgrade: table '%s' has no upgradeable columns", tname);
-            return false;
-        }
-
-        attr_ids = palloc0(ntups * sizeof(int));
-        for (j = 0; j < ntups; j++)
-        {
-              attr_id[j] = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[j],
-                                                       SPI_tuptable->tupdesc,
-                                                       1,
-                                                       &isnull));
-              if (isnull)
-              {
-                  elog(WARNING, "bw_colupgrade: null result for attribute id");
-                  return false;
-              }
-        }
-
-        for (j = 0; j < ntups; j++)
-        {
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "SELECT key_name, key_type FROM document_schema._attributes WHERE"
-                               " _id = %d",
-                               attr_id);
-              ret = SPI_execute(buf.data, true, 0);
-              if (ret != SPI_OK_SELECT)
-              {
-                  elog(ERROR, "bw_colupgrade: cannot find attribute name for id %d", attr_id);
-              }
-              if (SPI_processed == 0) /* Go until we find a table with a column to upgrade, or we run out of tables */
-              {
-                  elog(ERROR, "bw_colupgrade: cannot find attribute name for id %d", attr_id);
-                  return false;
-              }
-
-              key_name = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
-              key_type = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2);
-
-              /*
-               * NOTE: assume that if we have upgraded == FALSE && dirty, then
-               * the column exists. Otherwise, we have bigger problems than
-               * this module
-               */
-              /* Add to doc column */
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "UPDATE %s SET json_data = document_put(json_data, '%s', '%s', %s)",
-                               tname,
-                               key_name,
-                               key_type,
-                               key_name);
-              ret = SPI_execute(buf.data, false, 0);
-              if (ret != SPI_OK_UPDATE)
-              {
-                  elog(ERROR, "bw_colupgrade: column upgrade for '%s.%s' failed", tname, key_name);
-              }
-
-              /* Delete current column */
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "ALTER TABLE %s DROP COLUMN %s",
-                               tname,
-                               key_name);
-              ret = SPI_execute(buf.data, false, 0);
-              if (ret != SPI_OK_UTILITY)
-              {
-                  elog(ERROR, "bw_colupgrade: column deletion for '%s.%s' failed", tname, key_name);
-              }
-
-              /* Set dirty = false */
-              resetStringInfo(&buf);
-              appendStringInfo(&buf,
-                               "UPDATE %s.%s SET dirty = false" 
-                               " WHERE _id = %d",
-                               SCHEMA_NAME,
-                               tname,
-                               attr_id);
-              ret = SPI_execute(buf.data, false, 0);
-              if (ret != SPI_OK_UPDATE || SPI_processed != 1)
-              {
-                  elog(ERROR, "bw_colupgrade: could not update schema properly");
-              }
-        }
-        pfree(attr_ids);
-        return true;
+        wake_coordinators();
     }
+    LWLockRelease(shared->lock);
 }
+
 void
-bw_colupgrader_main(void *main_arg)
+bw_colupgrader_main(Datum main_arg)
 {
-    StringInfoData buf;
+    int slot = DatumGetInt32(main_arg);
+    upgrade_job *job;
+    bool rescan;
+
+    /* Establish signal handlers before unblocking signals */
+    pqsignal(SIGHUP, bw_colupgrader_sighup);
+    pqsignal(SIGTERM, bw_colupgrader_sigterm);
 
     /* We're now ready to receive signals */
     BackgroundWorkerUnblockSignals();
 
     /* Connect to our database */
-    BackgroundWorkerInitializeConnection("test", "postgres");
+    BackgroundWorkerInitializeConnection("test", "postgres", 0);
+    /* We read keys from the document, not from the columns being filled */
+    SetConfigOption("document_type.rewrite_accessors", "off",
+                    PGC_SUSET, PGC_S_OVERRIDE);
 
+    progress_attach(slot, false);
     initialize_bw_colupgrader();
 
+    upgrader_context = AllocSetContextCreate(TopMemoryContext,
+                                             "bw_colupgrader",
+                                             ALLOCSET_DEFAULT_SIZES);
+
+    job = &shared->jobs[slot];
+    LWLockAcquire(shared->lock, LW_EXCLUSIVE);
+    job->latch = MyLatch;
+    job->current[0] = '\0';
+    LWLockRelease(shared->lock);
+
+    /* Pick up whatever was left dirty before we (re)started */
+    rescan = true;
     while (!got_sigterm)
     {
-        int	ret;
-        int	rc;
         int num_tables;
+        char **tnames;
+        int i;
+
+        if (got_sighup)
+        {
+            got_sighup = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
 
-        rc = WaitLatch(&MyProc->procLatch,
-                       WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-                       bw_colupgrader_naptime * 1000L);
-        ResetLatch(&MyProc->procLatch);
+        MemoryContextReset(upgrader_context);
+        if (rescan || take_rescan_request())
+        {
+            tnames = get_table_names(&num_tables);
+            rescan = false;
+        }
+        else
+        {
+            tnames = MemoryContextAlloc(upgrader_context, sizeof(char*));
+            tnames[0] = next_pending_table(slot);
+            num_tables = tnames[0] ? 1 : 0;
+        }
 
-        /* emergency bailout if postmaster has died */
-        if (rc & WL_POSTMASTER_DEATH)
+        if (num_tables == 0)
         {
-            proc_exit(1);
+            int rc;
+
+            progress_set_state("idle");
+            rc = WaitLatch(MyLatch,
+                           WL_LATCH_SET | WL_EXIT_ON_PM_DEATH |
+                           (bw_colupgrader_naptime > 0 ? WL_TIMEOUT : 0),
+                           bw_colupgrader_naptime * 1000L,
+                           PG_WAIT_EXTENSION);
+            ResetLatch(MyLatch);
+            rescan = (rc & WL_TIMEOUT) != 0;
+            continue;
         }
 
-        if (got_sighup)
+        for (i = 0; i < num_tables && !got_sigterm; i++)
         {
-            got_sighup = false;
-            ProcessConfigFile(PGC_SIGHUP);
+            pending_attr *attrs;
+            int nattrs;
+
+            if (!claim_table(slot, tnames[i]))
+            {
+                continue;
+            }
+            PG_TRY();
+            {
+                attrs = get_pending_attrs(tnames[i], &nattrs);
+                (void)process_table(slot, tnames[i], attrs, nattrs);
+            }
+            PG_CATCH();
+            {
+                /* The worker restarts; keep what stopped it */
+                progress_report_error(tnames[i]);
+                PG_RE_THROW();
+            }
+            PG_END_TRY();
+            release_table(slot);
         }
+    }
 
-        SetCurrentStatementStartTimestamp();
-        StartTransactionCommand();
-        SPI_connect();
-        PushActiveSnapshot(GetTransactionSnapshot());
-        pgstat_report_activity(STATE_RUNNING, buf.data);
+    proc_exit(0);
+}
 
-        initStringInfo(&buf);
-        appendStringInfo(&buf, "SELECT tablename FROM pg_tables WHERE schemaname='%s'", SCHEMA_NAME);
+/* A progress slot as upgrade_worker_stats reports it */
+typedef struct worker_stats {
+    int job;
+    bool helper;
+    worker_progress progress;
+} worker_stats;
+
+static void
+check_loaded(const char *fname)
+{
+    if (!shared)
+    {
+        elog(ERROR,
+             "%s: bw_colupgrader must be loaded via shared_preload_libraries",
+             fname);
+    }
+}
+
+static Datum
+text_or_null(const char *str, bool *isnull)
+{
+    *isnull = str[0] == '\0';
+    return *isnull ? (Datum)0 : CStringGetTextDatum(str);
+}
+
+/*
+ * document_schema.upgrade_worker_stats(): a row per coordinator, running or
+ * not, and per running helper, from a snapshot of the progress slots
+ */
+Datum
+bw_colupgrader_worker_stats(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    worker_stats *stats;
 
-        /* We can now execute queries via SPI */
-        ret = SPI_execute(buf.data, true, 0);
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext old_context;
+        TupleDesc tupdesc;
+        int nslots;
+        int n;
+        int i;
+
+        check_loaded("upgrade_worker_stats");
 
-        if (ret != SPI_OK_SELECT)
+        funcctx = SRF_FIRSTCALL_INIT();
+        old_context = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
         {
-            elog(ERROR, "bw_colupgrade: cannot get table names in schema '%s'", SCHEMA_NAME);
+            elog(ERROR, "upgrade_worker_stats: return type must be a row type");
         }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
 
-        num_tables = SPI_processed;
-        if (num_tables > 0)
+        nslots = shared->njobs * WORKERS_PER_JOB;
+        stats = palloc(nslots * sizeof(worker_stats));
+        n = 0;
+        LWLockAcquire(shared->lock, LW_SHARED);
+        for (i = 0; i < nslots; i++)
         {
-            int     i;
-            char  **tnames;
+            bool helper = i % WORKERS_PER_JOB != 0;
 
-            tnames = palloc0(num_tables * sizeof(char*));
-            for (i = 0; i < num_tables; i++)
+            if (helper && shared->workers[i].pid == 0)
             {
-                tnames[i] = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+                continue;
             }
+            stats[n].job = i / WORKERS_PER_JOB;
+            stats[n].helper = helper;
+            memcpy(&stats[n].progress, &shared->workers[i], sizeof(worker_progress));
+            n++;
+        }
+        LWLockRelease(shared->lock);
 
-            /* Need to do this separately so as not to overwrite the global SPI_tuptable */
-            for (i = 0; i < num_tables; i++)
-            {
-                char *tname;
-                // FIXME: always ask for a lock on this table; if can't acquire, sleep
+        funcctx->user_fctx = stats;
+        funcctx->max_calls = n;
 
-                resetStringInfo(&buf);
-                tname = tnames[i];
-                if (!tname || !strcmp(tname, "_attributes")
-                {
-                    continue;
-                }
+        MemoryContextSwitchTo(old_context);
+    }
 
-                if (upgradeColumns(tname) || downgradeColumns(tname))
-                {
-                    break;
-                }
+    funcctx = SRF_PERCALL_SETUP();
+    stats = (worker_stats*)funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls)
+    {
+        worker_stats *worker;
+        worker_progress *progress;
+        Datum latency[LATENCY_BUCKETS];
+        Datum values[13];
+        bool nulls[13];
+        HeapTuple tuple;
+        int i;
+
+        worker = &stats[funcctx->call_cntr];
+        progress = &worker->progress;
+        memset(nulls, 0, sizeof(nulls));
+
+        values[0] = Int32GetDatum(progress->pid);
+        nulls[0] = progress->pid == 0;
+        values[1] = CStringGetTextDatum(worker->helper ? "helper" : "coordinator");
+        values[2] = Int32GetDatum(worker->job + 1); /* As in the worker's name */
+        values[3] = text_or_null(progress->tname, &nulls[3]);
+        values[4] = text_or_null(progress->attribute, &nulls[4]);
+        values[5] = text_or_null(progress->state, &nulls[5]);
+        values[6] = TimestampTzGetDatum(progress->state_since);
+        nulls[6] = nulls[5];
+        values[7] = Int64GetDatum(progress->rows);
+        values[8] = Int64GetDatum(progress->bytes);
+        values[9] = Int64GetDatum(progress->batches);
+        for (i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            latency[i] = Int64GetDatum(progress->latency[i]);
+        }
+        values[10] = PointerGetDatum(construct_array(latency,
+                                                     LATENCY_BUCKETS,
+                                                     INT8OID,
+                                                     sizeof(int64),
+                                                     FLOAT8PASSBYVAL,
+                                                     'd'));
+        values[11] = text_or_null(progress->last_error, &nulls[11]);
+        values[12] = TimestampTzGetDatum(progress->last_error_time);
+        nulls[12] = nulls[11];
+
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * document_schema.upgrade_table_stats(): cumulative counters of the tables
+ * rewritten since startup (the MAX_TABLE_STATS most recently active ones)
+ */
+Datum
+bw_colupgrader_table_stats(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    table_progress *tables;
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext old_context;
+        TupleDesc tupdesc;
+        int n;
+        int i;
+
+        check_loaded("upgrade_table_stats");
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        old_context = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        {
+            elog(ERROR, "upgrade_table_stats: return type must be a row type");
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        tables = palloc(MAX_TABLE_STATS * sizeof(table_progress));
+        n = 0;
+        LWLockAcquire(shared->lock, LW_SHARED);
+        for (i = 0; i < MAX_TABLE_STATS; i++)
+        {
+            if (shared->tables[i].tname[0] != '\0')
+            {
+                memcpy(&tables[n++], &shared->tables[i], sizeof(table_progress));
             }
         }
+        LWLockRelease(shared->lock);
 
-        /*
-         * And finish our transaction.
-         */
-        SPI_finish();
-        PopActiveSnapshot();
-        CommitTransactionCommand();
-        pgstat_report_activity(STATE_IDLE, NULL);
+        funcctx->user_fctx = tables;
+        funcctx->max_calls = n;
+
+        MemoryContextSwitchTo(old_context);
     }
 
-    proc_exit(0);
+    funcctx = SRF_PERCALL_SETUP();
+    tables = (table_progress*)funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls)
+    {
+        table_progress *table;
+        Datum values[8];
+        bool nulls[8];
+        HeapTuple tuple;
+
+        table = &tables[funcctx->call_cntr];
+        memset(nulls, 0, sizeof(nulls));
+
+        values[0] = CStringGetTextDatum(table->tname);
+        values[1] = Int64GetDatum(table->passes);
+        values[2] = Int64GetDatum(table->batches);
+        values[3] = Int64GetDatum(table->rows);
+        values[4] = Int64GetDatum(table->bytes);
+        values[5] = Float8GetDatum(table->batch_time / 1000.0);
+        values[6] = Int64GetDatum(table->errors);
+        values[7] = TimestampTzGetDatum(table->last_activity);
+
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+static Size
+upgrader_jobs_size(void)
+{
+    return add_size(offsetof(upgrader_shared, jobs),
+                    mul_size(bw_colupgrader_total_workers, sizeof(upgrade_job)));
+}
+
+static Size
+upgrader_shmem_size(void)
+{
+    return add_size(MAXALIGN(upgrader_jobs_size()),
+                    mul_size(mul_size(bw_colupgrader_total_workers, WORKERS_PER_JOB),
+                             sizeof(worker_progress)));
+}
+
+static void
+upgrader_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (prev_shmem_request_hook)
+    {
+        prev_shmem_request_hook();
+    }
+#endif
+
+    RequestAddinShmemSpace(upgrader_shmem_size());
+    RequestNamedLWLockTranche("bw_colupgrader", 1);
+}
+
+static void
+upgrader_shmem_startup(void)
+{
+    bool found;
+
+    if (prev_shmem_startup_hook)
+    {
+        prev_shmem_startup_hook();
+    }
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    shared = ShmemInitStruct("bw_colupgrader", upgrader_shmem_size(), &found);
+    if (!found)
+    {
+        memset(shared, 0, upgrader_shmem_size());
+        shared->lock = &(GetNamedLWLockTranche("bw_colupgrader"))->lock;
+        shared->njobs = bw_colupgrader_total_workers;
+        shared->workers = (worker_progress*)((char*)shared +
+                                             MAXALIGN(upgrader_jobs_size()));
+    }
+    LWLockRelease(AddinShmemInitLock);
 }
 
 /*
  * Entrypoint of this module.
  *
- * We register more than one worker process here, to demonstrate how that can
- * be done.
+ * We register total_workers coordinators here; they start their helpers
+ * dynamically.
  */
 void
 _PG_init(void)
@@ -522,13 +2406,52 @@ _PG_init(void)
 
     /* get the configuration */
     DefineCustomIntVariable("bw_colupgrader.naptime",
-                            "Duration between each check (in seconds).",
-                            NULL,
+                            "Duration between full scans for dirty tables (in seconds).",
+                            "0 disables them; tables are queued by analyze_schema.",
                             &bw_colupgrader_naptime,
-                            10,
+                            0,
+                            0,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            GUC_UNIT_S,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("bw_colupgrader.batch_size",
+                            "Heap blocks rewritten per transaction.",
+                            NULL,
+                            &bw_colupgrader_batch_size,
+                            1024,
                             1,
                             INT_MAX,
                             PGC_SIGHUP,
+                            GUC_UNIT_BLOCKS,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("bw_colupgrader.cost_delay",
+                            "Time to sleep after each batch (in milliseconds).",
+                            "0 disables throttling.",
+                            &bw_colupgrader_cost_delay,
+                            10,
+                            0,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MS,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("bw_colupgrader.parallel_workers",
+                            "Dynamic workers helping to rewrite each table.",
+                            "Limited by max_worker_processes.",
+                            &bw_colupgrader_parallel_workers,
+                            2,
+                            0,
+                            MAX_JOB_UNITS - 1,
+                            PGC_SIGHUP,
                             0,
                             NULL,
                             NULL,
@@ -552,50 +2475,41 @@ _PG_init(void)
                             NULL,
                             NULL);
 
+    /* One job slot per worker with its progress slots, and the lock
+     * protecting them */
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = upgrader_shmem_request;
+#else
+    upgrader_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = upgrader_shmem_startup;
+
+    /* Every backend loads us here, so analyze_schema can find us */
+    *find_rendezvous_variable(BW_COLUPGRADER_RENDEZVOUS) =
+        (void*)bw_colupgrader_request_table;
+
     /* set up common data for all our workers */
+    memset(&worker, 0, sizeof(worker));
     worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
         BGWORKER_BACKEND_DATABASE_CONNECTION;
     worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
-    worker.bgw_restart_time = BGW_NEVER_RESTART;
-    worker.bgw_main = bw_colupgrader_main;
-    worker.bgw_sighup = bw_colupgrader_sighup;
-    worker.bgw_sigterm = bw_colupgrader_sigterm;
-    worker.bgw_main_arg = NULL;
+    /* A crashed worker resumes from the saved cursors */
+    worker.bgw_restart_time = BGW_RESTART_SECONDS;
+    sprintf(worker.bgw_library_name, "bw_colupgrader");
+    sprintf(worker.bgw_function_name, "bw_colupgrader_main");
+    worker.bgw_notify_pid = 0;
 
     /*
      * Now fill in worker-specific data, and do the actual registrations.
      */
     for (i = 1; i <= bw_colupgrader_total_workers; i++)
     {
-        char name[BGW_MAXLEN];
-
-        sprintf(name, "bw_colupgrader_%d", i);
-        worker.bgw_name = pstrdup(name);
+        snprintf(worker.bgw_name, BGW_MAXLEN, "bw_colupgrader_%d", i);
+        snprintf(worker.bgw_type, BGW_MAXLEN, "bw_colupgrader");
+        worker.bgw_main_arg = Int32GetDatum(i - 1); /* Job slot */
 
         RegisterBackgroundWorker(&worker);
     }
 }
-
-/*
- * Dynamically launch an SPI worker.
- * NOTE: Changes as of 7/16/13
- * https://github.com/postgres/postgres/commit/7f7485a0cde92aa4ba235a1ffe4dda0ca0b6cc9a
- * Datum
- * bw_colupgrader_launch(PG_FUNCTION_ARGS)
- * {
- *     BackgroundWorker worker;
- *
- *     worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
- *       BGWORKER_BACKEND_DATABASE_CONNECTION;
- *     worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
- *     worker.bgw_restart_time = 300;
- *     worker.bgw_main = NULL;		// new worker might not have library loaded
- *     sprintf(worker.bgw_library_name, "bw_colupgrader");
- *     sprintf(worker.bgw_function_name, "bw_colupgrader_main");
- *     worker.bgw_sighup = NULL;	// new worker might not have library loaded
- *     worker.bgw_sigterm = NULL;	// new worker might not have library loaded
- *     worker.bgw_main_arg = PointerGetDatum(NULL);
- *
- *     PG_RETURN_BOOL(RegisterDynamicBackgroundWorker(&worker));
- * }
- */
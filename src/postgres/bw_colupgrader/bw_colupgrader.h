@@ -0,0 +1,11 @@
+#ifndef BW_COLUPGRADER_H
+#define BW_COLUPGRADER_H
+
+/* Name of the rendezvous variable (see find_rendezvous_variable) holding a
+ * bw_colupgrader_request_fn, or NULL if bw_colupgrader isn't loaded. Other
+ * modules use it to queue a table whose columns need rewriting */
+#define BW_COLUPGRADER_RENDEZVOUS "bw_colupgrader_request_table"
+
+typedef void (*bw_colupgrader_request_fn)(const char *tname);
+
+#endif
@@ -6,9 +6,37 @@ BEGIN
      ALTER TABLE ' || tname::regclass || ' ADD COLUMN id serial; 
      ALTER TABLE ' || tname::regclass || ' ADD COLUMN data document; 
 
-     CREATE TABLE IF NOT EXISTS document_schema.' || tname || ' (key_id bigint, count bigint, dirty bool, upgraded bool);
-     CREATE TRIGGER count_keys AFTER INSERT ON ' || tname::regclass || ' FOR EACH ROW EXECUTE PROCEDURE analyze_document();
+     CREATE TABLE IF NOT EXISTS document_schema.' || tname || ' (key_id bigint, count bigint, dirty bool, upgraded bool, upgrade_block bigint, upgrade_state text, access_mark bigint, access_rate double precision, access_time timestamptz);
+     -- BEFORE row triggers fire in name order: count keys before route_keys moves them out
+     CREATE TRIGGER count_keys BEFORE INSERT ON ' || tname::regclass || ' FOR EACH ROW EXECUTE PROCEDURE analyze_document();
+     CREATE TRIGGER route_keys BEFORE INSERT OR UPDATE ON ' || tname::regclass || ' FOR EACH ROW EXECUTE PROCEDURE document_route_keys();
      CREATE TRIGGER analyze_schema AFTER INSERT ON ' || tname::regclass || ' FOR EACH STATEMENT EXECUTE PROCEDURE analyze_schema();
      ';
 END;
 $$ LANGUAGE plpgsql;
+
+-- Materialize a nested path (e.g. 'address.city') into its own column. The
+-- analyzer only counts top-level keys, so nested paths are requested by hand;
+-- bw_colupgrader then adds the column (named 'address__city') and copies it.
+CREATE OR REPLACE FUNCTION materialize_document_path(tname text, path text, type text) RETURNS void AS $$
+DECLARE
+  attr_id bigint;
+  updated bigint;
+BEGIN
+  IF strpos(path, '[') > 0 THEN
+    RAISE EXCEPTION 'materialize_document_path: array indexes are not supported (%)', path;
+  END IF;
+
+  -- Not a plain INSERT: other backends must hear of a new attribute, and
+  -- _attributes doesn't stop duplicates
+  attr_id := document_attribute_id(path, type);
+
+  EXECUTE 'UPDATE document_schema.' || tname || ' SET upgraded = true, dirty = true, upgrade_state = CASE WHEN upgrade_state IS NULL OR upgrade_state = ''pending'' THEN ''pending'' ELSE ''copying'' END WHERE key_id = ' || attr_id;
+  GET DIAGNOSTICS updated = ROW_COUNT;
+  IF updated = 0 THEN
+    EXECUTE 'INSERT INTO document_schema.' || tname || ' (key_id, count, dirty, upgraded, upgrade_state) VALUES (' || attr_id || ', 0, true, true, ''pending'')';
+  END IF;
+
+  PERFORM document_schema_changed(tname::regclass);
+END;
+$$ LANGUAGE plpgsql;
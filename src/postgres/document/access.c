@@ -0,0 +1,271 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <executor/executor.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <parser/parsetree.h>
+#include <port/atomics.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/builtins.h>
+
+#include "access.h"
+#include "binary.h"
+
+/*******************************************************************************
+ * Access counting
+ *
+ * Counts accessor calls per relation and top-level key name, so that
+ * analyze_schema can weigh how often a key of a collection is read when
+ * deciding whether to materialize it. The counters only grow; analyze_schema
+ * turns them into a rate over its own windows.
+ *
+ * An accessor only sees a document, so the relation comes from its call: if
+ * the document argument is a column of a table, the Var is looked up in the
+ * range table of the innermost query being run, which ExecutorRun_hook keeps
+ * track of. Calls on anything else (constants, join outputs, ...) aren't
+ * counted.
+ *
+ * The counters live in shared memory, so they only exist when document_type is
+ * in shared_preload_libraries. (database, relation, name) is hashed into
+ * ACCESS_SLOTS counters (a collision just inflates a count), and each backend
+ * buffers up to ACCESS_FLUSH calls per slot before touching shared memory, so
+ * that a hot key doesn't bounce a cache line between cores.
+ ******************************************************************************/
+
+#define ACCESS_SLOTS (16384)
+#define ACCESS_FLUSH (64)
+#define ACCESS_MAX_DEPTH (32) /* Deeper nested queries aren't counted */
+
+typedef struct access_counters {
+    pg_atomic_uint64 counts[ACCESS_SLOTS];
+} access_counters;
+
+static access_counters *counters = NULL;
+static uint16 local_counts[ACCESS_SLOTS];
+static bool exit_callback_registered = false;
+
+/* Queries in ExecutorRun, outermost first. running_depth goes on counting
+ * past ACCESS_MAX_DEPTH */
+static QueryDesc *running_queries[ACCESS_MAX_DEPTH];
+static int running_depth = 0;
+
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+Datum document_access_count(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_access_count);
+
+static void
+access_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (prev_shmem_request_hook)
+    {
+        prev_shmem_request_hook();
+    }
+#endif
+
+    RequestAddinShmemSpace(sizeof(access_counters));
+}
+
+static void
+access_shmem_startup(void)
+{
+    bool found;
+    int i;
+
+    if (prev_shmem_startup_hook)
+    {
+        prev_shmem_startup_hook();
+    }
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    counters = ShmemInitStruct("document_type access counters",
+                               sizeof(access_counters),
+                               &found);
+    if (!found)
+    {
+        for (i = 0; i < ACCESS_SLOTS; i++)
+        {
+            pg_atomic_init_u64(&counters->counts[i], 0);
+        }
+    }
+    LWLockRelease(AddinShmemInitLock);
+}
+
+#if PG_VERSION_NUM >= 180000
+static void
+access_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count)
+#else
+static void
+access_ExecutorRun(QueryDesc *queryDesc,
+                   ScanDirection direction,
+                   uint64 count,
+                   bool execute_once)
+#endif
+{
+    int depth = running_depth;
+
+    if (depth < ACCESS_MAX_DEPTH)
+    {
+        running_queries[depth] = queryDesc;
+    }
+    running_depth = depth + 1;
+
+    PG_TRY();
+    {
+#if PG_VERSION_NUM >= 180000
+        if (prev_ExecutorRun)
+        {
+            prev_ExecutorRun(queryDesc, direction, count);
+        }
+        else
+        {
+            standard_ExecutorRun(queryDesc, direction, count);
+        }
+#else
+        if (prev_ExecutorRun)
+        {
+            prev_ExecutorRun(queryDesc, direction, count, execute_once);
+        }
+        else
+        {
+            standard_ExecutorRun(queryDesc, direction, count, execute_once);
+        }
+#endif
+    }
+    PG_CATCH();
+    {
+        running_depth = depth;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    running_depth = depth;
+}
+
+void
+document_access_init(void)
+{
+    if (!process_shared_preload_libraries_in_progress)
+    {
+        return;
+    }
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = access_shmem_request;
+#else
+    access_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = access_shmem_startup;
+    prev_ExecutorRun = ExecutorRun_hook;
+    ExecutorRun_hook = access_ExecutorRun;
+}
+
+static void
+flush_access_counts(int code, Datum arg)
+{
+    int i;
+
+    for (i = 0; i < ACCESS_SLOTS; i++)
+    {
+        if (local_counts[i])
+        {
+            pg_atomic_fetch_add_u64(&counters->counts[i], local_counts[i]);
+            local_counts[i] = 0;
+        }
+    }
+}
+
+static int
+access_slot(Oid relid, const char *key_name)
+{
+    uint32 hash;
+
+    hash = doc_key_hash(key_name);
+    hash ^= (uint32)relid * 0x9E3779B1u;
+    hash ^= (uint32)MyDatabaseId * 0x85EBCA77u;
+    return hash % ACCESS_SLOTS;
+}
+
+Oid
+document_access_relid(FunctionCallInfo fcinfo)
+{
+    QueryDesc *query;
+    Node *expr;
+    Var *var;
+    RangeTblEntry *rte;
+
+    if (!counters || running_depth == 0 || running_depth > ACCESS_MAX_DEPTH ||
+        !fcinfo->flinfo || !fcinfo->flinfo->fn_expr)
+    {
+        return InvalidOid;
+    }
+    query = running_queries[running_depth - 1];
+
+    expr = fcinfo->flinfo->fn_expr;
+    if (!IsA(expr, FuncExpr) || list_length(((FuncExpr*)expr)->args) < 1 ||
+        !IsA(linitial(((FuncExpr*)expr)->args), Var))
+    {
+        return InvalidOid;
+    }
+    var = (Var*)linitial(((FuncExpr*)expr)->args);
+    if (IS_SPECIAL_VARNO(var->varno) || var->varno < 1 ||
+        var->varno > list_length(query->plannedstmt->rtable))
+    {
+        return InvalidOid; /* e.g. the output of a join below */
+    }
+
+    rte = rt_fetch(var->varno, query->plannedstmt->rtable);
+    return rte->rtekind == RTE_RELATION ? rte->relid : InvalidOid;
+}
+
+void
+document_count_access(Oid relid, const char *key_name)
+{
+    int slot;
+
+    if (!counters || !OidIsValid(relid))
+    {
+        return;
+    }
+
+    if (!exit_callback_registered)
+    {
+        before_shmem_exit(flush_access_counts, (Datum)0);
+        exit_callback_registered = true;
+    }
+
+    slot = access_slot(relid, key_name);
+    if (++local_counts[slot] >= ACCESS_FLUSH)
+    {
+        pg_atomic_fetch_add_u64(&counters->counts[slot], local_counts[slot]);
+        local_counts[slot] = 0;
+    }
+}
+
+/* Accessor calls on top-level key name of relid since startup, or NULL if
+ * they aren't counted */
+Datum
+document_access_count(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    char *key_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+    if (!counters)
+    {
+        PG_RETURN_NULL();
+    }
+
+    PG_RETURN_INT64((int64)pg_atomic_read_u64(
+                        &counters->counts[access_slot(relid, key_name)]));
+}
@@ -0,0 +1,10 @@
+#ifndef ACCESS_H
+#define ACCESS_H
+
+void document_access_init(void);
+/* Relation the document argument of the accessor call fcinfo was read from,
+ * or InvalidOid if that can't be told */
+Oid document_access_relid(FunctionCallInfo fcinfo);
+void document_count_access(Oid relid, const char *key_name);
+
+#endif
@@ -1,11 +1,20 @@
 #include <postgres.h> /* This include must precede all other postgres
                          dependencies */
 
+#include <catalog/pg_type.h>
 #include <fmgr.h>
 #include <funcapi.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
 
 #include <assert.h>
 
+#include "access.h"
+#include "accessors.h"
+#include "binary.h"
 #include "document.h"
 #include "schema.h"
 #include "utils.h"
@@ -43,6 +52,7 @@ Datum document_get_float(PG_FUNCTION_ARGS);
 Datum document_get_bool(PG_FUNCTION_ARGS);
 Datum document_get_text(PG_FUNCTION_ARGS);
 Datum document_get_doc(PG_FUNCTION_ARGS);
+Datum document_get_array(PG_FUNCTION_ARGS);
 Datum document_put(PG_FUNCTION_ARGS);
 Datum document_put_int(PG_FUNCTION_ARGS);
 Datum document_put_float(PG_FUNCTION_ARGS);
@@ -50,6 +60,7 @@ Datum document_put_bool(PG_FUNCTION_ARGS);
 Datum document_put_text(PG_FUNCTION_ARGS);
 Datum document_put_doc(PG_FUNCTION_ARGS);
 Datum document_delete(PG_FUNCTION_ARGS);
+Datum document_delete_many(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(document_get);
 PG_FUNCTION_INFO_V1(document_get_int);
@@ -57,6 +68,7 @@ PG_FUNCTION_INFO_V1(document_get_float);
 PG_FUNCTION_INFO_V1(document_get_bool);
 PG_FUNCTION_INFO_V1(document_get_text);
 PG_FUNCTION_INFO_V1(document_get_doc);
+PG_FUNCTION_INFO_V1(document_get_array);
 PG_FUNCTION_INFO_V1(document_put);
 PG_FUNCTION_INFO_V1(document_put_int);
 PG_FUNCTION_INFO_V1(document_put_float);
@@ -64,6 +76,7 @@ PG_FUNCTION_INFO_V1(document_put_bool);
 PG_FUNCTION_INFO_V1(document_put_text);
 PG_FUNCTION_INFO_V1(document_put_doc);
 PG_FUNCTION_INFO_V1(document_delete);
+PG_FUNCTION_INFO_V1(document_delete_many);
 
 static Datum
 make_datum(char *attr_data, int len, json_typeid type, bool *is_null)
@@ -94,8 +107,7 @@ make_datum(char *attr_data, int len, json_typeid type, bool *is_null)
          return Float8GetDatum(d);
     case BOOLEAN:
          assert(len == 1);
-         memcpy(&i, attr_data, sizeof(int));
-         return BoolGetDatum(i);
+         return BoolGetDatum(*attr_data != 0);
     case DOCUMENT:
          dd = palloc0(VARHDRSZ + len);
          SET_VARSIZE(dd, VARHDRSZ + len);
@@ -214,9 +226,7 @@ document_get_internal(const char *doc,
 {
     int attr_id;
     json_typeid type;
-    int natts;
-    char *attr_listing;
-    int buffpos;
+    int pos;
     char **path;
     char *path_arr_index_map;
     int path_depth;
@@ -251,31 +261,24 @@ document_get_internal(const char *doc,
         type = get_json_type(attr_pg_type);
     }
 
-    memcpy(&natts, doc, sizeof(int));
-    buffpos = sizeof(int);
+    if (attr_id < 0 || !doc_may_contain(doc, path[0]))
+    {
+        *is_null = true;
+        return (Datum)0;
+    }
 
-    attr_listing = NULL;
-    attr_listing = bsearch(&attr_id,
-                           doc + buffpos,
-                           natts,
-                           sizeof(int),
-                           int_comparator);
-    // elog(WARNING, "found listing");
+    pos = doc_find_attr(doc, attr_id);
     // elog(WARNING, "attr id %d", attr_id);
-    // elog(WARNING, "natts %d", natts);
 
-    if (attr_listing) /* TODO: separate attr_listing == NULL */
+    if (pos >= 0)
     {
-        int pos;
         int offstart, offend;
         int len;
         char *attr_data;
         char *subpath; /* In the case of a nested doc or array */
 
-        pos = (attr_listing - buffpos - doc) / sizeof(int);
-        buffpos += natts * sizeof(int);
-        memcpy(&offstart, doc + buffpos + pos * sizeof(int), sizeof(int));
-        memcpy(&offend, doc + buffpos + (pos + 1) * sizeof(int), sizeof(int));
+        offstart = doc_offset(doc, pos);
+        offend = doc_offset(doc, pos + 1);
         len = offend - offstart;
 
         attr_data = palloc0(len + 1);
@@ -332,182 +335,549 @@ document_get_internal(const char *doc,
     }
 }
 
+/* The binary value at a path of nested document keys (no array indexes), or
+ * NULL if doc doesn't have it */
+static const char *
+document_find_internal(const char *doc,
+                       char *attr_path,
+                       const char *attr_pg_type,
+                       int *len)
+{
+    char **path;
+    char *path_arr_index_map;
+    int path_depth;
+    int depth;
+
+    path_depth = parse_attr_path(attr_path, &path, &path_arr_index_map);
+    for (depth = 0; depth < path_depth; depth++)
+    {
+        const char *pg_type;
+        int attr_id;
+        int pos;
+
+        if (path_arr_index_map[depth])
+        {
+            elog(ERROR, "document_find_internal: array indexes are not supported - %s",
+                 attr_path);
+        }
+        pg_type = depth == path_depth - 1 ? attr_pg_type : DOCUMENT_TYPE;
+        attr_id = get_attribute_id(path[depth], pg_type);
+        if (attr_id < 0 || !doc_may_contain(doc, path[depth]))
+        {
+            return NULL;
+        }
+
+        pos = doc_find_attr(doc, attr_id);
+        if (pos < 0)
+        {
+            return NULL;
+        }
+        *len = doc_offset(doc, pos + 1) - doc_offset(doc, pos);
+        doc += doc_offset(doc, pos);
+    }
+
+    return path_depth > 0 ? doc : NULL;
+}
+
+typedef struct array_builder {
+    Oid elemtype;
+    json_typeid elemjsontype;
+    int ndims;
+    int dims[MAXDIM];
+    int leaf_depth; /* Depth of the arrays holding values, once seen */
+    Datum *values;
+    int nvalues;
+    int maxvalues;
+} array_builder;
+
+/* Add the values of a binary array at depth to builder. Returns false unless
+ * it fits the shape seen so far: arrays of equal length at each depth, and
+ * values of the element type at the deepest */
+static bool
+collect_array(const char *arr, int depth, array_builder *builder)
+{
+    int arrlen;
+    json_typeid type;
+    int buffpos;
+    int i;
+
+    memcpy(&arrlen, arr, sizeof(int));
+    memcpy(&type, arr + sizeof(int), sizeof(int));
+
+    if (depth == builder->ndims)
+    {
+        if (depth >= MAXDIM)
+        {
+            return false;
+        }
+        builder->dims[builder->ndims++] = arrlen;
+    }
+    else if (builder->dims[depth] != arrlen)
+    {
+        return false;
+    }
+    if (arrlen == 0)
+    {
+        return true;
+    }
+
+    if (type != ARRAY)
+    {
+        if (type != builder->elemjsontype ||
+            (builder->leaf_depth >= 0 && builder->leaf_depth != depth))
+        {
+            return false;
+        }
+        builder->leaf_depth = depth;
+    }
+    else if (builder->leaf_depth >= 0 && depth >= builder->leaf_depth)
+    {
+        return false;
+    }
+
+    buffpos = 2 * sizeof(int);
+    for (i = 0; i < arrlen; i++)
+    {
+        int itemlen;
+        bool is_null;
+
+        memcpy(&itemlen, arr + buffpos, sizeof(int));
+        buffpos += sizeof(int);
+        if (type == ARRAY)
+        {
+            if (!collect_array(arr + buffpos, depth + 1, builder))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (builder->nvalues == builder->maxvalues)
+            {
+                builder->maxvalues *= 2;
+                builder->values = repalloc(builder->values,
+                                           builder->maxvalues * sizeof(Datum));
+            }
+            is_null = false;
+            builder->values[builder->nvalues++] = make_datum((char*)arr + buffpos,
+                                                             itemlen,
+                                                             type,
+                                                             &is_null);
+        }
+        buffpos += itemlen;
+    }
+    return true;
+}
+
+/* A binary array as a native array of elemtype, with a dimension per level of
+ * nesting. Sets *is_null if it doesn't fit one (ragged, or of another type) */
+static Datum
+array_to_datum(const char *arr, Oid elemtype, bool *is_null)
+{
+    array_builder builder;
+    int lbs[MAXDIM];
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    int i;
+
+    builder.elemtype = elemtype;
+    switch (elemtype)
+    {
+    case INT8OID:
+        builder.elemjsontype = INTEGER;
+        break;
+    case FLOAT8OID:
+        builder.elemjsontype = FLOAT;
+        break;
+    case BOOLOID:
+        builder.elemjsontype = BOOLEAN;
+        break;
+    case TEXTOID:
+        builder.elemjsontype = STRING;
+        break;
+    default:
+        builder.elemjsontype = DOCUMENT;
+    }
+    builder.ndims = 0;
+    builder.leaf_depth = -1;
+    builder.nvalues = 0;
+    builder.maxvalues = 16;
+    builder.values = palloc(builder.maxvalues * sizeof(Datum));
+
+    if (!collect_array(arr, 0, &builder) ||
+        (builder.nvalues > 0 && builder.leaf_depth != builder.ndims - 1))
+    {
+        *is_null = true;
+        return (Datum)0;
+    }
+    if (builder.nvalues == 0)
+    {
+        return PointerGetDatum(construct_empty_array(elemtype));
+    }
+
+    for (i = 0; i < builder.ndims; i++)
+    {
+        lbs[i] = 1;
+    }
+    get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+    return PointerGetDatum(construct_md_array(builder.values,
+                                              NULL,
+                                              builder.ndims,
+                                              builder.dims,
+                                              lbs,
+                                              elemtype,
+                                              typlen,
+                                              typbyval,
+                                              typalign));
+}
+
+/* The value at a path of document keys, as its typed accessor would return
+ * it; arrays come back as native arrays of elemtype. Not counted as an
+ * access: this is for moving keys around, not for reading them */
 Datum
-document_get(PG_FUNCTION_ARGS)
+document_get_key(const char *doc,
+                 const char *attr_path,
+                 const char *attr_pg_type,
+                 Oid elemtype,
+                 bool *is_null)
 {
-    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
-    char *attr_path = (char*)PG_GETARG_CSTRING(1);
-    char *attr_pg_type = (char*)PG_GETARG_CSTRING(2);
+    *is_null = false;
+    if (get_json_type(attr_pg_type) == ARRAY)
+    {
+        const char *arr;
+        int len;
+
+        arr = document_find_internal(doc, pstrdup(attr_path), attr_pg_type, &len);
+        if (!arr)
+        {
+            *is_null = true;
+            return (Datum)0;
+        }
+        return array_to_datum(arr, elemtype, is_null);
+    }
+    return document_get_internal(doc,
+                                 pstrdup(attr_path),
+                                 (char*)attr_pg_type,
+                                 is_null);
+}
+
+/* Removes the value at a path of document keys; see document_put_internal */
+int
+document_delete_internal(const char *doc,
+                         int size,
+                         const char *attr_path,
+                         const char *attr_pg_type,
+                         char **outbinary)
+{
+    return document_put_internal((char*)doc,
+                                 size,
+                                 pstrdup(attr_path),
+                                 (char*)attr_pg_type,
+                                 NULL,
+                                 0,
+                                 outbinary);
+}
+
+/* Returns the document argument, or NULL if it cannot have the first key of
+ * attr_path: either no document ever had the key, or its bloom filter rules
+ * it out. For toasted documents the filter is read from a slice of the first
+ * few bytes, so the document is never fetched whole when the key is absent.
+ * The call is counted towards relid's key either way (see access.c) */
+static bytea *
+getarg_document_with_key(Datum datum,
+                         Oid relid,
+                         char *attr_path,
+                         char *attr_pg_type)
+{
+    char **path;
+    char *path_arr_index_map;
+    int path_depth;
+    char *pg_type;
+    int attr_id;
+    struct varlena *ptr;
+
+    path_depth = parse_attr_path(attr_path, &path, &path_arr_index_map);
+    if (path_depth == 0)
+    {
+        return NULL;
+    }
+    document_count_access(relid, path[0]);
+
+    ptr = (struct varlena*)DatumGetPointer(datum);
+    if (VARATT_IS_EXTERNAL(ptr) || VARATT_IS_COMPRESSED(ptr))
+    {
+        bytea *prefix;
+        bool may_contain;
+
+        prefix = DatumGetByteaPSlice(datum, 0, DOC_MAX_PREFIX_SIZE);
+        may_contain = doc_may_contain(prefix->vl_dat, path[0]);
+        pfree(prefix);
+        if (!may_contain)
+        {
+            return NULL;
+        }
+    }
+
+    pg_type = attr_pg_type;
+    if (path_depth > 1)
+    {
+        pg_type = get_pg_type_for_path(path,
+                                       path_arr_index_map,
+                                       path_depth,
+                                       attr_pg_type);
+    }
+    attr_id = get_attribute_id(path[0], pg_type);
+    if (attr_id < 0) /* No document has ever had the key */
+    {
+        return NULL;
+    }
+
+    return (bytea*)DatumGetByteaP(datum);
+}
+
+/*
+ * Look attr_path up in the document argument, as attr_pg_type; arrays come
+ * back as native arrays of elemtype if that is valid. Runs in a per-call
+ * arena (see document_arena_create): the detoasted document, the parsed path
+ * and the copies of values made on the way are freed together, and only the
+ * result is copied out.
+ */
+static Datum
+document_get_in_arena(FunctionCallInfo fcinfo,
+                      char *attr_path,
+                      char *attr_pg_type,
+                      Oid elemtype,
+                      bool *is_null)
+{
+    MemoryContext arena;
+    MemoryContext oldcontext;
+    bytea *datum;
     Datum retval;
-    bool is_null;
+    json_typeid type;
 
-    is_null = false;
-    retval = document_get_internal(datum->vl_dat,
-                                   attr_path,
-                                   attr_pg_type,
-                                   &is_null);
-    // elog(WARNING, "got retval");
-    if (is_null)
+    arena = document_arena_create();
+    oldcontext = MemoryContextSwitchTo(arena);
+
+    retval = (Datum)0;
+    *is_null = true;
+    type = get_json_type(attr_pg_type);
+    datum = getarg_document_with_key(PG_GETARG_DATUM(0),
+                                     document_access_relid(fcinfo),
+                                     attr_path,
+                                     attr_pg_type);
+    if (datum)
     {
-        PG_RETURN_NULL();
+        *is_null = false;
+        if (type == ARRAY && OidIsValid(elemtype))
+        {
+            retval = document_get_key(datum->vl_dat,
+                                      attr_path,
+                                      attr_pg_type,
+                                      elemtype,
+                                      is_null);
+        }
+        else
+        {
+            retval = document_get_internal(datum->vl_dat,
+                                           attr_path,
+                                           attr_pg_type,
+                                           is_null);
+        }
     }
-    else
+
+    MemoryContextSwitchTo(oldcontext);
+    if (!*is_null)
     {
-        char *strval;
-        bytea *text_datum;
-        /* This is super inefficient, but w/e */
-        switch(get_json_type(attr_pg_type))
+        switch (type)
         {
-        case STRING:
-        case ARRAY:
-            return retval;
         case INTEGER:
-            strval = palloc0(101); /* TODO: what is range */
-            sprintf(strval, "%d", (int)retval);
-            break;
         case FLOAT:
-            strval = palloc0(101);
-            sprintf(strval, "%f", (double)retval);
+            retval = datumCopy(retval, FLOAT8PASSBYVAL, sizeof(int64));
             break;
         case BOOLEAN:
-            strval = palloc0(6);
-            sprintf(strval, "%s", ((int)retval ? "true" : "false"));
-            break;
-        case DOCUMENT:
-            strval = binary_document_to_string(((bytea*)retval)->vl_dat);
             break;
-        case NONE:
         default:
-            PG_RETURN_NULL();
+            retval = datumCopy(retval, false, -1);
         }
-        text_datum = palloc0(VARHDRSZ + strlen(strval));
-        SET_VARSIZE(text_datum, VARHDRSZ + strlen(strval));
-        memcpy(text_datum->vl_dat, strval, strlen(strval));
-        pfree(strval);
-        return PointerGetDatum(text_datum);
     }
+    MemoryContextDelete(arena);
+
+    return retval;
+}
+
+/* The value as text, whatever its type */
+static Datum
+value_to_text(Datum value, json_typeid type)
+{
+    char *strval;
+
+    /* This is super inefficient, but w/e */
+    switch (type)
+    {
+    case STRING:
+    case ARRAY:
+        return value;
+    case INTEGER:
+        strval = psprintf("%d", (int)DatumGetInt64(value));
+        break;
+    case FLOAT:
+        strval = psprintf("%f", DatumGetFloat8(value));
+        break;
+    case BOOLEAN:
+        strval = pstrdup(DatumGetBool(value) ? "true" : "false");
+        break;
+    case DOCUMENT:
+        strval = binary_document_to_string(((bytea*)DatumGetPointer(value))->vl_dat);
+        break;
+    case NONE:
+    default:
+        elog(ERROR, "document_get: invalid type");
+    }
+
+    return CStringGetTextDatum(strval);
 }
 
 Datum
-document_get_int(PG_FUNCTION_ARGS)
+document_get(PG_FUNCTION_ARGS)
 {
-    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
     char *attr_path = (char*)PG_GETARG_CSTRING(1);
+    char *attr_pg_type = (char*)PG_GETARG_CSTRING(2);
+    json_typeid type;
     Datum retval;
     bool is_null;
 
-    is_null = false;
-    retval = document_get_internal(datum->vl_dat,
-                                   attr_path,
-                                   INTEGER_TYPE,
-                                   &is_null);
+    type = get_json_type(attr_pg_type);
+    if (type == NONE)
+    {
+        PG_RETURN_NULL();
+    }
 
+    retval = document_get_in_arena(fcinfo, attr_path, attr_pg_type, InvalidOid,
+                                   &is_null);
     if (is_null)
     {
         PG_RETURN_NULL();
     }
-    else
+    return value_to_text(retval, type);
+}
+
+Datum
+document_get_int(PG_FUNCTION_ARGS)
+{
+    char *attr_path = (char*)PG_GETARG_CSTRING(1);
+    Datum retval;
+    bool is_null;
+
+    retval = document_get_in_arena(fcinfo, attr_path, INTEGER_TYPE, InvalidOid,
+                                   &is_null);
+    if (is_null)
     {
-        return retval;
+        PG_RETURN_NULL();
     }
+    return retval;
 }
 
 Datum
 document_get_float(PG_FUNCTION_ARGS)
 {
-    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
     char *attr_path = (char*)PG_GETARG_CSTRING(1);
     Datum retval;
     bool is_null;
 
-    is_null = false;
-    retval = document_get_internal(datum->vl_dat,
-                                   attr_path,
-                                   FLOAT_TYPE,
+    retval = document_get_in_arena(fcinfo, attr_path, FLOAT_TYPE, InvalidOid,
                                    &is_null);
-
     if (is_null)
     {
         PG_RETURN_NULL();
     }
-    else
-    {
-        return retval;
-    }
+    return retval;
 }
 
 Datum
 document_get_bool(PG_FUNCTION_ARGS)
 {
-    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
     char *attr_path = (char*)PG_GETARG_CSTRING(1);
     Datum retval;
     bool is_null;
 
-    is_null = false;
-    retval = document_get_internal(datum->vl_dat,
-                                   attr_path,
-                                   BOOLEAN_TYPE,
+    retval = document_get_in_arena(fcinfo, attr_path, BOOLEAN_TYPE, InvalidOid,
                                    &is_null);
-
     if (is_null)
     {
         PG_RETURN_NULL();
     }
-    else
-    {
-        return retval;
-    }
+    return retval;
 }
 
 Datum
 document_get_text(PG_FUNCTION_ARGS)
 {
-    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
     char *attr_path = (char*)PG_GETARG_CSTRING(1);
     Datum retval;
     bool is_null;
 
-    is_null = false;
-    retval = document_get_internal(datum->vl_dat,
-                                   attr_path,
-                                   STRING_TYPE,
+    retval = document_get_in_arena(fcinfo, attr_path, STRING_TYPE, InvalidOid,
                                    &is_null);
-
     if (is_null)
     {
         PG_RETURN_NULL();
     }
-    else
-    {
-        return retval;
-    }
+    return retval;
 }
 
 Datum
 document_get_doc(PG_FUNCTION_ARGS)
 {
-    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
     char *attr_path = (char*)PG_GETARG_CSTRING(1);
     Datum retval;
     bool is_null;
 
-    is_null = false;
-    retval = document_get_internal(datum->vl_dat,
-                                   attr_path,
-                                   DOCUMENT_TYPE,
+    retval = document_get_in_arena(fcinfo, attr_path, DOCUMENT_TYPE, InvalidOid,
                                    &is_null);
-
     if (is_null)
     {
         PG_RETURN_NULL();
     }
-    else
+    return retval;
+}
+
+
+/*
+ * document_get_int_array and friends: an array key as a native array, one
+ * dimension per level of nesting, e.g. for bw_colupgrader to fill array
+ * columns without going through text. The element type is the declared
+ * result's. Arrays that don't fit it (ragged, or of other values) are NULL.
+ */
+Datum
+document_get_array(PG_FUNCTION_ARGS)
+{
+    char *attr_path = (char*)PG_GETARG_CSTRING(1);
+    char *attr_pg_type = (char*)PG_GETARG_CSTRING(2);
+    Oid *elemtype;
+    Datum retval;
+    bool is_null;
+
+    elemtype = (Oid*)fcinfo->flinfo->fn_extra;
+    if (!elemtype)
     {
-        return retval;
+        elemtype = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(Oid));
+        *elemtype = get_element_type(get_func_rettype(fcinfo->flinfo->fn_oid));
+        fcinfo->flinfo->fn_extra = elemtype;
+    }
+    if (get_json_type(attr_pg_type) != ARRAY)
+    {
+        elog(ERROR, "document_get_array: not an array type - %s", attr_pg_type);
     }
-}
 
+    retval = document_get_in_arena(fcinfo, attr_path, attr_pg_type, *elemtype,
+                                   &is_null);
+    if (is_null)
+    {
+        PG_RETURN_NULL();
+    }
+    return retval;
+}
 
 Datum
 document_delete(PG_FUNCTION_ARGS)
@@ -544,6 +914,198 @@ document_delete(PG_FUNCTION_ARGS)
     PG_RETURN_POINTER(outdatum);
 }
 
+/*
+ * Remove several top-level keys in one pass, e.g. all the columns
+ * bw_colupgrader materializes from a row, instead of one document_delete (and
+ * one copy of the document) per key. Keys are given as parallel arrays of names
+ * and types; keys the document lacks are ignored. Paths into nested documents
+ * (user.lang) are removed one at a time after that.
+ */
+Datum
+document_delete_many(PG_FUNCTION_ARGS)
+{
+    bytea *datum = (bytea*)PG_GETARG_BYTEA_P(0);
+    ArrayType *names = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType *types = PG_GETARG_ARRAYTYPE_P(2);
+    Datum *name_datums, *type_datums;
+    bool *name_nulls, *type_nulls;
+    int nnames, ntypes;
+    int *attr_ids;
+    int nids;
+    int i;
+    char *outbinary;
+    int outsize;
+    bytea *outdatum;
+
+    deconstruct_array(names, TEXTOID, -1, false, 'i',
+                      &name_datums, &name_nulls, &nnames);
+    deconstruct_array(types, TEXTOID, -1, false, 'i',
+                      &type_datums, &type_nulls, &ntypes);
+    if (nnames != ntypes)
+    {
+        elog(ERROR, "document_delete_many: key names and types differ in length");
+    }
+
+    attr_ids = palloc(Max(nnames, 1) * sizeof(int));
+    nids = 0;
+    for (i = 0; i < nnames; i++)
+    {
+        char *name;
+        int attr_id;
+
+        if (name_nulls[i] || type_nulls[i])
+        {
+            continue;
+        }
+        name = TextDatumGetCString(name_datums[i]);
+        if (strchr(name, '.'))
+        {
+            continue;
+        }
+        attr_id = get_attribute_id(name, TextDatumGetCString(type_datums[i]));
+        if (attr_id >= 0)
+        {
+            attr_ids[nids++] = attr_id;
+        }
+    }
+    qsort(attr_ids, nids, sizeof(int), int_comparator);
+
+    outsize = document_delete_many_internal(datum->vl_dat,
+                                            attr_ids,
+                                            nids,
+                                            &outbinary);
+    if (outsize < 0)
+    {
+        outbinary = datum->vl_dat;
+        outsize = VARSIZE(datum) - VARHDRSZ;
+    }
+
+    for (i = 0; i < nnames; i++)
+    {
+        char *name;
+        char *type;
+        char *nested_outbinary;
+        int nested_outsize;
+        int len;
+
+        if (name_nulls[i] || type_nulls[i])
+        {
+            continue;
+        }
+        name = TextDatumGetCString(name_datums[i]);
+        type = TextDatumGetCString(type_datums[i]);
+        /* Only if it's there: deleting from a missing container warns */
+        if (!strchr(name, '.') ||
+            !document_find_internal(outbinary, pstrdup(name), type, &len))
+        {
+            continue;
+        }
+        nested_outsize = document_delete_internal(outbinary,
+                                                  outsize,
+                                                  name,
+                                                  type,
+                                                  &nested_outbinary);
+        if (nested_outsize >= 0)
+        {
+            outbinary = nested_outbinary;
+            outsize = nested_outsize;
+        }
+    }
+
+    if (outbinary == datum->vl_dat)
+    {
+        PG_RETURN_POINTER(datum);
+    }
+    outdatum = palloc(VARHDRSZ + outsize);
+    SET_VARSIZE(outdatum, VARHDRSZ + outsize);
+    memcpy(outdatum->vl_dat, outbinary, outsize);
+
+    PG_RETURN_POINTER(outdatum);
+}
+
+/* attr_ids must be sorted. Returns -1 if doc has none of them */
+int
+document_delete_many_internal(const char *doc,
+                              int *attr_ids,
+                              int nids,
+                              char **outbinary)
+{
+    int natts, new_natts;
+    int prefix_size;
+    int size, new_size;
+    bool *keep;
+    int header;
+    int i, j, k;
+    int outpos;
+    int datapos;
+
+    natts = doc_natts(doc);
+    prefix_size = doc_prefix_size(doc);
+    size = doc_offset(doc, natts);
+
+    /* Both lists are sorted, so merge */
+    keep = palloc(Max(natts, 1) * sizeof(bool));
+    new_natts = natts;
+    new_size = size;
+    for (i = 0, j = 0; i < natts; i++)
+    {
+        int id;
+
+        id = doc_attr_id(doc, i);
+        while (j < nids && attr_ids[j] < id)
+        {
+            ++j;
+        }
+        keep[i] = !(j < nids && attr_ids[j] == id);
+        if (!keep[i])
+        {
+            --new_natts;
+            new_size -= doc_offset(doc, i + 1) - doc_offset(doc, i);
+            new_size -= 2 * sizeof(int);
+        }
+    }
+    if (new_natts == natts)
+    {
+        pfree(keep);
+        return -1;
+    }
+
+    *outbinary = palloc(new_size);
+    /* Keep the bloom filter; a deleted key's bits just stay set */
+    header = new_natts | (doc_has_bloom(doc) ? DOC_BLOOM_FLAG : 0);
+    memcpy(*outbinary, &header, sizeof(int));
+    memcpy(*outbinary + sizeof(int), doc + sizeof(int), prefix_size - sizeof(int));
+
+    outpos = prefix_size;
+    datapos = prefix_size + (2 * new_natts + 1) * sizeof(int);
+    for (i = 0, k = 0; i < natts; i++)
+    {
+        int id, start, len;
+
+        if (!keep[i])
+        {
+            continue;
+        }
+        id = doc_attr_id(doc, i);
+        start = doc_offset(doc, i);
+        len = doc_offset(doc, i + 1) - start;
+
+        memcpy(*outbinary + outpos + k * sizeof(int), &id, sizeof(int));
+        memcpy(*outbinary + outpos + (new_natts + k) * sizeof(int),
+               &datapos,
+               sizeof(int));
+        memcpy(*outbinary + datapos, doc + start, len);
+        datapos += len;
+        ++k;
+    }
+    memcpy(*outbinary + outpos + (2 * new_natts) * sizeof(int),
+           &new_size,
+           sizeof(int));
+
+    pfree(keep);
+    return new_size;
+}
+
 static int
 document_put_internal(char *doc,
                       int size,
@@ -566,6 +1128,8 @@ document_put_internal(char *doc,
     int item_size, old_item_size;
     json_typeid type;
     int buffpos, outbuffpos;
+    int prefix_size;
+    int header;
 
     // elog(WARNING, "%s", attr_path);
     path_depth = parse_attr_path(attr_path, &path, &path_arr_index_map);
@@ -603,7 +1167,8 @@ document_put_internal(char *doc,
         type = get_json_type(attr_pg_type); /* Unused, but for symmetry */
     }
 
-    natts = *(int*)(doc);
+    natts = doc_natts(doc);
+    prefix_size = doc_prefix_size(doc);
     /* Locate aid, if exists */
 
     attr_exists = false;
@@ -611,7 +1176,7 @@ document_put_internal(char *doc,
     {
         int id;
 
-        id = *(int*)(doc + sizeof(int) + i * sizeof(int));
+        id = doc_attr_id(doc, i);
         if (attr_id == id)
         {
             attr_exists = true;
@@ -640,8 +1205,8 @@ document_put_internal(char *doc,
             int start, end;
             char *subpath;
 
-            start = *(int*)(doc + (1 + natts + attr_pos) * sizeof(int));
-            end = *(int*)(doc + (1 + natts + attr_pos + 1) * sizeof(int));
+            start = doc_offset(doc, attr_pos);
+            end = doc_offset(doc, attr_pos + 1);
             old_item_size = end - start;
 
             if (type == ARRAY)
@@ -685,8 +1250,8 @@ document_put_internal(char *doc,
         {
             int start, end;
 
-            start = *(int*)(doc + (1 + natts + attr_pos) * sizeof(int));
-            end = *(int*)(doc + (1 + natts + attr_pos + 1) * sizeof(int));
+            start = doc_offset(doc, attr_pos);
+            end = doc_offset(doc, attr_pos + 1);
             old_item_size = end - start;
         }
         else
@@ -712,9 +1277,19 @@ document_put_internal(char *doc,
     }
     // elog(WARNING, "new size: %d", new_size);
     *outbinary = palloc0(new_size);
-    *(int*)(*outbinary) = new_natts - !(outitem);
-    buffpos = sizeof(int);
-    outbuffpos = sizeof(int);
+    /* Keep the bloom filter; a deleted key's bits just stay set */
+    header = (new_natts - !(outitem)) | (doc_has_bloom(doc) ? DOC_BLOOM_FLAG : 0);
+    memcpy(*outbinary, &header, sizeof(int));
+    if (doc_has_bloom(doc))
+    {
+        memcpy(*outbinary + sizeof(int), doc + sizeof(int), prefix_size - sizeof(int));
+        if (outitem)
+        {
+            doc_bloom_add((int*)(*outbinary + sizeof(int)), path[0]);
+        }
+    }
+    buffpos = prefix_size;
+    outbuffpos = prefix_size;
     for (i = 0; i < new_natts; ++i)
     {
         if (i == attr_pos && !attr_exists)
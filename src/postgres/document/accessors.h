@@ -0,0 +1,19 @@
+#ifndef ACCESSORS_H
+#define ACCESSORS_H
+
+Datum document_get_key(const char *doc,
+                       const char *attr_path,
+                       const char *attr_pg_type,
+                       Oid elemtype,
+                       bool *is_null);
+int document_delete_internal(const char *doc,
+                             int size,
+                             const char *attr_path,
+                             const char *attr_pg_type,
+                             char **outbinary);
+int document_delete_many_internal(const char *doc,
+                                  int *attr_ids,
+                                  int nids,
+                                  char **outbinary);
+
+#endif
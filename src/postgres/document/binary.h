@@ -0,0 +1,183 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <string.h>
+
+/* Binary document layout (see document_to_binary):
+ *
+ *   int natts               DOC_BLOOM_FLAG is set if a bloom filter follows
+ *   int bloom[DOC_BLOOM_WORDS]   optional; top-level key names present
+ *   int attr_ids[natts]     sorted ascending
+ *   int offsets[natts + 1]  from the start of the document; the last one is
+ *                           the total length
+ *   char data[]
+ *
+ * Binary array layout (see array_to_binary):
+ *
+ *   int arrlen
+ *   int elt_type            json_typeid of every element
+ *   { int len; char data[len]; } elts[arrlen]
+ *
+ * Nested values are not aligned, hence the memcpy.
+ */
+
+#define DOC_BLOOM_FLAG (1 << 30)
+#define DOC_NATTS_MASK (DOC_BLOOM_FLAG - 1)
+#define DOC_BLOOM_WORDS (4) /* 128 bits */
+#define DOC_BLOOM_MIN_NATTS (4) /* Smaller documents are cheap to search */
+/* Enough of a document to read its natts and bloom filter */
+#define DOC_MAX_PREFIX_SIZE ((1 + DOC_BLOOM_WORDS) * sizeof(int))
+
+static inline bool
+doc_has_bloom(const char *doc)
+{
+    int natts;
+
+    memcpy(&natts, doc, sizeof(int));
+    return (natts & DOC_BLOOM_FLAG) != 0;
+}
+
+static inline int
+doc_natts(const char *doc)
+{
+    int natts;
+
+    memcpy(&natts, doc, sizeof(int));
+    return natts & DOC_NATTS_MASK;
+}
+
+/* Size of natts and the bloom filter, i.e. where attr_ids start */
+static inline int
+doc_prefix_size(const char *doc)
+{
+    return (1 + (doc_has_bloom(doc) ? DOC_BLOOM_WORDS : 0)) * sizeof(int);
+}
+
+static inline int
+doc_attr_id(const char *doc, int i)
+{
+    int id;
+
+    memcpy(&id, doc + doc_prefix_size(doc) + i * sizeof(int), sizeof(int));
+    return id;
+}
+
+/* i ranges over [0, natts]; offset natts is the end of the last value */
+static inline int
+doc_offset(const char *doc, int i)
+{
+    int offset;
+
+    memcpy(&offset,
+           doc + doc_prefix_size(doc) + (doc_natts(doc) + i) * sizeof(int),
+           sizeof(int));
+    return offset;
+}
+
+/* Position of attr_id among doc's attributes, or -1 if doc doesn't have it.
+ * A binary search over attr_ids, read in place. It halves the range without
+ * branching on the comparison (a conditional move), so it always takes
+ * log2(natts) steps but never mispredicts, and the only branch is the loop's */
+static inline int
+doc_find_attr(const char *doc, int attr_id)
+{
+    const char *attr_ids;
+    int base, n;
+    int id;
+
+    attr_ids = doc + doc_prefix_size(doc);
+    n = doc_natts(doc);
+    if (n == 0)
+    {
+        return -1;
+    }
+    base = 0;
+    while (n > 1)
+    {
+        int half = n / 2;
+
+        memcpy(&id, attr_ids + (base + half) * sizeof(int), sizeof(int));
+        base = (id <= attr_id) ? base + half : base;
+        n -= half;
+    }
+    memcpy(&id, attr_ids + base * sizeof(int), sizeof(int));
+    return (id == attr_id) ? base : -1;
+}
+
+/* Starts loading doc's header (natts, bloom filter and the first attr_ids)
+ * into the cache, ahead of a lookup */
+static inline void
+doc_prefetch(const char *doc)
+{
+#ifdef __GNUC__
+    __builtin_prefetch(doc, 0, 3);
+    __builtin_prefetch(doc + 64, 0, 3);
+#endif
+}
+
+/* FNV-1a of a key name. Filters are keyed by name, not attribute id, so they
+ * answer "has a key called x" whatever its type, and can be checked before
+ * the attribute dictionary is consulted */
+static inline uint32
+doc_key_hash(const char *key_name)
+{
+    uint32 hash = 2166136261u;
+
+    for (; *key_name; key_name++)
+    {
+        hash ^= (unsigned char)*key_name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Two of the 128 bits per key, from independent parts of the hash */
+static inline void
+doc_bloom_bits(uint32 hash, int *bit1, int *bit2)
+{
+    *bit1 = hash & 0x7F;
+    *bit2 = (hash >> 16) & 0x7F;
+}
+
+static inline void
+doc_bloom_add(int *bloom, const char *key_name)
+{
+    int bit1, bit2;
+
+    doc_bloom_bits(doc_key_hash(key_name), &bit1, &bit2);
+    bloom[bit1 / 32] |= 1u << (bit1 % 32);
+    bloom[bit2 / 32] |= 1u << (bit2 % 32);
+}
+
+/* Whether bloom (DOC_BLOOM_WORDS ints, possibly unaligned) has both bits,
+ * as from doc_bloom_bits */
+static inline bool
+doc_bloom_has_bits(const char *bloom, int bit1, int bit2)
+{
+    int words[DOC_BLOOM_WORDS];
+
+    memcpy(words, bloom, sizeof(words));
+    return (words[bit1 / 32] & (1u << (bit1 % 32))) &&
+        (words[bit2 / 32] & (1u << (bit2 % 32)));
+}
+
+/* Whether bloom (DOC_BLOOM_WORDS ints, possibly unaligned) may hold key_name */
+static inline bool
+doc_bloom_may_contain(const char *bloom, const char *key_name)
+{
+    int bit1, bit2;
+
+    doc_bloom_bits(doc_key_hash(key_name), &bit1, &bit2);
+    return doc_bloom_has_bits(bloom, bit1, bit2);
+}
+
+/* False only if doc certainly has no top-level key called key_name. Only
+ * reads the first DOC_MAX_PREFIX_SIZE bytes */
+static inline bool
+doc_may_contain(const char *doc, const char *key_name)
+{
+    return !doc_has_bloom(doc) ||
+        doc_bloom_may_contain(doc + sizeof(int), key_name);
+}
+
+#endif
@@ -0,0 +1,295 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/brin_internal.h>
+#include <access/brin_tuple.h>
+#include <access/skey.h>
+#include <catalog/pg_type.h>
+#include <fmgr.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/typcache.h>
+
+#include "binary.h"
+#include "json.h"
+#include "schema.h"
+
+/*******************************************************************************
+ * Key presence
+ *
+ * Documents with at least DOC_BLOOM_MIN_NATTS keys carry a 128 bit bloom
+ * filter of their top-level key names (see binary.h). Accessors use it to
+ * answer for absent keys without looking at the payload; doc ? 'key' tests
+ * for a top-level key of any type; and the BRIN opclass below ORs the filters
+ * of a block range so that scans for rare keys skip whole ranges.
+ ******************************************************************************/
+
+#define DocumentExistsStrategyNumber (1)
+#define DocumentContainsStrategyNumber (2)
+
+Datum document_exists(PG_FUNCTION_ARGS);
+Datum brin_document_bloom_opcinfo(PG_FUNCTION_ARGS);
+Datum brin_document_bloom_add_value(PG_FUNCTION_ARGS);
+Datum brin_document_bloom_consistent(PG_FUNCTION_ARGS);
+Datum brin_document_bloom_union(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_exists);
+PG_FUNCTION_INFO_V1(brin_document_bloom_opcinfo);
+PG_FUNCTION_INFO_V1(brin_document_bloom_add_value);
+PG_FUNCTION_INFO_V1(brin_document_bloom_consistent);
+PG_FUNCTION_INFO_V1(brin_document_bloom_union);
+
+Datum
+document_exists(PG_FUNCTION_ARGS)
+{
+    char *key = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    struct varlena *ptr;
+    bytea *datum;
+    char *doc;
+    int natts;
+    int i;
+
+    /* For toasted documents the filter is read from a slice of the first few
+     * bytes, as in getarg_document_with_key, and the rest is only fetched if
+     * the filter lets the key through */
+    ptr = (struct varlena*)DatumGetPointer(PG_GETARG_DATUM(0));
+    if (VARATT_IS_EXTERNAL(ptr) || VARATT_IS_COMPRESSED(ptr))
+    {
+        bytea *prefix;
+        bool may_contain;
+
+        prefix = DatumGetByteaPSlice(PG_GETARG_DATUM(0), 0, DOC_MAX_PREFIX_SIZE);
+        may_contain = doc_may_contain(prefix->vl_dat, key);
+        pfree(prefix);
+        if (!may_contain)
+        {
+            PG_RETURN_BOOL(false);
+        }
+    }
+
+    datum = (bytea*)PG_GETARG_BYTEA_P(0);
+    doc = datum->vl_dat;
+    if (!doc_may_contain(doc, key))
+    {
+        PG_RETURN_BOOL(false);
+    }
+
+    natts = doc_natts(doc);
+    for (i = 0; i < natts; i++)
+    {
+        char *key_name, *key_type;
+
+        get_attr(doc_attr_id(doc, i), &key_name, &key_type);
+        if (key_name && !strcmp(key_name, key))
+        {
+            PG_RETURN_BOOL(true);
+        }
+    }
+    PG_RETURN_BOOL(false);
+}
+
+/*******************************************************************************
+ * BRIN opclass
+ *
+ * The summary of a block range is a bytea holding the OR of the filters of
+ * its documents. A document without a filter sets every bit, so the range is
+ * never skipped.
+ *
+ * The summary is no bigger than a document's filter, 128 bits with two per
+ * key name, so what fills it is the number of distinct top-level key names in
+ * the range, not the number of documents. With a couple of dozen names about a
+ * third of the bits are set and a probe for an absent key still skips most
+ * ranges; with a hundred or more it is nearly all ones and skips nothing. So
+ * the opclass pays off for collections with a small key vocabulary, or whose
+ * rare keys cluster by insertion order, with a small pages_per_range; it can't
+ * be made larger, as the documents' filters can't be rehashed into more bits.
+ ******************************************************************************/
+
+#define SUMMARY_SIZE (VARHDRSZ + DOC_BLOOM_WORDS * sizeof(int))
+
+Datum
+brin_document_bloom_opcinfo(PG_FUNCTION_ARGS)
+{
+    BrinOpcInfo *result;
+
+    result = palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+    result->oi_nstored = 1;
+#if PG_VERSION_NUM >= 130000
+    result->oi_regular_nulls = true; /* The core tracks nulls for us */
+#endif
+    result->oi_typcache[0] = lookup_type_cache(BYTEAOID, 0);
+
+    PG_RETURN_POINTER(result);
+}
+
+Datum
+brin_document_bloom_add_value(PG_FUNCTION_ARGS)
+{
+    BrinValues *column = (BrinValues*)PG_GETARG_POINTER(1);
+    Datum newval = PG_GETARG_DATUM(2);
+    bool isnull = PG_GETARG_BOOL(3);
+    int bloom[DOC_BLOOM_WORDS];
+    int summary[DOC_BLOOM_WORDS];
+    bytea *prefix;
+    bytea *result;
+    int i;
+
+    if (isnull) /* Only before 13, when opclasses tracked nulls themselves */
+    {
+        if (column->bv_hasnulls)
+        {
+            PG_RETURN_BOOL(false);
+        }
+        column->bv_hasnulls = true;
+        PG_RETURN_BOOL(true);
+    }
+
+    /* The filter is in the first few bytes; don't detoast the rest */
+    prefix = DatumGetByteaPSlice(newval, 0, DOC_MAX_PREFIX_SIZE);
+    if (doc_has_bloom(prefix->vl_dat))
+    {
+        memcpy(bloom, prefix->vl_dat + sizeof(int), sizeof(bloom));
+    }
+    else
+    {
+        memset(bloom, 0xFF, sizeof(bloom));
+    }
+    pfree(prefix);
+
+    if (column->bv_allnulls)
+    {
+        memset(summary, 0, sizeof(summary));
+    }
+    else
+    {
+        memcpy(summary,
+               VARDATA_ANY(DatumGetPointer(column->bv_values[0])),
+               sizeof(summary));
+        for (i = 0; i < DOC_BLOOM_WORDS; i++)
+        {
+            if (bloom[i] & ~summary[i])
+            {
+                break;
+            }
+        }
+        if (i == DOC_BLOOM_WORDS)
+        {
+            PG_RETURN_BOOL(false); /* Nothing new */
+        }
+        pfree(DatumGetPointer(column->bv_values[0]));
+    }
+
+    for (i = 0; i < DOC_BLOOM_WORDS; i++)
+    {
+        summary[i] |= bloom[i];
+    }
+    result = palloc(SUMMARY_SIZE);
+    SET_VARSIZE(result, SUMMARY_SIZE);
+    memcpy(result->vl_dat, summary, sizeof(summary));
+    column->bv_values[0] = PointerGetDatum(result);
+    column->bv_allnulls = false;
+
+    PG_RETURN_BOOL(true);
+}
+
+Datum
+brin_document_bloom_consistent(PG_FUNCTION_ARGS)
+{
+    BrinValues *column = (BrinValues*)PG_GETARG_POINTER(1);
+    ScanKey key = (ScanKey)PG_GETARG_POINTER(2);
+    const char *summary;
+
+#if PG_VERSION_NUM < 130000
+    if (key->sk_flags & SK_ISNULL)
+    {
+        PG_RETURN_BOOL(column->bv_hasnulls || column->bv_allnulls);
+    }
+    if (column->bv_allnulls)
+    {
+        PG_RETURN_BOOL(false);
+    }
+#endif
+
+    summary = VARDATA_ANY(DatumGetPointer(column->bv_values[0]));
+    switch (key->sk_strategy)
+    {
+    case DocumentExistsStrategyNumber:
+        PG_RETURN_BOOL(doc_bloom_may_contain(summary,
+                                             text_to_cstring(DatumGetTextPP(
+                                                 key->sk_argument))));
+    case DocumentContainsStrategyNumber:
+        {
+            bytea *query = DatumGetByteaP(key->sk_argument);
+            int natts;
+            int i;
+
+            /* Every top-level key of the query must be in the range */
+            natts = doc_natts(query->vl_dat);
+            for (i = 0; i < natts; i++)
+            {
+                char *key_name, *key_type;
+
+                get_attr(doc_attr_id(query->vl_dat, i), &key_name, &key_type);
+                if (key_name && !doc_bloom_may_contain(summary, key_name))
+                {
+                    PG_RETURN_BOOL(false);
+                }
+            }
+            PG_RETURN_BOOL(true);
+        }
+    default:
+        elog(ERROR,
+             "brin_document_bloom_consistent: unknown strategy %d",
+             key->sk_strategy);
+    }
+
+    PG_RETURN_BOOL(true); /* To shut up compiler warnings */
+}
+
+Datum
+brin_document_bloom_union(PG_FUNCTION_ARGS)
+{
+    BrinValues *col_a = (BrinValues*)PG_GETARG_POINTER(1);
+    BrinValues *col_b = (BrinValues*)PG_GETARG_POINTER(2);
+    int summary_a[DOC_BLOOM_WORDS];
+    int summary_b[DOC_BLOOM_WORDS];
+    bytea *result;
+    int i;
+
+#if PG_VERSION_NUM < 130000
+    if (col_b->bv_hasnulls && !col_a->bv_hasnulls)
+    {
+        col_a->bv_hasnulls = true;
+    }
+#endif
+
+    if (col_b->bv_allnulls)
+    {
+        PG_RETURN_VOID();
+    }
+    if (col_a->bv_allnulls)
+    {
+        col_a->bv_allnulls = false;
+        col_a->bv_values[0] = datumCopy(col_b->bv_values[0], false, -1);
+        PG_RETURN_VOID();
+    }
+
+    memcpy(summary_a,
+           VARDATA_ANY(DatumGetPointer(col_a->bv_values[0])),
+           sizeof(summary_a));
+    memcpy(summary_b,
+           VARDATA_ANY(DatumGetPointer(col_b->bv_values[0])),
+           sizeof(summary_b));
+    for (i = 0; i < DOC_BLOOM_WORDS; i++)
+    {
+        summary_a[i] |= summary_b[i];
+    }
+
+    result = palloc(SUMMARY_SIZE);
+    SET_VARSIZE(result, SUMMARY_SIZE);
+    memcpy(result->vl_dat, summary_a, sizeof(summary_a));
+    pfree(DatumGetPointer(col_a->bv_values[0]));
+    col_a->bv_values[0] = PointerGetDatum(result);
+
+    PG_RETURN_VOID();
+}
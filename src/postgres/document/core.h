@@ -0,0 +1,100 @@
+#ifndef CORE_H
+#define CORE_H
+
+/*
+ * The encoder, decoder and key lookups (document.c, json.c, utils.c,
+ * hash_table.c, project.c and binary.h) build either into the extension or,
+ * with -DDOCUMENT_STANDALONE, into a plain C library that the microbenchmarks
+ * and core_test link against (see Makefile.standalone). They include this in
+ * place of postgres.h.
+ *
+ * In the server this is just postgres.h. Standalone, it declares the little
+ * of the backend the core uses: palloc and friends, which go through an
+ * allocator hook; elog, which goes through an error callback; and StringInfo.
+ * The attribute dictionary is then an in-memory one (see standalone.c)
+ * instead of document_schema._attributes.
+ */
+
+#ifndef DOCUMENT_STANDALONE
+
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+#include <lib/stringinfo.h>
+
+#else
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t uint8;
+typedef int32_t int32;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+#define PG_INT32_MAX INT32_MAX
+#define Max(x, y) ((x) > (y) ? (x) : (y))
+#define Min(x, y) ((x) < (y) ? (x) : (y))
+
+/* Error levels. As in the server, elog(ERROR) does not return */
+#define DEBUG5 10
+#define WARNING 19
+#define ERROR 21
+
+typedef struct document_allocator {
+    void *(*alloc)(size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*free)(void *ptr);
+} document_allocator;
+
+/* Gets every message at WARNING and above. For an ERROR it should not return
+ * (longjmp out, or exit); if it does, the process aborts */
+typedef void (*document_error_callback)(int level, const char *message);
+
+/* Either argument may be NULL, for malloc and for printing to stderr and
+ * exiting on ERROR. Call before anything else in the library */
+void document_standalone_init(const document_allocator *allocator,
+                              document_error_callback error_callback);
+
+void *palloc(size_t size);
+void *palloc0(size_t size);
+void *repalloc(void *ptr, size_t size);
+void pfree(void *ptr);
+char *pstrdup(const char *str);
+
+void document_elog(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+#define elog(level, ...) \
+    do \
+    { \
+        document_elog(level, __VA_ARGS__); \
+        if ((level) >= ERROR) \
+        { \
+            abort(); \
+        } \
+    } while (0)
+
+typedef struct StringInfoData {
+    char *data;
+    int   len;
+    int   maxlen;
+    int   cursor;
+} StringInfoData;
+
+typedef StringInfoData *StringInfo;
+
+void initStringInfo(StringInfo str);
+void resetStringInfo(StringInfo str);
+void enlargeStringInfo(StringInfo str, int needed);
+void appendStringInfo(StringInfo str, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void appendStringInfoString(StringInfo str, const char *s);
+void appendStringInfoChar(StringInfo str, char ch);
+void appendBinaryStringInfo(StringInfo str, const char *data, int datalen);
+
+#endif
+
+#endif
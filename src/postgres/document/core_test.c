@@ -0,0 +1,330 @@
+#include "core.h" /* Built with -DDOCUMENT_STANDALONE; see Makefile.standalone */
+
+#include <setjmp.h>
+
+#include "binary.h"
+#include "document.h"
+#include "project.h"
+#include "schema.h"
+
+static int test_passed = 0;
+static int test_failed = 0;
+
+/* Terminate current test with error */
+#define fail() return __LINE__
+
+/* Successful end of the test case */
+#define done() return 0
+
+/* Check single condition */
+#define check(cond) do { if (!(cond)) fail(); } while (0)
+
+/* Test runner */
+static void
+test(int (*func)(void), const char *name)
+{
+    int r = func();
+
+    if (r == 0)
+    {
+        test_passed++;
+    }
+    else
+    {
+        test_failed++;
+        printf("FAILED: %s (at line %d)\n", name, r);
+    }
+}
+
+/* Allocator and error hooks that record what they see */
+
+static int num_allocs = 0;
+static int last_error_level = 0;
+static jmp_buf *error_jump = NULL;
+
+static void *
+counting_alloc(size_t size)
+{
+    num_allocs++;
+    return malloc(size);
+}
+
+static void *
+counting_realloc(void *ptr, size_t size)
+{
+    num_allocs++;
+    return realloc(ptr, size);
+}
+
+static void
+recording_error_callback(int level, const char *message)
+{
+    last_error_level = level;
+    if (level >= ERROR)
+    {
+        if (!error_jump)
+        {
+            fprintf(stderr, "ERROR: %s\n", message);
+            exit(EXIT_FAILURE);
+        }
+        longjmp(*error_jump, 1);
+    }
+}
+
+static char *
+serialize(const char *json, int *size)
+{
+    char *copy;
+    char *binary;
+
+    copy = pstrdup(json);
+    *size = document_to_binary(copy, &binary);
+    pfree(copy);
+    return binary;
+}
+
+/* The binary value of key_name, or NULL */
+static const char *
+find_value(const char *binary, const char *key_name, const char *type_name,
+           int *len)
+{
+    int attr_id;
+    int pos;
+
+    attr_id = get_attribute_id(key_name, type_name);
+    if (attr_id < 0 || !doc_may_contain(binary, key_name))
+    {
+        return NULL;
+    }
+    pos = doc_find_attr(binary, attr_id);
+    if (pos < 0)
+    {
+        return NULL;
+    }
+    *len = doc_offset(binary, pos + 1) - doc_offset(binary, pos);
+    return binary + doc_offset(binary, pos);
+}
+
+static int
+test_round_trip(void)
+{
+    char *binary;
+    char *json;
+    int size;
+
+    binary = serialize("{\"a\" : 1, \"b\" : \"two\", \"c\" : true, \"d\" : 2.5}",
+                       &size);
+    check(size > 0 && size == doc_offset(binary, doc_natts(binary)));
+    check(doc_natts(binary) == 4);
+
+    json = binary_document_to_string(binary);
+    check(strstr(json, "\"a\":1"));
+    check(strstr(json, "\"b\":\"two\""));
+    check(strstr(json, "\"c\":true"));
+    check(strstr(json, "\"d\":2.5"));
+
+    pfree(json);
+    pfree(binary);
+    done();
+}
+
+static int
+test_lookup(void)
+{
+    char *binary;
+    const char *value;
+    int size;
+    int len;
+    int i;
+
+    binary = serialize("{\"x\" : 7, \"y\" : \"why\", \"z\" : [\"p\", \"q\"]}", &size);
+
+    value = find_value(binary, "x", INTEGER_TYPE, &len);
+    check(value && len == sizeof(int));
+    memcpy(&i, value, sizeof(int));
+    check(i == 7);
+
+    value = find_value(binary, "y", STRING_TYPE, &len);
+    check(value && len == 3 && !memcmp(value, "why", 3));
+
+    check(find_value(binary, "z", STRING_TYPE "[]", &len));
+    /* Same name, other type */
+    check(!find_value(binary, "x", STRING_TYPE, &len));
+    check(!find_value(binary, "missing", INTEGER_TYPE, &len));
+
+    pfree(binary);
+    done();
+}
+
+static int
+test_shared_ids(void)
+{
+    char *binary1, *binary2;
+    int size;
+
+    binary1 = serialize("{\"shared\" : 1, \"only1\" : 1}", &size);
+    binary2 = serialize("{\"only2\" : 2, \"shared\" : 2}", &size);
+
+    check(doc_find_attr(binary1, get_attribute_id("shared", INTEGER_TYPE)) >= 0);
+    check(doc_find_attr(binary2, get_attribute_id("shared", INTEGER_TYPE)) >= 0);
+    check(doc_find_attr(binary2, get_attribute_id("only1", INTEGER_TYPE)) < 0);
+
+    pfree(binary1);
+    pfree(binary2);
+    done();
+}
+
+static int
+test_nested(void)
+{
+    char *binary;
+    const char *nested;
+    const char *value;
+    int size;
+    int len;
+
+    binary = serialize("{\"outer\" : {\"inner\" : \"deep\"}}", &size);
+    nested = find_value(binary, "outer", DOCUMENT_TYPE, &len);
+    check(nested);
+    value = find_value(nested, "inner", STRING_TYPE, &len);
+    check(value && len == 4 && !memcmp(value, "deep", 4));
+
+    pfree(binary);
+    done();
+}
+
+static int
+test_bloom_filter(void)
+{
+    char *binary;
+    int size;
+
+    binary = serialize("{\"k1\" : 1, \"k2\" : 2, \"k3\" : 3, \"k4\" : 4}", &size);
+    check(doc_has_bloom(binary));
+    check(doc_may_contain(binary, "k1") && doc_may_contain(binary, "k4"));
+    pfree(binary);
+
+    binary = serialize("{\"k1\" : 1}", &size);
+    check(!doc_has_bloom(binary));
+    pfree(binary);
+    done();
+}
+
+static int
+test_find_attr(void)
+{
+    char *binary;
+    int size;
+    int natts;
+    int i;
+
+    binary = serialize("{\"a1\" : 1, \"a2\" : 2, \"a3\" : 3, \"a4\" : 4, "
+                       "\"a5\" : 5, \"a6\" : 6, \"a7\" : 7}", &size);
+    natts = doc_natts(binary);
+    check(natts == 7);
+    for (i = 0; i < natts; i++)
+    {
+        check(doc_find_attr(binary, doc_attr_id(binary, i)) == i);
+    }
+    check(doc_find_attr(binary, doc_attr_id(binary, 0) - 1) < 0);
+    check(doc_find_attr(binary, doc_attr_id(binary, natts - 1) + 1) < 0);
+    pfree(binary);
+    done();
+}
+
+static int
+test_project_batch(void)
+{
+    const char *keys[] = { "name", "age", "nowhere" };
+    const char *types[] = { STRING_TYPE, INTEGER_TYPE, STRING_TYPE };
+    char *binaries[3];
+    const char *docs[4];
+    doc_projection *proj;
+    doc_column *columns;
+    int size;
+
+    binaries[0] = serialize("{\"name\" : \"ann\", \"age\" : 31}", &size);
+    binaries[1] = serialize("{\"name\" : \"bob\"}", &size);
+    binaries[2] = serialize("{\"p1\" : 1, \"p2\" : 2, \"p3\" : 3, \"age\" : 7}",
+                            &size);
+    docs[0] = binaries[0];
+    docs[1] = binaries[1];
+    docs[2] = NULL;
+    docs[3] = binaries[2];
+
+    proj = doc_projection_compile(3, keys, types);
+    check(proj->attr_ids[2] < 0);
+    columns = doc_columns_create(proj, 4);
+    doc_project_batch(proj, docs, 4, columns);
+
+    check(!doc_column_is_null(&columns[0], 0) && columns[0].lengths[0] == 3 &&
+          !memcmp(columns[0].values[0], "ann", 3));
+    check(!doc_column_is_null(&columns[0], 1) &&
+          !memcmp(columns[0].values[1], "bob", 3));
+    check(doc_column_is_null(&columns[0], 2) && !columns[0].values[2]);
+    check(doc_column_is_null(&columns[0], 3));
+    check(!doc_column_is_null(&columns[1], 0) && columns[1].lengths[0] > 0);
+    check(doc_column_is_null(&columns[1], 1) && columns[1].lengths[1] == 0);
+    check(!doc_column_is_null(&columns[1], 3));
+    check(doc_column_is_null(&columns[2], 0) && doc_column_is_null(&columns[2], 3));
+
+    doc_columns_free(proj, columns);
+    doc_projection_free(proj);
+    pfree(binaries[0]);
+    pfree(binaries[1]);
+    pfree(binaries[2]);
+    done();
+}
+
+static int
+test_allocator_hook(void)
+{
+    char *binary;
+    int size;
+
+    num_allocs = 0;
+    binary = serialize("{\"counted\" : \"yes\"}", &size);
+    check(num_allocs > 0);
+    pfree(binary);
+    done();
+}
+
+static int
+test_error_callback(void)
+{
+    jmp_buf jump;
+    char *volatile binary = NULL;
+    int size;
+
+    last_error_level = 0;
+    error_jump = &jump;
+    if (setjmp(jump) == 0)
+    {
+        binary = serialize("{\"unterminated\" : ", &size);
+    }
+    error_jump = NULL;
+
+    check(!binary);
+    check(last_error_level == ERROR);
+    done();
+}
+
+int
+main(void)
+{
+    document_allocator allocator = { counting_alloc, counting_realloc, free };
+
+    document_standalone_init(&allocator, recording_error_callback);
+
+    test(test_round_trip, "serialize and print a flat document");
+    test(test_lookup, "find values by attribute id");
+    test(test_shared_ids, "attribute ids are shared across documents");
+    test(test_nested, "find values in nested documents");
+    test(test_bloom_filter, "bloom filters on larger documents");
+    test(test_find_attr, "binary search finds every attribute");
+    test(test_project_batch, "project keys out of a batch of documents");
+    test(test_allocator_hook, "allocations go through the allocator hook");
+    test(test_error_callback, "errors go through the error callback");
+    printf("\nPASSED: %d\nFAILED: %d\n", test_passed, test_failed);
+    return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
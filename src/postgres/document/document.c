@@ -1,19 +1,18 @@
-#include <postgres.h> /* This include must precede all other postgres
-                         dependencies */
+#include "core.h" /* This include must precede all other postgres
+                     dependencies */
 
 #include <assert.h>
 
-#include <catalog/pg_type.h>
-#include <executor/spi.h>
-#include <lib/stringinfo.h>
-#include <utils/snapmgr.h>
-#include <utils/array.h>
-
 #include "lib/jsmn/jsmn.h"
+#include "binary.h"
 #include "document.h"
 #include "schema.h"
 #include "utils.h"
 
+/* Whether new documents get a bloom filter of their top-level key names (see
+ * binary.h); set by the document_type.bloom_filter GUC */
+bool document_bloom_filter = true;
+
 /*******************************************************************************
  * String -> Binary
  ******************************************************************************/
@@ -27,18 +26,20 @@ json_to_document(char *json, document *doc)
     size_t i, j;
     typedef enum { START, KEY, VALUE } parse_state;
     parse_state state;
+    char *keyname; /* Read in the KEY state, stored in the VALUE state after */
 
     assert(json);
     assert(doc);
 
     tokens = jsmn_tokenize(json);
     natts = 0;
+    capacity = 0;
+    keyname = NULL;
 
     state = START;
     for (i = 0, j = 1; j > 0; ++i, --j)
     {
         jsmntok_t *curtok;
-        char *keyname;
         char *value;
         json_typeid type;
 
@@ -66,7 +67,6 @@ json_to_document(char *json, document *doc)
             state = VALUE;
             break;
         case VALUE:
-            value = jsmntok_to_str(curtok, json);
             type = jsmn_get_type(curtok, json);
             if (type == NONE) /* Implicit convention: explicit 'nulls' do not
                                  exist; i.e. don't include the key */
@@ -74,6 +74,7 @@ json_to_document(char *json, document *doc)
                 state = KEY;
                 break;
             }
+            value = jsmntok_to_str(curtok, json);
 
             if (curtok->type == JSMN_ARRAY)
             {
@@ -210,65 +211,89 @@ int
 document_to_binary(char *json, char **outbuff_ref)
 {
     document doc;
+    int *attr_ids;
+    char **type_names;
+    int i;
+    int size;
+
+    json_to_document(json, &doc);
+    attr_ids = palloc0(doc.natts * sizeof(int));
+    type_names = palloc0(doc.natts * sizeof(char*));
+
+    for (i = 0; i < doc.natts; i++)
+    {
+        type_names[i] = get_pg_type(doc.types[i], doc.values[i]);
+    }
+    resolve_attributes(doc.natts, doc.keys, type_names, attr_ids);
+
+    size = document_fields_to_binary(&doc, attr_ids, outbuff_ref);
+
+    pfree(attr_ids);
+    pfree(type_names);
+
+    return size;
+}
+
+/* Serializes doc, whose ith key has attribute id attr_ids[i] (see
+ * resolve_attributes) */
+int
+document_fields_to_binary(document *doc, const int *attr_ids,
+                          char **outbuff_ref)
+{
     int natts;
     char *outbuff;
-    int  *attr_ids;
-    int **attr_id_refs; /* Just sort the pointers, so we can recover original
-                           positions */
+    const int **attr_id_refs; /* Just sort the pointers, so we can recover
+                                 original positions */
     int i;
     int data_size;
     int buffpos;
+    bool bloom;
+    int prefix_size; /* natts and bloom filter */
+    int header;
 
-    json_to_document(json, &doc);
-    natts = doc.natts;
-    attr_ids = palloc0(natts * sizeof(int));
+    natts = doc->natts;
     attr_id_refs = palloc0(natts * sizeof(int*));
 
-    outbuff = *outbuff_ref;
-
     for (i = 0; i < natts; i++)
     {
-        const char *type;
-
-        // elog(WARNING, "Key: %s",  doc.keys[i]);
-        // elog(WARNING, "type: %d", doc.types[i]);
-        // elog(WARNING, "value: %s",  doc.values[i]);
-
-        type = get_pg_type(doc.types[i], doc.values[i]);
-        attr_ids[i] = get_attribute_id(doc.keys[i], type);
-        if (attr_ids[i] < 0)
-        {
-            attr_ids[i] = add_attribute(doc.keys[i], type);
-        }
         attr_id_refs[i] = attr_ids + i;
     }
     qsort(attr_id_refs, natts, sizeof(int*), intref_comparator);
 
-    data_size = 2 * natts * sizeof(int) + 1024; /* arbitrary initial value */
-    buffpos = 0;
+    bloom = document_bloom_filter && natts >= DOC_BLOOM_MIN_NATTS;
+    prefix_size = (1 + (bloom ? DOC_BLOOM_WORDS : 0)) * sizeof(int);
+
+    data_size = prefix_size + 2 * natts * sizeof(int) + 1024; /* arbitrary
+                                                                 initial value */
     outbuff = palloc0(data_size);
-    memcpy(outbuff, &natts, sizeof(int));
-    buffpos += sizeof(int);
+    header = natts | (bloom ? DOC_BLOOM_FLAG : 0);
+    memcpy(outbuff, &header, sizeof(int));
+    buffpos = prefix_size;
     for (i = 0; i < natts; i++)
     {
         memcpy(outbuff + buffpos, attr_id_refs[i], sizeof(int));
         buffpos += sizeof(int);
+        if (bloom)
+        {
+            doc_bloom_add((int*)(outbuff + sizeof(int)),
+                          doc->keys[attr_id_refs[i] - attr_ids]);
+        }
     }
     /* Copy data and offsets */
-    buffpos = sizeof(int) + 2 * sizeof(int) * natts +
+    buffpos = prefix_size + 2 * sizeof(int) * natts +
         sizeof(int); /* # attrs, attr_ids, offsets, length */
     for (i = 0; i < natts; i++)
     {
         char *binary;
-        int *attr_id_ref;
+        const int *attr_id_ref;
         int orig_pos;
         int datum_size;
 
         attr_id_ref = attr_id_refs[i];
         orig_pos = attr_id_ref - attr_ids;
         // elog(WARNING, "pos: %d", orig_pos);
-        // elog(WARNING, "type: %d", doc.types[orig_pos]);
-        datum_size = to_binary(doc.types[orig_pos], doc.values[orig_pos],
+        // elog(WARNING, "type: %d", doc->types[orig_pos]);
+        datum_size = to_binary(doc->types[orig_pos], doc->values[orig_pos],
             &binary);
         if (buffpos + datum_size >= data_size)
         {
@@ -276,16 +301,16 @@ document_to_binary(char *json, char **outbuff_ref)
             outbuff = repalloc(outbuff, data_size);
         }
         memcpy(outbuff + buffpos, binary, datum_size);
-        memcpy(outbuff + (1 + natts + i) * sizeof(int), &buffpos,
+        memcpy(outbuff + prefix_size + (natts + i) * sizeof(int), &buffpos,
             sizeof(int)); /* # attrs, attr_ids, ith offset */
         buffpos += datum_size;
 
         /* Cleanup */
         pfree(binary);
     }
-    memcpy(outbuff + (1 + 2 * natts) * sizeof(int), &buffpos, sizeof(int));
+    memcpy(outbuff + prefix_size + 2 * natts * sizeof(int), &buffpos,
+        sizeof(int));
 
-    pfree(attr_ids);
     pfree(attr_id_refs);
 
     *outbuff_ref = outbuff;
@@ -347,243 +372,188 @@ to_binary(json_typeid typeid, char *value, char **outbuff_ref)
 
 /*******************************************************************************
  * Binary -> Strng
+ *
+ * Everything is appended to one StringInfo, straight from the binary: no
+ * per-value buffers, and no guessing at how long a value's text will be.
  ******************************************************************************/
 
+static void append_binary_value(StringInfo buf,
+                                json_typeid type,
+                                const char *binary,
+                                int datum_len);
+
 void
-binary_to_document(char *binary, document *doc)
+append_binary_document(StringInfo buf, const char *binary)
 {
     int natts;
-    int buffpos;
-    char **keys;
-    json_typeid *types;
-    char **values;
-    int i; /* Loop variable */
-
-    assert(binary);
+    int i;
 
-    memcpy(&natts, binary, sizeof(int));
-    // elog(WARNING, "Natts: %d", natts);
-    buffpos = sizeof(int);
+    natts = doc_natts(binary);
 
-    keys = palloc0(natts * sizeof(char*));
-    values = palloc0(natts * sizeof(char*));
-    types = palloc0(natts * sizeof(json_typeid));
+    appendStringInfoString(buf, "{\n");
     for (i = 0; i < natts; i++)
     {
-        int id;
         char *key_string;
         char *type_string;
+        int start, end;
 
-        memcpy(&id, binary + buffpos, sizeof(int));
-        get_attr(id, &key_string, &type_string);
-        // elog(WARNING, "Got attribute info for: %d: %s, %s", id, key_string, type_string);
+        get_attr(doc_attr_id(binary, i), &key_string, &type_string);
+        if (!key_string)
+        {
+            elog(ERROR, "document: unknown attribute id %d", doc_attr_id(binary, i));
+        }
+        start = doc_offset(binary, i);
+        end = doc_offset(binary, i + 1);
 
-        keys[i] = pstrndup(key_string, strlen(key_string));
-        types[i] = get_json_type(type_string);
+        appendStringInfo(buf, "\"%s\":", key_string);
+        append_binary_value(buf,
+                            get_json_type(type_string),
+                            binary + start,
+                            end - start);
+        appendStringInfoString(buf, ",\n");
 
         pfree(key_string);
         pfree(type_string);
-
-        buffpos += sizeof(int);
-    }
-    // elog(WARNING, "Got ids, keys, and types");
-
-    // TODO: combine with above
-    for (i = 0; i < natts; i++)
-    {
-        int start, end;
-        char *value_data;
-
-        memcpy(&start, binary + buffpos, sizeof(int));
-        memcpy(&end, binary + buffpos + sizeof(int), sizeof(int));
-
-        value_data = palloc0(end - start);
-        memcpy(value_data, binary + start, end - start);
-        // elog(WARNING, "converting value to binary");
-        // elog(WARNING, "start: %d, end: %d", start, end);
-        // elog(WARNING, "types[i]: %d", types[i]);
-        values[i] = binary_to_string(types[i], value_data, end - start);
-        // elog(WARNING, "key: %s", keys[i]);
-        // elog(WARNING, "type: %d", types[i]);
-        // elog(WARNING, "value: %s", values[i]);
-
-        pfree(value_data);
-
-        buffpos += sizeof(int);
-    }
-
-    doc->natts = natts;
-    doc->keys = keys;
-    doc->types = types;
-    doc->values = values;
-
-    /* FIXME: technically should free all the memory */
-}
-
-char *
-binary_document_to_string(char *binary)
-{
-    document doc;
-    int natts;
-    char *result;
-    int result_size, result_maxsize;
-    int i; /* Loop variable */
-
-    binary_to_document(binary, &doc);
-    // elog(WARNING, "converted  doc");
-    natts = doc.natts;
-
-    result_size = 3; /* {\n} */
-    result_maxsize = 64; // TODO: #define
-    result = palloc0(result_maxsize + 1);
-    strcat(result, "{\n");
-
-    for (i = 0; i < natts; i++)
-    {
-        char *key;
-        char *value;
-        char *attr;
-        int attr_len;
-
-        key = doc.keys[i];
-        value = doc.values[i];
-
-        attr_len = strlen(key) + strlen(value) + 5; /* "k":v,\n" */
-        attr = palloc0(attr_len + 1);
-        sprintf(attr, "\"%s\":%s,\n", key, value);
-        // elog(WARNING, "key: %s", key);
-        // elog(WARNING, "val: %s", value);
-        // elog(WARNING, "attr: %s", attr);
-
-        if (result_size + attr_len + 1 >= result_maxsize)
-        {
-            result_maxsize = 2 * (result_size + attr_len) + 1;
-            //elog(WARNING, "result pre repalloc: %s", result);
-            result = repalloc(result, result_maxsize + 1);
-            //elog(WARNING, "result post repalloc: %s", result);
-        }
-        //elog(WARNING, "result: %s", result);
-        strcat(result, attr);
-        //elog(WARNING, "result: %s", result);
-        result_size += attr_len;
     }
-    strcat(result, "}"); /* There is space because we keep adding an extra bit
-                            to result_maxsize */
-
-    return result;
+    appendStringInfoChar(buf, '}');
 }
 
-char *
-binary_array_to_string(char *binary)
+static void
+append_binary_array(StringInfo buf, const char *binary)
 {
     int buffpos;
     int natts;
     json_typeid type;
-    char *result;
-    int result_size, result_maxsize;
-    int i; /* Loop variable */
-
-    assert(binary);
+    int i;
 
-    // elog(WARNING, "in binary array to string");
     memcpy(&natts, binary, sizeof(int));
-    // elog(WARNING, "natts: %d", natts);
     memcpy(&type, binary + sizeof(int), sizeof(int));
-    // elog(WARNING, "type: %d", type);
     buffpos = 2 * sizeof(int);
 
-    result_size = 2; /* '[]' */
-    result_maxsize = 64;
-    result = palloc0(result_maxsize + 1);
-    strcat(result, "{");
-
-    // elog(WARNING, "converting binary array to str with natts:%d", natts);
-    for (i = 0; i < natts; i++) {
+    appendStringInfoChar(buf, '{');
+    for (i = 0; i < natts; i++)
+    {
         int elt_size;
-        char *elt;
 
         memcpy(&elt_size, binary + buffpos, sizeof(int));
-        if (result_size + elt_size + 2 + 1 >= result_maxsize) {
-            result_maxsize = 2 * (result_size + elt_size + 2) + 1;
-            result = repalloc(result, result_maxsize + 1);
-        }
-
-        result_size += sizeof(int);
         buffpos += sizeof(int);
 
-        if (i != 0) {
-           strcat(result, ", ");
+        if (i != 0)
+        {
+            appendStringInfoString(buf, ", ");
         }
-
-        elt = palloc0(elt_size);
-        memcpy(elt, binary + buffpos, elt_size);
-        strcat(result, binary_to_string(type, elt, elt_size));
-        pfree(elt);
-
-        result_size += elt_size;
+        append_binary_value(buf, type, binary + buffpos, elt_size);
         buffpos += elt_size;
     }
-    strcat(result, "}"); /* There is space because we keep adding an extra bit
-                            to result_maxsize */
-
-    return result;
+    appendStringInfoChar(buf, '}');
 }
 
-char *
-binary_to_string(json_typeid type, char *binary, int datum_len)
+static void
+append_binary_value(StringInfo buf,
+                    json_typeid type,
+                    const char *binary,
+                    int datum_len)
 {
     int i;
     double d;
-    char *temp; /* Store temporary result of conversion of raw string */
-    char *result;
-
-    assert(binary);
-
-    // elog(WARNING, "in binary to string");
-    // elog(WARNING, "type: %d", type);
-    // elog(WARNING, "len: %d", datum_len);
-    // elog(WARNING, "prod = %d", datum_len * 8 + 2 + 1);
-    result = palloc0(datum_len * 8 + 2 + 1); /* Guaranteed to be enough base 10 */
 
     switch (type)
     {
         case STRING:
-            temp = pstrndup(binary, datum_len);
-            sprintf(result, "\"%s\"", temp);
-            pfree(temp);
-            // elog(WARNING, "%s", result);
-            return result;
+            appendStringInfoChar(buf, '"');
+            appendBinaryStringInfo(buf, binary, strnlen(binary, datum_len));
+            appendStringInfoChar(buf, '"');
+            break;
         case INTEGER:
             assert(datum_len == sizeof(int));
             memcpy(&i, binary, sizeof(int));
-            sprintf(result, "%d", i);
-            // elog(WARNING, "%s", result);
-            return result;
+            appendStringInfo(buf, "%d", i);
+            break;
         case FLOAT:
             assert(datum_len == sizeof(double));
             memcpy(&d, binary, sizeof(double));
-            // sprintf(result, "%f", *(double*)binary)
-            sprintf(result, "%f", d);
-            // elog(WARNING, "%s", result);
-            return result;
+            appendStringInfo(buf, "%f", d);
+            break;
         case BOOLEAN:
             assert(datum_len == 1);
-            sprintf(result, "%s", *binary != 0 ? "true" : "false");
-            // elog(WARNING, "%s", result);
-            return result;
+            appendStringInfoString(buf, *binary != 0 ? "true" : "false");
+            break;
         case DOCUMENT:
-            /* pfree(result); Hack to get rid of segfault: in
-             * http://d.pr/i/UM8I
-             */
-            return binary_document_to_string(binary);
+            append_binary_document(buf, binary);
+            break;
         case ARRAY:
-            /* pfree(result); Hack to get rid of segfault: in
-             * http://d.pr/i/UM8I
-             */
-            return binary_array_to_string(binary);
+            append_binary_array(buf, binary);
+            break;
         case NONE:
         default:
             elog(ERROR, "document: invalid binary");
     }
+}
+
+void
+binary_to_document(char *binary, document *doc)
+{
+    int natts;
+    int i; /* Loop variable */
+
+    assert(binary);
+
+    natts = doc_natts(binary);
+    doc->natts = natts;
+    doc->keys = palloc(Max(natts, 1) * sizeof(char*));
+    doc->types = palloc(Max(natts, 1) * sizeof(json_typeid));
+    doc->values = palloc(Max(natts, 1) * sizeof(char*));
+    for (i = 0; i < natts; i++)
+    {
+        char *type_string;
+        int start, end;
+
+        get_attr(doc_attr_id(binary, i), &doc->keys[i], &type_string);
+        if (!doc->keys[i] || !type_string)
+        {
+            elog(ERROR, "document: unknown attribute id %d", doc_attr_id(binary, i));
+        }
+        doc->types[i] = get_json_type(type_string);
+        pfree(type_string);
+
+        start = doc_offset(binary, i);
+        end = doc_offset(binary, i + 1);
+        doc->values[i] = binary_to_string(doc->types[i], binary + start, end - start);
+    }
+}
+
+char *
+binary_document_to_string(char *binary)
+{
+    StringInfoData buf;
+
+    assert(binary);
+
+    initStringInfo(&buf);
+    append_binary_document(&buf, binary);
+    return buf.data;
+}
+
+char *
+binary_array_to_string(char *binary)
+{
+    StringInfoData buf;
+
+    assert(binary);
+
+    initStringInfo(&buf);
+    append_binary_array(&buf, binary);
+    return buf.data;
+}
+
+char *
+binary_to_string(json_typeid type, char *binary, int datum_len)
+{
+    StringInfoData buf;
+
+    assert(binary);
 
+    initStringInfo(&buf);
+    append_binary_value(&buf, type, binary, datum_len);
+    return buf.data;
 }
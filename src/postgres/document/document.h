@@ -1,3 +1,5 @@
+#include "core.h"
+
 #include "json.h"
 
 typedef struct {
@@ -7,9 +9,13 @@ typedef struct {
     char     **values;
 } document;
 
+extern bool document_bloom_filter;
+
 void json_to_document(char *json, document *doc);
 int array_to_binary(char *json_arr, char **outbuff_ref);
 int document_to_binary(char *json, char **outbuff_ref);
+int document_fields_to_binary(document *doc, const int *attr_ids,
+                              char **outbuff_ref);
 int to_binary(json_typeid type, char *value, char **outbuff_ref);
 
 /* TODO: should probably pass an outbuff ref in the same way as above */
@@ -19,5 +25,6 @@ int to_binary(json_typeid type, char *value, char **outbuff_ref);
  * do not face the same problem */
 void binary_to_document(char *binary, document *doc);
 char *binary_document_to_string(char *binary);
+void append_binary_document(StringInfo buf, const char *binary);
 char *binary_array_to_string(char *binary);
 char *binary_to_string(json_typeid type, char *binary, int datum_len);
@@ -5,6 +5,9 @@
 \echo Use "CREATE EXTENSION document_type" to load this file. \quit
 
 -- NOTE: 'STRICT' tag signifies that if any input is null, output is also null
+-- NOTE: 'PARALLEL SAFE' functions only read the attribute dictionary (see
+-- schema.c); those that may create attributes (the input function, puts) are
+-- left unsafe
 
 -- Serialization Functions
 
@@ -20,54 +23,153 @@ CREATE OR REPLACE FUNCTION
 document_datum_to_string(document)
 RETURNS cstring
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- Gathers per-key statistics (see document_key_stats) during ANALYZE
+CREATE OR REPLACE FUNCTION
+document_typanalyze(internal)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL SAFE;
 
 CREATE TYPE document (
     INPUT = string_to_document_datum,
     OUTPUT = document_datum_to_string,
+    ANALYZE = document_typanalyze,
     INTERNALLENGTH = VARIABLE
 );
 
 CREATE SCHEMA IF NOT EXISTS document_schema;
 CREATE TABLE IF NOT EXISTS document_schema._attributes(_id serial, key_name text NOT NULL, key_type text NOT NULL);
 
+-- Statistics
+
+CREATE OR REPLACE FUNCTION
+document_key_stats(regclass, name,
+                   OUT key_path text,
+                   OUT key_type text,
+                   OUT presence real,
+                   OUT n_distinct real,
+                   OUT avg_width integer,
+                   OUT most_common_vals text[],
+                   OUT most_common_freqs real[],
+                   OUT histogram_bounds text[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'document_key_stats_srf'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+-- Id of a key of a type in document_schema._attributes, creating it if it is
+-- new, through the same cache documents use
+CREATE OR REPLACE FUNCTION
+document_attribute_id(text, text)
+RETURNS integer
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+-- Accessor calls per relation and top-level key name since startup, for
+-- analyze_schema; NULL unless document_type is in shared_preload_libraries
+CREATE OR REPLACE FUNCTION
+document_access_count(regclass, text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT PARALLEL SAFE;
+
+-- Moves keys bw_colupgrader has materialized out of new documents and into
+-- their columns; a BEFORE INSERT OR UPDATE ... FOR EACH ROW trigger
+CREATE OR REPLACE FUNCTION
+document_route_keys()
+RETURNS trigger
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
 -- Accessors
 
+-- COSTs are per call, in units of cpu_operator_cost (see selfuncs.c, where
+-- document_get_support refines them by path depth). The dictionary is served
+-- from memory, a miss is checked against attributes committed since it was
+-- loaded (see schema.c), and a key's id never changes, so the getters are
+-- IMMUTABLE and can be used in expression indexes
+
+-- Planner support: accessor cost, and selectivity from document_key_stats
+CREATE OR REPLACE FUNCTION
+document_get_support(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL SAFE;
+
 CREATE OR REPLACE FUNCTION
 document_get(document, cstring, cstring)
 RETURNS text
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20
+SUPPORT document_get_support;
 
 CREATE OR REPLACE FUNCTION
 document_get_int(document, cstring)
 RETURNS bigint
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20
+SUPPORT document_get_support;
 
 CREATE OR REPLACE FUNCTION
 document_get_float(document, cstring)
 RETURNS double precision
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20
+SUPPORT document_get_support;
 
 CREATE OR REPLACE FUNCTION
 document_get_bool(document, cstring)
 RETURNS boolean
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20
+SUPPORT document_get_support;
 
 CREATE OR REPLACE FUNCTION
 document_get_text(document, cstring)
 RETURNS text
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20
+SUPPORT document_get_support;
 
 CREATE OR REPLACE FUNCTION
 document_get_doc(document, cstring)
 RETURNS document
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20
+SUPPORT document_get_support;
+
+-- Array keys as native arrays, one dimension per level of nesting; the last
+-- argument is the key's type, e.g. 'bigint[][]'
+CREATE OR REPLACE FUNCTION
+document_get_int_array(document, cstring, cstring)
+RETURNS bigint[]
+AS 'MODULE_PATHNAME', 'document_get_array'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 30;
+
+CREATE OR REPLACE FUNCTION
+document_get_float_array(document, cstring, cstring)
+RETURNS double precision[]
+AS 'MODULE_PATHNAME', 'document_get_array'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 30;
+
+CREATE OR REPLACE FUNCTION
+document_get_bool_array(document, cstring, cstring)
+RETURNS boolean[]
+AS 'MODULE_PATHNAME', 'document_get_array'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 30;
+
+CREATE OR REPLACE FUNCTION
+document_get_text_array(document, cstring, cstring)
+RETURNS text[]
+AS 'MODULE_PATHNAME', 'document_get_array'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 30;
+
+CREATE OR REPLACE FUNCTION
+document_get_doc_array(document, cstring, cstring)
+RETURNS document[]
+AS 'MODULE_PATHNAME', 'document_get_array'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 30;
 
 -- Delete
 
@@ -75,7 +177,15 @@ CREATE OR REPLACE FUNCTION
 document_delete(document, cstring, cstring)
 RETURNS document
 AS 'MODULE_PATHNAME'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20;
+
+-- Deletes several keys (or nested paths, e.g. user.lang), given as parallel
+-- arrays of names and types
+CREATE OR REPLACE FUNCTION
+document_delete_many(document, text[], text[])
+RETURNS document
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20;
 
 -- Put
 
@@ -114,3 +224,146 @@ document_put_doc(document, cstring, document)
 RETURNS document
 AS 'MODULE_PATHNAME'
 LANGUAGE C IMMUTABLE STRICT;
+
+-- Containment and indexing
+
+CREATE OR REPLACE FUNCTION
+document_contains(document, document)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20;
+
+CREATE OR REPLACE FUNCTION
+document_contained(document, document)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 20;
+
+CREATE OR REPLACE FUNCTION
+document_contsel(internal, oid, internal, integer)
+RETURNS double precision
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR @> (
+    LEFTARG = document,
+    RIGHTARG = document,
+    PROCEDURE = document_contains,
+    COMMUTATOR = '<@',
+    RESTRICT = document_contsel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR <@ (
+    LEFTARG = document,
+    RIGHTARG = document,
+    PROCEDURE = document_contained,
+    COMMUTATOR = '@>',
+    RESTRICT = document_contsel,
+    JOIN = contjoinsel
+);
+
+CREATE OR REPLACE FUNCTION
+gin_extract_document(document, internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+gin_extract_document_query(document, internal, int2, internal, internal,
+                           internal, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+gin_consistent_document(internal, int2, document, int4, internal, internal,
+                        internal, internal)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- Indexes (path, value) pairs; supports data @> '{"lang": "en"}'
+CREATE OPERATOR CLASS document_ops
+DEFAULT FOR TYPE document USING gin AS
+    OPERATOR 7 @>,
+    FUNCTION 1 btint4cmp(int4, int4),
+    FUNCTION 2 gin_extract_document(document, internal, internal),
+    FUNCTION 3 gin_extract_document_query(document, internal, int2, internal,
+                                          internal, internal, internal),
+    FUNCTION 4 gin_consistent_document(internal, int2, document, int4,
+                                       internal, internal, internal, internal),
+    STORAGE int4;
+
+-- Key presence
+
+CREATE OR REPLACE FUNCTION
+document_exists(document, text)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+
+CREATE OR REPLACE FUNCTION
+document_existsel(internal, oid, internal, integer)
+RETURNS double precision
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+-- Whether the document has a top-level key of that name, of any type
+CREATE OPERATOR ? (
+    LEFTARG = document,
+    RIGHTARG = text,
+    PROCEDURE = document_exists,
+    RESTRICT = document_existsel,
+    JOIN = contjoinsel
+);
+
+CREATE OR REPLACE FUNCTION
+brin_document_bloom_opcinfo(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+brin_document_bloom_add_value(internal, internal, internal, internal)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+brin_document_bloom_consistent(internal, internal, internal)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION
+brin_document_bloom_union(internal, internal, internal)
+RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- ORs the key bloom filters of each block range; for data ? 'rare_key'.
+-- The summary is 128 bits, so it only skips ranges whose documents use a
+-- few dozen distinct top-level key names at most (see bloom.c)
+CREATE OPERATOR CLASS document_bloom_ops
+DEFAULT FOR TYPE document USING brin AS
+    OPERATOR 1 ?(document, text),
+    OPERATOR 2 @>(document, document),
+    FUNCTION 1 brin_document_bloom_opcinfo(internal),
+    FUNCTION 2 brin_document_bloom_add_value(internal, internal, internal,
+                                             internal),
+    FUNCTION 3 brin_document_bloom_consistent(internal, internal, internal),
+    FUNCTION 4 brin_document_bloom_union(internal, internal, internal),
+    STORAGE bytea;
+
+-- Bulk loading
+
+-- Inserts the newline-delimited JSON documents of a server-side file into the
+-- data column of a relation, batch_size rows per statement, serializing them
+-- in up to workers parallel workers. Returns the number of rows inserted
+CREATE OR REPLACE FUNCTION
+document_load(tname regclass, path text, batch_size integer DEFAULT 10000,
+              workers integer DEFAULT 0)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
@@ -0,0 +1,272 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/gin.h>
+#include <access/stratnum.h>
+#include <fmgr.h>
+#if PG_VERSION_NUM >= 130000
+#include <common/hashfn.h>
+#else
+#include <access/hash.h>
+#include <utils/hashutils.h>
+#endif
+
+#include "binary.h"
+#include "json.h"
+#include "schema.h"
+
+/*******************************************************************************
+ * Containment
+ *
+ * doc @> query holds when every key of query is in doc with an equal value.
+ * Nested documents are compared recursively, everything else (including
+ * arrays) must match exactly. Keys are attribute ids, i.e. name and type, so
+ * {"a": 1} does not contain {"a": 1.0}.
+ ******************************************************************************/
+
+/* Strategy number of @> in the GIN opclass; the same as jsonb's */
+#define DocumentContainsStrategyNumber (7)
+
+Datum document_contains(PG_FUNCTION_ARGS);
+Datum document_contained(PG_FUNCTION_ARGS);
+Datum gin_extract_document(PG_FUNCTION_ARGS);
+Datum gin_extract_document_query(PG_FUNCTION_ARGS);
+Datum gin_consistent_document(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_contains);
+PG_FUNCTION_INFO_V1(document_contained);
+PG_FUNCTION_INFO_V1(gin_extract_document);
+PG_FUNCTION_INFO_V1(gin_extract_document_query);
+PG_FUNCTION_INFO_V1(gin_consistent_document);
+
+static bool
+is_document_attr(int attr_id)
+{
+    char *key_name, *key_type;
+
+    get_attr(attr_id, &key_name, &key_type);
+    return key_type && get_json_type(key_type) == DOCUMENT;
+}
+
+static bool
+binary_contains(const char *doc, const char *query)
+{
+    int natts, query_natts;
+    int i, j;
+
+    natts = doc_natts(doc);
+    query_natts = doc_natts(query);
+    if (query_natts > natts)
+    {
+        return false;
+    }
+
+    /* Both attribute id lists are sorted, so merge */
+    i = 0;
+    for (j = 0; j < query_natts; j++)
+    {
+        int attr_id;
+        int start, len;
+        int query_start, query_len;
+
+        attr_id = doc_attr_id(query, j);
+        while (i < natts && doc_attr_id(doc, i) < attr_id)
+        {
+            ++i;
+        }
+        if (i == natts || doc_attr_id(doc, i) != attr_id)
+        {
+            return false;
+        }
+
+        start = doc_offset(doc, i);
+        len = doc_offset(doc, i + 1) - start;
+        query_start = doc_offset(query, j);
+        query_len = doc_offset(query, j + 1) - query_start;
+
+        if (len == query_len && !memcmp(doc + start, query + query_start, len))
+        {
+            continue;
+        }
+        if (!is_document_attr(attr_id) ||
+            !binary_contains(doc + start, query + query_start))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Datum
+document_contains(PG_FUNCTION_ARGS)
+{
+    bytea *doc = (bytea*)PG_GETARG_BYTEA_P(0);
+    bytea *query = (bytea*)PG_GETARG_BYTEA_P(1);
+
+    PG_RETURN_BOOL(binary_contains(doc->vl_dat, query->vl_dat));
+}
+
+Datum
+document_contained(PG_FUNCTION_ARGS)
+{
+    bytea *query = (bytea*)PG_GETARG_BYTEA_P(0);
+    bytea *doc = (bytea*)PG_GETARG_BYTEA_P(1);
+
+    PG_RETURN_BOOL(binary_contains(doc->vl_dat, query->vl_dat));
+}
+
+/*******************************************************************************
+ * GIN opclass
+ *
+ * Each scalar or array value is indexed as one int4 entry: the hash of its
+ * path of attribute ids combined with the hash of its binary value. Nested
+ * documents contribute the entries of their values. A document contains the
+ * query only if it has all the query's entries; hashes can collide, so matches
+ * are always rechecked.
+ ******************************************************************************/
+
+typedef struct entry_buff {
+    Datum *entries;
+    int nentries;
+    int maxentries;
+} entry_buff;
+
+static void
+add_entry(entry_buff *buff, uint32 hash)
+{
+    if (buff->nentries >= buff->maxentries)
+    {
+        buff->maxentries *= 2;
+        buff->entries = repalloc(buff->entries, buff->maxentries * sizeof(Datum));
+    }
+    buff->entries[buff->nentries++] = Int32GetDatum((int32)hash);
+}
+
+static void
+extract_entries(const char *doc, uint32 path_hash, entry_buff *buff)
+{
+    int natts;
+    int i;
+
+    natts = doc_natts(doc);
+    for (i = 0; i < natts; i++)
+    {
+        int attr_id;
+        int start, end;
+        uint32 key_hash;
+
+        attr_id = doc_attr_id(doc, i);
+        start = doc_offset(doc, i);
+        end = doc_offset(doc, i + 1);
+        key_hash = hash_combine(path_hash, DatumGetUInt32(hash_uint32(attr_id)));
+
+        if (is_document_attr(attr_id))
+        {
+            extract_entries(doc + start, key_hash, buff);
+        }
+        else
+        {
+            add_entry(buff,
+                      hash_combine(key_hash,
+                                   DatumGetUInt32(hash_any((unsigned char*)
+                                                               doc + start,
+                                                           end - start))));
+        }
+    }
+}
+
+static int
+entry_comparator(const void *v1, const void *v2)
+{
+    int32 e1 = DatumGetInt32(*(const Datum*)v1);
+    int32 e2 = DatumGetInt32(*(const Datum*)v2);
+
+    return e1 < e2 ? -1 : (e1 > e2 ? 1 : 0);
+}
+
+/* Sorted, duplicate-free entries of doc */
+static Datum *
+document_entries(const char *doc, int32 *nentries)
+{
+    entry_buff buff;
+    int i, j;
+
+    buff.maxentries = Max(doc_natts(doc), 1) * 2;
+    buff.entries = palloc(buff.maxentries * sizeof(Datum));
+    buff.nentries = 0;
+    extract_entries(doc, 0, &buff);
+
+    if (buff.nentries > 1)
+    {
+        qsort(buff.entries, buff.nentries, sizeof(Datum), entry_comparator);
+        for (i = 1, j = 1; i < buff.nentries; i++)
+        {
+            if (entry_comparator(&buff.entries[i], &buff.entries[j - 1]))
+            {
+                buff.entries[j++] = buff.entries[i];
+            }
+        }
+        buff.nentries = j;
+    }
+
+    *nentries = buff.nentries;
+    return buff.entries;
+}
+
+Datum
+gin_extract_document(PG_FUNCTION_ARGS)
+{
+    bytea *doc = (bytea*)PG_GETARG_BYTEA_P(0);
+    int32 *nentries = (int32*)PG_GETARG_POINTER(1);
+
+    PG_RETURN_POINTER(document_entries(doc->vl_dat, nentries));
+}
+
+Datum
+gin_extract_document_query(PG_FUNCTION_ARGS)
+{
+    bytea *query = (bytea*)PG_GETARG_BYTEA_P(0);
+    int32 *nentries = (int32*)PG_GETARG_POINTER(1);
+    StrategyNumber strategy = PG_GETARG_UINT16(2);
+    int32 *search_mode = (int32*)PG_GETARG_POINTER(6);
+    Datum *entries;
+
+    if (strategy != DocumentContainsStrategyNumber)
+    {
+        elog(ERROR, "gin_extract_document_query: unknown strategy %d", strategy);
+    }
+
+    entries = document_entries(query->vl_dat, nentries);
+    if (*nentries == 0)
+    {
+        *search_mode = GIN_SEARCH_MODE_ALL; /* Everything contains {} */
+    }
+
+    PG_RETURN_POINTER(entries);
+}
+
+Datum
+gin_consistent_document(PG_FUNCTION_ARGS)
+{
+    bool *check = (bool*)PG_GETARG_POINTER(0);
+    StrategyNumber strategy = PG_GETARG_UINT16(1);
+    int32 nentries = PG_GETARG_INT32(3);
+    bool *recheck = (bool*)PG_GETARG_POINTER(5);
+    int i;
+
+    if (strategy != DocumentContainsStrategyNumber)
+    {
+        elog(ERROR, "gin_consistent_document: unknown strategy %d", strategy);
+    }
+
+    *recheck = true;
+    for (i = 0; i < nentries; i++)
+    {
+        if (!check[i])
+        {
+            PG_RETURN_BOOL(false);
+        }
+    }
+    PG_RETURN_BOOL(true);
+}
@@ -1,7 +1,5 @@
-#include <postgres.h> /* This include must precede all other postgres
-                         dependencies */
-#include <access/xact.h>
-#include <utils/memutils.h>
+#include "core.h" /* This include must precede all other postgres
+                     dependencies */
 
 #include <assert.h>
 
@@ -1,5 +1,6 @@
-#include <postgres.h>
+#include "core.h"
 #include <assert.h>
+#include <ctype.h>
 
 #include "json.h"
 #include "utils.h"
@@ -18,58 +19,144 @@ jsmntok_to_str(jsmntok_t *tok, char *json)
     return retval;
 }
 
-json_typeid
-jsmn_primitive_get_type(char *value_str)
+/*
+ * Classify the primitive in value[0..len) without copying it: true, false,
+ * null, or a number by the JSON grammar
+ *
+ *     -? (0 | [1-9][0-9]*) (.[0-9]+)? ([eE][+-]?[0-9]+)?
+ *
+ * Numbers with a fraction or exponent are FLOAT, and so are integers that
+ * would overflow the 4 bytes INTEGER values are stored in (see to_binary);
+ * anything else is NONE, like null, and drops the key.
+ */
+static json_typeid
+classify_primitive(const char *value, int len)
 {
-    char *ptr;
-    // elog(WARNING, "value_str: %s", value_str);
-    switch(value_str[0]) {
-    case 't': case 'f':
+    const char *p = value;
+    const char *end = value + len;
+    bool negative;
+    bool is_float;
+    uint64 magnitude;
+
+    if (len == 4 && !memcmp(value, "true", 4))
+    {
+        return BOOLEAN;
+    }
+    if (len == 5 && !memcmp(value, "false", 5))
+    {
         return BOOLEAN;
-    case 'n':
-        // elog(WARNING, "returned NONE TYPE");
+    }
+
+    negative = p < end && *p == '-';
+    if (negative)
+    {
+        p++;
+    }
+    if (p == end || !isdigit((unsigned char)*p))
+    {
         return NONE;
-    case '-':
-    case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-        ptr = NULL;
-        if ((ptr = strchr(value_str, '.')) && !strchr(ptr + 1, '.')) // FIXME: Only one decimal
+    }
+
+    /* Integer part; once past int32 range the exact value doesn't matter */
+    magnitude = 0;
+    if (*p == '0')
+    {
+        p++;
+    }
+    else
+    {
+        while (p < end && isdigit((unsigned char)*p))
         {
-            return FLOAT;
+            if (magnitude <= (uint64)PG_INT32_MAX + 1)
+            {
+                magnitude = magnitude * 10 + (*p - '0');
+            }
+            p++;
         }
-        else
+    }
+
+    is_float = false;
+    if (p < end && *p == '.')
+    {
+        p++;
+        if (p == end || !isdigit((unsigned char)*p))
         {
-            return INTEGER;
+            return NONE;
         }
-    default:
-        // elog(WARNING, "document: doc_insert: Got invalid json: %s", value_str);
+        while (p < end && isdigit((unsigned char)*p))
+        {
+            p++;
+        }
+        is_float = true;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+        {
+            p++;
+        }
+        if (p == end || !isdigit((unsigned char)*p))
+        {
+            return NONE;
+        }
+        while (p < end && isdigit((unsigned char)*p))
+        {
+            p++;
+        }
+        is_float = true;
+    }
+    if (p != end)
+    {
         return NONE;
     }
+
+    if (is_float ||
+        magnitude > (negative ? (uint64)PG_INT32_MAX + 1 : (uint64)PG_INT32_MAX))
+    {
+        return FLOAT;
+    }
+    return INTEGER;
+}
+
+json_typeid
+jsmn_primitive_get_type(char *value_str)
+{
+    return classify_primitive(value_str, strlen(value_str));
 }
 
+/* The type of the value tok spans in json. Classified once, then cached on the
+ * token itself, since callers ask again for array elements and documents */
 json_typeid
 jsmn_get_type(jsmntok_t* tok, char *json)
 {
-    jsmntype_t tok_type = tok->type;
-    char *value_str = jsmntok_to_str(tok, json);
+    json_typeid type;
 
-    if (!value_str) {
-        return NONE;
+    if (tok->value_type != 0)
+    {
+        return (json_typeid)tok->value_type;
     }
 
-    switch (tok_type)
+    switch (tok->type)
     {
     case JSMN_STRING:
-        return STRING;
+        type = STRING;
+        break;
     case JSMN_PRIMITIVE:
-        return jsmn_primitive_get_type(value_str);
+        type = classify_primitive(json + tok->start, tok->end - tok->start);
+        break;
     case JSMN_OBJECT:
-        return DOCUMENT;
+        type = DOCUMENT;
+        break;
     case JSMN_ARRAY:
-        return ARRAY;
+        type = ARRAY;
+        break;
     default:
-        return NONE;
+        type = NONE;
     }
+
+    tok->value_type = type;
+    return type;
 }
 
 
@@ -91,7 +178,7 @@ jsmn_tokenize(char *json)
         jsmntok_t *nulltok;
 
         elog(DEBUG5, "Null json");
-        nulltok = palloc0(sizeof(json));
+        nulltok = palloc0(sizeof(jsmntok_t));
         nulltok->type = NONE;
         return nulltok;
     }
@@ -148,7 +235,12 @@ get_pg_type(json_typeid type, char *value)
             tokens = jsmn_tokenize(value);
             assert(tokens->type == JSMN_ARRAY);
             arr_elt_type = jsmn_get_type(tokens + 1, value);
-            arr_elt_pg_type = get_pg_type(arr_elt_type, jsmntok_to_str(tokens + 1, value));
+            /* Only nested arrays need their text, to recur on */
+            arr_elt_pg_type = get_pg_type(arr_elt_type,
+                                          arr_elt_type == ARRAY ?
+                                              jsmntok_to_str(tokens + 1, value) :
+                                              value);
+            pfree(tokens);
             buffer = palloc0(strlen(arr_elt_pg_type) + 2 + 1);
             /* NOTE: 'leaks' memory for nested arrays */
             sprintf(buffer, "%s%s", arr_elt_pg_type, ARRAY_TYPE);
@@ -37,6 +37,7 @@ typedef struct {
 	int start;
 	int end;
 	int size;
+	int value_type; /* Left to the caller (see json.c); 0 when allocated */
 #ifdef JSMN_PARENT_LINKS
 	int parent;
 #endif
@@ -0,0 +1,636 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/parallel.h>
+#include <access/xact.h>
+#include <executor/spi.h>
+#include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <port/atomics.h>
+#include <storage/fd.h>
+#include <storage/latch.h>
+#include <storage/proc.h>
+#include <storage/shm_mq.h>
+#include <storage/shm_toc.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include "document.h"
+#include "json.h"
+#include "load.h"
+#include "schema.h"
+#include "utils.h"
+
+/*******************************************************************************
+ * Bulk loading
+ *
+ * document_load(rel, path, batch_size) reads newline-delimited JSON, one
+ * document per line, from a server-side file into rel's data column. Unlike
+ * COPY through the document input function, it
+ *
+ * - reads the JSON as is, where COPY needs it escaped as CSV;
+ * - resolves the attribute ids of a whole batch together, creating the new
+ *   ones with a single insert (see resolve_attributes);
+ * - inserts a batch with one statement, so statement triggers (analyze_schema)
+ *   run once per batch;
+ * - has schema_analyzer's count_keys trigger defer the key counts of the
+ *   batch, which are then applied with one update per distinct key (see
+ *   load.h).
+ *
+ * The other row triggers, route_keys in particular, run as for an INSERT.
+ *
+ * With workers > 0, the documents of a batch are serialized by parallel
+ * workers (see serialize_parallel), while we only read lines and insert the
+ * results, in input order. Workers never create attributes: they are given a
+ * snapshot of _attributes, and send back unserialized the lines with keys it
+ * lacks, which we then serialize ourselves, creating the keys. So ids are
+ * handed out as by a serial load, densely and in order of first appearance.
+ ******************************************************************************/
+
+Datum document_load(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_load);
+
+#define LOAD_READ_CHUNK (8192)
+#define LOAD_WORKER_CHUNK (64) /* Lines a worker claims at a time */
+#define LOAD_QUEUE_SIZE (256 * 1024)
+
+/* Keys of the table of contents of a parallel load (see serialize_parallel) */
+#define LOAD_KEY_SHARED     UINT64CONST(0xD0C0000000000001)
+#define LOAD_KEY_OFFSETS    UINT64CONST(0xD0C0000000000002)
+#define LOAD_KEY_TEXT       UINT64CONST(0xD0C0000000000003)
+#define LOAD_KEY_DICTIONARY UINT64CONST(0xD0C0000000000004)
+#define LOAD_KEY_QUEUES     UINT64CONST(0xD0C0000000000005)
+
+/* Lines of newline-delimited JSON read for one batch */
+typedef struct load_batch {
+    StringInfoData text; /* The lines, each '\0' terminated */
+    int *offsets;        /* Of each line in text */
+    int n;
+} load_batch;
+
+typedef struct load_shared {
+    int nlines;
+    int nattributes;            /* In the dictionary */
+    pg_atomic_uint32 next_line; /* First line no worker has claimed */
+} load_shared;
+
+/* What a worker sends back for each line, followed by the document */
+typedef struct load_result {
+    int line;
+    int size; /* -1 if the line has keys missing from the dictionary */
+} load_result;
+
+PGDLLEXPORT void document_load_worker(dsm_segment *seg, shm_toc *toc);
+
+/* Reads the next line of file into buf, without its line terminator. Returns
+ * false at the end of the file */
+static bool
+read_line(FILE *file, StringInfo buf)
+{
+    bool read;
+
+    resetStringInfo(buf);
+    read = false;
+    for (;;)
+    {
+        enlargeStringInfo(buf, LOAD_READ_CHUNK);
+        if (!fgets(buf->data + buf->len, buf->maxlen - buf->len, file))
+        {
+            if (ferror(file))
+            {
+                elog(ERROR, "document_load: could not read file: %m");
+            }
+            break;
+        }
+        read = true;
+        buf->len += strlen(buf->data + buf->len);
+        if (buf->len > 0 && buf->data[buf->len - 1] == '\n')
+        {
+            break;
+        }
+    }
+
+    while (buf->len > 0 && (buf->data[buf->len - 1] == '\n' ||
+                            buf->data[buf->len - 1] == '\r'))
+    {
+        buf->data[--buf->len] = '\0';
+    }
+
+    return read;
+}
+
+/* Reads up to batch_size lines of file into batch, skipping blank ones.
+ * line_no counts the lines read so far, for error messages */
+static void
+read_batch(FILE *file, StringInfo line, load_batch *batch, int batch_size,
+           int64 *line_no)
+{
+    resetStringInfo(&batch->text);
+    batch->n = 0;
+    while (batch->n < batch_size && read_line(file, line))
+    {
+        char *json;
+
+        ++*line_no;
+
+        json = line->data;
+        while (*json == ' ' || *json == '\t')
+        {
+            ++json;
+        }
+        if (!*json)
+        {
+            continue;
+        }
+        if (*json != '{')
+        {
+            elog(ERROR,
+                 "document_load: line " INT64_FORMAT " is not a JSON object",
+                 *line_no);
+        }
+
+        batch->offsets[batch->n++] = batch->text.len;
+        appendBinaryStringInfo(&batch->text, json, strlen(json) + 1);
+    }
+}
+
+/* Serializes the given n lines of batch into datums, resolving the ids of all
+ * of their keys at once */
+static void
+serialize_lines(load_batch *batch, const int *lines, int n, Datum *datums)
+{
+    document *docs;
+    int total;
+    int i, j, k;
+    char **key_names;
+    char **type_names;
+    int *attr_ids;
+
+    docs = palloc(n * sizeof(document));
+    total = 0;
+    for (i = 0; i < n; ++i)
+    {
+        json_to_document(batch->text.data + batch->offsets[lines[i]], docs + i);
+        total += docs[i].natts;
+    }
+
+    key_names = palloc(total * sizeof(char*));
+    type_names = palloc(total * sizeof(char*));
+    attr_ids = palloc(total * sizeof(int));
+    for (i = 0, k = 0; i < n; ++i)
+    {
+        for (j = 0; j < docs[i].natts; ++j, ++k)
+        {
+            key_names[k] = docs[i].keys[j];
+            type_names[k] = get_pg_type(docs[i].types[j], docs[i].values[j]);
+        }
+    }
+    resolve_attributes(total, key_names, type_names, attr_ids);
+
+    for (i = 0, k = 0; i < n; k += docs[i].natts, ++i)
+    {
+        char *binary;
+        int size;
+        bytea *datum;
+
+        size = document_fields_to_binary(docs + i, attr_ids + k, &binary);
+        datum = palloc(VARHDRSZ + size);
+        SET_VARSIZE(datum, VARHDRSZ + size);
+        memcpy(datum->vl_dat, binary, size);
+        pfree(binary);
+
+        datums[lines[i]] = PointerGetDatum(datum);
+    }
+}
+
+/*
+ * Serializes batch in up to nworkers parallel workers, into datums, and
+ * returns the number of lines the workers did. The others, which have keys
+ * missing from dictionary (or all of them, if no worker could be launched),
+ * are left (Datum) 0.
+ */
+static int
+serialize_parallel(load_batch *batch, StringInfo dictionary, int nattributes,
+                   int nworkers, Datum *datums)
+{
+    ParallelContext *pcxt;
+    load_shared *shared;
+    char *chunk;
+    char *queues;
+    shm_mq_handle **handles;
+    bool *detached;
+    int remaining;
+    int serialized;
+    int i;
+
+    EnterParallelMode();
+    pcxt = CreateParallelContext("document_type", "document_load_worker",
+                                 nworkers);
+
+    shm_toc_estimate_chunk(&pcxt->estimator, sizeof(load_shared));
+    shm_toc_estimate_chunk(&pcxt->estimator, batch->n * sizeof(int));
+    shm_toc_estimate_chunk(&pcxt->estimator, batch->text.len);
+    shm_toc_estimate_chunk(&pcxt->estimator, Max(dictionary->len, 1));
+    shm_toc_estimate_chunk(&pcxt->estimator,
+                           mul_size(LOAD_QUEUE_SIZE, nworkers));
+    shm_toc_estimate_keys(&pcxt->estimator, 5);
+    InitializeParallelDSM(pcxt);
+
+    shared = shm_toc_allocate(pcxt->toc, sizeof(load_shared));
+    shared->nlines = batch->n;
+    shared->nattributes = nattributes;
+    pg_atomic_init_u32(&shared->next_line, 0);
+    shm_toc_insert(pcxt->toc, LOAD_KEY_SHARED, shared);
+
+    chunk = shm_toc_allocate(pcxt->toc, batch->n * sizeof(int));
+    memcpy(chunk, batch->offsets, batch->n * sizeof(int));
+    shm_toc_insert(pcxt->toc, LOAD_KEY_OFFSETS, chunk);
+
+    chunk = shm_toc_allocate(pcxt->toc, batch->text.len);
+    memcpy(chunk, batch->text.data, batch->text.len);
+    shm_toc_insert(pcxt->toc, LOAD_KEY_TEXT, chunk);
+
+    chunk = shm_toc_allocate(pcxt->toc, Max(dictionary->len, 1));
+    memcpy(chunk, dictionary->data, dictionary->len);
+    shm_toc_insert(pcxt->toc, LOAD_KEY_DICTIONARY, chunk);
+
+    queues = shm_toc_allocate(pcxt->toc, mul_size(LOAD_QUEUE_SIZE, nworkers));
+    shm_toc_insert(pcxt->toc, LOAD_KEY_QUEUES, queues);
+    handles = palloc(nworkers * sizeof(shm_mq_handle*));
+    for (i = 0; i < nworkers; ++i)
+    {
+        shm_mq *mq;
+
+        mq = shm_mq_create(queues + i * LOAD_QUEUE_SIZE, LOAD_QUEUE_SIZE);
+        shm_mq_set_receiver(mq, MyProc);
+        handles[i] = shm_mq_attach(mq, pcxt->seg, NULL);
+    }
+
+    LaunchParallelWorkers(pcxt);
+    for (i = 0; i < pcxt->nworkers_launched; ++i)
+    {
+        shm_mq_set_handle(handles[i], pcxt->worker[i].bgwhandle);
+    }
+
+    /* Collect the documents, in whatever order they come */
+    detached = palloc0(nworkers * sizeof(bool));
+    remaining = pcxt->nworkers_launched;
+    serialized = 0;
+    while (remaining > 0)
+    {
+        bool progress;
+
+        progress = false;
+        for (i = 0; i < pcxt->nworkers_launched; ++i)
+        {
+            shm_mq_result res;
+            Size nbytes;
+            void *data;
+            load_result result;
+            bytea *datum;
+
+            if (detached[i])
+            {
+                continue;
+            }
+
+            res = shm_mq_receive(handles[i], &nbytes, &data, true);
+            if (res == SHM_MQ_WOULD_BLOCK)
+            {
+                continue;
+            }
+            progress = true;
+            if (res == SHM_MQ_DETACHED)
+            {
+                detached[i] = true;
+                --remaining;
+                continue;
+            }
+
+            memcpy(&result, data, sizeof(load_result));
+            if (result.size < 0)
+            {
+                continue;
+            }
+            datum = palloc(VARHDRSZ + result.size);
+            SET_VARSIZE(datum, VARHDRSZ + result.size);
+            memcpy(datum->vl_dat, (char*)data + sizeof(load_result),
+                   result.size);
+            datums[result.line] = PointerGetDatum(datum);
+            ++serialized;
+        }
+
+        if (!progress)
+        {
+            (void)WaitLatch(MyLatch,
+                            WL_LATCH_SET | WL_EXIT_ON_PM_DEATH,
+                            0,
+                            PG_WAIT_EXTENSION);
+            ResetLatch(MyLatch);
+        }
+        /* Also rethrows the errors of the workers */
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    WaitForParallelWorkersToFinish(pcxt);
+    for (i = 0; i < nworkers; ++i)
+    {
+        shm_mq_detach(handles[i]);
+    }
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+
+    return serialized;
+}
+
+/* Entry point of the workers of serialize_parallel. They take lines
+ * LOAD_WORKER_CHUNK at a time and send each one back serialized, with
+ * attribute ids from the leader's dictionary only */
+void
+document_load_worker(dsm_segment *seg, shm_toc *toc)
+{
+    load_shared *shared;
+    int *offsets;
+    char *text;
+    char *queues;
+    shm_mq *mq;
+    shm_mq_handle *handle;
+    StringInfoData message;
+    MemoryContext arena;
+
+    shared = shm_toc_lookup(toc, LOAD_KEY_SHARED, false);
+    offsets = shm_toc_lookup(toc, LOAD_KEY_OFFSETS, false);
+    text = shm_toc_lookup(toc, LOAD_KEY_TEXT, false);
+    queues = shm_toc_lookup(toc, LOAD_KEY_QUEUES, false);
+
+    mq = (shm_mq*)(queues + ParallelWorkerNumber * LOAD_QUEUE_SIZE);
+    shm_mq_set_sender(mq, MyProc);
+    handle = shm_mq_attach(mq, seg, NULL);
+
+    attributes_freeze(shm_toc_lookup(toc, LOAD_KEY_DICTIONARY, false),
+                      shared->nattributes);
+
+    initStringInfo(&message);
+    arena = document_arena_create();
+    for (;;)
+    {
+        uint32 first;
+        uint32 line;
+
+        first = pg_atomic_fetch_add_u32(&shared->next_line, LOAD_WORKER_CHUNK);
+        if (first >= shared->nlines)
+        {
+            break;
+        }
+
+        for (line = first;
+             line < first + LOAD_WORKER_CHUNK && line < shared->nlines;
+             ++line)
+        {
+            load_result result;
+            char *binary;
+            MemoryContext oldcontext;
+
+            CHECK_FOR_INTERRUPTS();
+
+            oldcontext = MemoryContextSwitchTo(arena);
+            attributes_missing = false;
+            result.line = line;
+            result.size = document_to_binary(text + offsets[line], &binary);
+            MemoryContextSwitchTo(oldcontext);
+
+            resetStringInfo(&message);
+            if (attributes_missing)
+            {
+                /* The leader does it, and creates the attributes */
+                result.size = -1;
+                appendBinaryStringInfo(&message, (char*)&result,
+                                       sizeof(load_result));
+            }
+            else
+            {
+                appendBinaryStringInfo(&message, (char*)&result,
+                                       sizeof(load_result));
+                appendBinaryStringInfo(&message, binary, result.size);
+            }
+            MemoryContextReset(arena);
+
+#if PG_VERSION_NUM >= 150000
+            if (shm_mq_send(handle, message.len, message.data, false, false) ==
+                SHM_MQ_DETACHED)
+#else
+            if (shm_mq_send(handle, message.len, message.data, false) ==
+                SHM_MQ_DETACHED)
+#endif
+            {
+                /* The leader is gone */
+                return;
+            }
+        }
+    }
+
+    shm_mq_detach(handle);
+}
+
+static ArrayType *
+datums_to_array(Datum *datums, int n, Oid doc_type)
+{
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+
+    get_typlenbyvalalign(doc_type, &typlen, &typbyval, &typalign);
+    return construct_array(datums, n, doc_type, typlen, typbyval, typalign);
+}
+
+static int64
+insert_batch(Oid relid, Oid doc_array_type, ArrayType *batch)
+{
+    int ret;
+    int64 processed;
+    StringInfoData query;
+    SPIPlanPtr plan;
+    Datum values[1];
+
+    SPI_connect();
+
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "INSERT INTO %s (data) SELECT unnest($1)",
+                     quote_qualified_identifier(
+                         get_namespace_name(get_rel_namespace(relid)),
+                         get_rel_name(relid)));
+    plan = SPI_prepare(query.data, 1, &doc_array_type);
+    if (!plan)
+    {
+        elog(ERROR,
+             "document_load: SPI_prepare failed: error code %d",
+             SPI_result);
+    }
+
+    values[0] = PointerGetDatum(batch);
+    ret = SPI_execute_plan(plan, values, NULL, false, 0);
+    if (ret != SPI_OK_INSERT)
+    {
+        elog(ERROR, "document_load: SPI_execute failed: error code %d", ret);
+    }
+    processed = SPI_processed;
+
+    SPI_finish();
+
+    return processed;
+}
+
+Datum
+document_load(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    char *path = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    int batch_size = PG_GETARG_INT32(2);
+    int nworkers = PG_GETARG_INT32(3);
+    AttrNumber attnum;
+    Oid doc_type;
+    Oid doc_array_type;
+    document_load_state *state;
+    FILE *file;
+    StringInfoData line;
+    load_batch batch;
+    StringInfoData dictionary;
+    int nattributes;
+    MemoryContext arena;
+    MemoryContext oldcontext;
+    int64 line_no;
+    int64 rows;
+
+    if (!superuser())
+    {
+        elog(ERROR, "document_load: must be superuser to read from a file");
+    }
+    if (batch_size < 1)
+    {
+        elog(ERROR, "document_load: batch size must be positive");
+    }
+    if (nworkers < 0 || nworkers > max_worker_processes)
+    {
+        elog(ERROR, "document_load: workers must be between 0 and %d",
+             max_worker_processes);
+    }
+
+    attnum = get_attnum(relid, "data");
+    if (attnum == InvalidAttrNumber)
+    {
+        elog(ERROR, "document_load: relation %u has no data column", relid);
+    }
+    doc_type = get_atttype(relid, attnum);
+    doc_array_type = get_array_type(doc_type);
+
+    state = document_load_get_state();
+    if (OidIsValid(state->relid))
+    {
+        elog(ERROR, "document_load: another load is in progress");
+    }
+
+    file = AllocateFile(path, PG_BINARY_R);
+    if (!file)
+    {
+        elog(ERROR, "document_load: could not open file \"%s\": %m", path);
+    }
+
+    initStringInfo(&line);
+    initStringInfo(&batch.text);
+    batch.offsets = palloc(batch_size * sizeof(int));
+    /* Workers get their attribute ids from here, never from _attributes, so
+     * that new ids are only ever handed out by us, in input order */
+    initStringInfo(&dictionary);
+    nattributes = nworkers > 0 ? attributes_serialize(&dictionary) : 0;
+    /* Everything a batch allocates goes at once when it is inserted */
+    arena = document_arena_create();
+    line_no = 0;
+    rows = 0;
+
+    state->relid = relid;
+    PG_TRY();
+    {
+        for (;;)
+        {
+            Datum *datums;
+            int *lines;
+            int n;
+            int i;
+
+            CHECK_FOR_INTERRUPTS();
+
+            read_batch(file, &line, &batch, batch_size, &line_no);
+            if (batch.n == 0)
+            {
+                break;
+            }
+
+            oldcontext = MemoryContextSwitchTo(arena);
+
+            datums = palloc0(batch.n * sizeof(Datum));
+            if (nworkers > 0 &&
+                serialize_parallel(&batch, &dictionary, nattributes, nworkers,
+                                   datums) == batch.n)
+            {
+                n = 0;
+            }
+            else
+            {
+                /* What the workers left: keys they had no id for, and all of
+                 * it if there are no workers */
+                lines = palloc(batch.n * sizeof(int));
+                for (i = 0, n = 0; i < batch.n; ++i)
+                {
+                    if (!datums[i])
+                    {
+                        lines[n++] = i;
+                    }
+                }
+                serialize_lines(&batch, lines, n, datums);
+            }
+            rows += insert_batch(relid, doc_array_type,
+                                 datums_to_array(datums, batch.n, doc_type));
+
+            MemoryContextSwitchTo(oldcontext);
+            MemoryContextReset(arena);
+
+            if (nworkers > 0 && n > 0)
+            {
+                resetStringInfo(&dictionary);
+                nattributes = attributes_serialize(&dictionary);
+            }
+
+            /* analyze_schema has usually applied them already */
+            if (state->flush_counts)
+            {
+                state->flush_counts(relid, true);
+            }
+        }
+    }
+    PG_CATCH();
+    {
+        if (state->flush_counts)
+        {
+            state->flush_counts(relid, false);
+        }
+        state->relid = InvalidOid;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    state->relid = InvalidOid;
+
+    FreeFile(file);
+    MemoryContextDelete(arena);
+    pfree(batch.offsets);
+    pfree(batch.text.data);
+    pfree(dictionary.data);
+    pfree(line.data);
+
+    PG_RETURN_INT64(rows);
+}
@@ -0,0 +1,37 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <fmgr.h>
+#include <utils/memutils.h>
+
+/* Name of the rendezvous variable (see find_rendezvous_variable) holding the
+ * document_load_state shared by document_load and schema_analyzer. Whichever
+ * module gets there first allocates it */
+#define DOCUMENT_LOAD_RENDEZVOUS "document_type_bulk_load"
+
+typedef struct document_load_state {
+    /* Relation document_load is inserting into, or InvalidOid. Its count_keys
+     * trigger defers the key counts of the rows instead of applying them one
+     * row at a time. Set by document_type */
+    Oid relid;
+    /* Applies (or, if !apply, drops) the counts deferred for relid. NULL if
+     * schema_analyzer isn't loaded. Set by schema_analyzer */
+    void (*flush_counts)(Oid relid, bool apply);
+} document_load_state;
+
+static inline document_load_state *
+document_load_get_state(void)
+{
+    document_load_state **state;
+
+    state = (document_load_state**)
+        find_rendezvous_variable(DOCUMENT_LOAD_RENDEZVOUS);
+    if (!*state)
+    {
+        *state = MemoryContextAllocZero(TopMemoryContext,
+                                        sizeof(document_load_state));
+    }
+    return *state;
+}
+
+#endif
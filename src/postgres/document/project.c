@@ -0,0 +1,141 @@
+#include "core.h" /* This include must precede all other postgres
+                     dependencies */
+
+#include "binary.h"
+#include "project.h"
+#include "schema.h"
+
+/*******************************************************************************
+ * Batch projection
+ *
+ * Per document, document_get and friends resolve the key, check the bloom
+ * filter and search attr_ids. Here the first two steps are done once per
+ * projection, and documents are visited in a loop that prefetches the header
+ * of the document DOC_PROJECT_PREFETCH places ahead, so that the cache misses
+ * on document headers overlap rather than happen one after another.
+ ******************************************************************************/
+
+doc_projection *
+doc_projection_compile(int nkeys,
+                       const char **key_names,
+                       const char **type_names)
+{
+    doc_projection *proj;
+    int i;
+
+    proj = palloc(sizeof(doc_projection));
+    proj->nkeys = nkeys;
+    proj->attr_ids = palloc(Max(nkeys, 1) * sizeof(int));
+    proj->bloom_bit1 = palloc(Max(nkeys, 1) * sizeof(int));
+    proj->bloom_bit2 = palloc(Max(nkeys, 1) * sizeof(int));
+    for (i = 0; i < nkeys; i++)
+    {
+        proj->attr_ids[i] = get_attribute_id(key_names[i], type_names[i]);
+        doc_bloom_bits(doc_key_hash(key_names[i]),
+                       &proj->bloom_bit1[i],
+                       &proj->bloom_bit2[i]);
+    }
+
+    return proj;
+}
+
+void
+doc_projection_free(doc_projection *proj)
+{
+    pfree(proj->attr_ids);
+    pfree(proj->bloom_bit1);
+    pfree(proj->bloom_bit2);
+    pfree(proj);
+}
+
+doc_column *
+doc_columns_create(const doc_projection *proj, int capacity)
+{
+    doc_column *columns;
+    int i;
+
+    columns = palloc(Max(proj->nkeys, 1) * sizeof(doc_column));
+    for (i = 0; i < proj->nkeys; i++)
+    {
+        columns[i].values = palloc(Max(capacity, 1) * sizeof(char*));
+        columns[i].lengths = palloc(Max(capacity, 1) * sizeof(int));
+        columns[i].nulls = palloc((capacity + 7) / 8 + 1);
+    }
+
+    return columns;
+}
+
+void
+doc_columns_free(const doc_projection *proj, doc_column *columns)
+{
+    int i;
+
+    for (i = 0; i < proj->nkeys; i++)
+    {
+        pfree(columns[i].values);
+        pfree(columns[i].lengths);
+        pfree(columns[i].nulls);
+    }
+    pfree(columns);
+}
+
+void
+doc_project_batch(const doc_projection *proj,
+                  const char *const *docs,
+                  int ndocs,
+                  doc_column *columns)
+{
+    int i, k;
+
+    for (k = 0; k < proj->nkeys; k++)
+    {
+        memset(columns[k].nulls, 0, (ndocs + 7) / 8);
+    }
+    for (i = 0; i < Min(ndocs, DOC_PROJECT_PREFETCH); i++)
+    {
+        if (docs[i])
+        {
+            doc_prefetch(docs[i]);
+        }
+    }
+
+    for (i = 0; i < ndocs; i++)
+    {
+        const char *doc = docs[i];
+        bool has_bloom;
+
+        if (i + DOC_PROJECT_PREFETCH < ndocs && docs[i + DOC_PROJECT_PREFETCH])
+        {
+            doc_prefetch(docs[i + DOC_PROJECT_PREFETCH]);
+        }
+
+        has_bloom = doc && doc_has_bloom(doc);
+        for (k = 0; k < proj->nkeys; k++)
+        {
+            int pos = -1;
+
+            if (doc && proj->attr_ids[k] >= 0 &&
+                (!has_bloom ||
+                 doc_bloom_has_bits(doc + sizeof(int),
+                                    proj->bloom_bit1[k],
+                                    proj->bloom_bit2[k])))
+            {
+                pos = doc_find_attr(doc, proj->attr_ids[k]);
+            }
+
+            if (pos >= 0)
+            {
+                int offset = doc_offset(doc, pos);
+
+                columns[k].values[i] = doc + offset;
+                columns[k].lengths[i] = doc_offset(doc, pos + 1) - offset;
+            }
+            else
+            {
+                columns[k].values[i] = NULL;
+                columns[k].lengths[i] = 0;
+                columns[k].nulls[i / 8] |= 1 << (i % 8);
+            }
+        }
+    }
+}
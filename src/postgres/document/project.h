@@ -0,0 +1,56 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include "core.h"
+
+/*
+ * Batch projection: the same keys out of many documents at once.
+ *
+ * A projection is compiled once, resolving its keys against the attribute
+ * dictionary and hashing them for the bloom filters, and then applied to
+ * batches of documents. Each key gets a column of outputs: for document i,
+ * values[i] points at the value in place in the document (binary.h layout)
+ * and lengths[i] is its size, or, if the document lacks the key, values[i]
+ * is NULL, lengths[i] is 0 and bit i of nulls is set.
+ */
+
+typedef struct doc_projection
+{
+    int         nkeys;
+    int        *attr_ids;      /* -1 for keys the dictionary doesn't have */
+    int        *bloom_bit1;
+    int        *bloom_bit2;
+} doc_projection;
+
+typedef struct doc_column
+{
+    const char **values;
+    int        *lengths;
+    uint8      *nulls;         /* bit i set if document i lacks the key */
+} doc_column;
+
+/* Documents ahead of the current one whose headers are prefetched */
+#define DOC_PROJECT_PREFETCH (8)
+
+doc_projection *doc_projection_compile(int nkeys,
+                                       const char **key_names,
+                                       const char **type_names);
+void doc_projection_free(doc_projection *proj);
+
+/* One column per key of proj, each for up to capacity documents */
+doc_column *doc_columns_create(const doc_projection *proj, int capacity);
+void doc_columns_free(const doc_projection *proj, doc_column *columns);
+
+/* Fills columns for docs[0..ndocs). A NULL document lacks every key */
+void doc_project_batch(const doc_projection *proj,
+                       const char *const *docs,
+                       int ndocs,
+                       doc_column *columns);
+
+static inline bool
+doc_column_is_null(const doc_column *column, int i)
+{
+    return (column->nulls[i / 8] & (1 << (i % 8))) != 0;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/sysattr.h>
+#include <miscadmin.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <optimizer/planner.h>
+#include <parser/parsetree.h>
+#include <utils/acl.h>
+#include <utils/lsyscache.h>
+
+#include "rewrite.h"
+#include "selfuncs.h"
+#include "upgrade.h"
+
+/*******************************************************************************
+ * Accessor rewrite
+ *
+ * Once bw_colupgrader has started materializing a key as a column of the same
+ * name and type (the key is COPYING, STRIPPING or DONE; see upgrade.h), the
+ * document only has the key for rows the upgrader hasn't reached yet, or that
+ * were inserted since. planner_hook rewrites
+ * document_get_int(data, 'k') on such a table to
+ * COALESCE(k, document_get_int(data, 'k')), which is right at every stage of
+ * an upgrade or downgrade, and reads upgraded rows from the column without
+ * touching the document. Once the upgrade is done (see upgrade.h) no document
+ * has the key any more, and it is planned as the bare column. Only constant
+ * paths without array indexes are rewritten (user.lang reads column
+ * user__lang), and only if the user may read the column.
+ *
+ * bw_colupgrader turns this off in its own sessions, since it has to read the
+ * document itself.
+ ******************************************************************************/
+
+bool document_rewrite_accessors = true;
+
+typedef struct rewrite_context {
+    List *queries; /* Enclosing queries, innermost first */
+} rewrite_context;
+
+static planner_hook_type prev_planner_hook = NULL;
+
+static Node *rewrite_mutator(Node *node, rewrite_context *context);
+
+/* COALESCE(column, expr) if expr is an accessor whose key has a column */
+static Node *
+rewrite_accessor(FuncExpr *expr, rewrite_context *context)
+{
+    Query *query;
+    Var *var;
+    char *path;
+    const char *pg_type;
+    RangeTblEntry *rte;
+    AttrNumber attnum;
+    Oid atttype;
+    int32 atttypmod;
+    Oid attcollation;
+    Var *column;
+    CoalesceExpr *coalesce;
+    upgrade_state state;
+#if PG_VERSION_NUM >= 160000
+    RTEPermissionInfo *perminfo;
+#endif
+
+    if (!document_match_accessor((Node*)expr, &var, &path, &pg_type) ||
+        strchr(path, '['))
+    {
+        return NULL;
+    }
+
+    query = (Query*)linitial(context->queries);
+    rte = rt_fetch(var->varno, query->rtable);
+    if (rte->rtekind != RTE_RELATION)
+    {
+        return NULL;
+    }
+
+    /* A column that merely shares the key's name is the user's own */
+    state = document_upgrade_state(rte->relid, path, pg_type);
+    if (state != UPGRADE_COPYING &&
+        state != UPGRADE_STRIPPING &&
+        state != UPGRADE_DONE)
+    {
+        return NULL;
+    }
+
+    attnum = get_attnum(rte->relid, doc_column_name(path));
+    if (attnum <= 0 || attnum == var->varattno)
+    {
+        return NULL;
+    }
+    get_atttypetypmodcoll(rte->relid, attnum, &atttype, &atttypmod, &attcollation);
+    if (atttype != expr->funcresulttype ||
+        pg_attribute_aclcheck(rte->relid, attnum, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+    {
+        return NULL;
+    }
+
+    /* The executor checks column privileges against the query's */
+#if PG_VERSION_NUM >= 160000
+    perminfo = getRTEPermissionInfo(query->rteperminfos, rte);
+    perminfo->selectedCols = bms_add_member(perminfo->selectedCols,
+                                            attnum - FirstLowInvalidHeapAttributeNumber);
+#else
+    rte->selectedCols = bms_add_member(rte->selectedCols,
+                                       attnum - FirstLowInvalidHeapAttributeNumber);
+#endif
+
+    column = makeVar(var->varno, attnum, atttype, atttypmod, attcollation, 0);
+#if PG_VERSION_NUM >= 160000
+    column->varnullingrels = bms_copy(var->varnullingrels);
+#endif
+    column->location = var->location;
+
+    if (state == UPGRADE_DONE)
+    {
+        return (Node*)column;
+    }
+
+    coalesce = makeNode(CoalesceExpr);
+    coalesce->coalescetype = atttype;
+    coalesce->coalescecollid = attcollation;
+    coalesce->args = list_make2(column, expr);
+    coalesce->location = expr->location;
+
+    return (Node*)coalesce;
+}
+
+static Node *
+rewrite_mutator(Node *node, rewrite_context *context)
+{
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    if (IsA(node, Query))
+    {
+        Query *query = (Query*)node;
+
+        /* The planner may scribble on its input, so rewrite in place */
+        context->queries = lcons(query, context->queries);
+        query = query_tree_mutator(query,
+                                   rewrite_mutator,
+                                   (void*)context,
+                                   QTW_DONT_COPY_QUERY);
+        context->queries = list_delete_first(context->queries);
+        return (Node*)query;
+    }
+
+    if (IsA(node, FuncExpr))
+    {
+        FuncExpr *expr;
+        Node *rewritten;
+
+        /* Arguments first, so the accessor we keep is rewritten too */
+        expr = (FuncExpr*)expression_tree_mutator(node,
+                                                  rewrite_mutator,
+                                                  (void*)context);
+        rewritten = rewrite_accessor(expr, context);
+        return rewritten ? rewritten : (Node*)expr;
+    }
+
+    return expression_tree_mutator(node, rewrite_mutator, (void*)context);
+}
+
+#if PG_VERSION_NUM >= 130000
+static PlannedStmt *
+document_planner(Query *parse,
+                 const char *query_string,
+                 int cursorOptions,
+                 ParamListInfo boundParams)
+#else
+static PlannedStmt *
+document_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
+#endif
+{
+    if (document_rewrite_accessors && parse->rtable)
+    {
+        rewrite_context context;
+
+        context.queries = NIL;
+        parse = (Query*)rewrite_mutator((Node*)parse, &context);
+    }
+
+#if PG_VERSION_NUM >= 130000
+    if (prev_planner_hook)
+    {
+        return prev_planner_hook(parse, query_string, cursorOptions, boundParams);
+    }
+    return standard_planner(parse, query_string, cursorOptions, boundParams);
+#else
+    if (prev_planner_hook)
+    {
+        return prev_planner_hook(parse, cursorOptions, boundParams);
+    }
+    return standard_planner(parse, cursorOptions, boundParams);
+#endif
+}
+
+void
+document_rewrite_init(void)
+{
+    prev_planner_hook = planner_hook;
+    planner_hook = document_planner;
+}
@@ -0,0 +1,11 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+/* document_type.rewrite_accessors */
+extern bool document_rewrite_accessors;
+
+/* Installs the planner hook that reads materialized keys from their columns
+ * (see rewrite.c). Called from _PG_init */
+void document_rewrite_init(void);
+
+#endif
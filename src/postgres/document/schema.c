@@ -1,11 +1,21 @@
 #include <postgres.h> /* This include must precede all other postgres
                          dependencies */
 
+#include <access/heapam.h>
+#include <access/tableam.h>
 #include <access/xact.h>
+#include <catalog/namespace.h>
 #include <catalog/pg_type.h>
 #include <executor/spi.h>
+#include <fmgr.h>
 #include <lib/stringinfo.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
 #include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/snapmgr.h>
 
 #include <assert.h>
 
@@ -15,296 +25,564 @@
 #include "hash_table.h"
 #include "schema.h"
 
-/* Globals */
-static TransactionId info_xid = 0;
+/*
+ * Attribute cache, by id (key_names, key_types) and by "key_name key_type"
+ * (attr_table), loaded whole by a scan of _attributes on first use and kept
+ * for the life of the backend. Lookups are served from it: no SPI, no
+ * transaction id and no writes, which is what lets the accessors be
+ * IMMUTABLE and PARALLEL SAFE.
+ *
+ * Whoever creates attributes invalidates _attributes' relcache entry, so every
+ * backend drops its cache once they commit, and rows of _attributes are never
+ * updated. But a backend only processes invalidations when it takes a lock, so
+ * inside a transaction that already holds its locks it may read rows that
+ * carry attributes created since it loaded the cache. So a miss is not final:
+ * it processes pending invalidations and, if that dropped the cache, reloads
+ * it and looks again (see refresh_attribute_cache). The cache is also
+ * dropped when _attributes is truncated or dropped, and when a
+ * (sub)transaction that created attributes aborts, as those rows are gone.
+ */
+static MemoryContext attr_context = NULL;
 static int num_keys = 0; /* Length of key_names and key_types */
 static char **key_names = NULL;
 static char **key_types = NULL;
-
-static TransactionId attr_xid = 0;
 static table_t *attr_table = NULL;
-
-/* TODO: at some point, I might want to make the caching on key by key basis
- * rather than global */
-
-/* NOTE: Assumes that key_names, key_types are valid */
-static void
-get_attr_info(int id, char **key_name_ref, char **key_type_ref)
+static Oid attributes_relid = InvalidOid;
+static bool attributes_created = false; /* In the current transaction */
+
+/* Attribute dictionary of a document_load worker (see load.c), which must not
+ * touch _attributes: ids come from it alone, and a key it lacks makes
+ * resolve_attributes set attributes_missing instead of creating the key */
+static table_t *frozen_table = NULL;
+bool attributes_missing = false;
+
+/* Prepared plans, kept for the life of the backend (see prepare_plan) */
+static SPIPlanPtr attr_insert_plan = NULL;
+static SPIPlanPtr attrs_insert_plan = NULL;
+
+/* NOTE: Must be called between SPI_connect and SPI_finish. The plan is moved
+ * out of the SPI procedure context by SPI_keepplan, so it is parsed and
+ * planned once per backend rather than once per call */
+static SPIPlanPtr
+prepare_plan(const char *query, int nargs, Oid *argtypes)
 {
-    // elog(WARNING, "get attr info: %d", id);
-    if (id > num_keys)
+    SPIPlanPtr plan;
+
+    plan = SPI_prepare(query, nargs, argtypes);
+    if (!plan)
     {
-         *key_name_ref = NULL;
-         *key_type_ref = NULL;
+        elog(ERROR,
+             "document: SPI_prepare failed (%s): error code %d",
+             query,
+             SPI_result);
     }
-    else
+    if (SPI_keepplan(plan))
     {
-         *key_name_ref = pstrndup(key_names[id], strlen(key_names[id]));
-         *key_type_ref = pstrndup(key_types[id], strlen(key_types[id]));
+        elog(ERROR, "document: SPI_keepplan failed");
     }
-    // elog(WARNING, "finished");
+
+    return plan;
 }
 
 /*******************************************************************************
- * Document Schema Lookup
+ * Attribute cache
  ******************************************************************************/
 
-void
-get_attr(int id, char **key_name_ref, char **key_type_ref)
+static void
+reset_attribute_cache(void)
 {
-    StringInfoData buf;
-    int ret;
-
-    if (info_xid != GetCurrentTransactionId() || !key_names)
+    if (attr_context)
     {
-        bool isnull;
-        int i;
-        MemoryContext old_context;
-
-        info_xid = GetCurrentTransactionId();
+        MemoryContextReset(attr_context);
+    }
+    num_keys = 0;
+    key_names = NULL;
+    key_types = NULL;
+    attr_table = NULL;
+}
 
-        SPI_connect();
+static void
+invalidate_attributes(Datum arg, Oid relid)
+{
+    if (relid == InvalidOid || relid == attributes_relid)
+    {
+        reset_attribute_cache();
+    }
+}
 
-        initStringInfo(&buf);
-        appendStringInfo(&buf,
-                         "select _id, key_name, key_type from "
-                         "document_schema._attributes ORDER BY _id ASC"); // TODO: Is Ascending tag necessary?
-        ret = SPI_execute(buf.data, false, 0);
-        if (ret != SPI_OK_SELECT)
+static void
+attributes_xact_callback(XactEvent event, void *arg)
+{
+    switch (event)
+    {
+    case XACT_EVENT_ABORT:
+    case XACT_EVENT_PARALLEL_ABORT:
+        if (attributes_created)
         {
-            elog(ERROR,
-                 "document: SPI_execute failed (get_attribute): error code %d",
-                 ret);
+            reset_attribute_cache();
         }
+        /* FALLTHROUGH */
+    case XACT_EVENT_COMMIT:
+    case XACT_EVENT_PARALLEL_COMMIT:
+        attributes_created = false;
+        break;
+    default:
+        break;
+    }
+}
 
-        num_keys = DatumGetInt32(SPI_getbinval(
-              SPI_tuptable->vals[SPI_processed - 1],
-              SPI_tuptable->tupdesc,
-              1,
-              &isnull)) + 1; /* +1 because 0 based index */
-        assert(!isnull);
-        // elog(WARNING, "num keys: %d", num_keys);
-
-        old_context = MemoryContextSwitchTo(CurTransactionContext);
-        /* Memory was already freed by MemoryContext stuff, so I don't have to
-         * redo it
-         */
-        key_names = palloc0(num_keys * sizeof(char*));
-        key_types = palloc0(num_keys * sizeof(char*));
-
-        // elog(WARNING, "allocated key types and names");
-        // elog(WARNING, "SPI_processed: %d", SPI_processed);
-        for (i = 0; i < SPI_processed; ++i)
-        {
-            int aid;
-            char *name, *val;
+static void
+attributes_subxact_callback(SubXactEvent event,
+                            SubTransactionId mySubid,
+                            SubTransactionId parentSubid,
+                            void *arg)
+{
+    /* Conservatively, it may have been this subtransaction that created
+     * them; the rest are reloaded from _attributes */
+    if (event == SUBXACT_EVENT_ABORT_SUB && attributes_created)
+    {
+        reset_attribute_cache();
+        attributes_created = false;
+    }
+}
 
-            aid = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i],
-                                              SPI_tuptable->tupdesc,
-                                              1,
-                                              &isnull));
-            // elog(WARNING, "found aid: %d", aid);
-            assert(!isnull);
-            name = SPI_getvalue(SPI_tuptable->vals[i],
-                                SPI_tuptable->tupdesc,
-                                2);
-            key_names[aid] = pstrndup(name, strlen(name));
-            // key_names[aid] = palloc0(strlen(name) + 1);
-            // strcpy(key_names[aid], name);
-            val = SPI_getvalue(SPI_tuptable->vals[i],
-                               SPI_tuptable->tupdesc,
-                               3);
-            key_types[aid] = pstrndup(val, strlen(val));
-            //key_types[aid] = palloc0(strlen(val) + 1);
-            strcpy(key_types[aid], val);
-        }
+/* Adds an attribute to the cache, if it is loaded */
+static void
+cache_attribute(int id, const char *name, const char *type)
+{
+    MemoryContext old_context;
+    char *attr;
+
+    if (!attr_table)
+    {
+        return;
+    }
 
-        SPI_finish();
+    old_context = MemoryContextSwitchTo(attr_context);
 
-        MemoryContextSwitchTo(old_context);
+    if (id >= num_keys)
+    {
+        int new_num_keys;
+
+        new_num_keys = Max(2 * num_keys, id + 1);
+        key_names = repalloc(key_names, new_num_keys * sizeof(char*));
+        key_types = repalloc(key_types, new_num_keys * sizeof(char*));
+        memset(key_names + num_keys, 0,
+               (new_num_keys - num_keys) * sizeof(char*));
+        memset(key_types + num_keys, 0,
+               (new_num_keys - num_keys) * sizeof(char*));
+        num_keys = new_num_keys;
+    }
+    if (!key_names[id])
+    {
+        key_names[id] = pstrdup(name);
+        key_types[id] = pstrdup(type);
+    }
 
-        get_attr_info(id, key_name_ref, key_type_ref);
+    attr = palloc0(strlen(name) + strlen(type) + 2);
+    sprintf(attr, "%s %s", name, type);
+    put(attr_table, attr, id);
+    pfree(attr);
+
+    MemoryContextSwitchTo(old_context);
+}
+
+/* Loads the whole dictionary into the cache with a single scan, unless it is
+ * loaded already */
+static void
+load_attribute_cache(void)
+{
+    Relation rel;
+    TableScanDesc scan;
+    HeapTuple tuple;
+    TupleDesc tupdesc;
+    Snapshot snapshot;
+    MemoryContext old_context;
+
+    if (attr_table)
+    {
         return;
     }
-    else if (id > num_keys || !key_names[id])
+
+    if (!attr_context)
     {
-        /* Cache miss.
-         * get_attribute only occurs on deserialization, so this is unlikely to
-         * be called, and hence we don't mind paying the cost of single lookup
-         */
-        SPI_connect();
+        attr_context = AllocSetContextCreate(CacheMemoryContext,
+                                             "document attributes",
+                                             ALLOCSET_DEFAULT_SIZES);
+    }
 
-        initStringInfo(&buf);
-        appendStringInfo(&buf, "select key_name, key_type from"
-        " document_schema._attributes where _id = '%d'", id);
+    attributes_relid = get_relname_relid("_attributes",
+                                         get_namespace_oid("document_schema",
+                                                           false));
+    if (!OidIsValid(attributes_relid))
+    {
+        elog(ERROR, "document: document_schema._attributes does not exist");
+    }
 
-        ret = SPI_execute(buf.data, false, 0);
-        if (ret != SPI_OK_SELECT)
-        {
-            elog(ERROR,
-                 "document: SPI_execute failed (get_attribute): error code %d",
-                 ret);
-        }
+    /* Taking the lock may process invalidations, so it comes before we start
+     * building */
+    rel = table_open(attributes_relid, AccessShareLock);
 
-        if (SPI_processed != 1)
-        {
-            *key_name_ref = NULL;
-            *key_type_ref = NULL;
-        }
-        else
+    /* Everything committed so far, and our own attributes. Parallel workers
+     * can't take a new snapshot, and use the query's */
+    snapshot = RegisterSnapshot(IsInParallelMode() ? GetActiveSnapshot() :
+                                                     GetLatestSnapshot());
+
+    reset_attribute_cache();
+    old_context = MemoryContextSwitchTo(attr_context);
+    key_names = palloc0(sizeof(char*));
+    key_types = palloc0(sizeof(char*));
+    attr_table = make_table();
+    MemoryContextSwitchTo(old_context);
+
+    /* A partial cache would have us create attributes twice */
+    PG_TRY();
+    {
+        tupdesc = RelationGetDescr(rel);
+        scan = table_beginscan(rel, snapshot, 0, NULL);
+        while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
         {
-            *key_name_ref = SPI_getvalue(SPI_tuptable->vals[0],
-                                         SPI_tuptable->tupdesc,
-                                         1);
-            *key_type_ref = SPI_getvalue(SPI_tuptable->vals[0],
-                                         SPI_tuptable->tupdesc,
-                                         2);
+            bool isnull;
+            int aid;
+            char *name, *type;
+
+            aid = DatumGetInt32(heap_getattr(tuple, 1, tupdesc, &isnull));
+            assert(!isnull);
+            name = TextDatumGetCString(heap_getattr(tuple, 2, tupdesc,
+                                                    &isnull));
+            type = TextDatumGetCString(heap_getattr(tuple, 3, tupdesc,
+                                                    &isnull));
+            cache_attribute(aid, name, type);
+            pfree(name);
+            pfree(type);
         }
-        return;
+        table_endscan(scan);
+    }
+    PG_CATCH();
+    {
+        reset_attribute_cache();
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    table_close(rel, AccessShareLock);
+
+    UnregisterSnapshot(snapshot);
+}
+
+/* For a miss in the cache: processes pending invalidations and, if they
+ * dropped the cache, reloads it. Returns whether it did, i.e. whether a
+ * second lookup may find what the first didn't */
+static bool
+refresh_attribute_cache(void)
+{
+    AcceptInvalidationMessages();
+    if (attr_table)
+    {
+        return false;
+    }
+    load_attribute_cache();
+    return true;
+}
+
+void
+document_schema_init(void)
+{
+    CacheRegisterRelcacheCallback(invalidate_attributes, (Datum)0);
+    RegisterXactCallback(attributes_xact_callback, NULL);
+    RegisterSubXactCallback(attributes_subxact_callback, NULL);
+}
+
+/*******************************************************************************
+ * Document Schema Lookup
+ ******************************************************************************/
+
+void
+get_attr(int id, char **key_name_ref, char **key_type_ref)
+{
+    load_attribute_cache();
+
+    if (!(id >= 0 && id < num_keys && key_names[id]))
+    {
+        (void)refresh_attribute_cache();
+    }
+    if (id >= 0 && id < num_keys && key_names[id])
+    {
+        *key_name_ref = pstrdup(key_names[id]);
+        *key_type_ref = pstrdup(key_types[id]);
     }
     else
     {
-        get_attr_info(id, key_name_ref, key_type_ref);
-        return;
+        *key_name_ref = NULL;
+        *key_type_ref = NULL;
     }
 }
 
+/* Returns -1 for an attribute that doesn't exist (see add_attribute,
+ * resolve_attributes) */
 int
 get_attribute_id(const char *keyname, const char *typename)
 {
-    StringInfoData buf;
-    int ret;
-    bool isnull;
     int attr_id;
     char *attr;
 
-    //elog(WARNING, "keyname : %s", keyname);
-    //elog(WARNING, "typename : %s", typename);
     attr = palloc0(strlen(keyname) + strlen(typename) + 2);
     sprintf(attr, "%s %s", keyname, typename);
-    //elog(WARNING, "Looking for attr: %s", attr);
 
-    if (attr_xid != GetCurrentTransactionId() || !attr_table)
+    if (frozen_table)
     {
-        bool isnull;
-        int i;
-        MemoryContext old_context;
+        attr_id = get(frozen_table, attr);
+    }
+    else
+    {
+        load_attribute_cache();
+        attr_id = get(attr_table, attr);
+        if (attr_id < 0 && refresh_attribute_cache())
+        {
+            attr_id = get(attr_table, attr);
+        }
+    }
+
+    pfree(attr);
+    return attr_id;
+}
+
+/* Creates an attribute, which must not exist yet. Not for parallel workers */
+int
+add_attribute(const char *keyname, const char *typename)
+{
+    int ret; /* Return code of SPI_execute */
+    bool isnull;
+    int attr_id;
+    Datum values[2];
+
+    SPI_connect();
+
+    if (!attr_insert_plan)
+    {
+        Oid argtypes[2] = { TEXTOID, TEXTOID };
 
-        attr_xid = GetCurrentTransactionId();
+        attr_insert_plan = prepare_plan("insert into document_schema._attributes"
+                                        "(key_name, key_type) values ($1, $2)"
+                                        " returning _id",
+                                        2,
+                                        argtypes);
+    }
+
+    values[0] = CStringGetTextDatum(keyname);
+    values[1] = CStringGetTextDatum(typename);
+    ret = SPI_execute_plan(attr_insert_plan, values, NULL, false, 0);
+    if (ret != SPI_OK_INSERT_RETURNING || SPI_processed != 1)
+    {
+        elog(ERROR, "document: SPI_execute failed: error code %d", ret);
+    }
+
+    attr_id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0],
+                                          SPI_tuptable->tupdesc,
+                                          1,
+                                          &isnull));
+    assert(!isnull);
+
+    SPI_finish();
+
+    attributes_created = true;
+    cache_attribute(attr_id, keyname, typename);
+    if (OidIsValid(attributes_relid))
+    {
+        CacheInvalidateRelcacheByRelid(attributes_relid);
+    }
+
+    return attr_id;
+}
 
-        SPI_connect();
+/*
+ * Fills ids[i] with the attribute id of (key_names[i], type_names[i]),
+ * creating the attributes that don't exist yet with a single insert. Pairs may
+ * repeat; each new one is only created once.
+ */
+void
+resolve_attributes(int n, char **key_names, char **type_names, int *ids)
+{
+    int ret;
+    int i;
+    int num_missing;
+    Datum *missing_names;
+    Datum *missing_types;
+    table_t *missing_table;
+    Datum values[2];
+
+    num_missing = 0;
+    missing_names = NULL;
+    missing_types = NULL;
+    missing_table = NULL;
+    for (i = 0; i < n; ++i)
+    {
+        char *attr;
 
-        initStringInfo(&buf);
-        appendStringInfo(&buf,
-                         "select _id, key_name, key_type from "
-                         "document_schema._attributes");
-        ret = SPI_execute(buf.data, false, 0);
-        if (ret != SPI_OK_SELECT)
+        ids[i] = get_attribute_id(key_names[i], type_names[i]);
+        if (ids[i] >= 0)
         {
-            elog(ERROR,
-                 "document: SPI_execute failed (get_attribute): error code %d",
-                 ret);
+            continue;
         }
 
-        /* Memory was already freed by MemoryContext stuff, so I don't have to
-         * redo it
-         */
-        old_context = MemoryContextSwitchTo(CurTransactionContext);
-        attr_table = make_table();
-
-        for (i = 0; i < SPI_processed; ++i)
+        if (!missing_table)
         {
-            int aid;
-            char *name, *type;
-            char *attr_tmp;
+            missing_table = make_table();
+            missing_names = palloc(n * sizeof(Datum));
+            missing_types = palloc(n * sizeof(Datum));
+        }
 
-            aid = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i],
-                                              SPI_tuptable->tupdesc,
-                                              1,
-                                              &isnull));
-            assert(!isnull);
-            name = SPI_getvalue(SPI_tuptable->vals[i],
-                                SPI_tuptable->tupdesc,
-                                2);
-            type = SPI_getvalue(SPI_tuptable->vals[i],
-                               SPI_tuptable->tupdesc,
-                               3);
-            attr_tmp = palloc0(strlen(name) + strlen(type) + 2);
-            sprintf(attr_tmp, "%s %s", name, type);
-            //elog(WARNING, "caching value: %s", attr_tmp);
-
-            put(attr_table, attr_tmp, aid);
-            //elog(WARNING, "cached");
-            pfree(attr_tmp);
+        attr = palloc0(strlen(key_names[i]) + strlen(type_names[i]) + 2);
+        sprintf(attr, "%s %s", key_names[i], type_names[i]);
+        if (get(missing_table, attr) < 0)
+        {
+            put(missing_table, attr, num_missing);
+            missing_names[num_missing] = CStringGetTextDatum(key_names[i]);
+            missing_types[num_missing] = CStringGetTextDatum(type_names[i]);
+            ++num_missing;
         }
+        pfree(attr);
+    }
 
-        SPI_finish();
+    if (!num_missing)
+    {
+        return;
+    }
+    else if (frozen_table)
+    {
+        attributes_missing = true;
+        return;
+    }
 
-        MemoryContextSwitchTo(old_context);
+    values[0] = PointerGetDatum(construct_array(missing_names, num_missing,
+                                                TEXTOID, -1, false, 'i'));
+    values[1] = PointerGetDatum(construct_array(missing_types, num_missing,
+                                                TEXTOID, -1, false, 'i'));
 
-        return get(attr_table, attr);
+    SPI_connect();
+
+    if (!attrs_insert_plan)
+    {
+        Oid argtypes[2] = { TEXTARRAYOID, TEXTARRAYOID };
+
+        attrs_insert_plan = prepare_plan("insert into document_schema._attributes"
+                                         "(key_name, key_type)"
+                                         " select unnest($1), unnest($2)"
+                                         " returning _id, key_name, key_type",
+                                         2,
+                                         argtypes);
     }
-    else if ((attr_id = get(attr_table, attr)) >= 0)
+
+    ret = SPI_execute_plan(attrs_insert_plan, values, NULL, false, 0);
+    if (ret != SPI_OK_INSERT_RETURNING || SPI_processed != num_missing)
     {
-        //elog(WARNING, "found attr id in table");
-        return attr_id;
+        elog(ERROR, "document: SPI_execute failed: error code %d", ret);
     }
-    else
+
+    attributes_created = true;
+    for (i = 0; i < SPI_processed; ++i)
     {
-        MemoryContext old_context;
+        bool isnull;
+        int aid;
+        char *name, *type;
+
+        aid = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[i],
+                                          SPI_tuptable->tupdesc,
+                                          1,
+                                          &isnull));
+        assert(!isnull);
+        name = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2);
+        type = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 3);
+        cache_attribute(aid, name, type);
+    }
+
+    SPI_finish();
 
-        SPI_connect();
+    if (OidIsValid(attributes_relid))
+    {
+        CacheInvalidateRelcacheByRelid(attributes_relid);
+    }
 
-        initStringInfo(&buf);
-        appendStringInfo(&buf, "select _id from document_schema._attributes"
-            " where key_name = '%s' AND key_type = '%s'", keyname, typename);
-        ret = SPI_execute(buf.data, false, 0);
-        if (ret != SPI_OK_SELECT)
+    for (i = 0; i < n; ++i)
+    {
+        if (ids[i] < 0)
         {
-            elog(ERROR, "document: SPI_execute failed: error code %d", ret);
+            ids[i] = get_attribute_id(key_names[i], type_names[i]);
         }
+    }
+}
 
-        if (SPI_processed != 1) {
-            SPI_finish();
-            return -1;
-        }
+Datum document_attribute_id(PG_FUNCTION_ARGS);
 
-        attr_id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0],
-                                              SPI_tuptable->tupdesc,
-                                              1,
-                                              &isnull));
-        assert(!isnull);
-        SPI_finish();
+PG_FUNCTION_INFO_V1(document_attribute_id);
 
-        /* Update table */
-        old_context = MemoryContextSwitchTo(CurTransactionContext);
-        put(attr_table, attr, attr_id);
-        MemoryContextSwitchTo(old_context);
+/* The id of an attribute, created if it doesn't exist yet: for SQL that needs
+ * an attribute (see materialize_document_path), so that it comes from the
+ * cache and the other backends hear about new ones, as with documents */
+Datum
+document_attribute_id(PG_FUNCTION_ARGS)
+{
+    char *key_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *key_type = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    int attr_id;
 
-        return attr_id;
+    resolve_attributes(1, &key_name, &key_type, &attr_id);
+    if (attr_id < 0)
+    {
+        elog(ERROR, "document_attribute_id: cannot create attribute %s %s",
+             key_name, key_type);
     }
+
+    PG_RETURN_INT32(attr_id);
 }
 
+/*
+ * Appends every attribute to buf, as an int id followed by
+ * "key_name key_type\0", and returns their number. attributes_freeze reads
+ * it back.
+ */
 int
-add_attribute(const char *keyname, const char *typename)
+attributes_serialize(StringInfo buf)
 {
-    int ret; /* Return code of SPI_execute */
-    StringInfoData buf;
-
-    SPI_connect();
+    int id;
+    int n;
 
-    initStringInfo(&buf);
-    appendStringInfo(&buf, "insert into document_schema._attributes(key_name, "
-        "key_type) values ('%s', '%s')", keyname, typename);
+    load_attribute_cache();
 
-    ret = SPI_execute(buf.data, false, 0);
-    if (ret != SPI_OK_INSERT)
+    n = 0;
+    for (id = 0; id < num_keys; ++id)
     {
-        elog(ERROR, "document: SPI_execute failed: error code %d", ret);
-    }
+        if (!key_names[id])
+        {
+            continue;
+        }
 
-    SPI_finish();
+        appendBinaryStringInfo(buf, (char*)&id, sizeof(int));
+        appendStringInfo(buf, "%s %s", key_names[id], key_types[id]);
+        appendStringInfoChar(buf, '\0');
+        ++n;
+    }
 
-    return get_attribute_id(keyname, typename); /* Refreshes the cache and gives value */
+    return n;
 }
 
+/* Serves every attribute id from the n attributes serialized in data (see
+ * attributes_serialize) for the rest of the backend's life */
+void
+attributes_freeze(const char *data, int n)
+{
+    int i;
+    MemoryContext old_context;
+
+    old_context = MemoryContextSwitchTo(TopMemoryContext);
+    frozen_table = make_table();
+    for (i = 0; i < n; ++i)
+    {
+        int aid;
+
+        memcpy(&aid, data, sizeof(int));
+        data += sizeof(int);
+        put(frozen_table, (char*)data, aid);
+        data += strlen(data) + 1;
+    }
+    MemoryContextSwitchTo(old_context);
+}
@@ -1,6 +1,18 @@
+#include "core.h"
+
+/* Registers the attribute cache's invalidation callbacks. Called from
+ * _PG_init */
+void document_schema_init(void);
+
 void get_attr(int id,
                    char **key_name_ref,
                    char **type_name_ref); /* TODO: better name */
 int get_attribute_id(const char *key_name, const char *type_name);
 int add_attribute(const char *key_name, const char *type_name);
 
+void resolve_attributes(int n, char **key_names, char **type_names, int *ids);
+
+/* Used by document_load to serialize in parallel workers (see load.c) */
+extern bool attributes_missing;
+int attributes_serialize(StringInfo buf);
+void attributes_freeze(const char *data, int n);
@@ -0,0 +1,832 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/htup_details.h>
+#include <access/table.h>
+#include <catalog/pg_collation.h>
+#include <catalog/pg_statistic.h>
+#include <catalog/pg_type.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/supportnodes.h>
+#include <optimizer/cost.h>
+#include <optimizer/plancat.h>
+#include <parser/parsetree.h>
+#include <utils/acl.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/lsyscache.h>
+#include <utils/rel.h>
+#include <utils/selfuncs.h>
+#include <utils/typcache.h>
+
+#include "binary.h"
+#include "json.h"
+#include "schema.h"
+#include "selfuncs.h"
+#include "stats.h"
+
+/*******************************************************************************
+ * Planner support for the accessors
+ *
+ * The selectivity estimators only look up statistics for plain columns and
+ * for expressions that appear in an index. To let them see the per-key
+ * statistics gathered by document_typanalyze, get_relation_info_hook adds a
+ * stats-only "index" over the accessor calls of each document column in the
+ * query. It can produce no paths; when the estimators match a clause against
+ * one of its expressions, get_index_stats_hook answers with a pg_statistic
+ * tuple built from the key's statistics. Predicates such as
+ * document_get_int(data, 'id') = 42 or document_get_text(data, 'lang') < 'f'
+ * are then estimated exactly as on a physical column.
+ *
+ * The hooks are installed when the library is loaded, so the first query of a
+ * session only gets them if document_type is in shared_preload_libraries or
+ * session_preload_libraries.
+ ******************************************************************************/
+
+/* Per-call cost of an accessor, in units of cpu_operator_cost. Each call
+ * detoasts the document, resolves the key in the attribute dictionary and
+ * binary searches the header, once per path level */
+#define ACCESSOR_BASE_COST (10)
+#define ACCESSOR_DEPTH_COST (10)
+
+typedef enum {
+    ACCESSOR_NONE = 0,
+    ACCESSOR_GET,
+    ACCESSOR_GET_INT,
+    ACCESSOR_GET_FLOAT,
+    ACCESSOR_GET_BOOL,
+    ACCESSOR_GET_TEXT,
+    ACCESSOR_GET_DOC
+} accessor_kind;
+
+typedef struct accessor_entry {
+    Oid funcid; /* Hash key */
+    accessor_kind kind;
+} accessor_entry;
+
+typedef struct collect_context {
+    Index relid;
+    List *exprs;
+} collect_context;
+
+/* Selectivity of doc @> query when we know nothing of a key; contsel's */
+#define DEFAULT_CONTAIN_SEL (0.001)
+
+Datum document_get_support(PG_FUNCTION_ARGS);
+Datum document_contsel(PG_FUNCTION_ARGS);
+Datum document_existsel(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_get_support);
+PG_FUNCTION_INFO_V1(document_contsel);
+PG_FUNCTION_INFO_V1(document_existsel);
+
+/* Defined in accessors.c */
+extern Datum document_get(PG_FUNCTION_ARGS);
+extern Datum document_get_int(PG_FUNCTION_ARGS);
+extern Datum document_get_float(PG_FUNCTION_ARGS);
+extern Datum document_get_bool(PG_FUNCTION_ARGS);
+extern Datum document_get_text(PG_FUNCTION_ARGS);
+extern Datum document_get_doc(PG_FUNCTION_ARGS);
+
+static HTAB *accessor_table = NULL; /* funcid -> accessor_kind */
+
+static get_relation_info_hook_type prev_get_relation_info_hook = NULL;
+static get_index_stats_hook_type prev_get_index_stats_hook = NULL;
+
+/* Which accessor, if any, funcid is. Accessors are recognized by their C
+ * symbol, so this holds whatever schema the extension was installed in */
+static accessor_kind
+get_accessor_kind(Oid funcid)
+{
+    accessor_entry *entry;
+    bool found;
+
+    if (!accessor_table)
+    {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(Oid);
+        ctl.entrysize = sizeof(accessor_entry);
+        accessor_table = hash_create("document accessors",
+                                     32,
+                                     &ctl,
+                                     HASH_ELEM | HASH_BLOBS);
+    }
+
+    entry = hash_search(accessor_table, &funcid, HASH_ENTER, &found);
+    if (!found)
+    {
+        FmgrInfo finfo;
+
+        entry->kind = ACCESSOR_NONE;
+        fmgr_info(funcid, &finfo);
+        if (finfo.fn_addr == document_get)
+        {
+            entry->kind = ACCESSOR_GET;
+        }
+        else if (finfo.fn_addr == document_get_int)
+        {
+            entry->kind = ACCESSOR_GET_INT;
+        }
+        else if (finfo.fn_addr == document_get_float)
+        {
+            entry->kind = ACCESSOR_GET_FLOAT;
+        }
+        else if (finfo.fn_addr == document_get_bool)
+        {
+            entry->kind = ACCESSOR_GET_BOOL;
+        }
+        else if (finfo.fn_addr == document_get_text)
+        {
+            entry->kind = ACCESSOR_GET_TEXT;
+        }
+        else if (finfo.fn_addr == document_get_doc)
+        {
+            entry->kind = ACCESSOR_GET_DOC;
+        }
+    }
+
+    return entry->kind;
+}
+
+/* Whether node is a scalar accessor applied to a column of the current query
+ * level with a constant path. If so, fills in the column, the path and the pg
+ * type of the key it reads */
+bool
+document_match_accessor(Node *node,
+                        Var **var_ref,
+                        char **path_ref,
+                        const char **type_ref)
+{
+    FuncExpr *expr;
+    Node *arg;
+    Const *path_const;
+
+    if (!node || !IsA(node, FuncExpr))
+    {
+        return false;
+    }
+    expr = (FuncExpr*)node;
+    if (list_length(expr->args) < 2)
+    {
+        return false;
+    }
+
+    arg = linitial(expr->args);
+    if (!IsA(arg, Var) || ((Var*)arg)->varlevelsup != 0)
+    {
+        return false;
+    }
+    path_const = (Const*)lsecond(expr->args);
+    if (!IsA(path_const, Const) || path_const->constisnull)
+    {
+        return false;
+    }
+
+    switch (get_accessor_kind(expr->funcid))
+    {
+    case ACCESSOR_GET_INT:
+        *type_ref = INTEGER_TYPE;
+        break;
+    case ACCESSOR_GET_FLOAT:
+        *type_ref = FLOAT_TYPE;
+        break;
+    case ACCESSOR_GET_BOOL:
+        *type_ref = BOOLEAN_TYPE;
+        break;
+    case ACCESSOR_GET_TEXT:
+        *type_ref = STRING_TYPE;
+        break;
+    case ACCESSOR_GET:
+        {
+            /* Only strings come back from document_get as themselves */
+            Const *type_const = (Const*)lthird(expr->args);
+
+            if (!IsA(type_const, Const) ||
+                type_const->constisnull ||
+                strcmp(DatumGetCString(type_const->constvalue), STRING_TYPE))
+            {
+                return false;
+            }
+            *type_ref = STRING_TYPE;
+            break;
+        }
+    default:
+        return false;
+    }
+
+    *var_ref = (Var*)arg;
+    *path_ref = DatumGetCString(path_const->constvalue);
+    return true;
+}
+
+/*******************************************************************************
+ * Stats-only index over accessor expressions
+ ******************************************************************************/
+
+static bool
+collect_accessors_walker(Node *node, collect_context *context)
+{
+    Var *var;
+    char *path;
+    const char *pg_type;
+
+    if (node == NULL)
+    {
+        return false;
+    }
+    if (IsA(node, Query))
+    {
+        return false; /* Sublinks plan their own relations */
+    }
+
+    if (document_match_accessor(node, &var, &path, &pg_type) &&
+        var->varno == context->relid)
+    {
+        FuncExpr *expr = copyObject((FuncExpr*)node);
+
+#if PG_VERSION_NUM >= 160000
+        /* Index expressions never carry outer join markings */
+        ((Var*)linitial(expr->args))->varnullingrels = NULL;
+#endif
+        if (!list_member(context->exprs, expr))
+        {
+            context->exprs = lappend(context->exprs, expr);
+        }
+    }
+
+    return expression_tree_walker(node, collect_accessors_walker, (void*)context);
+}
+
+/* Never chosen: the index has no scan methods. Just in case. */
+static void
+document_stats_costestimate(PlannerInfo *root,
+                            IndexPath *path,
+                            double loop_count,
+                            Cost *indexStartupCost,
+                            Cost *indexTotalCost,
+                            Selectivity *indexSelectivity,
+                            double *indexCorrelation,
+                            double *indexPages)
+{
+    *indexStartupCost = disable_cost;
+    *indexTotalCost = disable_cost;
+    *indexSelectivity = 1.0;
+    *indexCorrelation = 0.0;
+    *indexPages = 0.0;
+}
+
+static void
+document_get_relation_info(PlannerInfo *root,
+                           Oid relationObjectId,
+                           bool inhparent,
+                           RelOptInfo *rel)
+{
+    collect_context context;
+    IndexOptInfo *info;
+    ListCell *lc;
+    int ncolumns;
+    int i;
+
+    if (prev_get_relation_info_hook)
+    {
+        prev_get_relation_info_hook(root, relationObjectId, inhparent, rel);
+    }
+
+    /* Children of an inheritance tree are not named by the query's Vars */
+    if (rel->reloptkind != RELOPT_BASEREL)
+    {
+        return;
+    }
+
+    context.relid = rel->relid;
+    context.exprs = NIL;
+    query_tree_walker(root->parse,
+                      collect_accessors_walker,
+                      (void*)&context,
+                      QTW_IGNORE_RT_SUBQUERIES | QTW_IGNORE_CTE_SUBQUERIES);
+    if (context.exprs == NIL)
+    {
+        return;
+    }
+
+    ncolumns = list_length(context.exprs);
+
+    info = makeNode(IndexOptInfo);
+    info->indexoid = InvalidOid; /* Marks it as ours for the stats hook */
+    info->reltablespace = InvalidOid;
+    info->rel = rel;
+    info->pages = 0;
+    info->tuples = 0;
+    info->tree_height = -1;
+    info->ncolumns = ncolumns;
+    info->nkeycolumns = ncolumns;
+    info->indexkeys = palloc0(ncolumns * sizeof(int)); /* All expressions */
+    info->indexcollations = palloc0(ncolumns * sizeof(Oid));
+    info->opfamily = palloc0(ncolumns * sizeof(Oid)); /* Matches no clause */
+    info->opcintype = palloc0(ncolumns * sizeof(Oid));
+    info->canreturn = palloc0(ncolumns * sizeof(bool));
+    info->relam = InvalidOid;
+    info->indexprs = context.exprs;
+    info->indpred = NIL;
+    info->indextlist = NIL;
+    i = 0;
+    foreach(lc, context.exprs)
+    {
+        Expr *expr = (Expr*)lfirst(lc);
+
+        info->indexcollations[i] = exprCollation((Node*)expr);
+        info->indextlist = lappend(info->indextlist,
+                                   makeTargetEntry(expr, ++i, NULL, false));
+    }
+    info->hypothetical = true;
+    info->amhasgettuple = false;
+    info->amhasgetbitmap = false;
+    info->amcostestimate = document_stats_costestimate;
+
+    rel->indexlist = lappend(rel->indexlist, info);
+}
+
+/* Fakes the pg_statistic row an expression index on the accessor call would
+ * have, with the null fraction accounting for documents without the key */
+static HeapTuple
+build_stats_tuple(Oid relid,
+                  AttrNumber attnum,
+                  document_key_stats *stats,
+                  float4 nullfrac)
+{
+    Datum values[Natts_pg_statistic];
+    bool nulls[Natts_pg_statistic];
+    Relation sd;
+    HeapTuple tuple;
+    TypeCacheEntry *typentry;
+    Datum *key_values;
+    Oid typid, collation;
+    float4 present;
+    int slot;
+    int i;
+
+    typid = document_stats_value_type(stats->type);
+    typentry = lookup_type_cache(typid, TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR);
+    collation = typid == TEXTOID ? DEFAULT_COLLATION_OID : InvalidOid;
+    present = (1 - nullfrac) * stats->presence;
+    key_values = document_key_stats_values(stats);
+
+    memset(nulls, false, sizeof(nulls));
+    values[Anum_pg_statistic_starelid - 1] = ObjectIdGetDatum(relid);
+    values[Anum_pg_statistic_staattnum - 1] = Int16GetDatum(attnum);
+    values[Anum_pg_statistic_stainherit - 1] = BoolGetDatum(false);
+    values[Anum_pg_statistic_stanullfrac - 1] = Float4GetDatum(1 - present);
+    values[Anum_pg_statistic_stawidth - 1] =
+        Int32GetDatum(stats->avgwidth + (typid == TEXTOID ? VARHDRSZ : 0));
+    values[Anum_pg_statistic_stadistinct - 1] = Float4GetDatum(stats->ndistinct);
+    for (slot = 0; slot < STATISTIC_NUM_SLOTS; slot++)
+    {
+        values[Anum_pg_statistic_stakind1 - 1 + slot] = Int16GetDatum(0);
+        values[Anum_pg_statistic_staop1 - 1 + slot] = ObjectIdGetDatum(InvalidOid);
+        values[Anum_pg_statistic_stacoll1 - 1 + slot] = ObjectIdGetDatum(InvalidOid);
+        nulls[Anum_pg_statistic_stanumbers1 - 1 + slot] = true;
+        nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = true;
+    }
+
+    slot = 0;
+    if (stats->nmcv > 0)
+    {
+        Datum *freqs;
+
+        /* Stored frequencies are relative to the documents with the key */
+        freqs = palloc(stats->nmcv * sizeof(Datum));
+        for (i = 0; i < stats->nmcv; i++)
+        {
+            freqs[i] = Float4GetDatum(document_key_stats_mcv_freqs(stats)[i] *
+                                      present);
+        }
+
+        values[Anum_pg_statistic_stakind1 - 1 + slot] =
+            Int16GetDatum(STATISTIC_KIND_MCV);
+        values[Anum_pg_statistic_staop1 - 1 + slot] =
+            ObjectIdGetDatum(typentry->eq_opr);
+        values[Anum_pg_statistic_stacoll1 - 1 + slot] =
+            ObjectIdGetDatum(collation);
+        values[Anum_pg_statistic_stanumbers1 - 1 + slot] =
+            PointerGetDatum(construct_array(freqs,
+                                            stats->nmcv,
+                                            FLOAT4OID,
+                                            sizeof(float4),
+                                            true,
+                                            'i'));
+        nulls[Anum_pg_statistic_stanumbers1 - 1 + slot] = false;
+        values[Anum_pg_statistic_stavalues1 - 1 + slot] =
+            PointerGetDatum(construct_array(key_values,
+                                            stats->nmcv,
+                                            typid,
+                                            typentry->typlen,
+                                            typentry->typbyval,
+                                            typentry->typalign));
+        nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = false;
+        ++slot;
+    }
+    if (stats->nhist >= 2)
+    {
+        values[Anum_pg_statistic_stakind1 - 1 + slot] =
+            Int16GetDatum(STATISTIC_KIND_HISTOGRAM);
+        values[Anum_pg_statistic_staop1 - 1 + slot] =
+            ObjectIdGetDatum(typentry->lt_opr);
+        values[Anum_pg_statistic_stacoll1 - 1 + slot] =
+            ObjectIdGetDatum(collation);
+        values[Anum_pg_statistic_stavalues1 - 1 + slot] =
+            PointerGetDatum(construct_array(key_values + stats->nmcv,
+                                            stats->nhist,
+                                            typid,
+                                            typentry->typlen,
+                                            typentry->typbyval,
+                                            typentry->typalign));
+        nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = false;
+        ++slot;
+    }
+
+    sd = table_open(StatisticRelationId, AccessShareLock);
+    tuple = heap_form_tuple(RelationGetDescr(sd), values, nulls);
+    table_close(sd, AccessShareLock);
+
+    return tuple;
+}
+
+static bool
+document_get_index_stats(PlannerInfo *root,
+                         Oid indexOid,
+                         AttrNumber indexattnum,
+                         VariableStatData *vardata)
+{
+    RangeTblEntry *rte;
+    document_key_stats *stats;
+    Var *var;
+    char *path;
+    const char *pg_type;
+    float4 nullfrac;
+
+    if (OidIsValid(indexOid) ||
+        !document_match_accessor(vardata->var, &var, &path, &pg_type))
+    {
+        if (prev_get_index_stats_hook)
+        {
+            return prev_get_index_stats_hook(root, indexOid, indexattnum, vardata);
+        }
+        return false;
+    }
+
+    rte = planner_rt_fetch(var->varno, root);
+    if (rte->rtekind != RTE_RELATION)
+    {
+        return false;
+    }
+
+    stats = document_key_stats_lookup(rte->relid,
+                                      var->varattno,
+                                      path,
+                                      pg_type,
+                                      &nullfrac);
+    if (!stats)
+    {
+        return false;
+    }
+
+    vardata->statsTuple = build_stats_tuple(rte->relid,
+                                            var->varattno,
+                                            stats,
+                                            nullfrac);
+    vardata->freefunc = heap_freetuple;
+    /* Same rule as for the column itself: values from the statistics may only
+     * reach non-leakproof operators if the user could read them anyway */
+    vardata->acl_ok =
+        pg_class_aclcheck(rte->relid, GetUserId(), ACL_SELECT) == ACLCHECK_OK ||
+        pg_attribute_aclcheck(rte->relid,
+                              var->varattno,
+                              GetUserId(),
+                              ACL_SELECT) == ACLCHECK_OK;
+    pfree(stats);
+
+    return true;
+}
+
+void
+document_selfuncs_init(void)
+{
+    prev_get_relation_info_hook = get_relation_info_hook;
+    get_relation_info_hook = document_get_relation_info;
+    prev_get_index_stats_hook = get_index_stats_hook;
+    get_index_stats_hook = document_get_index_stats;
+}
+
+/*******************************************************************************
+ * Support function
+ ******************************************************************************/
+
+/* Number of levels in the accessor's path, if it is a constant */
+static int
+accessor_depth(Node *node)
+{
+    Const *path_const;
+    char *path;
+    int depth;
+
+    if (!node || !IsA(node, FuncExpr) ||
+        list_length(((FuncExpr*)node)->args) < 2)
+    {
+        return 1;
+    }
+    path_const = (Const*)lsecond(((FuncExpr*)node)->args);
+    if (!IsA(path_const, Const) || path_const->constisnull)
+    {
+        return 1;
+    }
+
+    depth = 1;
+    for (path = DatumGetCString(path_const->constvalue); *path; path++)
+    {
+        if (*path == '.' || *path == '[')
+        {
+            ++depth;
+        }
+    }
+    return depth;
+}
+
+/* SUPPORT function of the document_get* accessors: per-call cost, and the
+ * selectivity of document_get_bool used directly as a condition (which is what
+ * document_get_bool(...) = true is simplified to) */
+Datum
+document_get_support(PG_FUNCTION_ARGS)
+{
+    Node *rawreq = (Node*)PG_GETARG_POINTER(0);
+
+    if (IsA(rawreq, SupportRequestCost))
+    {
+        SupportRequestCost *req = (SupportRequestCost*)rawreq;
+
+        req->startup = 0;
+        req->per_tuple = cpu_operator_cost *
+            (ACCESSOR_BASE_COST + ACCESSOR_DEPTH_COST * accessor_depth(req->node));
+        PG_RETURN_POINTER(req);
+    }
+    else if (IsA(rawreq, SupportRequestSelectivity))
+    {
+        SupportRequestSelectivity *req = (SupportRequestSelectivity*)rawreq;
+        VariableStatData vardata;
+        FuncExpr *expr;
+        bool has_stats;
+
+        if (req->is_join || get_accessor_kind(req->funcid) != ACCESSOR_GET_BOOL)
+        {
+            PG_RETURN_POINTER(NULL);
+        }
+
+        expr = makeFuncExpr(req->funcid,
+                            BOOLOID,
+                            req->args,
+                            InvalidOid,
+                            req->inputcollid,
+                            COERCE_EXPLICIT_CALL);
+        examine_variable(req->root, (Node*)expr, req->varRelid, &vardata);
+        has_stats = HeapTupleIsValid(vardata.statsTuple);
+        ReleaseVariableStats(vardata);
+        if (!has_stats)
+        {
+            PG_RETURN_POINTER(NULL); /* Keep the default estimate */
+        }
+
+        req->selectivity = boolvarsel(req->root, (Node*)expr, req->varRelid);
+        PG_RETURN_POINTER(req);
+    }
+
+    PG_RETURN_POINTER(NULL);
+}
+
+/*******************************************************************************
+ * Containment selectivity
+ ******************************************************************************/
+
+/* Fraction of the documents carrying the key whose value equals value */
+static Selectivity
+value_selectivity(document_key_stats *stats, Datum value)
+{
+    TypeCacheEntry *typentry;
+    Datum *values;
+    float4 *freqs;
+    double mcv_total;
+    double nother;
+    int i;
+
+    typentry = lookup_type_cache(document_stats_value_type(stats->type),
+                                 TYPECACHE_EQ_OPR_FINFO);
+    values = document_key_stats_values(stats);
+    freqs = document_key_stats_mcv_freqs(stats);
+
+    mcv_total = 0;
+    for (i = 0; i < stats->nmcv; i++)
+    {
+        if (DatumGetBool(FunctionCall2Coll(&typentry->eq_opr_finfo,
+                                           DEFAULT_COLLATION_OID,
+                                           values[i],
+                                           value)))
+        {
+            return freqs[i];
+        }
+        mcv_total += freqs[i];
+    }
+
+    /* Spread what the MCVs leave over the remaining distinct values */
+    nother = stats->ndistinct - stats->nmcv;
+    return (1 - mcv_total) / Max(nother, 1);
+}
+
+/* Estimates the fraction of non-null documents containing query, treating
+ * its keys as independent */
+static Selectivity
+containment_selectivity(Oid relid,
+                        AttrNumber attnum,
+                        const char *query,
+                        const char *prefix)
+{
+    Selectivity selec;
+    int natts;
+    int i;
+
+    selec = 1.0;
+    natts = doc_natts(query);
+    for (i = 0; i < natts; i++)
+    {
+        document_key_stats *stats;
+        char *key_name, *key_type;
+        char *path;
+        json_typeid type;
+        int start, end;
+
+        get_attr(doc_attr_id(query, i), &key_name, &key_type);
+        if (!key_name)
+        {
+            selec *= DEFAULT_CONTAIN_SEL;
+            continue;
+        }
+
+        if (prefix)
+        {
+            path = palloc0(strlen(prefix) + strlen(key_name) + 2);
+            sprintf(path, "%s.%s", prefix, key_name);
+        }
+        else
+        {
+            path = key_name;
+        }
+
+        type = get_json_type(key_type);
+        start = doc_offset(query, i);
+        end = doc_offset(query, i + 1);
+        if (type == DOCUMENT)
+        {
+            selec *= containment_selectivity(relid, attnum, query + start, path);
+            continue;
+        }
+
+        stats = document_key_stats_lookup(relid, attnum, path, key_type, NULL);
+        if (!stats)
+        {
+            selec *= DEFAULT_CONTAIN_SEL;
+        }
+        else if (OidIsValid(document_stats_value_type(type)))
+        {
+            selec *= stats->presence *
+                value_selectivity(stats,
+                                  document_stats_value(type,
+                                                       query + start,
+                                                       end - start));
+        }
+        else
+        {
+            selec *= stats->presence * DEFAULT_EQ_SEL;
+        }
+    }
+
+    return selec;
+}
+
+/* RESTRICT estimator of @> and <@ */
+Datum
+document_contsel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo *root = (PlannerInfo*)PG_GETARG_POINTER(0);
+    Oid operator = PG_GETARG_OID(1);
+    List *args = (List*)PG_GETARG_POINTER(2);
+    int varRelid = PG_GETARG_INT32(3);
+    VariableStatData vardata;
+    Node *other;
+    bool varonleft;
+    bool var_contains;
+    Var *var;
+    Const *query_const;
+    bytea *query;
+    RangeTblEntry *rte;
+    float4 nullfrac;
+    Selectivity selec;
+
+    if (!get_restriction_variable(root, args, varRelid, &vardata, &other, &varonleft))
+    {
+        PG_RETURN_FLOAT8(DEFAULT_CONTAIN_SEL);
+    }
+
+    /* Only the column containing a constant is estimated from key stats */
+    var_contains = strcmp(get_opname(operator), "@>") == 0 ? varonleft : !varonleft;
+    if (!var_contains ||
+        !IsA(other, Const) ||
+        !vardata.var ||
+        !IsA(vardata.var, Var) ||
+        !HeapTupleIsValid(vardata.statsTuple))
+    {
+        ReleaseVariableStats(vardata);
+        PG_RETURN_FLOAT8(DEFAULT_CONTAIN_SEL);
+    }
+
+    query_const = (Const*)other;
+    if (query_const->constisnull)
+    {
+        ReleaseVariableStats(vardata);
+        PG_RETURN_FLOAT8(0.0); /* The operator is strict */
+    }
+
+    var = (Var*)vardata.var;
+    rte = planner_rt_fetch(var->varno, root);
+    nullfrac = ((Form_pg_statistic)GETSTRUCT(vardata.statsTuple))->stanullfrac;
+    query = (bytea*)PG_DETOAST_DATUM(query_const->constvalue);
+
+    selec = (1 - nullfrac) *
+        containment_selectivity(rte->relid, var->varattno, query->vl_dat, NULL);
+    CLAMP_PROBABILITY(selec);
+
+    ReleaseVariableStats(vardata);
+    PG_RETURN_FLOAT8((float8)selec);
+}
+
+/* RESTRICT estimator of ? : the presence of the key, summed over its types */
+Datum
+document_existsel(PG_FUNCTION_ARGS)
+{
+    PlannerInfo *root = (PlannerInfo*)PG_GETARG_POINTER(0);
+    List *args = (List*)PG_GETARG_POINTER(2);
+    int varRelid = PG_GETARG_INT32(3);
+    VariableStatData vardata;
+    Node *other;
+    bool varonleft;
+    document_key_stats **key_stats;
+    char *key;
+    Var *var;
+    RangeTblEntry *rte;
+    float4 nullfrac;
+    Selectivity selec;
+    int nkeys;
+    int i;
+
+    if (!get_restriction_variable(root, args, varRelid, &vardata, &other, &varonleft))
+    {
+        PG_RETURN_FLOAT8(DEFAULT_CONTAIN_SEL);
+    }
+    if (!varonleft ||
+        !IsA(other, Const) ||
+        ((Const*)other)->constisnull ||
+        !vardata.var ||
+        !IsA(vardata.var, Var) ||
+        !HeapTupleIsValid(vardata.statsTuple))
+    {
+        ReleaseVariableStats(vardata);
+        PG_RETURN_FLOAT8(DEFAULT_CONTAIN_SEL);
+    }
+
+    var = (Var*)vardata.var;
+    rte = planner_rt_fetch(var->varno, root);
+    nullfrac = ((Form_pg_statistic)GETSTRUCT(vardata.statsTuple))->stanullfrac;
+    key = TextDatumGetCString(((Const*)other)->constvalue);
+
+    /* A document has at most one key of a name, so the types are disjoint */
+    selec = 0;
+    key_stats = document_key_stats_fetch_all(rte->relid, var->varattno, &nkeys);
+    for (i = 0; i < nkeys; i++)
+    {
+        if (!strcmp(document_key_stats_path(key_stats[i]), key))
+        {
+            selec += key_stats[i]->presence;
+        }
+    }
+    if (selec == 0)
+    {
+        selec = DEFAULT_CONTAIN_SEL; /* Rare enough not to be in the sample */
+    }
+    selec *= 1 - nullfrac;
+    CLAMP_PROBABILITY(selec);
+
+    ReleaseVariableStats(vardata);
+    PG_RETURN_FLOAT8((float8)selec);
+}
@@ -0,0 +1,17 @@
+#ifndef SELFUNCS_H
+#define SELFUNCS_H
+
+#include <nodes/primnodes.h>
+
+/* Installs the planner hooks that expose per-key statistics (see stats.h) to
+ * the selectivity estimators. Called from _PG_init */
+void document_selfuncs_init(void);
+
+/* Whether node is a scalar accessor on a column of its own query level with a
+ * constant path; if so, returns the column, path and pg type of the key */
+bool document_match_accessor(Node *node,
+                             Var **var_ref,
+                             char **path_ref,
+                             const char **type_ref);
+
+#endif
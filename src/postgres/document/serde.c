@@ -6,14 +6,60 @@
 #include <catalog/pg_type.h>
 #include <funcapi.h>
 #include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
 
+#include "access.h"
 #include "document.h"
+#include "rewrite.h"
+#include "schema.h"
+#include "selfuncs.h"
+#include "upgrade.h"
 #include "utils.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
+void _PG_init(void);
+
+void
+_PG_init(void)
+{
+    DefineCustomBoolVariable("document_type.bloom_filter",
+                             "Stores a bloom filter of key names in new "
+                             "documents.",
+                             "Lets lookups of absent keys skip the payload, "
+                             "at the cost of 16 bytes per document.",
+                             &document_bloom_filter,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("document_type.rewrite_accessors",
+                             "Reads keys that have been materialized as "
+                             "columns from the column.",
+                             "Accessor calls on such keys are planned as "
+                             "COALESCE(column, accessor).",
+                             &document_rewrite_accessors,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    document_schema_init();
+    document_selfuncs_init();
+    document_rewrite_init();
+    document_upgrade_init();
+    document_access_init();
+}
+
 /*******************************************************************************
  * De/Serialization
  ******************************************************************************/
@@ -24,6 +70,12 @@ Datum document_datum_to_string(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(string_to_document_datum);
 PG_FUNCTION_INFO_V1(document_datum_to_string);
 
+/*
+ * Both directions run in a per-call arena (see document_arena_create), so the
+ * temporaries of every value cost next to nothing and never pile up in the
+ * caller's context over a long scan. Only the result is allocated outside
+ * it.
+ */
 Datum
 string_to_document_datum(PG_FUNCTION_ARGS)
 {
@@ -31,30 +83,52 @@ string_to_document_datum(PG_FUNCTION_ARGS)
     char *binary;
     int size;
     bytea *datum;
+    MemoryContext arena;
+    MemoryContext oldcontext;
+
+    arena = document_arena_create();
+    oldcontext = MemoryContextSwitchTo(arena);
 
     str = pstrndup(str, strlen(str));
+    size = document_to_binary(str, &binary);
 
-    if ((size = document_to_binary(str, &binary)) > 0)
+    MemoryContextSwitchTo(oldcontext);
+    datum = NULL;
+    if (size > 0)
     {
-        datum = palloc0(VARHDRSZ + size);
+        datum = palloc(VARHDRSZ + size);
         SET_VARSIZE(datum, VARHDRSZ + size);
-        memcpy(datum->vl_dat, binary, size); /* FIXME: Hack for now */
-        PG_RETURN_POINTER(datum);
+        memcpy(datum->vl_dat, binary, size);
     }
-    else
+    MemoryContextDelete(arena);
+
+    if (!datum)
     {
         PG_RETURN_NULL();
     }
+    PG_RETURN_POINTER(datum);
 }
 
 Datum
 document_datum_to_string(PG_FUNCTION_ARGS)
 {
-    bytea *datum = (bytea*)PG_GETARG_POINTER(0);
-    char *result;
+    bytea *datum;
+    StringInfoData result;
+    MemoryContext arena;
+    MemoryContext oldcontext;
+
+    /* The text grows in place in our context; only its temporaries, and the
+     * detoasted document, go in the arena */
+    initStringInfo(&result);
+
+    arena = document_arena_create();
+    oldcontext = MemoryContextSwitchTo(arena);
+
+    datum = PG_GETARG_BYTEA_P(0);
+    append_binary_document(&result, datum->vl_dat);
 
-    // TODO: I have the size sitting around here, could use it to verify
-    result = binary_document_to_string(datum->vl_dat);
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextDelete(arena);
 
-    PG_RETURN_CSTRING(result);
+    PG_RETURN_CSTRING(result.data);
 }
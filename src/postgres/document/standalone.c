@@ -0,0 +1,301 @@
+#include "core.h" /* Only built with -DDOCUMENT_STANDALONE */
+
+#include <assert.h>
+#include <stdarg.h>
+
+#include "hash_table.h"
+#include "schema.h"
+
+/* The backend the core expects, for use outside the server (see core.h) */
+
+static void default_error_callback(int level, const char *message);
+
+static document_allocator allocator = { malloc, realloc, free };
+static document_error_callback error_callback = default_error_callback;
+
+void
+document_standalone_init(const document_allocator *new_allocator,
+                         document_error_callback new_error_callback)
+{
+    static const document_allocator default_allocator = { malloc, realloc, free };
+
+    allocator = new_allocator ? *new_allocator : default_allocator;
+    error_callback = new_error_callback ? new_error_callback :
+        default_error_callback;
+}
+
+/*******************************************************************************
+ * Errors
+ ******************************************************************************/
+
+static void
+default_error_callback(int level, const char *message)
+{
+    fprintf(stderr, "%s: %s\n", level >= ERROR ? "ERROR" : "WARNING", message);
+    if (level >= ERROR)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+document_elog(int level, const char *fmt, ...)
+{
+    char message[1024];
+    va_list args;
+
+    if (level < WARNING)
+    {
+        return;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    error_callback(level, message);
+}
+
+/*******************************************************************************
+ * Memory
+ ******************************************************************************/
+
+void *
+palloc(size_t size)
+{
+    void *ptr;
+
+    ptr = allocator.alloc(size);
+    if (!ptr)
+    {
+        elog(ERROR, "out of memory");
+    }
+    return ptr;
+}
+
+void *
+palloc0(size_t size)
+{
+    void *ptr;
+
+    ptr = palloc(size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void *
+repalloc(void *ptr, size_t size)
+{
+    ptr = allocator.realloc(ptr, size);
+    if (!ptr)
+    {
+        elog(ERROR, "out of memory");
+    }
+    return ptr;
+}
+
+void
+pfree(void *ptr)
+{
+    allocator.free(ptr);
+}
+
+char *
+pstrdup(const char *str)
+{
+    size_t len;
+    char *retval;
+
+    len = strlen(str);
+    retval = palloc(len + 1);
+    memcpy(retval, str, len + 1);
+    return retval;
+}
+
+/*******************************************************************************
+ * StringInfo
+ ******************************************************************************/
+
+void
+initStringInfo(StringInfo str)
+{
+    str->maxlen = 1024;
+    str->data = palloc(str->maxlen);
+    resetStringInfo(str);
+}
+
+void
+resetStringInfo(StringInfo str)
+{
+    str->data[0] = '\0';
+    str->len = 0;
+    str->cursor = 0;
+}
+
+/* Makes room for needed more bytes and a terminating '\0' */
+void
+enlargeStringInfo(StringInfo str, int needed)
+{
+    int newlen;
+
+    needed += str->len + 1;
+    if (needed <= str->maxlen)
+    {
+        return;
+    }
+
+    newlen = 2 * str->maxlen;
+    while (needed > newlen)
+    {
+        newlen = 2 * newlen;
+    }
+    str->data = repalloc(str->data, newlen);
+    str->maxlen = newlen;
+}
+
+void
+appendStringInfo(StringInfo str, const char *fmt, ...)
+{
+    va_list args;
+    int avail;
+    int needed;
+
+    for (;;)
+    {
+        avail = str->maxlen - str->len;
+        va_start(args, fmt);
+        needed = vsnprintf(str->data + str->len, avail, fmt, args);
+        va_end(args);
+
+        if (needed < 0)
+        {
+            elog(ERROR, "appendStringInfo: invalid format - %s", fmt);
+        }
+        if (needed < avail)
+        {
+            str->len += needed;
+            return;
+        }
+        enlargeStringInfo(str, needed);
+    }
+}
+
+void
+appendStringInfoString(StringInfo str, const char *s)
+{
+    appendBinaryStringInfo(str, s, strlen(s));
+}
+
+void
+appendStringInfoChar(StringInfo str, char ch)
+{
+    if (str->len + 1 >= str->maxlen)
+    {
+        enlargeStringInfo(str, 1);
+    }
+    str->data[str->len++] = ch;
+    str->data[str->len] = '\0';
+}
+
+void
+appendBinaryStringInfo(StringInfo str, const char *data, int datalen)
+{
+    enlargeStringInfo(str, datalen);
+    memcpy(str->data + str->len, data, datalen);
+    str->len += datalen;
+    str->data[str->len] = '\0';
+}
+
+/*******************************************************************************
+ * Attribute dictionary
+ *
+ * Stands in for document_schema._attributes: ids are handed out from 1, in
+ * order of creation, and last as long as the process.
+ ******************************************************************************/
+
+static int num_keys = 0; /* Length of key_names and key_types */
+static char **key_names = NULL;
+static char **key_types = NULL;
+
+static table_t *attr_table = NULL;
+
+void
+get_attr(int id, char **key_name_ref, char **key_type_ref)
+{
+    if (id >= 0 && id < num_keys && key_names[id])
+    {
+        *key_name_ref = pstrdup(key_names[id]);
+        *key_type_ref = pstrdup(key_types[id]);
+    }
+    else
+    {
+        *key_name_ref = NULL;
+        *key_type_ref = NULL;
+    }
+}
+
+/* Returns -1 for an attribute that doesn't exist */
+int
+get_attribute_id(const char *keyname, const char *typename)
+{
+    int attr_id;
+    char *attr;
+
+    if (!attr_table)
+    {
+        return -1;
+    }
+
+    attr = palloc0(strlen(keyname) + strlen(typename) + 2);
+    sprintf(attr, "%s %s", keyname, typename);
+    attr_id = get(attr_table, attr);
+    pfree(attr);
+
+    return attr_id;
+}
+
+/* Creates an attribute, which must not exist yet */
+int
+add_attribute(const char *keyname, const char *typename)
+{
+    int attr_id;
+    char *attr;
+
+    if (!attr_table)
+    {
+        attr_table = make_table();
+        num_keys = 1; /* Ids start at 1 */
+        key_names = palloc0(num_keys * sizeof(char*));
+        key_types = palloc0(num_keys * sizeof(char*));
+    }
+
+    attr_id = num_keys++;
+    key_names = repalloc(key_names, num_keys * sizeof(char*));
+    key_types = repalloc(key_types, num_keys * sizeof(char*));
+    key_names[attr_id] = pstrdup(keyname);
+    key_types[attr_id] = pstrdup(typename);
+
+    attr = palloc0(strlen(keyname) + strlen(typename) + 2);
+    sprintf(attr, "%s %s", keyname, typename);
+    put(attr_table, attr, attr_id);
+    pfree(attr);
+
+    return attr_id;
+}
+
+/* Sets ids[i] to the id of key_names[i] with type_names[i], creating the
+ * attributes that don't exist yet */
+void
+resolve_attributes(int n, char **names, char **type_names, int *ids)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        ids[i] = get_attribute_id(names[i], type_names[i]);
+        if (ids[i] < 0)
+        {
+            ids[i] = add_attribute(names[i], type_names[i]);
+        }
+    }
+}
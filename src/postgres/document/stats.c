@@ -0,0 +1,994 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/htup_details.h>
+#include <catalog/pg_collation.h>
+#include <catalog/pg_statistic.h>
+#include <catalog/pg_type.h>
+#include <commands/vacuum.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/sortsupport.h>
+#include <utils/syscache.h>
+#include <utils/typcache.h>
+
+#include <assert.h>
+
+#include "binary.h"
+#include "document.h"
+#include "schema.h"
+#include "stats.h"
+#include "utils.h"
+
+/*******************************************************************************
+ * Per-key ANALYZE statistics
+ *
+ * The standard typanalyze can only record the null fraction and width of a
+ * document column. document_typanalyze instead walks every sampled document
+ * and, for each key path (nested documents are flattened into 'a.b' paths),
+ * records how often it is present, its most common values and a histogram of
+ * the rest. Everything is stored in a single pg_statistic slot of kind
+ * STATISTIC_KIND_DOCUMENT_KEYS, where the selectivity estimator and
+ * document_key_stats() read it back.
+ ******************************************************************************/
+
+#ifndef HASH_STRINGS
+#define HASH_STRINGS 0 /* Default before it became an explicit flag */
+#endif
+
+#define STATS_MAX_DEPTH (4)       /* Deepest nested document we descend into */
+#define STATS_KEYLEN (256)        /* Longest "path type" we keep stats for */
+#define STATS_KEYS_PER_TARGET (10) /* Max keys kept = this * stats target */
+
+typedef struct key_accum {
+    char key[STATS_KEYLEN]; /* "path type"; hash key */
+    char *path;
+    char *pg_type;
+    json_typeid type;
+    int nrows;              /* Sampled documents carrying the key */
+    double total_width;
+    int nvalues;
+    int maxvalues;
+    Datum *values;          /* Scalar values, as document_stats_value_type */
+} key_accum;
+
+typedef struct value_run {
+    int start;              /* Index of the first value of the run */
+    int count;
+    bool is_mcv;
+} value_run;
+
+Datum document_typanalyze(PG_FUNCTION_ARGS);
+Datum document_key_stats_srf(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_typanalyze);
+PG_FUNCTION_INFO_V1(document_key_stats_srf);
+
+static void compute_document_stats(VacAttrStatsP stats,
+                                   AnalyzeAttrFetchFunc fetchfunc,
+                                   int samplerows,
+                                   double totalrows);
+static void accum_document(HTAB *keys,
+                           char *doc,
+                           const char *prefix,
+                           int depth,
+                           MemoryContext value_context);
+static document_key_stats *build_key_stats(key_accum *key,
+                                           int nonnull_cnt,
+                                           double totalrows,
+                                           int samplerows,
+                                           int target);
+
+static int
+stats_target(VacAttrStats *stats)
+{
+#if PG_VERSION_NUM >= 170000
+    return stats->attstattarget;
+#else
+    if (stats->attr->attstattarget < 0)
+    {
+        return default_statistics_target;
+    }
+    return stats->attr->attstattarget;
+#endif
+}
+
+Oid
+document_stats_value_type(json_typeid type)
+{
+    switch (type)
+    {
+    case STRING:
+        return TEXTOID;
+    case INTEGER:
+        return INT8OID;
+    case FLOAT:
+        return FLOAT8OID;
+    case BOOLEAN:
+        return BOOLOID;
+    default:
+        return InvalidOid; /* Presence only */
+    }
+}
+
+Datum
+document_typanalyze(PG_FUNCTION_ARGS)
+{
+    VacAttrStats *stats = (VacAttrStats*)PG_GETARG_POINTER(0);
+
+    stats->compute_stats = compute_document_stats;
+    /* Same sample size as std_typanalyze; see the reasoning in analyze.c */
+    stats->minrows = 300 * stats_target(stats);
+
+    PG_RETURN_BOOL(true);
+}
+
+/* Binary value (as stored in a document) -> Datum of the accessor's type */
+Datum
+document_stats_value(json_typeid type, const char *data, int len)
+{
+    int i;
+    double d;
+
+    switch (type)
+    {
+    case STRING:
+        return PointerGetDatum(cstring_to_text_with_len(data, len));
+    case INTEGER:
+        assert(len == sizeof(int));
+        memcpy(&i, data, sizeof(int));
+        return Int64GetDatum((int64)i);
+    case FLOAT:
+        assert(len == sizeof(double));
+        memcpy(&d, data, sizeof(double));
+        return Float8GetDatum(d);
+    case BOOLEAN:
+        return BoolGetDatum(*data != 0);
+    default:
+        elog(ERROR, "document: no statistics for type %d", type);
+    }
+    return (Datum)0; /* To shut up compiler warnings */
+}
+
+static void
+accum_document(HTAB *keys,
+               char *doc,
+               const char *prefix,
+               int depth,
+               MemoryContext value_context)
+{
+    int natts;
+    int i;
+
+    natts = doc_natts(doc);
+    for (i = 0; i < natts; i++)
+    {
+        char *key_name, *key_type;
+        char key[STATS_KEYLEN];
+        char *path;
+        int start, end;
+        key_accum *entry;
+        bool found;
+
+        get_attr(doc_attr_id(doc, i), &key_name, &key_type);
+        if (!key_name)
+        {
+            continue;
+        }
+
+        if (prefix)
+        {
+            path = palloc0(strlen(prefix) + strlen(key_name) + 2);
+            sprintf(path, "%s.%s", prefix, key_name);
+        }
+        else
+        {
+            path = key_name;
+        }
+
+        if (snprintf(key, STATS_KEYLEN, "%s %s", path, key_type) >= STATS_KEYLEN)
+        {
+            continue;
+        }
+
+        start = doc_offset(doc, i);
+        end = doc_offset(doc, i + 1);
+
+        entry = hash_search(keys, key, HASH_ENTER, &found);
+        if (!found)
+        {
+            entry->path = MemoryContextStrdup(value_context, path);
+            entry->pg_type = MemoryContextStrdup(value_context, key_type);
+            entry->type = get_json_type(key_type);
+            entry->nrows = 0;
+            entry->total_width = 0;
+            entry->nvalues = 0;
+            entry->maxvalues = 0;
+            entry->values = NULL;
+        }
+        ++entry->nrows;
+        entry->total_width += end - start;
+
+        if (OidIsValid(document_stats_value_type(entry->type)))
+        {
+            MemoryContext old_context;
+
+            old_context = MemoryContextSwitchTo(value_context);
+            if (entry->nvalues >= entry->maxvalues)
+            {
+                entry->maxvalues = entry->maxvalues ? 2 * entry->maxvalues : 64;
+                entry->values = entry->values ?
+                    repalloc(entry->values, entry->maxvalues * sizeof(Datum)) :
+                    palloc(entry->maxvalues * sizeof(Datum));
+            }
+            entry->values[entry->nvalues++] =
+                document_stats_value(entry->type, doc + start, end - start);
+            MemoryContextSwitchTo(old_context);
+        }
+        else if (entry->type == DOCUMENT && depth < STATS_MAX_DEPTH)
+        {
+            accum_document(keys, doc + start, path, depth + 1, value_context);
+        }
+    }
+}
+
+static void
+compute_document_stats(VacAttrStatsP stats,
+                       AnalyzeAttrFetchFunc fetchfunc,
+                       int samplerows,
+                       double totalrows)
+{
+    MemoryContext value_context; /* Lives as long as the accumulated values */
+    MemoryContext row_context;   /* Reset after every sampled document */
+    MemoryContext old_context;
+    HASHCTL ctl;
+    HTAB *keys;
+    HASH_SEQ_STATUS scan;
+    key_accum *entry;
+    key_accum **entries;
+    document_key_stats **key_stats;
+    int nkeys, max_keys;
+    int null_cnt;
+    double total_width;
+    int target;
+    int i;
+
+    target = stats_target(stats);
+    value_context = CurrentMemoryContext;
+    row_context = AllocSetContextCreate(CurrentMemoryContext,
+                                        "document analyze row",
+                                        ALLOCSET_DEFAULT_SIZES);
+
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = STATS_KEYLEN;
+    ctl.entrysize = sizeof(key_accum);
+    ctl.hcxt = value_context;
+    keys = hash_create("document analyze keys",
+                       256,
+                       &ctl,
+                       HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+
+    null_cnt = 0;
+    total_width = 0;
+    for (i = 0; i < samplerows; i++)
+    {
+        Datum value;
+        bool isnull;
+        bytea *datum;
+
+        vacuum_delay_point();
+
+        value = fetchfunc(stats, i, &isnull);
+        if (isnull)
+        {
+            ++null_cnt;
+            continue;
+        }
+        total_width += VARSIZE_ANY(DatumGetPointer(value));
+
+        old_context = MemoryContextSwitchTo(row_context);
+        datum = (bytea*)PG_DETOAST_DATUM(value);
+        accum_document(keys, datum->vl_dat, NULL, 0, value_context);
+        MemoryContextSwitchTo(old_context);
+        MemoryContextReset(row_context);
+    }
+    MemoryContextDelete(row_context);
+
+    stats->stats_valid = true;
+    stats->stanullfrac = (double)null_cnt / (double)samplerows;
+    stats->stawidth = null_cnt < samplerows ?
+        total_width / (double)(samplerows - null_cnt) : 0;
+    stats->stadistinct = 0.0; /* "Unknown"; documents are not comparable */
+
+    nkeys = hash_get_num_entries(keys);
+    if (nkeys == 0)
+    {
+        return;
+    }
+
+    entries = palloc(nkeys * sizeof(key_accum*));
+    i = 0;
+    hash_seq_init(&scan, keys);
+    while ((entry = hash_seq_search(&scan)) != NULL)
+    {
+        entries[i++] = entry;
+    }
+
+    /* Bound the size of the pg_statistic row: keep the most frequent keys */
+    max_keys = STATS_KEYS_PER_TARGET * target;
+    if (nkeys > max_keys)
+    {
+        int j;
+
+        for (i = 0; i < max_keys; i++)
+        {
+            for (j = i + 1; j < nkeys; j++)
+            {
+                if (entries[j]->nrows > entries[i]->nrows)
+                {
+                    key_accum *tmp = entries[i];
+
+                    entries[i] = entries[j];
+                    entries[j] = tmp;
+                }
+            }
+        }
+        nkeys = max_keys;
+    }
+
+    old_context = MemoryContextSwitchTo(stats->anl_context);
+    key_stats = palloc(nkeys * sizeof(document_key_stats*));
+    for (i = 0; i < nkeys; i++)
+    {
+        key_stats[i] = build_key_stats(entries[i],
+                                       samplerows - null_cnt,
+                                       totalrows,
+                                       samplerows,
+                                       target);
+    }
+    MemoryContextSwitchTo(old_context);
+
+    /* Sort by path, then type, so readers can binary search */
+    for (i = 1; i < nkeys; i++)
+    {
+        int j;
+        document_key_stats *cur = key_stats[i];
+
+        for (j = i - 1; j >= 0; j--)
+        {
+            int cmp;
+
+            cmp = strcmp(document_key_stats_path(key_stats[j]),
+                         document_key_stats_path(cur));
+            if (cmp == 0)
+            {
+                cmp = strcmp(document_key_stats_type(key_stats[j]),
+                             document_key_stats_type(cur));
+            }
+            if (cmp <= 0)
+            {
+                break;
+            }
+            key_stats[j + 1] = key_stats[j];
+        }
+        key_stats[j + 1] = cur;
+    }
+
+    old_context = MemoryContextSwitchTo(stats->anl_context);
+    stats->stakind[0] = STATISTIC_KIND_DOCUMENT_KEYS;
+    stats->staop[0] = InvalidOid;
+    stats->stacoll[0] = InvalidOid;
+    stats->stavalues[0] = palloc(nkeys * sizeof(Datum));
+    stats->numvalues[0] = nkeys;
+    stats->stanumbers[0] = palloc(nkeys * sizeof(float4));
+    stats->numnumbers[0] = nkeys;
+    for (i = 0; i < nkeys; i++)
+    {
+        stats->stavalues[0][i] = PointerGetDatum(key_stats[i]);
+        stats->stanumbers[0][i] = key_stats[i]->presence;
+    }
+    stats->statypid[0] = BYTEAOID;
+    stats->statyplen[0] = -1;
+    stats->statypbyval[0] = false;
+    stats->statypalign[0] = 'i';
+    MemoryContextSwitchTo(old_context);
+}
+
+static int
+compare_values(const void *a, const void *b, void *arg)
+{
+    return ApplySortComparator(*(Datum*)a, false,
+                               *(Datum*)b, false,
+                               (SortSupport)arg);
+}
+
+static int
+compare_runs_by_count(const void *a, const void *b)
+{
+    const value_run *r1 = *(value_run**)a;
+    const value_run *r2 = *(value_run**)b;
+
+    return r2->count - r1->count;
+}
+
+/* Number of bytes value takes in the serialized stats; writes it to out if
+ * not NULL */
+static int
+stats_value_to_binary(json_typeid type, Datum value, char *out)
+{
+    int64 i;
+    double d;
+
+    switch (type)
+    {
+    case STRING:
+        if (out)
+        {
+            memcpy(out,
+                   VARDATA_ANY(DatumGetPointer(value)),
+                   VARSIZE_ANY_EXHDR(DatumGetPointer(value)));
+        }
+        return VARSIZE_ANY_EXHDR(DatumGetPointer(value));
+    case INTEGER:
+        i = DatumGetInt64(value);
+        if (out)
+        {
+            memcpy(out, &i, sizeof(int64));
+        }
+        return sizeof(int64);
+    case FLOAT:
+        d = DatumGetFloat8(value);
+        if (out)
+        {
+            memcpy(out, &d, sizeof(double));
+        }
+        return sizeof(double);
+    case BOOLEAN:
+        if (out)
+        {
+            *out = DatumGetBool(value) ? 1 : 0;
+        }
+        return 1;
+    default:
+        elog(ERROR, "document: no statistics for type %d", type);
+    }
+    return -1; /* To shut up compiler warnings */
+}
+
+static document_key_stats *
+build_key_stats(key_accum *key,
+                int nonnull_cnt,
+                double totalrows,
+                int samplerows,
+                int target)
+{
+    document_key_stats *result;
+    value_run *runs;
+    value_run **by_count;
+    Datum *mcvs, *hist;
+    float4 *mcv_freqs;
+    int nruns, nmcv, nhist;
+    int nsingletons;
+    double ndistinct;
+    int size;
+    char *pos;
+    int i;
+
+    nruns = nmcv = nhist = nsingletons = 0;
+    runs = NULL;
+    mcvs = hist = NULL;
+    mcv_freqs = NULL;
+    ndistinct = 0;
+
+    if (key->nvalues > 0)
+    {
+        TypeCacheEntry *typentry;
+        SortSupportData ssup;
+        double n, N;
+        int nremaining;
+        int j;
+
+        typentry = lookup_type_cache(document_stats_value_type(key->type),
+                                     TYPECACHE_LT_OPR);
+        memset(&ssup, 0, sizeof(ssup));
+        ssup.ssup_cxt = CurrentMemoryContext;
+        ssup.ssup_collation = DEFAULT_COLLATION_OID;
+        ssup.ssup_nulls_first = false;
+        PrepareSortSupportFromOrderingOp(typentry->lt_opr, &ssup);
+        qsort_arg(key->values, key->nvalues, sizeof(Datum), compare_values, &ssup);
+
+        /* Collapse the sorted values into runs of duplicates */
+        runs = palloc(key->nvalues * sizeof(value_run));
+        for (i = 0; i < key->nvalues; i++)
+        {
+            if (i > 0 && compare_values(&key->values[i - 1],
+                                        &key->values[i],
+                                        &ssup) == 0)
+            {
+                ++runs[nruns - 1].count;
+            }
+            else
+            {
+                runs[nruns].start = i;
+                runs[nruns].count = 1;
+                runs[nruns].is_mcv = false;
+                ++nruns;
+            }
+        }
+        for (i = 0; i < nruns; i++)
+        {
+            if (runs[i].count == 1)
+            {
+                ++nsingletons;
+            }
+        }
+
+        /* Haas and Stokes' Duj1 estimator, as in compute_scalar_stats. N is
+         * the estimated number of rows carrying the key */
+        n = key->nvalues;
+        N = totalrows * ((double)nonnull_cnt / samplerows) *
+            ((double)key->nrows / nonnull_cnt);
+        if (nsingletons == nruns)
+        {
+            ndistinct = N; /* Every value we saw was unique */
+        }
+        else
+        {
+            ndistinct = (n * nruns) /
+                ((n - nsingletons) + nsingletons * n / Max(N, n));
+        }
+        ndistinct = Max(ndistinct, nruns);
+        ndistinct = Min(ndistinct, Max(N, nruns));
+
+        /* If every value fits, everything is an MCV; otherwise only values
+         * seen more than once are candidates */
+        by_count = palloc(nruns * sizeof(value_run*));
+        for (i = 0; i < nruns; i++)
+        {
+            by_count[i] = runs + i;
+        }
+        qsort(by_count, nruns, sizeof(value_run*), compare_runs_by_count);
+        for (i = 0; i < nruns && nmcv < target; i++)
+        {
+            if (nruns > target && by_count[i]->count < 2)
+            {
+                break;
+            }
+            by_count[i]->is_mcv = true;
+            ++nmcv;
+        }
+
+        mcvs = palloc(Max(nmcv, 1) * sizeof(Datum));
+        mcv_freqs = palloc(Max(nmcv, 1) * sizeof(float4));
+        for (i = 0; i < nmcv; i++)
+        {
+            mcvs[i] = key->values[by_count[i]->start];
+            mcv_freqs[i] = (float4)by_count[i]->count / key->nvalues;
+        }
+
+        /* Equi-depth histogram over the values that are not MCVs */
+        nremaining = nruns - nmcv;
+        if (nremaining >= 2)
+        {
+            Datum *remaining;
+            int nrem_values;
+
+            remaining = palloc(key->nvalues * sizeof(Datum));
+            nrem_values = 0;
+            for (i = 0; i < nruns; i++)
+            {
+                if (runs[i].is_mcv)
+                {
+                    continue;
+                }
+                for (j = 0; j < runs[i].count; j++)
+                {
+                    remaining[nrem_values++] = key->values[runs[i].start + j];
+                }
+            }
+
+            nhist = Min(nremaining, target + 1);
+            hist = palloc(nhist * sizeof(Datum));
+            for (i = 0; i < nhist; i++)
+            {
+                hist[i] = remaining[(int64)i * (nrem_values - 1) / (nhist - 1)];
+            }
+        }
+    }
+
+    /* Serialize */
+    size = sizeof(document_key_stats) + strlen(key->path) + 1 +
+        strlen(key->pg_type) + 1;
+    size = INTALIGN(size);
+    size += nmcv * sizeof(float4);
+    for (i = 0; i < nmcv; i++)
+    {
+        size += sizeof(int32) +
+            INTALIGN(stats_value_to_binary(key->type, mcvs[i], NULL));
+    }
+    for (i = 0; i < nhist; i++)
+    {
+        size += sizeof(int32) +
+            INTALIGN(stats_value_to_binary(key->type, hist[i], NULL));
+    }
+
+    result = palloc0(size);
+    SET_VARSIZE(result, size);
+    result->type = key->type;
+    result->presence = (float4)key->nrows / nonnull_cnt;
+    result->ndistinct = ndistinct;
+    result->avgwidth = key->total_width / key->nrows;
+    result->pathlen = strlen(key->path);
+    result->typelen = strlen(key->pg_type);
+    result->nmcv = nmcv;
+    result->nhist = nhist;
+
+    strcpy((char*)document_key_stats_path(result), key->path);
+    strcpy((char*)document_key_stats_type(result), key->pg_type);
+    if (nmcv > 0)
+    {
+        memcpy(document_key_stats_mcv_freqs(result),
+               mcv_freqs,
+               nmcv * sizeof(float4));
+    }
+
+    pos = (char*)document_key_stats_mcv_freqs(result) + nmcv * sizeof(float4);
+    for (i = 0; i < nmcv + nhist; i++)
+    {
+        Datum value;
+        int32 len;
+
+        value = i < nmcv ? mcvs[i] : hist[i - nmcv];
+        len = stats_value_to_binary(key->type, value, pos + sizeof(int32));
+        memcpy(pos, &len, sizeof(int32));
+        pos += sizeof(int32) + INTALIGN(len);
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * Reading statistics back
+ ******************************************************************************/
+
+const char *
+document_key_stats_path(document_key_stats *stats)
+{
+    return (char*)stats + sizeof(document_key_stats);
+}
+
+const char *
+document_key_stats_type(document_key_stats *stats)
+{
+    return document_key_stats_path(stats) + stats->pathlen + 1;
+}
+
+float4 *
+document_key_stats_mcv_freqs(document_key_stats *stats)
+{
+    int offset;
+
+    offset = sizeof(document_key_stats) + stats->pathlen + 1 +
+        stats->typelen + 1;
+    return (float4*)((char*)stats + INTALIGN(offset));
+}
+
+/* Returns the nmcv most common values followed by the nhist histogram bounds,
+ * as Datums of document_stats_value_type(stats->type) */
+Datum *
+document_key_stats_values(document_key_stats *stats)
+{
+    Datum *values;
+    char *pos;
+    int i;
+
+    values = palloc(Max(stats->nmcv + stats->nhist, 1) * sizeof(Datum));
+    pos = (char*)document_key_stats_mcv_freqs(stats) +
+        stats->nmcv * sizeof(float4);
+    for (i = 0; i < stats->nmcv + stats->nhist; i++)
+    {
+        int32 len;
+        int64 l;
+        double d;
+
+        memcpy(&len, pos, sizeof(int32));
+        pos += sizeof(int32);
+        switch (stats->type)
+        {
+        case STRING:
+            values[i] = PointerGetDatum(cstring_to_text_with_len(pos, len));
+            break;
+        case INTEGER:
+            memcpy(&l, pos, sizeof(int64));
+            values[i] = Int64GetDatum(l);
+            break;
+        case FLOAT:
+            memcpy(&d, pos, sizeof(double));
+            values[i] = Float8GetDatum(d);
+            break;
+        case BOOLEAN:
+            values[i] = BoolGetDatum(*pos != 0);
+            break;
+        default:
+            elog(ERROR, "document: invalid key statistics");
+        }
+        pos += INTALIGN(len);
+    }
+
+    return values;
+}
+
+static int
+compare_key_stats(document_key_stats *stats, const char *path, const char *pg_type)
+{
+    int cmp;
+
+    cmp = strcmp(document_key_stats_path(stats), path);
+    if (cmp == 0)
+    {
+        cmp = strcmp(document_key_stats_type(stats), pg_type);
+    }
+    return cmp;
+}
+
+/* Returns a palloc'd copy of the statistics for path of type pg_type in
+ * relid.attnum, or NULL if the column has not been analyzed or the key was not
+ * seen. nullfrac, if given, gets the column's null fraction */
+document_key_stats *
+document_key_stats_lookup(Oid relid,
+                          AttrNumber attnum,
+                          const char *path,
+                          const char *pg_type,
+                          float4 *nullfrac)
+{
+    HeapTuple tuple;
+    AttStatsSlot sslot;
+    document_key_stats *result;
+
+    tuple = SearchSysCache3(STATRELATTINH,
+                            ObjectIdGetDatum(relid),
+                            Int16GetDatum(attnum),
+                            BoolGetDatum(false));
+    if (!HeapTupleIsValid(tuple))
+    {
+        return NULL;
+    }
+
+    if (nullfrac)
+    {
+        *nullfrac = ((Form_pg_statistic)GETSTRUCT(tuple))->stanullfrac;
+    }
+
+    result = NULL;
+    if (get_attstatsslot(&sslot,
+                         tuple,
+                         STATISTIC_KIND_DOCUMENT_KEYS,
+                         InvalidOid,
+                         ATTSTATSSLOT_VALUES))
+    {
+        int low, high;
+
+        low = 0;
+        high = sslot.nvalues - 1;
+        while (low <= high)
+        {
+            int mid;
+            int cmp;
+
+            mid = (low + high) / 2;
+            cmp = compare_key_stats((document_key_stats*)
+                                        DatumGetPointer(sslot.values[mid]),
+                                    path,
+                                    pg_type);
+            if (cmp == 0)
+            {
+                result = (document_key_stats*)
+                    PG_DETOAST_DATUM_COPY(sslot.values[mid]);
+                break;
+            }
+            else if (cmp < 0)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid - 1;
+            }
+        }
+        free_attstatsslot(&sslot);
+    }
+
+    ReleaseSysCache(tuple);
+
+    return result;
+}
+
+/* Returns palloc'd copies of all key statistics for relid.attnum */
+document_key_stats **
+document_key_stats_fetch_all(Oid relid, AttrNumber attnum, int *nkeys)
+{
+    HeapTuple tuple;
+    AttStatsSlot sslot;
+    document_key_stats **result;
+    int i;
+
+    *nkeys = 0;
+    result = NULL;
+
+    tuple = SearchSysCache3(STATRELATTINH,
+                            ObjectIdGetDatum(relid),
+                            Int16GetDatum(attnum),
+                            BoolGetDatum(false));
+    if (!HeapTupleIsValid(tuple))
+    {
+        return NULL;
+    }
+
+    if (get_attstatsslot(&sslot,
+                         tuple,
+                         STATISTIC_KIND_DOCUMENT_KEYS,
+                         InvalidOid,
+                         ATTSTATSSLOT_VALUES))
+    {
+        result = palloc(Max(sslot.nvalues, 1) * sizeof(document_key_stats*));
+        for (i = 0; i < sslot.nvalues; i++)
+        {
+            result[i] = (document_key_stats*)
+                PG_DETOAST_DATUM_COPY(sslot.values[i]);
+        }
+        *nkeys = sslot.nvalues;
+        free_attstatsslot(&sslot);
+    }
+
+    ReleaseSysCache(tuple);
+
+    return result;
+}
+
+/* Datums of the stats' value type -> text[], or NULL if there are none */
+static Datum
+stats_values_to_text_array(document_key_stats *stats,
+                           Datum *values,
+                           int nvalues,
+                           bool *isnull)
+{
+    Datum *text_values;
+    Oid outfunc;
+    bool isvarlena;
+    int i;
+
+    if (nvalues == 0)
+    {
+        *isnull = true;
+        return (Datum)0;
+    }
+
+    getTypeOutputInfo(document_stats_value_type(stats->type),
+                      &outfunc,
+                      &isvarlena);
+    text_values = palloc(nvalues * sizeof(Datum));
+    for (i = 0; i < nvalues; i++)
+    {
+        text_values[i] = CStringGetTextDatum(OidOutputFunctionCall(outfunc,
+                                                                   values[i]));
+    }
+
+    *isnull = false;
+    return PointerGetDatum(construct_array(text_values,
+                                           nvalues,
+                                           TEXTOID,
+                                           -1,
+                                           false,
+                                           'i'));
+}
+
+/* document_key_stats(regclass, name): the per-key statistics gathered by the
+ * last ANALYZE of a document column, in the spirit of pg_stats */
+Datum
+document_key_stats_srf(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    document_key_stats **key_stats;
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext old_context;
+        Oid relid;
+        Name attname;
+        AttrNumber attnum;
+        TupleDesc tupdesc;
+        int nkeys;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        old_context = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        relid = PG_GETARG_OID(0);
+        attname = PG_GETARG_NAME(1);
+        attnum = get_attnum(relid, NameStr(*attname));
+        if (attnum == InvalidAttrNumber)
+        {
+            elog(ERROR,
+                 "document_key_stats: column \"%s\" does not exist",
+                 NameStr(*attname));
+        }
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        {
+            elog(ERROR, "document_key_stats: return type must be a row type");
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        funcctx->user_fctx = document_key_stats_fetch_all(relid, attnum, &nkeys);
+        funcctx->max_calls = nkeys;
+
+        MemoryContextSwitchTo(old_context);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    key_stats = (document_key_stats**)funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls)
+    {
+        document_key_stats *stats;
+        Datum *stats_values;
+        Datum values[8];
+        bool nulls[8];
+        HeapTuple tuple;
+
+        stats = key_stats[funcctx->call_cntr];
+        memset(nulls, 0, sizeof(nulls));
+
+        values[0] = CStringGetTextDatum(document_key_stats_path(stats));
+        values[1] = CStringGetTextDatum(document_key_stats_type(stats));
+        values[2] = Float4GetDatum(stats->presence);
+        values[3] = Float4GetDatum(stats->ndistinct);
+        values[4] = Int32GetDatum(stats->avgwidth);
+
+        stats_values = NULL;
+        if (stats->nmcv + stats->nhist > 0)
+        {
+            stats_values = document_key_stats_values(stats);
+        }
+        values[5] = stats_values_to_text_array(stats,
+                                               stats_values,
+                                               stats->nmcv,
+                                               &nulls[5]);
+        if (stats->nmcv > 0)
+        {
+            Datum *freqs;
+            int i;
+
+            freqs = palloc(stats->nmcv * sizeof(Datum));
+            for (i = 0; i < stats->nmcv; i++)
+            {
+                freqs[i] = Float4GetDatum(document_key_stats_mcv_freqs(stats)[i]);
+            }
+            values[6] = PointerGetDatum(construct_array(freqs,
+                                                        stats->nmcv,
+                                                        FLOAT4OID,
+                                                        sizeof(float4),
+                                                        true,
+                                                        'i'));
+        }
+        else
+        {
+            nulls[6] = true;
+        }
+        values[7] = stats_values_to_text_array(stats,
+                                               stats_values ?
+                                                   stats_values + stats->nmcv :
+                                                   NULL,
+                                               stats->nhist,
+                                               &nulls[7]);
+
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "json.h"
+
+/* pg_statistic slot kind holding per-key statistics of a document column.
+ * Kinds below 10000 are reserved for core and registered projects (see
+ * catalog/pg_statistic.h).
+ *
+ * stavalues: one document_key_stats (as bytea) per key path, sorted by
+ *            path and then type
+ * stanumbers: presence fraction of the key, in the same order
+ */
+#define STATISTIC_KIND_DOCUMENT_KEYS (10013)
+
+/* Statistics for one key path (e.g. 'user.lang') of one type, computed by
+ * document_typanalyze over the ANALYZE sample. Values are kept in the type the
+ * typed accessors return (see document_stats_value_type) */
+typedef struct document_key_stats {
+    int32 vl_len_;     /* varlena header (do not touch directly!) */
+    int32 type;        /* json_typeid of the values */
+    float4 presence;   /* fraction of non-null documents carrying the key */
+    float4 ndistinct;  /* estimated distinct values among those documents */
+    int32 avgwidth;    /* average width of the stored value, in bytes */
+    int32 pathlen;     /* strlen of the key path */
+    int32 typelen;     /* strlen of the key's pg type name */
+    int32 nmcv;        /* number of most common values */
+    int32 nhist;       /* number of histogram bounds */
+    /* Followed by char path[pathlen + 1], char type[typelen + 1], padded to
+     * int alignment; float4 mcv_freqs[nmcv]; then nmcv + nhist values, each an
+     * int32 length followed by that many bytes, padded to int alignment.
+     * mcv_freqs are fractions of the documents carrying the key */
+} document_key_stats;
+
+Oid document_stats_value_type(json_typeid type);
+Datum document_stats_value(json_typeid type, const char *data, int len);
+
+const char *document_key_stats_path(document_key_stats *stats);
+const char *document_key_stats_type(document_key_stats *stats);
+float4 *document_key_stats_mcv_freqs(document_key_stats *stats);
+Datum *document_key_stats_values(document_key_stats *stats);
+
+document_key_stats *document_key_stats_lookup(Oid relid,
+                                              AttrNumber attnum,
+                                              const char *path,
+                                              const char *pg_type,
+                                              float4 *nullfrac);
+document_key_stats **document_key_stats_fetch_all(Oid relid,
+                                                  AttrNumber attnum,
+                                                  int *nkeys);
+
+#endif
@@ -0,0 +1,473 @@
+#include <postgres.h> /* This include must precede all other postgres
+                         dependencies */
+
+#include <access/htup_details.h>
+#include <catalog/namespace.h>
+#include <commands/trigger.h>
+#include <executor/spi.h>
+#include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+
+#include "accessors.h"
+#include "json.h"
+#include "schema.h"
+#include "upgrade.h"
+#include "utils.h"
+
+/*******************************************************************************
+ * Upgrade states
+ *
+ * bw_colupgrader moves a key through pending -> copying -> stripping -> done
+ * as it materializes it, and back through copying when it folds the column
+ * back in (see bw_colupgrader.c). Readers need to know where the key is for a
+ * given row, and this caches document_schema.<rel>.upgrade_state per backend:
+ *
+ * - the planner (rewrite.c) reads a key from its column alone once it is done,
+ *   and from COALESCE(column, accessor) while it is being copied or stripped;
+ * - document_route_keys, a BEFORE INSERT OR UPDATE trigger, moves keys that
+ *   are copying, stripping or done out of new documents into their columns, so
+ *   the upgrade converges however much is written while it runs.
+ *
+ * Keys may be paths into nested documents (see doc_column_name), and arrays
+ * go to native array columns.
+ *
+ * Whoever changes a state invalidates the relation's relcache entry in the
+ * same transaction, which drops our entry (and the plans built on it) once
+ * that commits.
+ ******************************************************************************/
+
+#define DOCUMENT_SCHEMA "document_schema"
+
+typedef struct upgrade_key {
+    char *key_name;
+    char *key_type;
+    bool upgraded;
+    upgrade_state state;
+    AttrNumber attnum; /* Of the key's column, if it is of the key's type */
+    Oid elemtype; /* Of the column, for array keys */
+    bool nested; /* A path into nested documents, e.g. user.lang */
+} upgrade_key;
+
+typedef struct relation_upgrades {
+    Oid relid; /* Hash key */
+    MemoryContext context; /* Holds keys */
+    int nkeys;
+    upgrade_key *keys;
+    bool route; /* Some key is routed by document_route_keys */
+} relation_upgrades;
+
+static HTAB *upgrades_table = NULL;
+
+Datum document_route_keys(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(document_route_keys);
+
+static upgrade_state
+parse_upgrade_state(const char *state)
+{
+    if (!state)
+    {
+        return UPGRADE_NONE;
+    }
+    else if (!strcmp(state, "pending"))
+    {
+        return UPGRADE_PENDING;
+    }
+    else if (!strcmp(state, "copying"))
+    {
+        return UPGRADE_COPYING;
+    }
+    else if (!strcmp(state, "stripping"))
+    {
+        return UPGRADE_STRIPPING;
+    }
+    else if (!strcmp(state, "done"))
+    {
+        return UPGRADE_DONE;
+    }
+    elog(ERROR, "document_upgrade_state: unknown upgrade state '%s'", state);
+    return UPGRADE_NONE; /* To shut up compiler warnings */
+}
+
+/* Whether document_route_keys moves key out of new documents */
+static bool
+is_routed(upgrade_key *key)
+{
+    return key->upgraded && key->attnum > 0 &&
+           (key->state == UPGRADE_COPYING ||
+            key->state == UPGRADE_STRIPPING ||
+            key->state == UPGRADE_DONE);
+}
+
+/* Find the column of key in relid. Array columns have one type whatever
+ * their dimensions, so bigint[][] keys live in bigint[] columns */
+static void
+resolve_column(Oid relid, upgrade_key *key)
+{
+    Oid atttype;
+    char *base_type;
+    int len;
+
+    key->nested = strchr(key->key_name, '.') != NULL;
+    key->attnum = get_attnum(relid, doc_column_name(key->key_name));
+    if (key->attnum <= 0)
+    {
+        key->attnum = 0;
+        return;
+    }
+    atttype = get_atttype(relid, key->attnum);
+
+    base_type = pstrdup(key->key_type);
+    len = strlen(base_type);
+    while (len > 2 && !strcmp(base_type + len - 2, ARRAY_TYPE))
+    {
+        len -= 2;
+        base_type[len] = '\0';
+    }
+    if (len < (int)strlen(key->key_type))
+    {
+        key->elemtype = get_element_type(atttype);
+        atttype = key->elemtype;
+    }
+
+    if (!OidIsValid(atttype) || strcmp(format_type_be(atttype), base_type))
+    {
+        key->attnum = 0; /* Not one of bw_colupgrader's */
+    }
+    pfree(base_type);
+}
+
+static void
+load_upgrades(relation_upgrades *upgrades)
+{
+    char *relname;
+    Oid nspid;
+    Oid schema_relid;
+    StringInfoData buf;
+    int ret;
+    int i;
+
+    upgrades->nkeys = 0;
+    upgrades->keys = NULL;
+    upgrades->route = false;
+
+    relname = get_rel_name(upgrades->relid);
+    nspid = get_namespace_oid(DOCUMENT_SCHEMA, true);
+    if (!relname || !OidIsValid(nspid))
+    {
+        return;
+    }
+    schema_relid = get_relname_relid(relname, nspid);
+    if (!OidIsValid(schema_relid) ||
+        get_attnum(schema_relid, "upgrade_state") == InvalidAttrNumber)
+    {
+        return; /* Not a collection, or bw_colupgrader hasn't been by yet */
+    }
+
+    if (SPI_connect() < 0)
+    {
+        elog(ERROR, "document_upgrade_state: SPI_connect failed");
+    }
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT a.key_name, a.key_type, s.upgraded, s.upgrade_state "
+                     "FROM %s.%s s JOIN %s._attributes a ON a._id = s.key_id "
+                     "WHERE s.upgrade_state IS NOT NULL",
+                     DOCUMENT_SCHEMA,
+                     quote_identifier(relname),
+                     DOCUMENT_SCHEMA);
+    ret = SPI_execute(buf.data, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(ERROR, "document_upgrade_state: SPI_execute failed: error code %d", ret);
+    }
+
+    upgrades->nkeys = SPI_processed;
+    upgrades->keys = MemoryContextAllocZero(upgrades->context,
+                                            Max(upgrades->nkeys, 1) *
+                                                sizeof(upgrade_key));
+    for (i = 0; i < upgrades->nkeys; i++)
+    {
+        HeapTuple tuple = SPI_tuptable->vals[i];
+        TupleDesc tupdesc = SPI_tuptable->tupdesc;
+        upgrade_key *key = &upgrades->keys[i];
+        bool isnull;
+
+        key->key_name = MemoryContextStrdup(upgrades->context,
+                                            SPI_getvalue(tuple, tupdesc, 1));
+        key->key_type = MemoryContextStrdup(upgrades->context,
+                                            SPI_getvalue(tuple, tupdesc, 2));
+        key->upgraded = DatumGetBool(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+        key->state = parse_upgrade_state(SPI_getvalue(tuple, tupdesc, 4));
+        resolve_column(upgrades->relid, key);
+        upgrades->route |= is_routed(key);
+    }
+
+    pfree(buf.data);
+    SPI_finish();
+}
+
+static relation_upgrades *
+get_relation_upgrades(Oid relid)
+{
+    relation_upgrades *upgrades;
+    MemoryContext context;
+    bool found;
+
+    if (!upgrades_table)
+    {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(Oid);
+        ctl.entrysize = sizeof(relation_upgrades);
+        upgrades_table = hash_create("document upgrade states",
+                                     16,
+                                     &ctl,
+                                     HASH_ELEM | HASH_BLOBS);
+    }
+
+    upgrades = hash_search(upgrades_table, &relid, HASH_FIND, NULL);
+    if (upgrades)
+    {
+        return upgrades;
+    }
+
+    /* Only enter the relation once it has loaded, so an error leaves no
+     * half-built entry behind */
+    context = AllocSetContextCreate(CacheMemoryContext,
+                                    "document upgrade states",
+                                    ALLOCSET_SMALL_SIZES);
+    PG_TRY();
+    {
+        relation_upgrades loaded;
+
+        loaded.relid = relid;
+        loaded.context = context;
+        load_upgrades(&loaded);
+
+        upgrades = hash_search(upgrades_table, &relid, HASH_ENTER, &found);
+        *upgrades = loaded;
+    }
+    PG_CATCH();
+    {
+        MemoryContextDelete(context);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    return upgrades;
+}
+
+upgrade_state
+document_upgrade_state(Oid relid, const char *key_name, const char *key_pg_type)
+{
+    relation_upgrades *upgrades;
+    int i;
+
+    upgrades = get_relation_upgrades(relid);
+    for (i = 0; i < upgrades->nkeys; i++)
+    {
+        if (!strcmp(upgrades->keys[i].key_name, key_name) &&
+            !strcmp(upgrades->keys[i].key_type, key_pg_type))
+        {
+            return upgrades->keys[i].state;
+        }
+    }
+    return UPGRADE_NONE;
+}
+
+static void
+forget_upgrades(relation_upgrades *upgrades)
+{
+    Oid relid = upgrades->relid;
+
+    MemoryContextDelete(upgrades->context);
+    (void)hash_search(upgrades_table, &relid, HASH_REMOVE, NULL);
+}
+
+static void
+invalidate_upgrades(Datum arg, Oid relid)
+{
+    relation_upgrades *upgrades;
+
+    if (!upgrades_table)
+    {
+        return;
+    }
+
+    if (OidIsValid(relid))
+    {
+        upgrades = hash_search(upgrades_table, &relid, HASH_FIND, NULL);
+        if (upgrades)
+        {
+            forget_upgrades(upgrades);
+        }
+    }
+    else
+    {
+        HASH_SEQ_STATUS status;
+
+        hash_seq_init(&status, upgrades_table);
+        while ((upgrades = hash_seq_search(&status)) != NULL)
+        {
+            forget_upgrades(upgrades);
+        }
+    }
+}
+
+void
+document_upgrade_init(void)
+{
+    CacheRegisterRelcacheCallback(invalidate_upgrades, (Datum)0);
+}
+
+/*
+ * BEFORE INSERT OR UPDATE trigger of collections: moves the keys that are
+ * being (or have been) upgraded out of the new row's document into their
+ * columns. The value in the document wins over what the statement put in the
+ * column, since it is the later write as far as the document API goes.
+ */
+Datum
+document_route_keys(PG_FUNCTION_ARGS)
+{
+    TriggerData *trigdata = (TriggerData*)fcinfo->context;
+    HeapTuple tuple;
+    TupleDesc tupdesc;
+    relation_upgrades *upgrades;
+    int data_attnum;
+    Datum data;
+    bool isnull;
+    bytea *datum;
+    Datum *values;
+    bool *nulls;
+    bool *replace;
+    int *attr_ids;
+    int nids;
+    bool *strip;
+    int nstrip;
+    char *outbinary;
+    int outsize;
+    int i;
+
+    if (!CALLED_AS_TRIGGER(fcinfo) ||
+        !TRIGGER_FIRED_BEFORE(trigdata->tg_event) ||
+        !TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+    {
+        elog(ERROR, "document_route_keys: must be a BEFORE ... FOR EACH ROW trigger");
+    }
+    if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+    {
+        tuple = trigdata->tg_trigtuple;
+    }
+    else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+    {
+        tuple = trigdata->tg_newtuple;
+    }
+    else
+    {
+        elog(ERROR, "document_route_keys: can only be called on insert/update");
+    }
+
+    upgrades = get_relation_upgrades(RelationGetRelid(trigdata->tg_relation));
+    tupdesc = RelationGetDescr(trigdata->tg_relation);
+    data_attnum = SPI_fnumber(tupdesc, "data");
+    if (!upgrades->route || data_attnum <= 0)
+    {
+        return PointerGetDatum(tuple);
+    }
+    data = heap_getattr(tuple, data_attnum, tupdesc, &isnull);
+    if (isnull)
+    {
+        return PointerGetDatum(tuple);
+    }
+    datum = DatumGetByteaP(data);
+
+    values = palloc(tupdesc->natts * sizeof(Datum));
+    nulls = palloc0(tupdesc->natts * sizeof(bool));
+    replace = palloc0(tupdesc->natts * sizeof(bool));
+    attr_ids = palloc(upgrades->nkeys * sizeof(int));
+    strip = palloc0(upgrades->nkeys * sizeof(bool));
+    nids = 0;
+    nstrip = 0;
+    for (i = 0; i < upgrades->nkeys; i++)
+    {
+        upgrade_key *key = &upgrades->keys[i];
+        Datum value;
+
+        if (!is_routed(key))
+        {
+            continue;
+        }
+        value = document_get_key(datum->vl_dat,
+                                 key->key_name,
+                                 key->key_type,
+                                 key->elemtype,
+                                 &isnull);
+        if (isnull)
+        {
+            continue;
+        }
+
+        values[key->attnum - 1] = value;
+        replace[key->attnum - 1] = true;
+        if (!key->nested)
+        {
+            attr_ids[nids++] = get_attribute_id(key->key_name, key->key_type);
+        }
+        strip[i] = true;
+        ++nstrip;
+    }
+    if (nstrip == 0)
+    {
+        return PointerGetDatum(tuple);
+    }
+
+    /* Top-level keys in one pass, then paths one at a time */
+    qsort(attr_ids, nids, sizeof(int), int_comparator);
+    outsize = document_delete_many_internal(datum->vl_dat, attr_ids, nids, &outbinary);
+    if (outsize < 0)
+    {
+        outbinary = datum->vl_dat;
+        outsize = VARSIZE(datum) - VARHDRSZ;
+    }
+    for (i = 0; i < upgrades->nkeys; i++)
+    {
+        char *nested_outbinary;
+        int nested_outsize;
+
+        if (!strip[i] || !upgrades->keys[i].nested)
+        {
+            continue;
+        }
+        nested_outsize = document_delete_internal(outbinary,
+                                                  outsize,
+                                                  upgrades->keys[i].key_name,
+                                                  upgrades->keys[i].key_type,
+                                                  &nested_outbinary);
+        if (nested_outsize >= 0)
+        {
+            outbinary = nested_outbinary;
+            outsize = nested_outsize;
+        }
+    }
+    if (outbinary != datum->vl_dat)
+    {
+        bytea *outdatum;
+
+        outdatum = palloc(VARHDRSZ + outsize);
+        SET_VARSIZE(outdatum, VARHDRSZ + outsize);
+        memcpy(outdatum->vl_dat, outbinary, outsize);
+        values[data_attnum - 1] = PointerGetDatum(outdatum);
+        replace[data_attnum - 1] = true;
+    }
+
+    return PointerGetDatum(heap_modify_tuple(tuple, tupdesc, values, nulls, replace));
+}
@@ -0,0 +1,50 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+/* Where a key of a collection lives while bw_colupgrader moves it between the
+ * documents and a column of its own (document_schema.<rel>.upgrade_state) */
+typedef enum upgrade_state {
+    UPGRADE_NONE,      /* In the documents only */
+    UPGRADE_PENDING,   /* To be upgraded; there is no column yet */
+    UPGRADE_COPYING,   /* Being moved, either way: in the column for some rows
+                          and in the document for others */
+    UPGRADE_STRIPPING, /* New rows get it in the column; documents written
+                          before that are being stripped */
+    UPGRADE_DONE       /* In the column only */
+} upgrade_state;
+
+/* Column a key path is materialized as: nested keys are joined with "__", so
+ * user.lang becomes user__lang */
+static inline char *
+doc_column_name(const char *path)
+{
+    char *column;
+    int i, j;
+
+    column = palloc(2 * strlen(path) + 1);
+    for (i = 0, j = 0; path[i]; i++)
+    {
+        if (path[i] == '.')
+        {
+            column[j++] = '_';
+            column[j++] = '_';
+        }
+        else
+        {
+            column[j++] = path[i];
+        }
+    }
+    column[j] = '\0';
+    return column;
+}
+
+/* State of a key of relid, from a per-backend cache that is dropped when
+ * relid's relcache entry is invalidated */
+upgrade_state document_upgrade_state(Oid relid,
+                                     const char *key_name,
+                                     const char *key_pg_type);
+
+/* Registers the cache's invalidation callback. Called from _PG_init */
+void document_upgrade_init(void);
+
+#endif
@@ -1,6 +1,12 @@
+#include "core.h"
+
 #include <assert.h>
+#include <ctype.h>
+
+#ifndef DOCUMENT_STANDALONE
+#include <utils/memutils.h>
+#endif
 
-#include <postgres.h>
 #include "utils.h"
 
 int
@@ -41,8 +47,8 @@ pstrndup(const char *str, int len)
 {
     char *retval;
 
-    retval = palloc0(len + 1);
-    strncpy(retval, str, len);
+    retval = palloc(len + 1);
+    memcpy(retval, str, len);
     retval[len] = '\0';
     return retval;
 }
@@ -142,3 +148,23 @@ parse_attr_path(char *attr_path, char ***path, char **path_arr_index_map)
 
     return path_depth;
 }
+
+/*
+ * A context for the temporaries of one call: serializing a document, or
+ * looking a key up in one, makes many small allocations (copies of values,
+ * attribute names, parsed paths) that are all dead once it returns. Callers
+ * switch to it, copy what they return out to their own context, and delete
+ * it. Deleting frees everything at once, and the context itself is kept on
+ * AllocSet's freelist, so the next call gets it back, keeper block and all,
+ * without a malloc. It is a child of the current context, so an error frees
+ * it along with that one.
+ */
+#ifndef DOCUMENT_STANDALONE
+MemoryContext
+document_arena_create(void)
+{
+    return AllocSetContextCreate(CurrentMemoryContext,
+                                 "document arena",
+                                 ALLOCSET_DEFAULT_SIZES);
+}
+#endif
@@ -2,3 +2,6 @@ int int_comparator(const void *v1, const void *v2);
 int intref_comparator(const void *v1, const void *v2);
 char *pstrndup(const char *str, int len);
 int parse_attr_path(char *attr_path, char ***path, char **path_arr_index_map);
+#ifndef DOCUMENT_STANDALONE
+MemoryContext document_arena_create(void);
+#endif
@@ -16,3 +16,8 @@ CREATE OR REPLACE FUNCTION analyze_schema()
 RETURNS trigger
 AS 'MODULE_PATHNAME'
 LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION document_schema_changed(regclass)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
@@ -1,59 +1,499 @@
 #include <postgres.h> /* This must precede all other includes */
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_type.h>
 #include <executor/spi.h>       /* this is what you need to work with SPI */
 #include <commands/trigger.h>   /* ... and triggers */
 #include <lib/stringinfo.h>
+#include <utils/builtins.h>
+#include <utils/guc.h>
+#include <nodes/pg_list.h>
+#include <utils/hsearch.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
 #include <utils/rel.h>
+#include <utils/timestamp.h>
 
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#include "../bw_colupgrader/bw_colupgrader.h"
+#include "../document/binary.h"
+#include "../document/load.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
-#define THRESHOLD_FREQUENCY (0.5)
+#define CONFIDENCE_Z (1.96) /* ~95% two-sided normal interval */
+#define ACCESS_SMOOTHING (0.3) /* Weight of the latest window's access rate */
+
+void _PG_init(void);
+
+/* GUC variables */
+/* Fraction of rows whose keys are counted, rounded to 1/N (see
+ * sample_weight). Each sampled row is counted with weight N, so count stays an
+ * unbiased estimate of the number of rows carrying the key */
+static double schema_analyzer_sample_rate = 1.0;
+/* See upgrade_score */
+static double schema_analyzer_upgrade_threshold = 0.5;
+static double schema_analyzer_hysteresis = 0.2;
+static double schema_analyzer_storage_weight = 0.5;
+/* Seconds over which accesses are turned into a rate; see
+ * update_upgrade_flags */
+static int schema_analyzer_access_window = 600;
+
+/* Prepared statements against document_schema.<relname>, one set per
+ * relation. The plans are kept (SPI_keepplan) for the life of the backend, so
+ * the trigger path only pays for parse/plan once per relation */
+typedef struct relation_plans {
+    Oid relid; /* Hash key */
+    char relname[NAMEDATALEN];
+    SPIPlanPtr update_count;
+    SPIPlanPtr insert_count;
+    SPIPlanPtr candidates;
+    SPIPlanPtr set_upgraded;
+    SPIPlanPtr set_access;
+} relation_plans;
+
+static HTAB *plans_table = NULL;
+static SPIPlanPtr live_tuples_plan = NULL;
+
+/* Relations whose keys this transaction flipped. bw_colupgrader is told about
+ * them at commit, once its worker can see the change */
+static List *flipped_relations = NIL;
+static bool xact_callback_registered = false;
+
+/* Key counts of the rows document_load inserted into deferred_relid that are
+ * yet to be applied, by key id. Lives in TopTransactionContext */
+typedef struct deferred_count {
+    int64 key_id; /* Hash key */
+    int64 count;
+} deferred_count;
+
+static HTAB *deferred_counts = NULL;
+static Oid deferred_relid = InvalidOid;
+static document_load_state *load_state = NULL;
+
+static SPIPlanPtr prepare_plan(const char *query, int nargs, Oid *argtypes);
+static relation_plans *get_relation_plans(Oid relid, const char *relname);
+static int sample_weight(void);
+static void remember_flipped(const char *relname);
+static void notify_upgrader(XactEvent event, void *arg);
+static void update_upgrade_flags(relation_plans *plans, int64 live_tuples);
+static void defer_key_counts(Oid relid, char *doc, int weight);
+static void apply_deferred_counts(relation_plans *plans);
+static void flush_deferred_counts(Oid relid, bool apply);
+static void update_key_counts(relation_plans *plans,
+                              char *doc,
+                              bool increment,
+                              int weight);
+
+void
+_PG_init(void)
+{
+    DefineCustomRealVariable("schema_analyzer.sample_rate",
+                             "Fraction of inserted/updated/deleted rows whose "
+                             "keys are counted.",
+                             "The rate is rounded to 1/N for the nearest whole "
+                             "N (0.4 samples 1 row in 2, 0.3 one in 3); rows "
+                             "are Bernoulli sampled at 1/N and counted with "
+                             "weight N.",
+                             &schema_analyzer_sample_rate,
+                             1.0,
+                             0.0001,
+                             1.0,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomRealVariable("schema_analyzer.upgrade_threshold",
+                             "Score at which a key is materialized as a column.",
+                             "Without access counts the score is the fraction "
+                             "of rows carrying the key.",
+                             &schema_analyzer_upgrade_threshold,
+                             0.5,
+                             0.0,
+                             DBL_MAX,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomRealVariable("schema_analyzer.hysteresis",
+                             "Relative margin around upgrade_threshold.",
+                             "Keys are upgraded above threshold * (1 + "
+                             "hysteresis) and downgraded below threshold * "
+                             "(1 - hysteresis).",
+                             &schema_analyzer_hysteresis,
+                             0.2,
+                             0.0,
+                             1.0,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomRealVariable("schema_analyzer.storage_weight",
+                             "Weight of key density in the upgrade score.",
+                             NULL,
+                             &schema_analyzer_storage_weight,
+                             0.5,
+                             0.0,
+                             DBL_MAX,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("schema_analyzer.access_window",
+                            "Window over which key accesses are turned into "
+                            "a rate.",
+                            "The upgrade score uses a smoothed rate of "
+                            "accessor calls per row per window.",
+                            &schema_analyzer_access_window,
+                            600,
+                            1,
+                            INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_S,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    load_state = document_load_get_state();
+    load_state->flush_counts = flush_deferred_counts;
+}
+
+/* Relative cost of an accessor call extracting a value of key_type from a
+ * document, where reading a column costs about nothing */
+static double
+extract_cost(const char *key_type)
+{
+    if (strstr(key_type, "[]") || !strcmp(key_type, "document"))
+    {
+        return 4.0; /* Copied out as a whole document or array */
+    }
+    else if (!strcmp(key_type, "text"))
+    {
+        return 2.0; /* Copied out */
+    }
+    return 1.0;
+}
+
+/*
+ * How much a key would gain from being a column.
+ *
+ * Density stands in for storage: as a column, each row carrying the key saves
+ * the attribute id and offset it takes in the document header, and a row
+ * without it costs a null bit. Accesses per row stand in for CPU: each
+ * accessor call on the key would read a column instead of searching the
+ * document, saving extract_cost. So dense keys nobody reads stay in the
+ * document, and sparse keys that are read a lot become columns.
+ *
+ * Accesses per row are a smoothed rate of accessor calls on the key in this
+ * relation per row and access_window (see update_upgrade_flags). They only
+ * exist when document_type is preloaded; without them the score is the plain
+ * density.
+ */
+static double
+upgrade_score(double density,
+              double accesses_per_row,
+              bool have_accesses,
+              const char *key_type)
+{
+    if (!have_accesses)
+    {
+        return density;
+    }
+    return schema_analyzer_storage_weight * density +
+        accesses_per_row * extract_cost(key_type);
+}
+
+/* 1/sample_rate rounded to a whole number, since counts are integers: rows
+ * are sampled with probability exactly 1/weight, which keeps the weighted
+ * counts unbiased, so the effective rate is 1/weight rather than sample_rate */
+static int
+sample_weight(void)
+{
+    return (int)rint(1.0 / schema_analyzer_sample_rate);
+}
+
+static void
+remember_flipped(const char *relname)
+{
+    ListCell *lc;
+    MemoryContext oldcontext;
 
-static void update_key_counts(char *relname, char *doc, bool increment);
+    foreach(lc, flipped_relations)
+    {
+        if (!strcmp((char*)lfirst(lc), relname))
+        {
+            return;
+        }
+    }
+
+    if (!xact_callback_registered)
+    {
+        RegisterXactCallback(notify_upgrader, NULL);
+        xact_callback_registered = true;
+    }
+
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    flipped_relations = lappend(flipped_relations, pstrdup(relname));
+    MemoryContextSwitchTo(oldcontext);
+}
+
+/* Wake bw_colupgrader for the relations we flipped keys of, if it is loaded */
+static void
+notify_upgrader(XactEvent event, void *arg)
+{
+    bw_colupgrader_request_fn *request;
+    ListCell *lc;
+
+    switch (event)
+    {
+    case XACT_EVENT_COMMIT:
+    case XACT_EVENT_PARALLEL_COMMIT:
+        request = (bw_colupgrader_request_fn*)
+            find_rendezvous_variable(BW_COLUPGRADER_RENDEZVOUS);
+        if (*request)
+        {
+            foreach(lc, flipped_relations)
+            {
+                (*request)((char*)lfirst(lc));
+            }
+        }
+        /* FALLTHROUGH */
+    case XACT_EVENT_ABORT:
+    case XACT_EVENT_PARALLEL_ABORT:
+        list_free_deep(flipped_relations);
+        flipped_relations = NIL;
+        break;
+    default:
+        break;
+    }
+}
+
+/* NOTE: Must be called between SPI_connect and SPI_finish */
+static SPIPlanPtr
+prepare_plan(const char *query, int nargs, Oid *argtypes)
+{
+    SPIPlanPtr plan;
+
+    plan = SPI_prepare(query, nargs, argtypes);
+    if (!plan)
+    {
+        elog(ERROR,
+             "analyze_document: SPI_prepare failed (%s): error code %d",
+             query,
+             SPI_result);
+    }
+    if (SPI_keepplan(plan))
+    {
+        elog(ERROR, "analyze_document: SPI_keepplan failed");
+    }
+
+    return plan;
+}
+
+static void
+free_relation_plans(relation_plans *plans)
+{
+    if (plans->update_count)
+    {
+        SPI_freeplan(plans->update_count);
+    }
+    if (plans->insert_count)
+    {
+        SPI_freeplan(plans->insert_count);
+    }
+    if (plans->candidates)
+    {
+        SPI_freeplan(plans->candidates);
+    }
+    if (plans->set_upgraded)
+    {
+        SPI_freeplan(plans->set_upgraded);
+    }
+    if (plans->set_access)
+    {
+        SPI_freeplan(plans->set_access);
+    }
+}
 
+/* Collections configured before access rates were kept lack their columns.
+ * NOTE: Must be called between SPI_connect and SPI_finish */
 static void
-update_key_counts(char *relname, char *doc, bool increment)
+add_access_columns(const char *relname)
 {
+    Oid schema_relid;
+    StringInfoData buf;
     int ret;
-    int i, num_keys;
+
+    schema_relid = get_relname_relid(relname,
+                                     get_namespace_oid("document_schema", false));
+    if (!OidIsValid(schema_relid) ||
+        get_attnum(schema_relid, "access_rate") != InvalidAttrNumber)
+    {
+        return;
+    }
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "ALTER TABLE document_schema.%s "
+                     "ADD COLUMN IF NOT EXISTS access_mark bigint, "
+                     "ADD COLUMN IF NOT EXISTS access_rate double precision, "
+                     "ADD COLUMN IF NOT EXISTS access_time timestamptz",
+                     quote_identifier(relname));
+    ret = SPI_execute(buf.data, false, 0);
+    if (ret != SPI_OK_UTILITY)
+    {
+        elog(ERROR,
+             "analyze_document: SPI_execute failed (add access columns): error "
+             "code %d",
+             ret);
+    }
+    pfree(buf.data);
+}
+
+/* Looks up (or prepares) the plans for rel. The table name is baked into the
+ * query text, so a renamed relation gets a fresh set */
+static relation_plans *
+get_relation_plans(Oid relid, const char *relname)
+{
+    relation_plans *plans;
+    const char *schema_table;
+    bool found;
     StringInfoData buf;
+    Oid argtypes[4];
+
+    if (!plans_table)
+    {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(Oid);
+        ctl.entrysize = sizeof(relation_plans);
+        plans_table = hash_create("schema_analyzer plans",
+                                  16,
+                                  &ctl,
+                                  HASH_ELEM | HASH_BLOBS);
+    }
 
+    plans = hash_search(plans_table, &relid, HASH_ENTER, &found);
+    if (found && !strcmp(plans->relname, relname))
+    {
+        return plans;
+    }
+    else if (found)
+    {
+        free_relation_plans(plans);
+    }
+
+    /* Zero first, so an error below leaves an entry that is simply rebuilt */
+    memset(plans, 0, sizeof(relation_plans));
+    plans->relid = relid;
+
+    add_access_columns(relname);
+    schema_table = quote_identifier(relname);
     initStringInfo(&buf);
 
-    num_keys = *(int*)doc;
+    argtypes[0] = INT8OID;
+    argtypes[1] = INT8OID;
+
+    appendStringInfo(&buf,
+                     "UPDATE document_schema.%s SET count = count + $2"
+                     ", dirty = true WHERE key_id = $1",
+                     schema_table);
+    plans->update_count = prepare_plan(buf.data, 2, argtypes);
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "INSERT INTO document_schema.%s (key_id, count, "
+                     "dirty, upgraded) VALUES($1, $2, 'true', 'false')",
+                     schema_table);
+    plans->insert_count = prepare_plan(buf.data, 2, argtypes);
+
+    argtypes[0] = OIDOID;
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "SELECT s.key_id, s.count, s.upgraded, a.key_type, "
+                     "document_access_count($1, a.key_name), "
+                     "s.access_mark, s.access_rate, s.access_time "
+                     "FROM document_schema.%s s "
+                     "JOIN document_schema._attributes a ON a._id = s.key_id "
+                     /* Nested paths are never counted; they are only
+                      * materialized on request (materialize_document_path) */
+                     "WHERE strpos(a.key_name, '.') = 0",
+                     schema_table);
+    plans->candidates = prepare_plan(buf.data, 1, argtypes);
+
+    argtypes[0] = INT8OID;
+    argtypes[1] = BOOLOID;
+
+    resetStringInfo(&buf);
+    /* See upgrade.h in document_type. A key with a column goes (back) to
+     * copying either way; one without goes to pending, or back to nothing */
+    appendStringInfo(&buf,
+                     "UPDATE document_schema.%s SET upgraded = $2, "
+                     "dirty = 'true', upgrade_state = CASE "
+                     "WHEN upgrade_state IS NULL OR upgrade_state = 'pending' "
+                     "THEN CASE WHEN $2 THEN 'pending' END "
+                     "ELSE 'copying' END "
+                     "WHERE key_id = $1 AND upgraded <> $2",
+                     schema_table);
+    plans->set_upgraded = prepare_plan(buf.data, 2, argtypes);
+
+    argtypes[0] = INT8OID;
+    argtypes[1] = INT8OID;
+    argtypes[2] = FLOAT8OID;
+    argtypes[3] = TIMESTAMPTZOID;
+
+    resetStringInfo(&buf);
+    appendStringInfo(&buf,
+                     "UPDATE document_schema.%s SET access_mark = $2, "
+                     "access_rate = $3, access_time = $4 WHERE key_id = $1",
+                     schema_table);
+    plans->set_access = prepare_plan(buf.data, 4, argtypes);
+
+    pfree(buf.data);
+
+    strlcpy(plans->relname, relname, NAMEDATALEN);
+
+    return plans;
+}
+
+static void
+update_key_counts(relation_plans *plans, char *doc, bool increment, int weight)
+{
+    int ret;
+    int i, num_keys;
+    Datum values[2];
+
+    num_keys = doc_natts(doc);
     // elog(WARNING, "%d", num_keys);
 
+    values[1] = Int64GetDatum(increment ? weight : -weight);
+
     for (i = 0; i < num_keys; ++i)
     {
-        /* TODO: prepared statement
-         * http://www.postgresql.org/docs/9.2/static/spi-spi-prepare.html
-         */
         int id;
 
-        id = *((int*)(doc + (i + 1) * sizeof(int)));
+        id = doc_attr_id(doc, i);
+        values[0] = Int64GetDatum(id);
 
         /* Increment count of key appearances */
-        if (increment)
-        {
-            appendStringInfo(&buf,
-                             "UPDATE document_schema.%s SET count = count + 1"
-                             ", dirty = true WHERE key_id = %d",
-                             relname,
-                             id);
-        }
-        else
-        {
-            appendStringInfo(&buf,
-                             "UPDATE document_schema.%s SET count = count - 1"
-                             ", dirty = true WHERE key_id = %d",
-                             relname,
-                             id);
-        }
-
-        ret = SPI_execute(buf.data, false, 0);
+        ret = SPI_execute_plan(plans->update_count, values, NULL, false, 0);
         if (ret != SPI_OK_UPDATE)
         {
             elog(ERROR,
@@ -66,20 +506,20 @@ update_key_counts(char *relname, char *doc, bool increment)
         /* Try to insert if key is new */
         if (SPI_processed != 1) {
             // elog(WARNING, "update failed; trying insert");
-            if (!increment)
+            if (!increment && weight == 1)
             {
                 elog(ERROR,
                      "Key id (%d) not listed in attributes table for rel %s",
                      id,
-                     relname);
+                     plans->relname);
+            }
+            else if (!increment)
+            {
+                /* Sampled on removal but never on insertion; the estimate
+                 * stays unbiased without it */
+                continue;
             }
-            resetStringInfo(&buf);
-            appendStringInfo(&buf,
-                             "INSERT INTO document_schema.%s (key_id, count, "
-                             "dirty, upgraded) VALUES(%d, 1, 'true', 'false')",
-                             relname,
-                             id);
-            ret = SPI_execute(buf.data, false, 0);
+            ret = SPI_execute_plan(plans->insert_count, values, NULL, false, 0);
             if (ret != SPI_OK_INSERT || SPI_processed != 1)
             {
                 elog(ERROR,
@@ -89,17 +529,306 @@ update_key_counts(char *relname, char *doc, bool increment)
             }
             // elog(WARNING, "finished insert");
         }
-
-        resetStringInfo(&buf);
     }
     // elog(WARNING, "end of analyze_doc");
 }
 
+/* Counts the keys of doc, inserted by document_load, towards the next
+ * apply_deferred_counts. No SPI work per row */
+static void
+defer_key_counts(Oid relid, char *doc, int weight)
+{
+    int i, num_keys;
+
+    if (!deferred_counts)
+    {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(int64);
+        ctl.entrysize = sizeof(deferred_count);
+        ctl.hcxt = TopTransactionContext;
+        deferred_counts = hash_create("schema_analyzer deferred counts",
+                                      256,
+                                      &ctl,
+                                      HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+        deferred_relid = relid;
+    }
+    assert(deferred_relid == relid);
+
+    num_keys = doc_natts(doc);
+    for (i = 0; i < num_keys; ++i)
+    {
+        int64 id;
+        deferred_count *entry;
+        bool found;
+
+        id = doc_attr_id(doc, i);
+        entry = hash_search(deferred_counts, &id, HASH_ENTER, &found);
+        if (!found)
+        {
+            entry->count = 0;
+        }
+        entry->count += weight;
+    }
+}
+
+/* Applies the deferred counts, one update (or insert) per key.
+ * NOTE: Must be called between SPI_connect and SPI_finish */
+static void
+apply_deferred_counts(relation_plans *plans)
+{
+    HASH_SEQ_STATUS status;
+    deferred_count *entry;
+    int ret;
+    Datum values[2];
+
+    if (!deferred_counts || deferred_relid != plans->relid)
+    {
+        return;
+    }
+
+    hash_seq_init(&status, deferred_counts);
+    while ((entry = hash_seq_search(&status)) != NULL)
+    {
+        values[0] = Int64GetDatum(entry->key_id);
+        values[1] = Int64GetDatum(entry->count);
+
+        ret = SPI_execute_plan(plans->update_count, values, NULL, false, 0);
+        if (ret != SPI_OK_UPDATE)
+        {
+            elog(ERROR,
+                 "analyze_document: SPI_execute failed (update count): error "
+                 "code %d",
+                 ret);
+        }
+        if (SPI_processed == 1)
+        {
+            continue;
+        }
+
+        ret = SPI_execute_plan(plans->insert_count, values, NULL, false, 0);
+        if (ret != SPI_OK_INSERT || SPI_processed != 1)
+        {
+            elog(ERROR,
+                 "analyze_document: SPI_execute failed (update count): "
+                 "error code %d",
+                 ret);
+        }
+    }
+
+    hash_destroy(deferred_counts);
+    deferred_counts = NULL;
+    deferred_relid = InvalidOid;
+}
+
+/* document_load_state.flush_counts: called by document_load after each batch,
+ * and with !apply when it fails */
+static void
+flush_deferred_counts(Oid relid, bool apply)
+{
+    relation_plans *plans;
+
+    if (!deferred_counts || deferred_relid != relid)
+    {
+        return;
+    }
+    else if (!apply)
+    {
+        hash_destroy(deferred_counts);
+        deferred_counts = NULL;
+        deferred_relid = InvalidOid;
+        return;
+    }
+
+    if (SPI_connect() < 0)
+    {
+        elog(ERROR, "analyze_document: spi_connect failed");
+    }
+    plans = get_relation_plans(relid, get_rel_name(relid));
+    apply_deferred_counts(plans);
+    SPI_finish();
+}
+
+/*
+ * Flip the upgraded bit of every key whose score (see upgrade_score) left the
+ * hysteresis band on the other side. With sampling, count is an estimate with
+ * variance count * (weight - 1), so the density is taken at the end of its
+ * confidence interval that argues against the flip; with weight 1 the interval
+ * is empty.
+ *
+ * The access counters only grow, so each key keeps the reading it had at the
+ * end of its last window (access_mark, access_time). Once access_window has
+ * passed, the calls since then, per row and scaled to one window, are folded
+ * into access_rate with weight ACCESS_SMOOTHING: a single scan of the table
+ * moves the rate by that much, while one scan per window brings it to 1. The
+ * counters restart from zero with the server, and a reading below the mark is
+ * taken as the calls since then. Reads of an upgraded key are planned against
+ * its column (see rewrite.c in document_type) and never reach the counters,
+ * so its rate is held rather than decayed, and it is downgraded on density.
+ * NOTE: Must be called between SPI_connect and SPI_finish
+ */
+static void
+update_upgrade_flags(relation_plans *plans, int64 live_tuples)
+{
+    int ret;
+    int nkeys;
+    int64 *flip_ids;
+    bool *flip_to;
+    int nflips;
+    double variance_weight;
+    int64 *access_ids;
+    int64 *access_marks;
+    double *access_rates;
+    int naccesses;
+    TimestampTz now;
+    Datum values[4];
+    int i;
+
+    values[0] = ObjectIdGetDatum(plans->relid);
+    ret = SPI_execute_plan(plans->candidates, values, NULL, true, 0);
+    if (ret != SPI_OK_SELECT)
+    {
+        elog(ERROR, "analyze_document: SPI_execute failed (get key scores): error code"
+             " %d", ret);
+    }
+
+    nkeys = SPI_processed;
+    flip_ids = palloc(Max(nkeys, 1) * sizeof(int64));
+    flip_to = palloc(Max(nkeys, 1) * sizeof(bool));
+    nflips = 0;
+    access_ids = palloc(Max(nkeys, 1) * sizeof(int64));
+    access_marks = palloc(Max(nkeys, 1) * sizeof(int64));
+    access_rates = palloc(Max(nkeys, 1) * sizeof(double));
+    naccesses = 0;
+    now = GetCurrentTimestamp();
+    variance_weight = (double)(sample_weight() - 1);
+    for (i = 0; i < nkeys; i++)
+    {
+        HeapTuple tuple = SPI_tuptable->vals[i];
+        TupleDesc tupdesc = SPI_tuptable->tupdesc;
+        bool isnull;
+        int64 key_id;
+        double key_count;
+        double spread;
+        bool upgraded;
+        char *key_type;
+        Datum accesses;
+        bool have_accesses;
+        double access_rate;
+        double score;
+
+        key_id = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+        key_count = (double)DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+        upgraded = DatumGetBool(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+        key_type = SPI_getvalue(tuple, tupdesc, 4);
+        accesses = SPI_getbinval(tuple, tupdesc, 5, &isnull);
+        have_accesses = !isnull;
+        access_rate = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 7, &isnull));
+        if (isnull)
+        {
+            access_rate = 0.0;
+        }
+
+        if (have_accesses)
+        {
+            int64 current = DatumGetInt64(accesses);
+            int64 mark;
+            TimestampTz since;
+            bool mark_isnull, since_isnull;
+            double elapsed;
+
+            mark = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 6, &mark_isnull));
+            since = DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 8,
+                                                      &since_isnull));
+            elapsed = (mark_isnull || since_isnull) ?
+                0.0 : (double)(now - since) / USECS_PER_SEC;
+
+            if (mark_isnull || since_isnull ||
+                elapsed >= schema_analyzer_access_window)
+            {
+                if (!mark_isnull && !since_isnull && !upgraded)
+                {
+                    int64 delta = current >= mark ? current - mark : current;
+
+                    access_rate = ACCESS_SMOOTHING *
+                        ((double)delta / live_tuples) *
+                        (schema_analyzer_access_window / elapsed) +
+                        (1 - ACCESS_SMOOTHING) * access_rate;
+                }
+                access_ids[naccesses] = key_id;
+                access_marks[naccesses] = current;
+                access_rates[naccesses++] = access_rate;
+            }
+        }
+
+        spread = CONFIDENCE_Z * sqrt(Max(key_count, 0) * variance_weight);
+        score = upgrade_score((key_count + (upgraded ? spread : -spread)) /
+                                  live_tuples,
+                              access_rate,
+                              have_accesses,
+                              key_type);
+
+        if (!upgraded &&
+            score >= schema_analyzer_upgrade_threshold * (1 + schema_analyzer_hysteresis))
+        {
+            flip_ids[nflips] = key_id;
+            flip_to[nflips++] = true;
+        }
+        else if (upgraded &&
+                 score < schema_analyzer_upgrade_threshold * (1 - schema_analyzer_hysteresis))
+        {
+            flip_ids[nflips] = key_id;
+            flip_to[nflips++] = false;
+        }
+    }
+
+    /* Separately, so as not to overwrite SPI_tuptable */
+    for (i = 0; i < naccesses; i++)
+    {
+        values[0] = Int64GetDatum(access_ids[i]);
+        values[1] = Int64GetDatum(access_marks[i]);
+        values[2] = Float8GetDatum(access_rates[i]);
+        values[3] = TimestampTzGetDatum(now);
+        ret = SPI_execute_plan(plans->set_access, values, NULL, false, 0);
+        if (ret != SPI_OK_UPDATE)
+        {
+            elog(ERROR, "analyze_document: SPI_execute failed (set access rate): "
+                 "error code %d", ret);
+        }
+    }
+    for (i = 0; i < nflips; i++)
+    {
+        values[0] = Int64GetDatum(flip_ids[i]);
+        values[1] = BoolGetDatum(flip_to[i]);
+        ret = SPI_execute_plan(plans->set_upgraded, values, NULL, false, 0);
+        if (ret != SPI_OK_UPDATE)
+        {
+            elog(ERROR, "analyze_document: SPI_execute failed (%s cols): error code"
+                 " %d", flip_to[i] ? "upgrade" : "downgrade", ret);
+        }
+        if (SPI_processed > 0)
+        {
+            /* Readers and document_route_keys cache the upgrade states */
+            CacheInvalidateRelcacheByRelid(plans->relid);
+            remember_flipped(plans->relname);
+        }
+    }
+
+    pfree(flip_ids);
+    pfree(flip_to);
+    pfree(access_ids);
+    pfree(access_marks);
+    pfree(access_rates);
+}
+
 Datum analyze_document(PG_FUNCTION_ARGS);
 Datum analyze_schema(PG_FUNCTION_ARGS);
+Datum document_schema_changed(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(analyze_document);
 PG_FUNCTION_INFO_V1(analyze_schema);
+PG_FUNCTION_INFO_V1(document_schema_changed);
 
 Datum
 analyze_document(PG_FUNCTION_ARGS)
@@ -107,25 +836,48 @@ analyze_document(PG_FUNCTION_ARGS)
     TriggerData *trigdata = (TriggerData*)fcinfo->context;
     TupleDesc   tupdesc;
     HeapTuple rettuple;
-    Oid rd_id;
-    int ret;
-    StringInfoData buf;
-    char *relname;
+    relation_plans *plans;
     bytea* datum;
     char *doc_old, *doc_new;
     bool isnull;
+    int weight;
 
     if (!CALLED_AS_TRIGGER(fcinfo))
     {
         elog(ERROR, "analyze_document: not called by trigger manager");
     }
 
+    /* Bernoulli sample: unsampled rows cost no SPI work at all */
+    weight = sample_weight();
+    if (weight > 1 && random() % weight != 0)
+    {
+        if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+        {
+            return PointerGetDatum(trigdata->tg_newtuple);
+        }
+        return PointerGetDatum(trigdata->tg_trigtuple);
+    }
+
+    tupdesc = trigdata->tg_relation->rd_att;
+
+    /* Rows of a document_load are counted a batch at a time */
+    if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event) &&
+        load_state->relid == RelationGetRelid(trigdata->tg_relation))
+    {
+        datum = (bytea*)DatumGetPointer(SPI_getbinval(trigdata->tg_trigtuple,
+                                                      tupdesc,
+                                                      2,
+                                                      &isnull));
+        assert(datum);
+        defer_key_counts(load_state->relid, datum->vl_dat, weight);
+        return PointerGetDatum(trigdata->tg_trigtuple);
+    }
+
     if (SPI_connect() < 0)
     {
         elog(ERROR, "analyze_document: spi_connect failed");
     }
 
-    tupdesc = trigdata->tg_relation->rd_att;
     if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event) ||
         TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) ||
         TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
@@ -152,39 +904,25 @@ analyze_document(PG_FUNCTION_ARGS)
     }
     // elog(WARNING, "Got doc");
 
-    rd_id = trigdata->tg_relation->rd_id;
-    initStringInfo(&buf);
-    appendStringInfo(&buf,
-                     "SELECT relname FROM pg_class where oid = %d",
-                     rd_id);
-
-    ret = SPI_execute(buf.data, false, 0);
-    if (ret != SPI_OK_SELECT)
-    {
-        elog(ERROR, "analyze_document: SPI_execute failed (get relname): error code"
-            " %d", ret);
-    }
-
-    if (SPI_processed != 1) {
-        PG_RETURN_NULL();
-    }
-
-    relname = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+    plans = get_relation_plans(RelationGetRelid(trigdata->tg_relation),
+                               RelationGetRelationName(trigdata->tg_relation));
 
     if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
     {
-        update_key_counts(relname, doc_old, true);
-        rettuple = trigdata->tg_newtuple;
+        update_key_counts(plans, doc_old, true, weight);
+        /* May run BEFORE INSERT (see configure_collection.sql), where the
+         * tuple returned is the one inserted */
+        rettuple = trigdata->tg_trigtuple;
     }
     else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
     {
-        update_key_counts(relname, doc_old, false);
-        update_key_counts(relname, doc_new, true);
+        update_key_counts(plans, doc_old, false, weight);
+        update_key_counts(plans, doc_new, true, weight);
         rettuple = trigdata->tg_newtuple;
     }
     else if (TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
     {
-        update_key_counts(relname, doc_old, false);
+        update_key_counts(plans, doc_old, false, weight);
         rettuple = trigdata->tg_trigtuple;
     }
     else
@@ -203,11 +941,10 @@ Datum
 analyze_schema(PG_FUNCTION_ARGS)
 {
     TriggerData *trigdata = (TriggerData*)fcinfo->context;
-    Oid rd_id;
+    relation_plans *plans;
     int ret;
-    StringInfoData buf;
-    int count;
-    char *relname;
+    int64 count;
+    Datum values[1];
     bool isnull;
 
     if (!CALLED_AS_TRIGGER(fcinfo))
@@ -220,72 +957,46 @@ analyze_schema(PG_FUNCTION_ARGS)
         elog(ERROR, "analyze_document: spi_connect failed");
     }
 
-    rd_id = trigdata->tg_relation->rd_id;
-    // elog(WARNING, "got relation id: %d", rd_id);
+    plans = get_relation_plans(RelationGetRelid(trigdata->tg_relation),
+                               RelationGetRelationName(trigdata->tg_relation));
+
+    /* A document_load batch ends here; count it before deciding anything */
+    apply_deferred_counts(plans);
 
     /* Get number of records in table */
-    initStringInfo(&buf);
-    appendStringInfo(&buf, "SELECT n_live_tup FROM pg_stat_user_tables WHERE relid = %d", rd_id);
-    // elog(WARNING, "%s", buf.data);
-    ret = SPI_execute(buf.data, true, 0);
+    if (!live_tuples_plan)
+    {
+        Oid argtypes[1] = { OIDOID };
+
+        live_tuples_plan = prepare_plan("SELECT n_live_tup FROM "
+                                        "pg_stat_user_tables WHERE relid = $1",
+                                        1,
+                                        argtypes);
+    }
+    values[0] = ObjectIdGetDatum(RelationGetRelid(trigdata->tg_relation));
+    ret = SPI_execute_plan(live_tuples_plan, values, NULL, true, 0);
     if (ret != SPI_OK_SELECT)
     {
         elog(ERROR, "analyze_document: SPI_execute failed (get record count): error code"
              " %d", ret);
     }
     if (SPI_processed != 1) {
+        SPI_finish();
         PG_RETURN_NULL();
     }
-    // elog(WARNING, "HELLO");
     count = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
                                         SPI_tuptable->tupdesc,
                                         1,
                                         &isnull));
     // elog(WARNING, "found %d tuples", count);
 
-    /* Get relation name */
-    resetStringInfo(&buf);
-    appendStringInfo(&buf, "SELECT relname FROM pg_class where oid = %d", rd_id);
-    ret = SPI_execute(buf.data, true, 0);
-    if (ret != SPI_OK_SELECT)
+    if (count <= 0)
     {
-        elog(ERROR, "analyze_document: SPI_execute failed (get relname): error code"
-             " %d", ret);
-    }
-    if (SPI_processed != 1) {
-        PG_RETURN_NULL();
+        SPI_finish();
+        return NULL;
     }
-    relname = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
-    // elog(WARNING, "got relname: %s", relname);
 
-    resetStringInfo(&buf);
-    appendStringInfo(&buf,
-                     "UPDATE document_schema.%s SET upgraded = 'true', "
-                     "dirty = 'true' WHERE count >= %d AND upgraded = 'false'",
-                     relname,
-                     (int)(count * THRESHOLD_FREQUENCY));
-    ret = SPI_execute(buf.data, false, 0);
-    if (ret != SPI_OK_UPDATE)
-    {
-        elog(ERROR, "analyze_document: SPI_execute failed (upgrade cols): error code"
-             " %d", ret);
-    }
-    // elog(WARNING, "upgraded");
-
-    resetStringInfo(&buf);
-    appendStringInfo(&buf,
-                     "UPDATE document_schema.%s SET upgraded = 'false', "
-                     "dirty = 'true' WHERE count < %d AND upgraded = 'true'",
-                     relname,
-                     (int)(count * THRESHOLD_FREQUENCY));
-    ret = SPI_execute(buf.data, false, 0);
-    if (ret != SPI_OK_UPDATE)
-    {
-        elog(ERROR, "analyze_document: SPI_execute failed (downgrade cols): error code"
-             " %d", ret);
-    }
-
-    // elog(WARNING, "downgraded");
+    update_upgrade_flags(plans, count);
 
     SPI_finish();
 
@@ -295,3 +1006,24 @@ analyze_schema(PG_FUNCTION_ARGS)
      */
     return NULL;
 }
+
+/* Called after document_schema.<rel> was changed by hand (see
+ * materialize_document_path): let other backends see the new states, and wake
+ * the upgrader once we commit */
+Datum
+document_schema_changed(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    char *relname;
+
+    relname = get_rel_name(relid);
+    if (!relname)
+    {
+        elog(ERROR, "document_schema_changed: no relation with oid %u", relid);
+    }
+
+    CacheInvalidateRelcacheByRelid(relid);
+    remember_flipped(relname);
+
+    PG_RETURN_VOID();
+}
@@ -0,0 +1,56 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+CONTAINS = "SELECT data @> %s::document FROM test;"
+
+class TestContains(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def contains(self, doc, query):
+        self.cur.execute(INSERT, (json.dumps(doc),))
+        self.cur.execute(CONTAINS, (json.dumps(query),))
+        return (self.cur.fetchone())[0]
+
+    def test_empty(self):
+        self.assertTrue(self.contains(flat_dict, empty_dict))
+
+    def test_flat(self):
+        self.assertTrue(self.contains(flat_dict, { INT_KEY : TEST_INT,
+                                                   STRING_KEY : TEST_STRING }))
+        self.assertFalse(self.contains(flat_dict, { INT_KEY : TEST_INT + 1 }))
+        self.assertFalse(self.contains(flat_dict, { "doesnotexist" : TEST_INT }))
+
+    def test_type_mismatch(self):
+        self.assertFalse(self.contains(flat_dict, { INT_KEY : str(TEST_INT) }))
+
+    def test_nested(self):
+        self.assertTrue(self.contains(nested_dict,
+                                      { DOCUMENT_KEY : { BOOL_KEY : TEST_BOOL } }))
+        self.assertFalse(self.contains(nested_dict,
+                                       { DOCUMENT_KEY : { BOOL_KEY : not TEST_BOOL } }))
+
+    def test_index_scan(self):
+        self.cur.execute("CREATE INDEX test_data_idx ON test USING gin (data);")
+        self.cur.execute("SET LOCAL enable_seqscan = off;")
+        for doc in [flat_dict, nested_dict, array_dict]:
+            self.cur.execute(INSERT, (json.dumps(doc),))
+        self.cur.execute("SELECT count(*) FROM test WHERE data @> %s::document;",
+                         (json.dumps({ FLOAT_KEY : TEST_FLOAT }),))
+        self.assertEqual(3, (self.cur.fetchone())[0])
+        self.cur.execute("SELECT count(*) FROM test WHERE data @> %s::document;",
+                         (json.dumps({ INT_KEY : TEST_INT }),))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,51 @@
+import copy
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+DOCUMENT_DELETE_MANY = "SELECT document_delete_many(data, %s, %s) FROM test;"
+
+class TestDeleteMany(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def delete_many(self, doc, names, types):
+        self.cur.execute(INSERT, (json.dumps(doc),))
+        self.cur.execute(DOCUMENT_DELETE_MANY, (names, types))
+        return json.loads((self.cur.fetchone())[0])
+
+    def test_flat(self):
+        new_dict = copy.deepcopy(flat_dict)
+        del new_dict[INT_KEY]
+        del new_dict[STRING_KEY]
+        self.assertEqual(new_dict,
+                         self.delete_many(flat_dict,
+                                          [INT_KEY, STRING_KEY],
+                                          [INT_TYPE, STRING_TYPE]))
+
+    def test_nomatch(self):
+        self.assertEqual(flat_dict,
+                         self.delete_many(flat_dict,
+                                          ["doesnotexist", INT_KEY],
+                                          [INT_TYPE, STRING_TYPE]))
+
+    def test_empty(self):
+        self.assertEqual(flat_dict, self.delete_many(flat_dict, [], []))
+
+    def test_get_after_delete(self):
+        self.delete_many(flat_dict, [STRING_KEY], [STRING_TYPE])
+        self.cur.execute("SELECT document_get_float(document_delete_many(data, %s, %s), %s) FROM test;",
+                         ([STRING_KEY], [STRING_TYPE], FLOAT_KEY))
+        self.assertAlmostEqual(TEST_FLOAT, (self.cur.fetchone())[0])
+
+if __name__ == '__main__':
+    unittest.main()
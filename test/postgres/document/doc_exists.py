@@ -0,0 +1,65 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+EXISTS = "SELECT data ? %s FROM test;"
+DOCUMENT_GET_INT = "SELECT document_get_int(data, %s) FROM test;"
+
+class TestExists(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def insert(self, doc):
+        self.cur.execute(INSERT, (json.dumps(doc),))
+
+    def test_exists(self):
+        self.insert(flat_dict)
+        self.cur.execute(EXISTS, (INT_KEY,))
+        self.assertTrue((self.cur.fetchone())[0])
+
+    def test_not_exists(self):
+        self.insert(flat_dict)
+        self.cur.execute(EXISTS, ("doesnotexist",))
+        self.assertFalse((self.cur.fetchone())[0])
+
+    def test_nested_key_is_not_top_level(self):
+        self.insert(nested_dict)
+        self.cur.execute(EXISTS, (INT_KEY,))
+        self.assertFalse((self.cur.fetchone())[0])
+
+    def test_without_bloom_filter(self):
+        self.cur.execute("SET LOCAL document_type.bloom_filter = off;")
+        self.insert(flat_dict)
+        self.cur.execute(DOCUMENT_GET_INT, (INT_KEY,))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+        self.cur.execute(EXISTS, ("doesnotexist",))
+        self.assertFalse((self.cur.fetchone())[0])
+
+    def test_put_keeps_bloom_filter(self):
+        self.insert(flat_dict)
+        self.cur.execute("UPDATE test SET data = document_put_int(data, 'new_key', 7);")
+        self.cur.execute(DOCUMENT_GET_INT, ("new_key",))
+        self.assertEqual(7, (self.cur.fetchone())[0])
+        self.cur.execute(EXISTS, ("new_key",))
+        self.assertTrue((self.cur.fetchone())[0])
+
+    def test_brin_scan(self):
+        self.cur.execute("CREATE INDEX test_data_brin ON test USING brin (data);")
+        self.cur.execute("SET LOCAL enable_seqscan = off;")
+        for doc in [flat_dict, nested_dict, array_dict]:
+            self.insert(doc)
+        self.cur.execute("SELECT brin_summarize_new_values('test_data_brin');")
+        self.cur.execute("SELECT count(*) FROM test WHERE data ? %s;", (INT_KEY,))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+if __name__ == '__main__':
+    unittest.main()
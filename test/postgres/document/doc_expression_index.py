@@ -0,0 +1,50 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+CREATE_INDEX = "CREATE INDEX test_int_idx ON test ((document_get_int(data, %s)));"
+LOOKUP = "SELECT count(*) FROM test WHERE document_get_int(data, %s) = %s;"
+
+class TestExpressionIndex(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def insert(self, doc):
+        self.cur.execute(INSERT, (json.dumps(doc),))
+
+    def test_index_scan(self):
+        for i in range(20):
+            self.insert({INT_KEY : i})
+        self.cur.execute(CREATE_INDEX, (INT_KEY,))
+        self.cur.execute("SET enable_seqscan = off;")
+        self.cur.execute("EXPLAIN " + LOOKUP, (INT_KEY, 7))
+        plan = "\n".join(row[0] for row in self.cur.fetchall())
+        self.assertIn("test_int_idx", plan)
+        self.cur.execute(LOOKUP, (INT_KEY, 7))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+    def test_index_sees_new_keys(self):
+        # The index is built before the key exists anywhere
+        self.cur.execute(CREATE_INDEX, ("expression_index_key",))
+        self.insert({"expression_index_key" : 3})
+        self.cur.execute("SET enable_seqscan = off;")
+        self.cur.execute(LOOKUP, ("expression_index_key", 3))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+    def test_constant_folding(self):
+        self.cur.execute("EXPLAIN SELECT document_get_int(%s::document, %s);",
+                         (json.dumps(flat_dict), INT_KEY))
+        plan = "\n".join(row[0] for row in self.cur.fetchall())
+        self.assertNotIn("document_get_int", plan)
+
+if __name__ == '__main__':
+    unittest.main()
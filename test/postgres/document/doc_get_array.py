@@ -0,0 +1,71 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+GET_INT_ARRAY = "SELECT document_get_int_array(data, %s, %s) FROM test;"
+GET_TEXT_ARRAY = "SELECT document_get_text_array(data, %s, %s) FROM test;"
+GET_BOOL_ARRAY = "SELECT document_get_bool_array(data, %s, %s) FROM test;"
+
+class TestGetArray(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def insert(self, doc):
+        self.cur.execute(INSERT, (json.dumps(doc),))
+
+    def test_int_array(self):
+        self.insert(array_dict)
+        self.cur.execute(GET_INT_ARRAY, ("INT_ARRAY", "bigint[]"))
+        self.assertEqual([1, 2, 3, 4, 5, 26], (self.cur.fetchone())[0])
+
+    def test_text_array(self):
+        self.insert(array_dict)
+        self.cur.execute(GET_TEXT_ARRAY, ("STRING_ARRAY", "text[]"))
+        self.assertEqual(["a", "b", "cdef"], (self.cur.fetchone())[0])
+
+    def test_bool_array(self):
+        # Booleans are a byte each, packed next to one another
+        self.insert({"flags" : [False, True, False, False]})
+        self.cur.execute(GET_BOOL_ARRAY, ("flags", "boolean[]"))
+        self.assertEqual([False, True, False, False], (self.cur.fetchone())[0])
+
+    def test_missing(self):
+        self.insert(flat_dict)
+        self.cur.execute(GET_INT_ARRAY, ("INT_ARRAY", "bigint[]"))
+        self.assertEqual(None, (self.cur.fetchone())[0])
+
+    def test_rectangular_nested_array(self):
+        self.insert({"matrix" : [[1, 2], [3, 4]]})
+        self.cur.execute(GET_INT_ARRAY, ("matrix", "bigint[][]"))
+        self.assertEqual([[1, 2], [3, 4]], (self.cur.fetchone())[0])
+
+    def test_ragged_nested_array(self):
+        # Postgres arrays must be rectangular
+        self.insert(nested_array_dict)
+        self.cur.execute(GET_INT_ARRAY, ("NESTED_INT_ARRAY", "bigint[][]"))
+        self.assertEqual(None, (self.cur.fetchone())[0])
+
+    def test_nested_path(self):
+        self.insert({DOCUMENT_KEY : array_dict})
+        self.cur.execute(GET_INT_ARRAY, (DOCUMENT_KEY + ".INT_ARRAY", "bigint[]"))
+        self.assertEqual([1, 2, 3, 4, 5, 26], (self.cur.fetchone())[0])
+
+    def test_delete_nested_path(self):
+        self.insert(nested_dict)
+        self.cur.execute("SELECT document_delete_many(data, %s, %s)::text FROM test;",
+                         ([DOCUMENT_KEY + "." + INT_KEY], [INT_TYPE]))
+        result = json.loads((self.cur.fetchone())[0])
+        self.assertNotIn(INT_KEY, result[DOCUMENT_KEY])
+        self.assertEqual(TEST_STRING, result[DOCUMENT_KEY][STRING_KEY])
+
+if __name__ == '__main__':
+    unittest.main()
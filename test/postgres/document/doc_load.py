@@ -0,0 +1,80 @@
+import json
+import os
+import psycopg2
+import tempfile
+import unittest
+
+from test_data import *
+
+LOAD = "SELECT document_load('test', %s, %s, %s);"
+ATTRIBUTE_COUNT = ("SELECT count(*) FROM document_schema._attributes "
+                   "WHERE key_name = %s AND key_type = %s;")
+
+class TestLoad(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+        self.paths = []
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+        for path in self.paths:
+            os.remove(path)
+
+    def write(self, lines):
+        # Read by the server, which runs on this machine
+        f = tempfile.NamedTemporaryFile(mode="w", suffix=".json", delete=False)
+        f.write("\n".join(lines) + "\n")
+        f.close()
+        os.chmod(f.name, 0o644)
+        self.paths.append(f.name)
+        return f.name
+
+    def load(self, lines, batch_size=10000, workers=0):
+        self.cur.execute(LOAD, (self.write(lines), batch_size, workers))
+        return (self.cur.fetchone())[0]
+
+    def test_load(self):
+        self.assertEqual(2, self.load([json.dumps(flat_dict), json.dumps(nested_dict)]))
+        self.cur.execute("SELECT document_get_int(data, %s) FROM test "
+                         "WHERE data ? %s;", (INT_KEY, INT_KEY))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+        self.cur.execute("SELECT document_get_text(data, %s) FROM test "
+                         "WHERE data ? %s;", (DOCUMENT_KEY + "." + STRING_KEY,
+                                              DOCUMENT_KEY))
+        self.assertEqual(TEST_STRING, (self.cur.fetchone())[0])
+
+    def test_batches(self):
+        lines = [json.dumps({"load_key" : i}) for i in range(10)]
+        self.assertEqual(10, self.load(lines, 3))
+        self.cur.execute("SELECT sum(document_get_int(data, 'load_key')) FROM test;")
+        self.assertEqual(45, (self.cur.fetchone())[0])
+        # Created once, though every row of every batch has it
+        self.cur.execute(ATTRIBUTE_COUNT, ("load_key", INT_TYPE))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+    def test_parallel(self):
+        # Every third document brings a new key
+        lines = [json.dumps({"load_key%d" % (i // 3) : i, STRING_KEY : TEST_STRING})
+                 for i in range(30)]
+        self.assertEqual(30, self.load(lines, 7, 2))
+        self.cur.execute("SELECT sum(document_get_int(data, 'load_key4')) FROM test;")
+        self.assertEqual(12 + 13 + 14, (self.cur.fetchone())[0])
+        # Ids are handed out in order of first appearance, as by a serial load
+        self.cur.execute("SELECT key_name FROM document_schema._attributes "
+                         "WHERE key_name LIKE 'load_key%%' ORDER BY _id;")
+        self.assertEqual(["load_key%d" % i for i in range(10)],
+                         [row[0] for row in self.cur.fetchall()])
+
+    def test_blank_lines(self):
+        self.assertEqual(1, self.load(["", json.dumps(flat_dict) + "\r", "  "]))
+
+    def test_not_an_object(self):
+        with self.assertRaises(psycopg2.Error):
+            self.load([json.dumps(flat_dict), "[1, 2]"])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,68 @@
+import psycopg2
+import unittest
+
+from test_data import *
+
+DOCUMENT_GET_INT = "SELECT document_get_int(data, %s) FROM test;"
+DOCUMENT_GET_FLOAT = "SELECT document_get_float(data, %s) FROM test;"
+EXISTS = "SELECT data ? %s FROM test;"
+
+class TestNumbers(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def insert_raw(self, json_str):
+        # Not through json.dumps, which would normalize the numbers
+        self.cur.execute(INSERT, (json_str,))
+
+    def get(self, query, key):
+        self.cur.execute(query, (key,))
+        return (self.cur.fetchone())[0]
+
+    def test_integer(self):
+        self.insert_raw('{"a" : -42, "b" : 0}')
+        self.assertEqual(-42, self.get(DOCUMENT_GET_INT, "a"))
+        self.assertEqual(0, self.get(DOCUMENT_GET_INT, "b"))
+
+    def test_exponent_is_float(self):
+        self.insert_raw('{"a" : 1e5, "b" : 2.5E-1}')
+        self.assertAlmostEqual(100000.0, self.get(DOCUMENT_GET_FLOAT, "a"))
+        self.assertAlmostEqual(0.25, self.get(DOCUMENT_GET_FLOAT, "b"))
+        self.assertEqual(None, self.get(DOCUMENT_GET_INT, "a"))
+
+    def test_overflow_is_float(self):
+        self.insert_raw('{"a" : 2147483647, "b" : 2147483648, "c" : -2147483648, '
+                        '"d" : 123456789012345678901234567890}')
+        self.assertEqual(2147483647, self.get(DOCUMENT_GET_INT, "a"))
+        self.assertEqual(None, self.get(DOCUMENT_GET_INT, "b"))
+        self.assertAlmostEqual(2147483648.0, self.get(DOCUMENT_GET_FLOAT, "b"))
+        self.assertEqual(-2147483648, self.get(DOCUMENT_GET_INT, "c"))
+        self.assertAlmostEqual(1.2345678901234568e29, self.get(DOCUMENT_GET_FLOAT, "d"),
+                               delta=1e15)
+
+    def test_malformed_number_is_dropped(self):
+        self.insert_raw('{"a" : 1.2.3, "b" : 7}')
+        self.assertFalse(self.get(EXISTS, "a"))
+        self.assertEqual(7, self.get(DOCUMENT_GET_INT, "b"))
+
+    def test_get_float_as_text(self):
+        self.insert_raw('{"a" : 1.5}')
+        self.cur.execute("SELECT document_get(data, %s, %s) FROM test;",
+                         ("a", FLOAT_TYPE))
+        self.assertAlmostEqual(1.5, float((self.cur.fetchone())[0]))
+
+    def test_large_float_output(self):
+        # Its text is longer than any buffer sized from the binary value
+        self.insert_raw('{"a" : 1e300}')
+        self.cur.execute("SELECT data::text FROM test;")
+        self.assertRegex((self.cur.fetchone())[0], r'"a":1\d{300}\.\d{6}')
+
+if __name__ == '__main__':
+    unittest.main()
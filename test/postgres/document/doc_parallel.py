@@ -0,0 +1,50 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+# Plan a parallel scan however small the table
+FORCE_PARALLEL = ["SET parallel_setup_cost = 0;",
+                  "SET parallel_tuple_cost = 0;",
+                  "SET min_parallel_table_scan_size = 0;",
+                  "SET max_parallel_workers_per_gather = 2;"]
+GROUP_BY = ("SELECT document_get_text(data, %s), sum(document_get_int(data, %s)) "
+            "FROM test GROUP BY 1 ORDER BY 1;")
+PREDICATE = ("SELECT count(*) FROM test WHERE document_get_text(data, %s) = %s "
+             "AND data ? %s;")
+
+class TestParallel(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+        for i in range(100):
+            self.cur.execute(INSERT, (json.dumps({STRING_KEY : "s%d" % (i % 2),
+                                                  INT_KEY : i}),))
+        for statement in FORCE_PARALLEL:
+            self.cur.execute(statement)
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def plan(self, query, args):
+        self.cur.execute("EXPLAIN " + query, args)
+        return "\n".join(row[0] for row in self.cur.fetchall())
+
+    def test_group_by(self):
+        args = (STRING_KEY, INT_KEY)
+        self.assertIn("Gather", self.plan(GROUP_BY, args))
+        self.cur.execute(GROUP_BY, args)
+        self.assertEqual([("s0", 2450), ("s1", 2500)], self.cur.fetchall())
+
+    def test_predicate(self):
+        args = (STRING_KEY, "s1", INT_KEY)
+        self.assertIn("Gather", self.plan(PREDICATE, args))
+        self.cur.execute(PREDICATE, args)
+        self.assertEqual(50, (self.cur.fetchone())[0])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,82 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+DOCUMENT_GET_INT = "SELECT document_get_int(data, %s) FROM test;"
+SCHEMA_TABLE = ("CREATE TABLE IF NOT EXISTS document_schema.test (key_id bigint, "
+                "count bigint, dirty bool, upgraded bool, upgrade_block bigint, "
+                "upgrade_state text);")
+SET_STATE = ("INSERT INTO document_schema.test SELECT _id, 1, false, true, NULL, %s "
+             "FROM document_schema._attributes WHERE key_name = %s AND key_type = %s;")
+
+class TestRewrite(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def upgrade(self, value, state="copying"):
+        # What bw_colupgrader does to a row once the key has a column. Rows
+        # must have been inserted first, to register the key
+        self.cur.execute(SCHEMA_TABLE)
+        self.cur.execute(SET_STATE, (state, INT_KEY, INT_TYPE))
+        self.cur.execute('ALTER TABLE test ADD COLUMN "int" bigint;')
+        self.cur.execute('UPDATE test SET "int" = %s, '
+                         "data = document_delete(data, %s, 'bigint');",
+                         (value, INT_KEY))
+
+    def test_reads_column(self):
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.upgrade(7)
+        self.cur.execute(DOCUMENT_GET_INT, (INT_KEY,))
+        self.assertEqual(7, (self.cur.fetchone())[0])
+
+    def test_reads_document_for_pending_rows(self):
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.upgrade(None)
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.cur.execute("SELECT count(*) FROM test WHERE document_get_int(data, %s) = %s;",
+                         (INT_KEY, TEST_INT))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+    def test_disabled(self):
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.upgrade(7)
+        self.cur.execute("SET LOCAL document_type.rewrite_accessors = off;")
+        self.cur.execute(DOCUMENT_GET_INT, (INT_KEY,))
+        self.assertIsNone((self.cur.fetchone())[0])
+
+    def test_user_column(self):
+        # A column that only shares the key's name and type isn't an upgrade
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.cur.execute('ALTER TABLE test ADD COLUMN "int" bigint;')
+        self.cur.execute('UPDATE test SET "int" = 7;')
+        self.cur.execute(DOCUMENT_GET_INT, (INT_KEY,))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+
+    def test_pending_upgrade(self):
+        # No column has been created by the upgrader yet
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.cur.execute(SCHEMA_TABLE)
+        self.cur.execute(SET_STATE, ("pending", INT_KEY, INT_TYPE))
+        self.cur.execute('ALTER TABLE test ADD COLUMN "int" bigint;')
+        self.cur.execute('UPDATE test SET "int" = 7;')
+        self.cur.execute(DOCUMENT_GET_INT, (INT_KEY,))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+
+    def test_type_mismatch(self):
+        self.cur.execute(INSERT, (json.dumps(flat_dict),))
+        self.cur.execute('ALTER TABLE test ADD COLUMN "int" text;')
+        self.cur.execute('UPDATE test SET "int" = %s;', ("other",))
+        self.cur.execute(DOCUMENT_GET_INT, (INT_KEY,))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+
+if __name__ == '__main__':
+    unittest.main()
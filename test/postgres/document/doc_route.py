@@ -0,0 +1,94 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+SCHEMA_TABLE = ("CREATE TABLE IF NOT EXISTS document_schema.test (key_id bigint, "
+                "count bigint, dirty bool, upgraded bool, upgrade_block bigint, "
+                "upgrade_state text);")
+SET_STATE = ("INSERT INTO document_schema.test SELECT _id, 1, false, %s, NULL, %s "
+             "FROM document_schema._attributes WHERE key_name = %s AND key_type = %s;")
+ROUTE_KEYS = ("CREATE TRIGGER route_keys BEFORE INSERT OR UPDATE ON test "
+              "FOR EACH ROW EXECUTE PROCEDURE document_route_keys();")
+ROUTED = "SELECT count(*) FROM test WHERE \"int\" = %s AND NOT data ? %s;"
+
+class TestRoute(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def insert(self, doc):
+        self.cur.execute(INSERT, (json.dumps(doc),))
+
+    def upgrade(self, upgraded, state):
+        # Where bw_colupgrader would have got to with INT_KEY
+        self.insert(flat_dict) # Registers the keys
+        self.cur.execute("DELETE FROM test;")
+        self.cur.execute(SCHEMA_TABLE)
+        self.cur.execute(SET_STATE, (upgraded, state, INT_KEY, INT_TYPE))
+        self.cur.execute('ALTER TABLE test ADD COLUMN "int" bigint;')
+        self.cur.execute(ROUTE_KEYS)
+
+    def test_copying(self):
+        self.upgrade(True, "copying")
+        self.insert(flat_dict)
+        self.cur.execute(ROUTED, (TEST_INT, INT_KEY))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+    def test_update(self):
+        self.upgrade(True, "stripping")
+        self.cur.execute('INSERT INTO test(data, "int") VALUES(%s, 1);',
+                         (json.dumps(empty_dict),))
+        self.cur.execute("UPDATE test SET data = document_put_int(data, %s, 7);",
+                         (INT_KEY,))
+        self.cur.execute(ROUTED, (7, INT_KEY))
+        self.assertEqual(1, (self.cur.fetchone())[0])
+
+    def test_pending(self):
+        self.upgrade(True, "pending")
+        self.insert(flat_dict)
+        self.cur.execute(ROUTED, (TEST_INT, INT_KEY))
+        self.assertEqual(0, (self.cur.fetchone())[0])
+
+    def test_downgrade(self):
+        self.upgrade(False, "copying")
+        self.insert(flat_dict)
+        self.cur.execute("SELECT document_get_int(data, %s) FROM test;", (INT_KEY,))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+        self.cur.execute(ROUTED, (TEST_INT, INT_KEY))
+        self.assertEqual(0, (self.cur.fetchone())[0])
+
+    def test_done_reads_column(self):
+        self.upgrade(True, "done")
+        self.insert(flat_dict)
+        self.cur.execute("SELECT document_get_int(data, %s) FROM test;", (INT_KEY,))
+        self.assertEqual(TEST_INT, (self.cur.fetchone())[0])
+        self.cur.execute("EXPLAIN VERBOSE SELECT document_get_int(data, %s) FROM test;",
+                         (INT_KEY,))
+        plan = "\n".join(row[0] for row in self.cur.fetchall())
+        self.assertNotIn("document_get_int", plan)
+
+    def test_nested_path(self):
+        path = DOCUMENT_KEY + "." + INT_KEY
+        self.cur.execute(SCHEMA_TABLE)
+        self.cur.execute("INSERT INTO document_schema._attributes (key_name, key_type) "
+                         "VALUES(%s, %s);", (path, INT_TYPE))
+        self.cur.execute(SET_STATE, (True, "copying", path, INT_TYPE))
+        self.cur.execute('ALTER TABLE test ADD COLUMN document__int bigint;')
+        self.cur.execute(ROUTE_KEYS)
+        self.insert(nested_dict)
+        self.cur.execute("SELECT document__int, document_get_int(data, %s) FROM test;",
+                         (path,))
+        self.assertEqual((TEST_INT, TEST_INT), self.cur.fetchone())
+        self.cur.execute("SELECT data ? %s FROM test;", (DOCUMENT_KEY,))
+        self.assertTrue((self.cur.fetchone())[0])
+
+if __name__ == '__main__':
+    unittest.main()
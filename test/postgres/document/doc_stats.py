@@ -0,0 +1,56 @@
+import json
+import psycopg2
+import unittest
+
+from test_data import *
+
+KEY_STATS = "SELECT key_path, key_type, presence, most_common_vals FROM document_key_stats('test', 'data') WHERE key_path = %s AND key_type = %s;"
+
+EXPLAIN_GET_INT = "EXPLAIN (FORMAT JSON) SELECT * FROM test WHERE document_get_int(data, %s) = %s;"
+
+class TestKeyStats(unittest.TestCase):
+
+    def setUp(self):
+        self.conn = psycopg2.connect("dbname=test user=postgres password=postgres")
+        self.cur = self.conn.cursor()
+
+    def tearDown(self):
+        self.conn.rollback()
+        self.cur.close()
+        self.conn.close()
+
+    def analyze(self, docs):
+        for doc in docs:
+            self.cur.execute(INSERT, (json.dumps(doc),))
+        self.cur.execute("ANALYZE test;")
+
+    def test_presence(self):
+        self.analyze([flat_dict, flat_dict, nested_dict, empty_dict])
+        self.cur.execute(KEY_STATS, (INT_KEY, INT_TYPE))
+        (path, key_type, presence, mcvs) = self.cur.fetchone()
+        self.assertEqual(INT_KEY, path)
+        self.assertEqual(INT_TYPE, key_type)
+        self.assertAlmostEqual(0.5, presence, places=5)
+        self.assertEqual([str(TEST_INT)], mcvs)
+
+    def test_nested_path(self):
+        self.analyze([nested_dict, nested_dict])
+        self.cur.execute(KEY_STATS, (DOCUMENT_KEY + "." + STRING_KEY, STRING_TYPE))
+        (path, key_type, presence, mcvs) = self.cur.fetchone()
+        self.assertAlmostEqual(1.0, presence, places=5)
+        self.assertEqual([TEST_STRING], mcvs)
+
+    def test_unseen_key(self):
+        self.analyze([flat_dict])
+        self.cur.execute(KEY_STATS, ("doesnotexist", INT_TYPE))
+        self.assertEqual(None, self.cur.fetchone())
+
+    def test_row_estimate(self):
+        self.cur.execute("LOAD 'document_type';")
+        self.analyze([flat_dict] * 20 + [nested_dict] * 80)
+        self.cur.execute(EXPLAIN_GET_INT, (INT_KEY, TEST_INT))
+        plan = self.cur.fetchone()[0][0]["Plan"]
+        self.assertEqual(20, plan["Plan Rows"])
+
+if __name__ == '__main__':
+    unittest.main()